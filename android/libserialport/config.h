@@ -20,6 +20,9 @@
 /* Define to 1 if you have the <memory.h> header file. */
 #define HAVE_MEMORY_H 1
 
+/* ppoll is available. */
+#define HAVE_PPOLL 1
+
 /* realpath is available. */
 #define HAVE_REALPATH 1
 
@@ -56,6 +59,9 @@
 /* Define to 1 if the system has the type `struct termiox'. */
 #undef HAVE_STRUCT_TERMIOX
 
+/* Define to 1 if you have the <sys/epoll.h> header file. */
+#define HAVE_SYS_EPOLL_H 1
+
 /* sys/file.h is available. */
 #define HAVE_SYS_FILE_H 1
 
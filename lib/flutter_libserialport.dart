@@ -1 +1,3 @@
 export 'package:libserialport/libserialport.dart';
+
+export 'src/native_reader.dart';
@@ -0,0 +1,103 @@
+import 'dart:async';
+import 'dart:ffi';
+import 'dart:io';
+import 'dart:isolate';
+import 'dart:typed_data';
+
+import 'package:libserialport/libserialport.dart';
+
+typedef _StartNative = Int32 Function(
+    Pointer<Void>, Pointer<Void>, Int64, Int32, Int64);
+typedef _StartDart = int Function(Pointer<Void>, Pointer<Void>, int, int, int);
+typedef _StopNative = Int32 Function(Pointer<Void>);
+typedef _StopDart = int Function(Pointer<Void>);
+
+final _plugin = DynamicLibrary.open('libflutter_libserialport_plugin.so');
+final _start = _plugin.lookupFunction<_StartNative, _StartDart>(
+    'flutter_libserialport_reader_start');
+final _stop = _plugin.lookupFunction<_StopNative, _StopDart>(
+    'flutter_libserialport_reader_stop');
+
+/// Reads a serial port natively and streams the data without polling.
+///
+/// Unlike [SerialPortReader], which polls the port from a helper isolate, the
+/// plugin reads the port on a native thread and posts the data straight to
+/// the isolate. Bytes are coalesced into chunks of up to [maxBytes], each
+/// delivered at most [maxDelay] after its first byte arrived, which trades
+/// the message rate against latency. With the default zero delay, data is
+/// delivered as soon as it is read.
+///
+/// The port must be open for reading, and stay open until the reader is
+/// closed. Only available on Linux, see [isSupported].
+class SerialPortNativeReader {
+  /// Whether the platform has a native reader.
+  static bool get isSupported => Platform.isLinux;
+
+  final SerialPort port;
+  final int maxBytes;
+  final Duration maxDelay;
+
+  ReceivePort? _receiver;
+  StreamController<Uint8List>? __controller;
+
+  SerialPortNativeReader(
+    this.port, {
+    this.maxBytes = 4096,
+    this.maxDelay = Duration.zero,
+  });
+
+  /// A stream of data chunks. A read error ends it with a [SerialPortError].
+  Stream<Uint8List> get stream => _controller.stream;
+
+  /// Stops reading and closes the stream.
+  void close() {
+    _stopReading();
+    __controller?.close();
+    __controller = null;
+  }
+
+  StreamController<Uint8List> get _controller {
+    return __controller ??= StreamController<Uint8List>(
+      onListen: _startReading,
+      onCancel: _stopReading,
+    );
+  }
+
+  void _startReading() {
+    final receiver = ReceivePort();
+    final result = _start(
+      Pointer.fromAddress(NativeApi.postCObject.address),
+      Pointer.fromAddress(port.address),
+      receiver.sendPort.nativePort,
+      maxBytes,
+      maxDelay.inMicroseconds,
+    );
+    if (result != 0) {
+      receiver.close();
+      _controller.addError(SerialPortError('Native reader failed', result));
+      return;
+    }
+    receiver.listen(_onMessage);
+    _receiver = receiver;
+  }
+
+  void _stopReading() {
+    final receiver = _receiver;
+    if (receiver == null) return;
+    _stop(Pointer.fromAddress(port.address));
+    receiver.close();
+    _receiver = null;
+  }
+
+  void _onMessage(dynamic message) {
+    if (message is Uint8List) {
+      __controller?.add(message);
+    } else if (message is int) {
+      // The native reader has already let go of the port.
+      _receiver?.close();
+      _receiver = null;
+      __controller?.addError(SerialPortError('Read failed', message));
+      close();
+    }
+  }
+}
@@ -0,0 +1,58 @@
+#ifndef FLUTTER_PLUGIN_DART_COBJECT_H_
+#define FLUTTER_PLUGIN_DART_COBJECT_H_
+
+// The subset of the Dart native API's message types used by the plugin,
+// matching the layout of dart_native_api.h. The Flutter embedder does not
+// ship the Dart SDK headers, and the one function needed, Dart_PostCObject,
+// is handed over from Dart as NativeApi.postCObject.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef int64_t Dart_Port;
+
+typedef enum {
+  Dart_CObject_kNull = 0,
+  Dart_CObject_kBool,
+  Dart_CObject_kInt32,
+  Dart_CObject_kInt64,
+  Dart_CObject_kDouble,
+  Dart_CObject_kString,
+  Dart_CObject_kArray,
+  Dart_CObject_kTypedData,
+  Dart_CObject_kExternalTypedData,
+} Dart_CObject_Type;
+
+typedef enum {
+  Dart_TypedData_kByteData = 0,
+  Dart_TypedData_kInt8,
+  Dart_TypedData_kUint8,
+} Dart_TypedData_Type;
+
+typedef void (*Dart_HandleFinalizer)(void* isolate_callback_data, void* peer);
+
+typedef struct _Dart_CObject {
+  Dart_CObject_Type type;
+  union {
+    int64_t as_int64;
+    struct {
+      Dart_TypedData_Type type;
+      intptr_t length;
+      uint8_t* data;
+      void* peer;
+      Dart_HandleFinalizer callback;
+    } as_external_typed_data;
+  } value;
+} Dart_CObject;
+
+typedef bool (*Dart_PostCObjectType)(Dart_Port port_id, Dart_CObject* message);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // FLUTTER_PLUGIN_DART_COBJECT_H_
@@ -3,6 +3,11 @@
 #include <flutter_linux/flutter_linux.h>
 #include <glib.h>
 
+#include <memory>
+#include <mutex>
+
+#include "serial_reader.h"
+
 #define FLUTTER_LIBSERIALPORT_PLUGIN(obj)                                     \
   (G_TYPE_CHECK_INSTANCE_CAST((obj), flutter_libserialport_plugin_get_type(), \
                               FlutterLibserialportPlugin))
@@ -20,6 +25,9 @@ static void flutter_libserialport_plugin_class_init(
 static void flutter_libserialport_plugin_init(
     FlutterLibserialportPlugin* self) {}
 
+static std::mutex reader_mutex;
+static std::unique_ptr<SerialReader> reader;
+
 static gchar* g_self_exe() {
   g_autoptr(GError) error = nullptr;
   g_autofree gchar* self_exe = g_file_read_link("/proc/self/exe", &error);
@@ -41,3 +49,28 @@ void flutter_libserialport_plugin_register_with_registrar(
 
   g_object_unref(plugin);
 }
+
+int32_t flutter_libserialport_reader_start(void* post_cobject,
+                                           struct sp_port* port,
+                                           int64_t dart_port, int32_t max_bytes,
+                                           int64_t max_delay_us) {
+  if (!post_cobject || max_bytes <= 0 || max_delay_us < 0) {
+    return SP_ERR_ARG;
+  }
+
+  std::lock_guard<std::mutex> lock(reader_mutex);
+  if (!reader) {
+    reader.reset(new SerialReader(
+        reinterpret_cast<Dart_PostCObjectType>(post_cobject)));
+  }
+  return reader->Start(port, dart_port, max_bytes,
+                       std::chrono::microseconds(max_delay_us));
+}
+
+int32_t flutter_libserialport_reader_stop(struct sp_port* port) {
+  std::lock_guard<std::mutex> lock(reader_mutex);
+  if (!reader) {
+    return SP_ERR_ARG;
+  }
+  return reader->Stop(port);
+}
@@ -2,6 +2,7 @@
 #define FLUTTER_PLUGIN_FLUTTER_LIBSERIALPORT_PLUGIN_H_
 
 #include <flutter_linux/flutter_linux.h>
+#include <stdint.h>
 
 G_BEGIN_DECLS
 
@@ -21,6 +22,20 @@ FLUTTER_PLUGIN_EXPORT GType flutter_libserialport_plugin_get_type();
 FLUTTER_PLUGIN_EXPORT void flutter_libserialport_plugin_register_with_registrar(
     FlPluginRegistrar* registrar);
 
+struct sp_port;
+
+// Starts posting data read from an open port to a Dart port. post_cobject is
+// NativeApi.postCObject. Data is posted as Uint8List batches of up to
+// max_bytes, each at most max_delay_us after its first byte; a read error
+// ends the stream with an int errno. Returns an sp_return code.
+FLUTTER_PLUGIN_EXPORT int32_t flutter_libserialport_reader_start(
+    void* post_cobject, struct sp_port* port, int64_t dart_port,
+    int32_t max_bytes, int64_t max_delay_us);
+
+// Stops reading a port, posting any pending data first.
+FLUTTER_PLUGIN_EXPORT int32_t flutter_libserialport_reader_stop(
+    struct sp_port* port);
+
 G_END_DECLS
 
 #endif  // FLUTTER_PLUGIN_FLUTTER_LIBSERIALPORT_PLUGIN_H_
@@ -17,9 +17,16 @@
 /* Define to 1 if you have the <inttypes.h> header file. */
 #define HAVE_INTTYPES_H 1
 
+/* Define to 1 if you have the <linux/io_uring.h> header file. Set by
+   CMakeLists.txt, which checks for it at build time. */
+/* #undef HAVE_LINUX_IO_URING_H */
+
 /* Define to 1 if you have the <memory.h> header file. */
 #define HAVE_MEMORY_H 1
 
+/* ppoll is available. */
+#define HAVE_PPOLL 1
+
 /* realpath is available. */
 #define HAVE_REALPATH 1
 
@@ -56,6 +63,9 @@
 /* Define to 1 if the system has the type `struct termiox'. */
 /* #undef HAVE_STRUCT_TERMIOX */
 
+/* Define to 1 if you have the <sys/epoll.h> header file. */
+#define HAVE_SYS_EPOLL_H 1
+
 /* sys/file.h is available. */
 #define HAVE_SYS_FILE_H 1
 
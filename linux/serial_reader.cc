@@ -0,0 +1,271 @@
+#include "serial_reader.h"
+
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <cstdlib>
+
+namespace {
+
+constexpr int kMaxEvents = 16;
+
+void FreeBatch(void* isolate_callback_data, void* peer) { free(peer); }
+
+}  // namespace
+
+SerialReader::SerialReader(Dart_PostCObjectType post_cobject)
+    : post_cobject_(post_cobject) {
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  wake_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+  struct epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.fd = wake_fd_;
+  if (epoll_fd_ < 0 || wake_fd_ < 0 ||
+      epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &event) < 0) {
+    // Start() fails from now on.
+    if (epoll_fd_ >= 0) {
+      close(epoll_fd_);
+      epoll_fd_ = -1;
+    }
+    return;
+  }
+
+  thread_ = std::thread(&SerialReader::Run, this);
+}
+
+SerialReader::~SerialReader() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  if (thread_.joinable()) {
+    Wake();
+    thread_.join();
+  }
+  for (auto& entry : channels_) {
+    free(entry.second.batch);
+  }
+  if (wake_fd_ >= 0) {
+    close(wake_fd_);
+  }
+  if (epoll_fd_ >= 0) {
+    close(epoll_fd_);
+  }
+}
+
+sp_return SerialReader::Start(struct sp_port* port, Dart_Port dart_port,
+                              size_t max_bytes,
+                              std::chrono::microseconds max_delay) {
+  if (!port || max_bytes == 0 || max_delay.count() < 0) {
+    return SP_ERR_ARG;
+  }
+  if (epoll_fd_ < 0) {
+    return SP_ERR_FAIL;
+  }
+
+  int fd = -1;
+  if (sp_get_port_handle(port, &fd) != SP_OK || fd < 0) {
+    return SP_ERR_ARG;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (channels_.count(fd)) {
+    return SP_ERR_ARG;
+  }
+
+  uint8_t* batch = static_cast<uint8_t*>(malloc(max_bytes));
+  if (!batch) {
+    return SP_ERR_MEM;
+  }
+
+  struct epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.fd = fd;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) < 0) {
+    free(batch);
+    return SP_ERR_FAIL;
+  }
+
+  channels_[fd] = {port, fd, dart_port, max_bytes, max_delay,
+                   batch, 0, Clock::time_point()};
+  return SP_OK;
+}
+
+sp_return SerialReader::Stop(struct sp_port* port) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto& entry : channels_) {
+    Channel* channel = &entry.second;
+    if (channel->port == port) {
+      FlushLocked(channel);
+      RemoveLocked(channel->fd);
+      return SP_OK;
+    }
+  }
+  return SP_ERR_ARG;
+}
+
+void SerialReader::Run() {
+  struct epoll_event events[kMaxEvents];
+  int timeout;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    timeout = TimeoutLocked(Clock::now());
+  }
+
+  for (;;) {
+    int count = epoll_wait(epoll_fd_, events, kMaxEvents, timeout);
+    if (count < 0 && errno != EINTR) {
+      return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopping_) {
+      return;
+    }
+
+    for (int i = 0; i < count; i++) {
+      int fd = events[i].data.fd;
+      if (fd == wake_fd_) {
+        uint64_t value;
+        while (read(wake_fd_, &value, sizeof(value)) > 0) {
+        }
+        continue;
+      }
+      // The port may have been stopped while we were waiting.
+      auto it = channels_.find(fd);
+      if (it != channels_.end()) {
+        ReadLocked(&it->second, events[i].events & (EPOLLHUP | EPOLLERR));
+      }
+    }
+
+    Clock::time_point now = Clock::now();
+    for (auto& entry : channels_) {
+      Channel* channel = &entry.second;
+      if (channel->length > 0 && channel->deadline <= now) {
+        FlushLocked(channel);
+      }
+    }
+    timeout = TimeoutLocked(now);
+  }
+}
+
+void SerialReader::ReadLocked(Channel* channel, bool hangup) {
+  for (;;) {
+    size_t space = channel->max_bytes - channel->length;
+    int result = sp_nonblocking_read(channel->port,
+                                     channel->batch + channel->length, space);
+    if (result < 0) {
+      FailLocked(channel, sp_last_error_code());
+      return;
+    }
+    if (result == 0) {
+      // A terminal reports a hangup by becoming readable at end of file.
+      if (hangup) {
+        FailLocked(channel, EIO);
+      }
+      return;
+    }
+
+    if (channel->length == 0) {
+      channel->deadline = Clock::now() + channel->max_delay;
+    }
+    channel->length += result;
+
+    if (channel->length == channel->max_bytes ||
+        channel->max_delay.count() == 0) {
+      if (!FlushLocked(channel)) {
+        FailLocked(channel, ENOMEM);
+        return;
+      }
+    }
+    if (static_cast<size_t>(result) < space) {
+      return;
+    }
+  }
+}
+
+bool SerialReader::FlushLocked(Channel* channel) {
+  if (channel->length == 0) {
+    return true;
+  }
+
+  // Ownership of the batch passes to Dart, so the next one needs a fresh
+  // buffer. Without one the batch is kept and nothing is posted.
+  uint8_t* next = static_cast<uint8_t*>(malloc(channel->max_bytes));
+  if (!next) {
+    return false;
+  }
+
+  Dart_CObject message;
+  message.type = Dart_CObject_kExternalTypedData;
+  message.value.as_external_typed_data.type = Dart_TypedData_kUint8;
+  message.value.as_external_typed_data.length = channel->length;
+  message.value.as_external_typed_data.data = channel->batch;
+  message.value.as_external_typed_data.peer = channel->batch;
+  message.value.as_external_typed_data.callback = FreeBatch;
+
+  if (post_cobject_(channel->dart_port, &message)) {
+    channel->batch = next;
+  } else {
+    // The receive port is closed and the data has nowhere to go.
+    free(next);
+  }
+  channel->length = 0;
+  return true;
+}
+
+void SerialReader::FailLocked(Channel* channel, int error) {
+  FlushLocked(channel);
+
+  Dart_CObject message;
+  message.type = Dart_CObject_kInt64;
+  message.value.as_int64 = error;
+  post_cobject_(channel->dart_port, &message);
+
+  RemoveLocked(channel->fd);
+}
+
+void SerialReader::RemoveLocked(int fd) {
+  auto it = channels_.find(fd);
+  if (it == channels_.end()) {
+    return;
+  }
+  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+  free(it->second.batch);
+  channels_.erase(it);
+}
+
+int SerialReader::TimeoutLocked(Clock::time_point now) {
+  bool pending = false;
+  Clock::time_point deadline = Clock::time_point::max();
+  for (const auto& entry : channels_) {
+    const Channel& channel = entry.second;
+    if (channel.length > 0 && channel.deadline < deadline) {
+      deadline = channel.deadline;
+      pending = true;
+    }
+  }
+  if (!pending) {
+    return -1;
+  }
+  if (deadline <= now) {
+    return 0;
+  }
+  // Round up so that a batch is never posted before its deadline.
+  auto remaining = deadline - now;
+  auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(remaining);
+  if (ms < remaining) {
+    ms += std::chrono::milliseconds(1);
+  }
+  return static_cast<int>(ms.count());
+}
+
+void SerialReader::Wake() {
+  uint64_t value = 1;
+  ssize_t result = write(wake_fd_, &value, sizeof(value));
+  (void)result;
+}
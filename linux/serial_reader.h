@@ -0,0 +1,70 @@
+#ifndef FLUTTER_PLUGIN_SERIAL_READER_H_
+#define FLUTTER_PLUGIN_SERIAL_READER_H_
+
+#include <libserialport.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include "dart_cobject.h"
+
+// Reads serial ports on a shared epoll thread and posts the received data
+// to Dart ports.
+//
+// Bytes are coalesced per port and posted as external Uint8List messages
+// once max_bytes have accumulated or max_delay has passed since the first
+// byte of the batch, whichever comes first. A zero delay posts whatever a
+// single read returned. When reading fails or the device hangs up, the
+// pending batch is posted followed by an int error code (errno), and the
+// port stops being read.
+class SerialReader {
+ public:
+  explicit SerialReader(Dart_PostCObjectType post_cobject);
+  ~SerialReader();
+
+  SerialReader(const SerialReader&) = delete;
+  SerialReader& operator=(const SerialReader&) = delete;
+
+  // Starts reading an open port. The port must stay open until Stop().
+  sp_return Start(struct sp_port* port, Dart_Port dart_port, size_t max_bytes,
+                  std::chrono::microseconds max_delay);
+
+  // Stops reading a port, posting any pending data first.
+  sp_return Stop(struct sp_port* port);
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Channel {
+    struct sp_port* port;
+    int fd;
+    Dart_Port dart_port;
+    size_t max_bytes;
+    std::chrono::microseconds max_delay;
+    uint8_t* batch;
+    size_t length;
+    Clock::time_point deadline;
+  };
+
+  void Run();
+  void ReadLocked(Channel* channel, bool hangup);
+  bool FlushLocked(Channel* channel);
+  void FailLocked(Channel* channel, int error);
+  void RemoveLocked(int fd);
+  int TimeoutLocked(Clock::time_point now);
+  void Wake();
+
+  Dart_PostCObjectType post_cobject_;
+  int epoll_fd_ = -1;
+  int wake_fd_ = -1;
+  bool stopping_ = false;
+  std::mutex mutex_;
+  std::map<int, Channel> channels_;
+  std::thread thread_;
+};
+
+#endif  // FLUTTER_PLUGIN_SERIAL_READER_H_
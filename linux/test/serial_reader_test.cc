@@ -0,0 +1,392 @@
+#include "serial_reader.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <condition_variable>
+#include <string>
+#include <vector>
+
+// SerialReader tests, run against pseudo-terminal pairs. The test writes to
+// the master side of each pair, and the reader reads the port opened on the
+// slave side. Messages go to a stub Dart_PostCObject that records them and
+// finalizes external typed data straight away, as the Dart VM would once the
+// Uint8List is collected.
+
+#define CHECK(condition)                                               \
+  do {                                                                 \
+    if (!(condition)) {                                                \
+      fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, \
+              #condition);                                             \
+      abort();                                                         \
+    }                                                                  \
+  } while (0)
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+
+struct Message {
+  Dart_Port port;
+  bool is_error;
+  std::string data;
+  int64_t error;
+  Clock::time_point time;
+};
+
+std::mutex messages_mutex;
+std::condition_variable messages_changed;
+std::vector<Message> messages;
+bool post_fails = false;
+
+bool PostCObject(Dart_Port port, Dart_CObject* object) {
+  std::lock_guard<std::mutex> lock(messages_mutex);
+  if (post_fails) {
+    return false;
+  }
+
+  Message message = {port, false, std::string(), 0, Clock::now()};
+  if (object->type == Dart_CObject_kExternalTypedData) {
+    auto& data = object->value.as_external_typed_data;
+    CHECK(data.type == Dart_TypedData_kUint8);
+    CHECK(data.length > 0);
+    message.data.assign(reinterpret_cast<char*>(data.data), data.length);
+    data.callback(nullptr, data.peer);
+  } else {
+    CHECK(object->type == Dart_CObject_kInt64);
+    message.is_error = true;
+    message.error = object->value.as_int64;
+  }
+  messages.push_back(message);
+  messages_changed.notify_all();
+  return true;
+}
+
+void Reset() {
+  std::lock_guard<std::mutex> lock(messages_mutex);
+  messages.clear();
+  post_fails = false;
+}
+
+// Waits until at least count messages have been posted.
+std::vector<Message> WaitMessages(size_t count) {
+  std::unique_lock<std::mutex> lock(messages_mutex);
+  CHECK(messages_changed.wait_for(lock, std::chrono::seconds(5), [count] {
+    return messages.size() >= count;
+  }));
+  return messages;
+}
+
+std::vector<Message> Messages() {
+  std::lock_guard<std::mutex> lock(messages_mutex);
+  return messages;
+}
+
+// Concatenates the data posted to a port, checking there was no error.
+std::string Received(const std::vector<Message>& list, Dart_Port port) {
+  std::string data;
+  for (const auto& message : list) {
+    if (message.port == port) {
+      CHECK(!message.is_error);
+      data += message.data;
+    }
+  }
+  return data;
+}
+
+struct Pair {
+  int master;
+  struct sp_port* port;
+};
+
+Pair OpenPair() {
+  Pair pair;
+  pair.master = posix_openpt(O_RDWR | O_NOCTTY);
+  CHECK(pair.master >= 0);
+  CHECK(grantpt(pair.master) == 0);
+  CHECK(unlockpt(pair.master) == 0);
+  CHECK(sp_get_port_by_name(ptsname(pair.master), &pair.port) == SP_OK);
+  CHECK(sp_open(pair.port, SP_MODE_READ_WRITE) == SP_OK);
+  // Binary data must not be taken for XON/XOFF characters.
+  CHECK(sp_set_flowcontrol(pair.port, SP_FLOWCONTROL_NONE) == SP_OK);
+  return pair;
+}
+
+void ClosePair(Pair* pair) {
+  CHECK(sp_close(pair->port) == SP_OK);
+  sp_free_port(pair->port);
+  if (pair->master >= 0) {
+    close(pair->master);
+  }
+}
+
+void WriteMaster(const Pair& pair, const std::string& data) {
+  size_t written = 0;
+  while (written < data.size()) {
+    ssize_t result =
+        write(pair.master, data.data() + written, data.size() - written);
+    CHECK(result > 0);
+    written += result;
+  }
+}
+
+void TestArguments() {
+  SerialReader reader(PostCObject);
+  Pair pair = OpenPair();
+
+  CHECK(reader.Start(nullptr, 1, 16, microseconds(0)) == SP_ERR_ARG);
+  CHECK(reader.Start(pair.port, 1, 0, microseconds(0)) == SP_ERR_ARG);
+  CHECK(reader.Start(pair.port, 1, 16, microseconds(-1)) == SP_ERR_ARG);
+  CHECK(reader.Stop(pair.port) == SP_ERR_ARG);
+
+  CHECK(reader.Start(pair.port, 1, 16, microseconds(0)) == SP_OK);
+  CHECK(reader.Start(pair.port, 1, 16, microseconds(0)) == SP_ERR_ARG);
+  CHECK(reader.Stop(pair.port) == SP_OK);
+  CHECK(reader.Stop(pair.port) == SP_ERR_ARG);
+
+  // A closed port cannot be read.
+  CHECK(sp_close(pair.port) == SP_OK);
+  CHECK(reader.Start(pair.port, 1, 16, microseconds(0)) == SP_ERR_ARG);
+  sp_free_port(pair.port);
+  close(pair.master);
+}
+
+// Without a delay, every read is posted as it is.
+void TestNoDelay() {
+  Reset();
+  SerialReader reader(PostCObject);
+  Pair pair = OpenPair();
+  CHECK(reader.Start(pair.port, 7, 4096, microseconds(0)) == SP_OK);
+
+  WriteMaster(pair, "hello");
+  auto list = WaitMessages(1);
+  CHECK(list[0].port == 7);
+  CHECK(list[0].data == "hello");
+
+  WriteMaster(pair, "world");
+  list = WaitMessages(2);
+  CHECK(Received(list, 7) == "helloworld");
+
+  CHECK(reader.Stop(pair.port) == SP_OK);
+  ClosePair(&pair);
+}
+
+// Data arriving within the delay is posted as one batch, no earlier than
+// the delay after its first byte.
+void TestDelay() {
+  Reset();
+  SerialReader reader(PostCObject);
+  Pair pair = OpenPair();
+  CHECK(reader.Start(pair.port, 1, 4096, milliseconds(100)) == SP_OK);
+
+  Clock::time_point start = Clock::now();
+  WriteMaster(pair, "abc");
+  std::this_thread::sleep_for(milliseconds(20));
+  WriteMaster(pair, "def");
+
+  auto list = WaitMessages(1);
+  CHECK(list[0].data == "abcdef");
+  CHECK(list[0].time - start >= milliseconds(100));
+
+  std::this_thread::sleep_for(milliseconds(150));
+  CHECK(Messages().size() == 1);
+
+  // The next batch starts its own delay.
+  start = Clock::now();
+  WriteMaster(pair, "ghi");
+  list = WaitMessages(2);
+  CHECK(list[1].data == "ghi");
+  CHECK(list[1].time - start >= milliseconds(100));
+
+  CHECK(reader.Stop(pair.port) == SP_OK);
+  ClosePair(&pair);
+}
+
+// A full batch is posted at once, and Stop() posts what is left.
+void TestMaxBytes() {
+  Reset();
+  SerialReader reader(PostCObject);
+  Pair pair = OpenPair();
+  CHECK(reader.Start(pair.port, 1, 16, std::chrono::seconds(60)) == SP_OK);
+
+  std::string data;
+  for (int i = 0; i < 40; i++) {
+    data += static_cast<char>('a' + i % 26);
+  }
+  WriteMaster(pair, data);
+
+  auto list = WaitMessages(2);
+  CHECK(list[0].data.size() == 16);
+  CHECK(list[1].data.size() == 16);
+
+  // Let the last 8 bytes be read into the pending batch.
+  std::this_thread::sleep_for(milliseconds(50));
+  CHECK(Messages().size() == 2);
+  CHECK(reader.Stop(pair.port) == SP_OK);
+
+  list = Messages();
+  CHECK(list.size() == 3);
+  CHECK(Received(list, 1) == data);
+
+  ClosePair(&pair);
+}
+
+// A hangup posts the pending data, then the error, and stops the port.
+void TestHangup() {
+  Reset();
+  SerialReader reader(PostCObject);
+  Pair pair = OpenPair();
+  CHECK(reader.Start(pair.port, 3, 4096, std::chrono::seconds(60)) == SP_OK);
+
+  WriteMaster(pair, "bye");
+  std::this_thread::sleep_for(milliseconds(50));
+  close(pair.master);
+  pair.master = -1;
+
+  auto list = WaitMessages(2);
+  CHECK(!list[0].is_error);
+  CHECK(list[0].data == "bye");
+  CHECK(list[1].is_error);
+  CHECK(list[1].error == EIO);
+
+  CHECK(reader.Stop(pair.port) == SP_ERR_ARG);
+  ClosePair(&pair);
+}
+
+// Data that cannot be posted is dropped without leaking the batch.
+void TestPostFails() {
+  Reset();
+  SerialReader reader(PostCObject);
+  Pair pair = OpenPair();
+  CHECK(reader.Start(pair.port, 1, 4096, microseconds(0)) == SP_OK);
+
+  {
+    std::lock_guard<std::mutex> lock(messages_mutex);
+    post_fails = true;
+  }
+  WriteMaster(pair, "lost");
+  std::this_thread::sleep_for(milliseconds(50));
+  {
+    std::lock_guard<std::mutex> lock(messages_mutex);
+    post_fails = false;
+  }
+
+  WriteMaster(pair, "found");
+  auto list = WaitMessages(1);
+  CHECK(list[0].data == "found");
+
+  CHECK(reader.Stop(pair.port) == SP_OK);
+  ClosePair(&pair);
+}
+
+// Ports share the reader thread without mixing up their data.
+void TestManyPorts() {
+  constexpr int kPairs = 16;
+  constexpr int kChunks = 50;
+
+  Reset();
+  SerialReader reader(PostCObject);
+  Pair pairs[kPairs];
+  std::string sent[kPairs];
+
+  for (int i = 0; i < kPairs; i++) {
+    pairs[i] = OpenPair();
+    CHECK(reader.Start(pairs[i].port, 100 + i, 64, milliseconds(i % 3)) ==
+          SP_OK);
+  }
+  for (int chunk = 0; chunk < kChunks; chunk++) {
+    for (int i = 0; i < kPairs; i++) {
+      std::string data = std::to_string(i) + ":" + std::to_string(chunk) + ";";
+      WriteMaster(pairs[i], data);
+      sent[i] += data;
+    }
+  }
+
+  Clock::time_point deadline = Clock::now() + std::chrono::seconds(5);
+  for (int i = 0; i < kPairs; i++) {
+    while (Received(Messages(), 100 + i).size() < sent[i].size()) {
+      CHECK(Clock::now() < deadline);
+      std::this_thread::sleep_for(milliseconds(1));
+    }
+  }
+
+  auto list = Messages();
+  for (int i = 0; i < kPairs; i++) {
+    CHECK(reader.Stop(pairs[i].port) == SP_OK);
+    CHECK(Received(list, 100 + i) == sent[i]);
+    ClosePair(&pairs[i]);
+  }
+}
+
+// Prints how many messages a stream of small writes turns into, which is
+// the message rate the coalescing settings trade against latency. The
+// counts depend on timing, so only bounds that hold for any timing are
+// checked: no batch is larger than max_bytes, and a batch is only posted
+// before it is full once max_delay has passed since its first byte.
+void Benchmark(size_t max_bytes, microseconds max_delay) {
+  constexpr int kWrites = 2000;
+  constexpr int kWriteSize = 32;
+
+  Reset();
+  SerialReader reader(PostCObject);
+  Pair pair = OpenPair();
+  CHECK(reader.Start(pair.port, 1, max_bytes, max_delay) == SP_OK);
+
+  std::string data(kWriteSize, 'x');
+  Clock::time_point start = Clock::now();
+  for (int i = 0; i < kWrites; i++) {
+    WriteMaster(pair, data);
+    if (i % 10 == 9) {
+      std::this_thread::sleep_for(microseconds(100));
+    }
+  }
+
+  size_t total = kWrites * kWriteSize;
+  Clock::time_point deadline = Clock::now() + std::chrono::seconds(10);
+  while (Received(Messages(), 1).size() < total) {
+    CHECK(Clock::now() < deadline);
+    std::this_thread::sleep_for(milliseconds(1));
+  }
+  auto elapsed = Clock::now() - start;
+  size_t count = Messages().size();
+
+  printf("max_bytes %5zu, max_delay %5lld us: %5zu messages for %zu bytes "
+         "in %lld ms\n",
+         max_bytes, static_cast<long long>(max_delay.count()), count, total,
+         static_cast<long long>(
+             std::chrono::duration_cast<milliseconds>(elapsed).count()));
+
+  CHECK(count >= (total + max_bytes - 1) / max_bytes);
+  if (max_delay.count() > 0) {
+    // Batches posted on their deadline do not overlap in time.
+    CHECK(count <= total / max_bytes + elapsed / max_delay + 1);
+  }
+
+  CHECK(reader.Stop(pair.port) == SP_OK);
+  ClosePair(&pair);
+}
+
+}  // namespace
+
+int main() {
+  TestArguments();
+  TestNoDelay();
+  TestDelay();
+  TestMaxBytes();
+  TestHangup();
+  TestPostFails();
+  TestManyPorts();
+
+  Benchmark(4096, microseconds(0));
+  Benchmark(4096, microseconds(1000));
+  Benchmark(4096, microseconds(10000));
+  Benchmark(256, microseconds(10000));
+
+  return 0;
+}
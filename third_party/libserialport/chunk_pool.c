@@ -0,0 +1,387 @@
+/*
+ * This file is part of the libserialport project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libserialport_internal.h"
+
+/*
+ * Chunk data is aligned to cache lines, so that chunks handed to different
+ * threads never share one.
+ */
+#define CHUNK_ALIGN 64
+
+/*
+ * The free list is a lock-free stack of chunk indexes. Its head holds the
+ * index of the top chunk plus one, zero meaning empty, in the low 32 bits,
+ * and a tag in the high 32 bits which changes with every update. Without
+ * the tag, a pop could succeed after the top chunk was taken and put back
+ * by other threads in between, installing a stale next index.
+ */
+#define FREE_INDEX(head) ((unsigned int) ((head) & 0xffffffffULL))
+#define FREE_HEAD(head, index) \
+	((((head) >> 32) + 1) << 32 | (unsigned long long) (index))
+
+#ifdef _MSC_VER
+#define ATOMIC_LOAD(var) \
+	((unsigned long long) InterlockedCompareExchange64((volatile LONG64 *) &(var), 0, 0))
+#define ATOMIC_STORE(var, value) \
+	InterlockedExchange64((volatile LONG64 *) &(var), (LONG64) (value))
+#define ATOMIC_ADD(var, n) \
+	((unsigned long long) InterlockedExchangeAdd64((volatile LONG64 *) &(var), \
+		(LONG64) (n)) + (n))
+#define ATOMIC_SUB(var, n) \
+	((unsigned long long) InterlockedExchangeAdd64((volatile LONG64 *) &(var), \
+		-(LONG64) (n)) - (n))
+#else
+#define ATOMIC_LOAD(var) __atomic_load_n(&(var), __ATOMIC_ACQUIRE)
+#define ATOMIC_STORE(var, value) __atomic_store_n(&(var), (value), __ATOMIC_RELEASE)
+#define ATOMIC_ADD(var, n) __atomic_add_fetch(&(var), (n), __ATOMIC_ACQ_REL)
+#define ATOMIC_SUB(var, n) __atomic_sub_fetch(&(var), (n), __ATOMIC_ACQ_REL)
+#endif
+
+struct pool_chunk {
+	/* The caller's view of the chunk; sp_chunk pointers point here. */
+	struct sp_chunk chunk;
+	struct sp_chunk_pool *pool;
+	unsigned long long refs;
+	/* Index plus one of the next free chunk, while on the free list. */
+	unsigned long long next;
+};
+
+struct sp_chunk_pool {
+	size_t chunk_size;
+	/* Distance between the data of consecutive chunks. */
+	size_t stride;
+	unsigned int num_chunks;
+	struct pool_chunk *chunks;
+	unsigned char *data;
+	unsigned long long free_head;
+	/*
+	 * One for the owner, plus one for each chunk in use. The pool is
+	 * freed when this drops to zero. A chunk is put back on the free list
+	 * before its reference is dropped, so this may briefly count a chunk
+	 * that has already been taken again.
+	 */
+	unsigned long long refs;
+	unsigned long long high_water;
+	unsigned long long allocations;
+	unsigned long long exhaustions;
+};
+
+/*
+ * Atomically replace *var with desired if it equals *expected. Otherwise,
+ * load its current value into *expected.
+ */
+static bool compare_exchange(unsigned long long *var,
+	unsigned long long *expected, unsigned long long desired)
+{
+#ifdef _MSC_VER
+	unsigned long long previous = (unsigned long long)
+		InterlockedCompareExchange64((volatile LONG64 *) var,
+			(LONG64) desired, (LONG64) *expected);
+
+	if (previous == *expected)
+		return true;
+	*expected = previous;
+	return false;
+#else
+	return __atomic_compare_exchange_n(var, expected, desired, false,
+		__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+#endif
+}
+
+/* Number of chunks in use, from the pool's reference count. */
+static unsigned int chunks_in_use(const struct sp_chunk_pool *pool,
+	unsigned long long refs)
+{
+	return refs - 1 < pool->num_chunks ? (unsigned int) (refs - 1) : pool->num_chunks;
+}
+
+static void free_pool(struct sp_chunk_pool *pool)
+{
+	DEBUG_FMT("Freeing chunk pool %p", pool);
+
+	free(pool->data);
+	free(pool->chunks);
+	free(pool);
+}
+
+static void put_chunk(struct pool_chunk *pc)
+{
+	struct sp_chunk_pool *pool = pc->pool;
+	unsigned int index = (unsigned int) (pc - pool->chunks) + 1;
+	unsigned long long head = ATOMIC_LOAD(pool->free_head);
+
+	do {
+		ATOMIC_STORE(pc->next, FREE_INDEX(head));
+	} while (!compare_exchange(&pool->free_head, &head, FREE_HEAD(head, index)));
+
+	if (ATOMIC_SUB(pool->refs, 1) == 0)
+		free_pool(pool);
+}
+
+SP_PRIV struct sp_chunk *get_pool_chunk(struct sp_chunk_pool *pool)
+{
+	unsigned long long head = ATOMIC_LOAD(pool->free_head);
+	unsigned long long high_water;
+	unsigned int in_use;
+	struct pool_chunk *pc;
+
+	do {
+		if (FREE_INDEX(head) == 0) {
+			ATOMIC_ADD(pool->exhaustions, 1);
+			return NULL;
+		}
+		pc = &pool->chunks[FREE_INDEX(head) - 1];
+	} while (!compare_exchange(&pool->free_head, &head,
+			FREE_HEAD(head, ATOMIC_LOAD(pc->next))));
+
+	ATOMIC_STORE(pc->refs, 1);
+	pc->chunk.length = 0;
+	ATOMIC_ADD(pool->allocations, 1);
+
+	in_use = chunks_in_use(pool, ATOMIC_ADD(pool->refs, 1));
+	high_water = ATOMIC_LOAD(pool->high_water);
+	while (in_use > high_water &&
+			!compare_exchange(&pool->high_water, &high_water, in_use))
+		;
+
+	return &pc->chunk;
+}
+
+/* Hand a chunk filled by a read to the caller, or drop it if it is empty. */
+static int finish_read(struct sp_chunk *chunk, int result,
+	struct sp_chunk **chunk_ptr)
+{
+	if (result > 0) {
+		chunk->length = result;
+		*chunk_ptr = chunk;
+	} else {
+		put_chunk((struct pool_chunk *) chunk);
+	}
+
+	return result;
+}
+
+SP_API enum sp_return sp_new_chunk_pool(size_t chunk_size,
+	unsigned int num_chunks, struct sp_chunk_pool **pool_ptr)
+{
+	struct sp_chunk_pool *pool;
+	size_t stride;
+	unsigned char *base;
+	unsigned int i;
+
+	TRACE("%d, %d, %p", chunk_size, num_chunks, pool_ptr);
+
+	if (!pool_ptr)
+		RETURN_ERROR(SP_ERR_ARG, "Null result pointer");
+
+	*pool_ptr = NULL;
+
+	if (chunk_size == 0 || chunk_size > INT_MAX)
+		RETURN_ERROR(SP_ERR_ARG, "Invalid chunk size");
+
+	if (num_chunks == 0 || num_chunks == UINT_MAX)
+		RETURN_ERROR(SP_ERR_ARG, "Invalid number of chunks");
+
+	stride = (chunk_size + CHUNK_ALIGN - 1) & ~(size_t) (CHUNK_ALIGN - 1);
+	if (stride > (SIZE_MAX - CHUNK_ALIGN) / num_chunks)
+		RETURN_ERROR(SP_ERR_ARG, "Chunk pool too large");
+
+	DEBUG_FMT("Creating pool of %d chunks of %d bytes", num_chunks, chunk_size);
+
+	if (!(pool = calloc(1, sizeof(struct sp_chunk_pool))))
+		RETURN_ERROR(SP_ERR_MEM, "Chunk pool malloc failed");
+
+	pool->chunks = calloc(num_chunks, sizeof(struct pool_chunk));
+	pool->data = malloc(stride * num_chunks + CHUNK_ALIGN);
+	if (!pool->chunks || !pool->data) {
+		free_pool(pool);
+		RETURN_ERROR(SP_ERR_MEM, "Chunk pool malloc failed");
+	}
+
+	pool->chunk_size = chunk_size;
+	pool->stride = stride;
+	pool->num_chunks = num_chunks;
+	pool->refs = 1;
+
+	base = pool->data + (CHUNK_ALIGN - (uintptr_t) pool->data % CHUNK_ALIGN);
+	for (i = 0; i < num_chunks; i++) {
+		pool->chunks[i].chunk.data = base + i * stride;
+		pool->chunks[i].pool = pool;
+		/* Chain each chunk to the next, the last one ending the list. */
+		pool->chunks[i].next = i + 1 < num_chunks ? i + 2 : 0;
+	}
+	pool->free_head = 1;
+
+	*pool_ptr = pool;
+
+	RETURN_OK();
+}
+
+SP_API enum sp_return sp_blocking_read_chunk(struct sp_port *port,
+	struct sp_chunk_pool *pool, unsigned int timeout_ms,
+	struct sp_chunk **chunk_ptr)
+{
+	struct sp_chunk *chunk;
+
+	TRACE("%p, %p, %d, %p", port, pool, timeout_ms, chunk_ptr);
+
+	if (!chunk_ptr)
+		RETURN_ERROR(SP_ERR_ARG, "Null result pointer");
+
+	*chunk_ptr = NULL;
+
+	if (!pool)
+		RETURN_ERROR(SP_ERR_ARG, "Null pool");
+
+	if (!(chunk = get_pool_chunk(pool)))
+		RETURN_ERROR(SP_ERR_MEM, "Chunk pool exhausted");
+
+	RETURN_INT(finish_read(chunk, sp_blocking_read(port, chunk->data,
+		pool->chunk_size, timeout_ms), chunk_ptr));
+}
+
+SP_API enum sp_return sp_blocking_read_next_chunk(struct sp_port *port,
+	struct sp_chunk_pool *pool, unsigned int timeout_ms,
+	struct sp_chunk **chunk_ptr)
+{
+	struct sp_chunk *chunk;
+
+	TRACE("%p, %p, %d, %p", port, pool, timeout_ms, chunk_ptr);
+
+	if (!chunk_ptr)
+		RETURN_ERROR(SP_ERR_ARG, "Null result pointer");
+
+	*chunk_ptr = NULL;
+
+	if (!pool)
+		RETURN_ERROR(SP_ERR_ARG, "Null pool");
+
+	if (!(chunk = get_pool_chunk(pool)))
+		RETURN_ERROR(SP_ERR_MEM, "Chunk pool exhausted");
+
+	RETURN_INT(finish_read(chunk, sp_blocking_read_next(port, chunk->data,
+		pool->chunk_size, timeout_ms), chunk_ptr));
+}
+
+SP_API enum sp_return sp_nonblocking_read_chunk(struct sp_port *port,
+	struct sp_chunk_pool *pool, struct sp_chunk **chunk_ptr)
+{
+	struct sp_chunk *chunk;
+
+	TRACE("%p, %p, %p", port, pool, chunk_ptr);
+
+	if (!chunk_ptr)
+		RETURN_ERROR(SP_ERR_ARG, "Null result pointer");
+
+	*chunk_ptr = NULL;
+
+	if (!pool)
+		RETURN_ERROR(SP_ERR_ARG, "Null pool");
+
+	if (!(chunk = get_pool_chunk(pool)))
+		RETURN_ERROR(SP_ERR_MEM, "Chunk pool exhausted");
+
+	RETURN_INT(finish_read(chunk, sp_nonblocking_read(port, chunk->data,
+		pool->chunk_size), chunk_ptr));
+}
+
+SP_API enum sp_return sp_retain_chunk(struct sp_chunk *chunk)
+{
+	TRACE("%p", chunk);
+
+	if (!chunk)
+		RETURN_ERROR(SP_ERR_ARG, "Null chunk");
+
+	ATOMIC_ADD(((struct pool_chunk *) chunk)->refs, 1);
+
+	RETURN_OK();
+}
+
+SP_API enum sp_return sp_release_chunk(struct sp_chunk *chunk)
+{
+	struct pool_chunk *pc = (struct pool_chunk *) chunk;
+
+	TRACE("%p", chunk);
+
+	if (!chunk)
+		RETURN_ERROR(SP_ERR_ARG, "Null chunk");
+
+	/*
+	 * The sole holder cannot race with anyone taking another reference,
+	 * which spares the common case an atomic decrement.
+	 */
+	if (ATOMIC_LOAD(pc->refs) == 1 || ATOMIC_SUB(pc->refs, 1) == 0)
+		put_chunk(pc);
+
+	RETURN_OK();
+}
+
+SP_API enum sp_return sp_get_chunk_pool_stats(struct sp_chunk_pool *pool,
+	struct sp_chunk_pool_stats *stats)
+{
+	TRACE("%p, %p", pool, stats);
+
+	if (!pool)
+		RETURN_ERROR(SP_ERR_ARG, "Null pool");
+
+	if (!stats)
+		RETURN_ERROR(SP_ERR_ARG, "Null stats");
+
+	stats->chunk_size = pool->chunk_size;
+	stats->num_chunks = pool->num_chunks;
+	stats->in_use = chunks_in_use(pool, ATOMIC_LOAD(pool->refs));
+	stats->high_water = (unsigned int) ATOMIC_LOAD(pool->high_water);
+	stats->allocations = ATOMIC_LOAD(pool->allocations);
+	stats->exhaustions = ATOMIC_LOAD(pool->exhaustions);
+	stats->memory = sizeof(struct sp_chunk_pool) +
+		pool->num_chunks * (sizeof(struct pool_chunk) + pool->stride) +
+		CHUNK_ALIGN;
+	stats->memory_in_use = stats->in_use * pool->chunk_size;
+	stats->memory_high_water = stats->high_water * pool->chunk_size;
+
+	RETURN_OK();
+}
+
+SP_API enum sp_return sp_reset_chunk_pool_stats(struct sp_chunk_pool *pool)
+{
+	TRACE("%p", pool);
+
+	if (!pool)
+		RETURN_ERROR(SP_ERR_ARG, "Null pool");
+
+	ATOMIC_STORE(pool->allocations, 0);
+	ATOMIC_STORE(pool->exhaustions, 0);
+	ATOMIC_STORE(pool->high_water, chunks_in_use(pool, ATOMIC_LOAD(pool->refs)));
+
+	RETURN_OK();
+}
+
+SP_API void sp_free_chunk_pool(struct sp_chunk_pool *pool)
+{
+	TRACE("%p", pool);
+
+	if (!pool) {
+		DEBUG("Null pool");
+		RETURN();
+	}
+
+	if (ATOMIC_SUB(pool->refs, 1) == 0)
+		free_pool(pool);
+
+	RETURN();
+}
@@ -50,19 +50,30 @@ int main(int argc, char **argv)
 		check(sp_add_port_events(event_set, ports[i], SP_EVENT_RX_READY));
 	}
 
-	/* Now we can call sp_wait() to await any event in the set.
-	 * It will return when an event occurs, or the timeout elapses. */
+	/* Now we can call sp_wait_events() to await any event in the set.
+	 * It will return when an event occurs, or the timeout elapses,
+	 * and tells us which ports the events occurred on. */
+	struct sp_event_result *results =
+		malloc(num_ports * sizeof(struct sp_event_result));
+	if (!results)
+		abort();
+
 	printf("Waiting up to 5 seconds for RX on any port...\n");
-	check(sp_wait(event_set, 5000));
+	int num_results = check(sp_wait_events(event_set, results, num_ports, 5000));
 
-	/* Iterate over ports to see which have data waiting. */
-	for (int i = 0; i < num_ports; i++) {
+	if (num_results == 0)
+		printf("No events occurred.\n");
+
+	/* Iterate over the ports that had events. */
+	for (int i = 0; i < num_results; i++) {
 		/* Get number of bytes waiting. */
-		int bytes_waiting = check(sp_input_waiting(ports[i]));
+		int bytes_waiting = check(sp_input_waiting(results[i].port));
 		printf("Port %s: %d bytes received.\n",
-				sp_get_port_name(ports[i]), bytes_waiting);
+				sp_get_port_name(results[i].port), bytes_waiting);
 	}
 
+	free(results);
+
 	/* Close ports and free resources. */
 	sp_free_event_set(event_set);
 	for (int i = 0; i < num_ports; i++) {
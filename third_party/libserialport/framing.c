@@ -0,0 +1,466 @@
+/*
+ * This file is part of the libserialport project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libserialport_internal.h"
+
+/* Smallest read-ahead buffer allocated for a port. */
+#define MIN_FRAME_BUFFER_SIZE 4096
+
+#define SLIP_END 0xC0
+#define SLIP_ESC 0xDB
+#define SLIP_ESC_END 0xDC
+#define SLIP_ESC_ESC 0xDD
+
+/* Set the OS error reported by sp_last_error_message() for a bad frame. */
+static void set_frame_error(bool too_long)
+{
+#ifdef _WIN32
+	SetLastError(too_long ? ERROR_INSUFFICIENT_BUFFER : ERROR_INVALID_DATA);
+#else
+	errno = too_long ? EMSGSIZE : EBADMSG;
+#endif
+}
+
+SP_PRIV void clear_frame_buffer(struct sp_port *port)
+{
+	struct frame_buffer *fb = &port->frame_buffer;
+
+	fb->start = fb->end = 0;
+	fb->skip = 0;
+	fb->resync = false;
+}
+
+SP_PRIV void free_frame_buffer(struct sp_port *port)
+{
+	struct frame_buffer *fb = &port->frame_buffer;
+
+	free(fb->data);
+	fb->data = NULL;
+	fb->size = 0;
+	clear_frame_buffer(port);
+}
+
+static void consume(struct frame_buffer *fb, size_t count)
+{
+	fb->start += count;
+	if (fb->start == fb->end)
+		fb->start = fb->end = 0;
+}
+
+/*
+ * Read more data into the buffer, making sure that it can hold at least
+ * capacity bytes of unconsumed data. As much as fits is read at once.
+ * Returns the number of bytes read, zero if the timeout expired, or a
+ * negative error code.
+ */
+static enum sp_return fill(struct sp_port *port, size_t capacity,
+	struct timeout *timeout)
+{
+	struct frame_buffer *fb = &port->frame_buffer;
+	unsigned char *new_data;
+	unsigned int remaining_ms;
+	size_t new_size;
+	int ret;
+
+	if (capacity < MIN_FRAME_BUFFER_SIZE)
+		capacity = MIN_FRAME_BUFFER_SIZE;
+
+	if (fb->size < capacity) {
+		for (new_size = fb->size ? fb->size : MIN_FRAME_BUFFER_SIZE;
+				new_size < capacity; new_size *= 2)
+			;
+		if (!(new_data = realloc(fb->data, new_size)))
+			RETURN_ERROR(SP_ERR_MEM, "Frame buffer realloc failed");
+		fb->data = new_data;
+		fb->size = new_size;
+	}
+
+	if (fb->end == fb->size) {
+		/* Move unconsumed data to the front to make room. */
+		memmove(fb->data, fb->data + fb->start, fb->end - fb->start);
+		fb->end -= fb->start;
+		fb->start = 0;
+	}
+
+	if (timeout_check(timeout))
+		RETURN_INT(0);
+
+	if (timeout->ns) {
+		/* Never pass zero, which would mean waiting indefinitely. */
+		remaining_ms = timeout_remaining_ms(timeout);
+		if (remaining_ms == 0)
+			remaining_ms = 1;
+	} else {
+		remaining_ms = 0;
+	}
+
+	ret = sp_blocking_read_next(port, fb->data + fb->end,
+		fb->size - fb->end, remaining_ms);
+
+	timeout_update(timeout);
+
+	if (ret < 0)
+		RETURN_CODEVAL(ret);
+
+	fb->end += ret;
+
+	RETURN_INT(ret);
+}
+
+/*
+ * Discard the rest of an oversized length-prefixed frame. If the timeout
+ * expires first, *done is set to false.
+ */
+static enum sp_return skip_frame(struct sp_port *port, struct timeout *timeout,
+	bool *done)
+{
+	struct frame_buffer *fb = &port->frame_buffer;
+	size_t available;
+	int ret;
+
+	while (fb->skip > 0) {
+		available = fb->end - fb->start;
+		if (available > fb->skip)
+			available = fb->skip;
+		consume(fb, available);
+		fb->skip -= available;
+
+		if (fb->skip > 0) {
+			if ((ret = fill(port, 0, timeout)) <= 0) {
+				*done = false;
+				if (ret < 0)
+					RETURN_CODEVAL(ret);
+				RETURN_OK();
+			}
+		}
+	}
+
+	*done = true;
+
+	RETURN_OK();
+}
+
+/*
+ * Find the next frame ending with the given delimiter, at most max_length
+ * bytes long including the delimiter, reading more data as needed. The
+ * buffer is scanned in bulk with memchr(), and only newly read data is
+ * scanned again. On success, the frame starts at fb->start, and its
+ * length is stored in *length; this is zero if the timeout expired.
+ */
+static enum sp_return find_delimited(struct sp_port *port, unsigned char delimiter,
+	size_t max_length, struct timeout *timeout, size_t *length)
+{
+	struct frame_buffer *fb = &port->frame_buffer;
+	size_t scanned = 0, frame_length;
+	unsigned char *found;
+	int ret;
+
+	*length = 0;
+
+	while (1) {
+		found = NULL;
+		if (fb->end - fb->start > scanned)
+			found = memchr(fb->data + fb->start + scanned, delimiter,
+				fb->end - fb->start - scanned);
+
+		if (found) {
+			frame_length = found - (fb->data + fb->start) + 1;
+			if (fb->resync) {
+				/* End of an oversized frame; resume from here. */
+				consume(fb, frame_length);
+				fb->resync = false;
+				scanned = 0;
+				continue;
+			}
+			if (frame_length > max_length) {
+				consume(fb, frame_length);
+				set_frame_error(true);
+				RETURN_FAIL("Frame too long");
+			}
+			*length = frame_length;
+			RETURN_OK();
+		}
+
+		if (fb->resync) {
+			/* Still inside an oversized frame; drop what was read. */
+			consume(fb, fb->end - fb->start);
+			scanned = 0;
+		} else {
+			scanned = fb->end - fb->start;
+			if (scanned >= max_length) {
+				consume(fb, scanned);
+				fb->resync = true;
+				set_frame_error(true);
+				RETURN_FAIL("Frame too long");
+			}
+		}
+
+		if ((ret = fill(port, max_length, timeout)) <= 0) {
+			if (ret < 0)
+				RETURN_CODEVAL(ret);
+			RETURN_OK();
+		}
+	}
+}
+
+/* Check arguments and set up the timeout, common to all frame reads. */
+#define START_FRAME_READ() do { \
+	CHECK_OPEN_PORT(); \
+	CHECK_READ_OWNER(); \
+	if (!buf) \
+		RETURN_ERROR(SP_ERR_ARG, "Null buffer"); \
+	if (count == 0) \
+		RETURN_ERROR(SP_ERR_ARG, "Zero count"); \
+	if (count > INT_MAX / 2 - 4) \
+		RETURN_ERROR(SP_ERR_ARG, "Count too large"); \
+	timeout_start(&timeout, timeout_ms); \
+} while (0)
+
+SP_API enum sp_return sp_blocking_read_until(struct sp_port *port, void *buf,
+                                             size_t count, unsigned char delimiter,
+                                             unsigned int timeout_ms)
+{
+	struct frame_buffer *fb;
+	struct timeout timeout;
+	size_t length;
+
+	TRACE("%p, %p, %d, 0x%02x, %d", port, buf, count, delimiter, timeout_ms);
+
+	START_FRAME_READ();
+
+	fb = &port->frame_buffer;
+
+	DEBUG_FMT("Reading up to 0x%02x from port %s", delimiter, port->name);
+
+	TRY(find_delimited(port, delimiter, count, &timeout, &length));
+
+	if (length > 0) {
+		memcpy(buf, fb->data + fb->start, length);
+		consume(fb, length);
+	}
+
+	RETURN_INT((int) length);
+}
+
+SP_API enum sp_return sp_blocking_read_prefixed(struct sp_port *port, void *buf,
+                                                size_t count,
+                                                enum sp_length_prefix prefix,
+                                                unsigned int timeout_ms)
+{
+	struct frame_buffer *fb;
+	struct timeout timeout;
+	const unsigned char *p;
+	size_t prefix_size, length, available;
+	bool done;
+	int ret;
+
+	TRACE("%p, %p, %d, %d, %d", port, buf, count, prefix, timeout_ms);
+
+	START_FRAME_READ();
+
+	fb = &port->frame_buffer;
+
+	switch (prefix) {
+	case SP_PREFIX_8:
+		prefix_size = 1;
+		break;
+	case SP_PREFIX_16_BE:
+	case SP_PREFIX_16_LE:
+		prefix_size = 2;
+		break;
+	case SP_PREFIX_32_BE:
+	case SP_PREFIX_32_LE:
+		prefix_size = 4;
+		break;
+	default:
+		RETURN_ERROR(SP_ERR_ARG, "Invalid length prefix");
+	}
+
+	DEBUG_FMT("Reading length-prefixed frame from port %s", port->name);
+
+	TRY(skip_frame(port, &timeout, &done));
+	if (!done)
+		RETURN_INT(0);
+
+	while (fb->end - fb->start < prefix_size) {
+		if ((ret = fill(port, prefix_size + count, &timeout)) <= 0) {
+			if (ret < 0)
+				RETURN_CODEVAL(ret);
+			RETURN_INT(0);
+		}
+	}
+
+	p = fb->data + fb->start;
+	switch (prefix) {
+	case SP_PREFIX_8:
+		length = p[0];
+		break;
+	case SP_PREFIX_16_BE:
+		length = ((size_t) p[0] << 8) | p[1];
+		break;
+	case SP_PREFIX_16_LE:
+		length = ((size_t) p[1] << 8) | p[0];
+		break;
+	case SP_PREFIX_32_BE:
+		length = ((size_t) p[0] << 24) | ((size_t) p[1] << 16) |
+			((size_t) p[2] << 8) | p[3];
+		break;
+	default:
+		length = ((size_t) p[3] << 24) | ((size_t) p[2] << 16) |
+			((size_t) p[1] << 8) | p[0];
+		break;
+	}
+
+	if (length > count) {
+		/* Drop the frame, including any part of it still to arrive. */
+		consume(fb, prefix_size);
+		available = fb->end - fb->start;
+		if (available > length)
+			available = length;
+		consume(fb, available);
+		fb->skip = length - available;
+		set_frame_error(true);
+		RETURN_FAIL("Frame too long");
+	}
+
+	while (fb->end - fb->start < prefix_size + length) {
+		if ((ret = fill(port, prefix_size + length, &timeout)) <= 0) {
+			if (ret < 0)
+				RETURN_CODEVAL(ret);
+			RETURN_INT(0);
+		}
+	}
+
+	memcpy(buf, fb->data + fb->start + prefix_size, length);
+	consume(fb, prefix_size + length);
+
+	RETURN_INT((int) length);
+}
+
+SP_API enum sp_return sp_blocking_read_slip(struct sp_port *port, void *buf,
+                                            size_t count, unsigned int timeout_ms)
+{
+	struct frame_buffer *fb;
+	struct timeout timeout;
+	unsigned char *out = buf;
+	const unsigned char *in, *in_end;
+	size_t length, decoded;
+
+	TRACE("%p, %p, %d, %d", port, buf, count, timeout_ms);
+
+	START_FRAME_READ();
+
+	fb = &port->frame_buffer;
+
+	DEBUG_FMT("Reading SLIP frame from port %s", port->name);
+
+	do {
+		/* Every byte may be escaped, and the frame ends with SLIP_END. */
+		TRY(find_delimited(port, SLIP_END, 2 * count + 1, &timeout, &length));
+		if (length == 0)
+			RETURN_INT(0);
+		/* Skip empty frames, which senders use to flush line noise. */
+		if (length == 1)
+			consume(fb, length);
+	} while (length == 1);
+
+	in = fb->data + fb->start;
+	in_end = in + length - 1;
+	decoded = 0;
+
+	while (in < in_end) {
+		unsigned char c = *in++;
+		if (c == SLIP_ESC) {
+			if (in == in_end || (*in != SLIP_ESC_END && *in != SLIP_ESC_ESC)) {
+				consume(fb, length);
+				set_frame_error(false);
+				RETURN_FAIL("Invalid SLIP escape sequence");
+			}
+			c = (*in++ == SLIP_ESC_END) ? SLIP_END : SLIP_ESC;
+		}
+		if (decoded == count) {
+			consume(fb, length);
+			set_frame_error(true);
+			RETURN_FAIL("Frame too long");
+		}
+		out[decoded++] = c;
+	}
+
+	consume(fb, length);
+
+	RETURN_INT((int) decoded);
+}
+
+SP_API enum sp_return sp_blocking_read_cobs(struct sp_port *port, void *buf,
+                                            size_t count, unsigned int timeout_ms)
+{
+	struct frame_buffer *fb;
+	struct timeout timeout;
+	unsigned char *out = buf;
+	const unsigned char *in, *in_end;
+	size_t length, decoded, code, i;
+
+	TRACE("%p, %p, %d, %d", port, buf, count, timeout_ms);
+
+	START_FRAME_READ();
+
+	fb = &port->frame_buffer;
+
+	DEBUG_FMT("Reading COBS frame from port %s", port->name);
+
+	do {
+		/* One overhead byte per 254 data bytes, plus the zero delimiter. */
+		TRY(find_delimited(port, 0, count + count / 254 + 2, &timeout, &length));
+		if (length == 0)
+			RETURN_INT(0);
+		if (length == 1)
+			consume(fb, length);
+	} while (length == 1);
+
+	in = fb->data + fb->start;
+	in_end = in + length - 1;
+	decoded = 0;
+
+	while (in < in_end) {
+		code = *in++;
+		if ((size_t) (in_end - in) < code - 1) {
+			consume(fb, length);
+			set_frame_error(false);
+			RETURN_FAIL("Invalid COBS frame");
+		}
+		if (decoded + code - 1 > count) {
+			consume(fb, length);
+			set_frame_error(true);
+			RETURN_FAIL("Frame too long");
+		}
+		for (i = 1; i < code; i++)
+			out[decoded++] = *in++;
+		/* A block shorter than the maximum implies a zero, unless last. */
+		if (code < 0xFF && in < in_end) {
+			if (decoded == count) {
+				consume(fb, length);
+				set_frame_error(true);
+				RETURN_FAIL("Frame too long");
+			}
+			out[decoded++] = 0;
+		}
+	}
+
+	consume(fb, length);
+
+	RETURN_INT((int) decoded);
+}
@@ -322,7 +322,7 @@ SP_PRIV enum sp_return get_port_details(struct sp_port *port)
 	RETURN_OK();
 }
 
-SP_PRIV enum sp_return list_ports(struct sp_port ***list)
+SP_PRIV enum sp_return list_ports(struct port_list *list)
 {
 	DIR *dir;
 	struct dirent *entry;
@@ -371,8 +371,7 @@ SP_PRIV enum sp_return list_ports(struct sp_port ***list)
 		DEBUG_FMT("Found port %s", name);
 		DBG("%s: %s\n", __func__, entry->d_name);
 
-		*list = list_append(*list, name);
-		if (!*list) {
+		if (!list_append(list, name)) {
 			SET_ERROR(ret, SP_ERR_MEM, "List append failed");
 			break;
 		}
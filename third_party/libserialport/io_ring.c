@@ -0,0 +1,1398 @@
+/*
+ * This file is part of the libserialport project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libserialport_internal.h"
+
+#ifndef _WIN32
+
+#if defined(__linux__) && defined(HAVE_LINUX_IO_URING_H)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+/* Provided buffer rings and cancellation by descriptor both arrived in 5.19. */
+#ifdef IORING_ASYNC_CANCEL_FD
+#define USE_IO_URING
+#endif
+#endif
+
+/* Largest number of receive buffers; io_uring buffer IDs are 16 bits. */
+#define MAX_IO_BUFFERS 32768
+
+/* Maximum number of queued writes submitted in one writev() call. */
+#define MAX_WRITE_IOVS 64
+
+/* A write queued with sp_io_ring_write(). */
+struct io_ring_write {
+	const unsigned char *buf;
+	size_t count;
+	void *user_data;
+	struct io_ring_write *next;
+};
+
+/* A port's registration with an I/O ring. */
+struct io_ring_port {
+	struct sp_io_ring *ring;
+	struct sp_port *port;
+	int fd;
+	/* Queued writes, oldest first, and the bytes written of the oldest. */
+	struct io_ring_write *writes_head, *writes_tail;
+	size_t written;
+	/* Set when reading has stopped for lack of buffers. */
+	bool starved;
+	/* Set when a read has failed; the port is then not read again. */
+	bool failed;
+	/* Whether the port is in the ring's list of ports with new writes. */
+	bool flushing;
+	struct io_ring_port *flush_next;
+	/* The ring's list of ports waiting for a buffer. */
+	struct io_ring_port *starved_next;
+	struct io_ring_port *prev, *next;
+#ifdef USE_IO_URING
+	/* Outstanding io_uring requests, which must finish before freeing. */
+	unsigned int pending;
+	/* Whether a read or a write request is outstanding. */
+	bool reading;
+	bool writing;
+	/* Set on removal, while waiting for outstanding requests. */
+	bool removed;
+	/* Set when a poll has reported a hangup or error. */
+	bool hangup;
+	/* The buffers of the outstanding write. */
+	struct iovec iovs[MAX_WRITE_IOVS];
+	size_t submitted;
+#endif
+};
+
+#ifdef USE_IO_URING
+/* Multishot reads, added in Linux 6.7, are missing from older headers. */
+#define OP_READ_MULTISHOT 49
+
+#define URING_SQ_ENTRIES 256
+/* Larger, as each multishot read can post many completions. */
+#define URING_CQ_ENTRIES 1024
+
+/* Buffer group of the receive buffer pool. */
+#define BUFFER_GROUP 0
+
+/*
+ * The low bits of a request's user data tell what it is, and the rest
+ * point to the registration it belongs to. Requests with no tag, such as
+ * cancellations, are not tracked.
+ */
+#define TAG_READ 1
+#define TAG_WRITE 2
+#define TAG_POLL 3
+#define TAG_MASK 3
+
+struct uring {
+	int fd;
+	void *map;
+	size_t map_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+	unsigned int *sq_head, *sq_tail, *sq_array, sq_mask, sq_entries;
+	unsigned int *cq_head, *cq_tail, cq_mask;
+	struct io_uring_cqe *cqes;
+	/* Tail of the submission queue, including requests not yet submitted. */
+	unsigned int sq_local_tail;
+	unsigned int to_submit;
+	struct io_uring_buf_ring *buf_ring;
+	unsigned int buf_mask;
+	/* Whether the kernel has multishot reads; otherwise reads are rearmed. */
+	bool multishot;
+};
+#endif
+
+struct sp_io_ring {
+	enum sp_io_ring_backend backend;
+	unsigned char *pool;
+	size_t buffer_size;
+	unsigned int num_buffers;
+	struct io_ring_port *ports;
+	unsigned int num_ports;
+	/* Ports with writes queued since the last submission. */
+	struct io_ring_port *flush_head;
+	/* Ports waiting for a buffer, in the order they ran out. */
+	struct io_ring_port *starved_head, *starved_tail;
+	/* Completions collected but not yet returned, oldest at head. */
+	struct sp_io_completion *backlog;
+	unsigned int backlog_head, backlog_len, backlog_size;
+	struct sp_io_ring_stats stats;
+	/* Number of free receive buffers, and for poll(), a stack of them. */
+	unsigned int *free_buffers;
+	unsigned int num_free;
+	struct pollfd *pollfds;
+	struct io_ring_port **poll_ports;
+	unsigned int pollfds_size;
+#ifdef USE_IO_URING
+	struct uring uring;
+#endif
+};
+
+static enum sp_return add_completion(struct sp_io_ring *ring,
+	struct io_ring_port *rp, enum sp_io_ring_op op, int result,
+	const void *buf, unsigned int buffer_id, void *user_data)
+{
+	struct sp_io_completion *completion, *backlog;
+	unsigned int size;
+
+	if (ring->backlog_head > 0 && ring->backlog_head == ring->backlog_len)
+		ring->backlog_head = ring->backlog_len = 0;
+
+	if (ring->backlog_len == ring->backlog_size) {
+		size = ring->backlog_size ? ring->backlog_size * 2 : 64;
+		if (!(backlog = realloc(ring->backlog, size * sizeof(*backlog))))
+			return SP_ERR_MEM;
+		ring->backlog = backlog;
+		ring->backlog_size = size;
+	}
+
+	completion = &ring->backlog[ring->backlog_len++];
+	completion->port = rp->port;
+	completion->op = op;
+	completion->result = result;
+	completion->buf = buf;
+	completion->buffer_id = buffer_id;
+	completion->user_data = user_data;
+
+	if (op == SP_IO_RING_READ && result > 0) {
+		ring->stats.reads++;
+		ring->stats.bytes_read += result;
+	} else if (op == SP_IO_RING_WRITE) {
+		ring->stats.writes++;
+	}
+
+	return SP_OK;
+}
+
+static unsigned int take_completions(struct sp_io_ring *ring,
+	struct sp_io_completion *completions, unsigned int count)
+{
+	unsigned int n = ring->backlog_len - ring->backlog_head;
+
+	if (n > count)
+		n = count;
+
+	memcpy(completions, &ring->backlog[ring->backlog_head],
+		n * sizeof(*completions));
+	ring->backlog_head += n;
+
+	return n;
+}
+
+static void *io_buffer(struct sp_io_ring *ring, unsigned int id)
+{
+	return ring->pool + (size_t) id * ring->buffer_size;
+}
+
+/* Gather the buffers of queued writes, returning the number used. */
+static int gather_writes(struct io_ring_port *rp, struct iovec *iovs,
+	size_t *total)
+{
+	struct io_ring_write *write;
+	int num_iovs = 0;
+
+	*total = 0;
+	for (write = rp->writes_head; write && num_iovs < MAX_WRITE_IOVS; write = write->next) {
+		iovs[num_iovs].iov_base = (char *) write->buf;
+		iovs[num_iovs].iov_len = write->count;
+		if (write == rp->writes_head) {
+			iovs[num_iovs].iov_base = (char *) write->buf + rp->written;
+			iovs[num_iovs].iov_len -= rp->written;
+		}
+		*total += iovs[num_iovs].iov_len;
+		num_iovs++;
+	}
+
+	return num_iovs;
+}
+
+/*
+ * Account for bytes written from the head of a port's queue, reporting
+ * the writes which have been written in full.
+ */
+static enum sp_return complete_writes(struct sp_io_ring *ring,
+	struct io_ring_port *rp, size_t written)
+{
+	struct io_ring_write *write;
+	size_t remaining;
+	enum sp_return ret;
+
+	ring->stats.bytes_written += written;
+
+	while ((write = rp->writes_head)) {
+		remaining = write->count - rp->written;
+		if (written < remaining) {
+			rp->written += written;
+			break;
+		}
+		written -= remaining;
+
+		rp->writes_head = write->next;
+		if (!rp->writes_head)
+			rp->writes_tail = NULL;
+		rp->written = 0;
+
+		ret = add_completion(ring, rp, SP_IO_RING_WRITE, (int) write->count,
+			write->buf, 0, write->user_data);
+		free(write);
+		if (ret != SP_OK)
+			return ret;
+	}
+
+	return SP_OK;
+}
+
+/* Report the write at the head of a port's queue as failed. */
+static enum sp_return fail_write(struct sp_io_ring *ring,
+	struct io_ring_port *rp)
+{
+	struct io_ring_write *write = rp->writes_head;
+	enum sp_return ret;
+
+	DEBUG_FMT("Write to port %s failed", rp->port->name);
+
+	rp->writes_head = write->next;
+	if (!rp->writes_head)
+		rp->writes_tail = NULL;
+	rp->written = 0;
+
+	ret = add_completion(ring, rp, SP_IO_RING_WRITE, SP_ERR_FAIL,
+		write->buf, 0, write->user_data);
+	free(write);
+
+	return ret;
+}
+
+static void add_starved(struct sp_io_ring *ring, struct io_ring_port *rp)
+{
+	DEBUG_FMT("No receive buffers for port %s", rp->port->name);
+
+	rp->starved = true;
+	rp->starved_next = NULL;
+	if (ring->starved_tail)
+		ring->starved_tail->starved_next = rp;
+	else
+		ring->starved_head = rp;
+	ring->starved_tail = rp;
+}
+
+static void unlink_port(struct sp_io_ring *ring, struct io_ring_port *rp)
+{
+	struct io_ring_port **link, *prev = NULL;
+	struct io_ring_write *write;
+
+	while ((write = rp->writes_head)) {
+		rp->writes_head = write->next;
+		free(write);
+	}
+
+	if (rp->flushing) {
+		for (link = &ring->flush_head; *link != rp; link = &(*link)->flush_next);
+		*link = rp->flush_next;
+	}
+
+	if (rp->starved) {
+		for (link = &ring->starved_head; *link != rp; link = &(*link)->starved_next)
+			prev = *link;
+		*link = rp->starved_next;
+		if (ring->starved_tail == rp)
+			ring->starved_tail = prev;
+	}
+
+	if (rp->prev)
+		rp->prev->next = rp->next;
+	else
+		ring->ports = rp->next;
+	if (rp->next)
+		rp->next->prev = rp->prev;
+	ring->num_ports--;
+
+	rp->port->io_ring = NULL;
+}
+
+#ifdef USE_IO_URING
+
+static int uring_setup(unsigned int entries, struct io_uring_params *params)
+{
+	return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_register(int fd, unsigned int opcode, void *arg,
+	unsigned int nr_args)
+{
+	return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/*
+ * Submit the queued requests, then wait for at least min_complete
+ * completions or until the timeout expires.
+ */
+static int uring_enter(struct sp_io_ring *ring, unsigned int min_complete,
+	const struct timespec *timeout)
+{
+	struct uring *uring = &ring->uring;
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned int flags = 0;
+	int ret;
+
+	memset(&arg, 0, sizeof(arg));
+	if (min_complete > 0) {
+		flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+		if (timeout) {
+			ts.tv_sec = timeout->tv_sec;
+			ts.tv_nsec = timeout->tv_nsec;
+			arg.ts = (uintptr_t) &ts;
+		}
+	}
+
+	__atomic_store_n(uring->sq_tail, uring->sq_local_tail, __ATOMIC_RELEASE);
+
+	ret = (int) syscall(__NR_io_uring_enter, uring->fd, uring->to_submit,
+		min_complete, flags, flags ? &arg : NULL, sizeof(arg));
+	ring->stats.syscalls++;
+
+	if (ret >= 0)
+		uring->to_submit -= (unsigned int) ret;
+
+	return ret;
+}
+
+static struct io_uring_sqe *get_sqe(struct sp_io_ring *ring)
+{
+	struct uring *uring = &ring->uring;
+	struct io_uring_sqe *sqe;
+	unsigned int index;
+
+	/* Make room by submitting what is queued. */
+	while (uring->sq_local_tail -
+			__atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE) >= uring->sq_entries)
+		if (uring_enter(ring, 0, NULL) < 0 && errno != EINTR && errno != EBUSY)
+			return NULL;
+
+	index = uring->sq_local_tail & uring->sq_mask;
+	uring->sq_array[index] = index;
+	sqe = &uring->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	uring->sq_local_tail++;
+	uring->to_submit++;
+
+	return sqe;
+}
+
+/* Queue a poll request, to which the next request is linked. */
+static enum sp_return queue_poll(struct sp_io_ring *ring,
+	struct io_ring_port *rp, short events)
+{
+	struct io_uring_sqe *sqe;
+
+	if (!(sqe = get_sqe(ring)))
+		return SP_ERR_FAIL;
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = rp->fd;
+#if __BYTE_ORDER == __BIG_ENDIAN
+	/* The kernel swaps the halves of the mask on big-endian machines. */
+	sqe->poll32_events = (uint32_t) events << 16;
+#else
+	sqe->poll32_events = (uint32_t) events;
+#endif
+	sqe->flags = IOSQE_IO_LINK;
+	sqe->user_data = (uintptr_t) rp | TAG_POLL;
+	rp->pending++;
+
+	return SP_OK;
+}
+
+/*
+ * Queue a read, which takes a buffer from the pool once data arrives.
+ * Reads of a terminal in raw mode with VMIN of zero, as set by sp_open(),
+ * return nothing rather than wait when no data is available, which also
+ * ends a multishot read. It is then rearmed behind a poll.
+ */
+static enum sp_return arm_read(struct sp_io_ring *ring,
+	struct io_ring_port *rp, bool poll_first)
+{
+	struct io_uring_sqe *sqe;
+
+	if (poll_first)
+		TRY(queue_poll(ring, rp, POLLIN));
+
+	if (!(sqe = get_sqe(ring)))
+		return SP_ERR_FAIL;
+
+	if (ring->uring.multishot) {
+		sqe->opcode = OP_READ_MULTISHOT;
+	} else {
+		sqe->opcode = IORING_OP_READ;
+		sqe->len = (uint32_t) ring->buffer_size;
+		sqe->off = (uint64_t) -1;
+	}
+	sqe->fd = rp->fd;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = BUFFER_GROUP;
+	sqe->user_data = (uintptr_t) rp | TAG_READ;
+
+	rp->reading = true;
+	rp->pending++;
+
+	return SP_OK;
+}
+
+/* Queue one writev of as many of a port's queued writes as possible. */
+static enum sp_return arm_write(struct sp_io_ring *ring,
+	struct io_ring_port *rp, bool poll_first)
+{
+	struct io_uring_sqe *sqe;
+	int num_iovs;
+
+	if (poll_first)
+		TRY(queue_poll(ring, rp, POLLOUT));
+
+	if (!(sqe = get_sqe(ring)))
+		return SP_ERR_FAIL;
+
+	num_iovs = gather_writes(rp, rp->iovs, &rp->submitted);
+
+	sqe->opcode = IORING_OP_WRITEV;
+	sqe->fd = rp->fd;
+	sqe->addr = (uintptr_t) rp->iovs;
+	sqe->len = (uint32_t) num_iovs;
+	sqe->off = (uint64_t) -1;
+	sqe->user_data = (uintptr_t) rp | TAG_WRITE;
+
+	rp->writing = true;
+	rp->pending++;
+
+	return SP_OK;
+}
+
+static void provide_buffer(struct sp_io_ring *ring, unsigned int id)
+{
+	struct uring *uring = &ring->uring;
+	struct io_uring_buf_ring *buf_ring = uring->buf_ring;
+	unsigned short tail = buf_ring->tail;
+	struct io_uring_buf *buf = &buf_ring->bufs[tail & uring->buf_mask];
+
+	buf->addr = (uintptr_t) io_buffer(ring, id);
+	buf->len = (uint32_t) ring->buffer_size;
+	buf->bid = (unsigned short) id;
+
+	__atomic_store_n(&buf_ring->tail, (unsigned short) (tail + 1),
+		__ATOMIC_RELEASE);
+	ring->num_free++;
+}
+
+static enum sp_return handle_read(struct sp_io_ring *ring,
+	struct io_ring_port *rp, const struct io_uring_cqe *cqe)
+{
+	bool has_buffer = cqe->flags & IORING_CQE_F_BUFFER;
+	unsigned int id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+	bool poll_first = false;
+	enum sp_return ret = SP_OK;
+
+	if (!(cqe->flags & IORING_CQE_F_MORE)) {
+		rp->reading = false;
+		rp->pending--;
+	}
+
+	if (has_buffer)
+		ring->num_free--;
+
+	if (rp->removed) {
+		if (has_buffer)
+			provide_buffer(ring, id);
+		return SP_OK;
+	}
+
+	if (cqe->res > 0 && has_buffer) {
+		ret = add_completion(ring, rp, SP_IO_RING_READ, cqe->res,
+			io_buffer(ring, id), id, NULL);
+		if (ret != SP_OK)
+			provide_buffer(ring, id);
+	} else if (cqe->res == -ENOBUFS) {
+		/* Buffers may have been released since the read ran out. */
+		if (!rp->reading && ring->num_free == 0)
+			add_starved(ring, rp);
+	} else if ((cqe->res == 0 && !rp->hangup) || cqe->res == -EAGAIN ||
+			cqe->res == -EINTR) {
+		if (has_buffer)
+			provide_buffer(ring, id);
+		poll_first = true;
+	} else if (cqe->res != -ECANCELED && cqe->res != -EOVERFLOW) {
+		/* A hangup or failure; reads ended by a full queue are rearmed. */
+		if (has_buffer)
+			provide_buffer(ring, id);
+		DEBUG_FMT("Read from port %s failed: %d", rp->port->name, cqe->res);
+		rp->failed = true;
+		ret = add_completion(ring, rp, SP_IO_RING_READ, SP_ERR_FAIL,
+			NULL, 0, NULL);
+	}
+
+	if (!rp->reading && !rp->starved && !rp->failed)
+		TRY(arm_read(ring, rp, poll_first));
+
+	return ret;
+}
+
+static enum sp_return handle_write(struct sp_io_ring *ring,
+	struct io_ring_port *rp, const struct io_uring_cqe *cqe)
+{
+	bool poll_first = false;
+
+	rp->writing = false;
+	rp->pending--;
+
+	if (rp->removed)
+		return SP_OK;
+
+	if (cqe->res >= 0) {
+		TRY(complete_writes(ring, rp, cqe->res));
+		/* Write the rest once the port can take more. */
+		poll_first = (size_t) cqe->res < rp->submitted;
+	} else if (cqe->res == -EAGAIN || cqe->res == -EINTR) {
+		poll_first = true;
+	} else {
+		TRY(fail_write(ring, rp));
+	}
+
+	if (rp->writes_head)
+		TRY(arm_write(ring, rp, poll_first));
+
+	return SP_OK;
+}
+
+/* Move the completions posted by the kernel to the backlog. */
+static enum sp_return reap_completions(struct sp_io_ring *ring)
+{
+	struct uring *uring = &ring->uring;
+	struct io_uring_cqe *cqe;
+	struct io_ring_port *rp;
+	unsigned int head, tail;
+	enum sp_return ret = SP_OK;
+
+	head = *uring->cq_head;
+	tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+
+	for (; head != tail && ret == SP_OK; head++) {
+		cqe = &uring->cqes[head & uring->cq_mask];
+		rp = (struct io_ring_port *) (uintptr_t) (cqe->user_data & ~TAG_MASK);
+
+		switch (cqe->user_data & TAG_MASK) {
+		case TAG_READ:
+			ret = handle_read(ring, rp, cqe);
+			break;
+		case TAG_WRITE:
+			ret = handle_write(ring, rp, cqe);
+			break;
+		case TAG_POLL:
+			rp->pending--;
+			if (cqe->res > 0 && (cqe->res & (POLLHUP | POLLERR)))
+				rp->hangup = true;
+			break;
+		}
+	}
+
+	__atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+
+	return ret;
+}
+
+static enum sp_return uring_flush(struct sp_io_ring *ring)
+{
+	struct io_ring_port *rp;
+
+	while ((rp = ring->flush_head)) {
+		ring->flush_head = rp->flush_next;
+		rp->flushing = false;
+		/* Otherwise, the new writes follow once the current one is done. */
+		if (!rp->writing)
+			TRY(arm_write(ring, rp, false));
+	}
+
+	return SP_OK;
+}
+
+static int uring_wait(struct sp_io_ring *ring,
+	struct sp_io_completion *completions, unsigned int count,
+	struct timeout *timeout)
+{
+	TRY(uring_flush(ring));
+
+	while (1) {
+		TRY(reap_completions(ring));
+
+		if (ring->backlog_len > ring->backlog_head) {
+			/* Let the kernel start on rearmed reads and further writes. */
+			if (ring->uring.to_submit > 0 && uring_enter(ring, 0, NULL) < 0 &&
+					errno != EINTR && errno != EBUSY)
+				return SP_ERR_FAIL;
+			return (int) take_completions(ring, completions, count);
+		}
+
+		if (timeout_check(timeout))
+			return 0;
+
+		if (uring_enter(ring, 1, timeout_timespec(timeout)) < 0 &&
+				errno != EINTR && errno != ETIME && errno != EBUSY)
+			return SP_ERR_FAIL;
+
+		timeout_update(timeout);
+	}
+}
+
+static void uring_remove(struct sp_io_ring *ring, struct io_ring_port *rp)
+{
+	struct io_uring_sqe *sqe;
+
+	if (rp->pending == 0)
+		return;
+
+	rp->removed = true;
+
+	/* Cancel everything outstanding on the port, and wait for it to end. */
+	if ((sqe = get_sqe(ring))) {
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = rp->fd;
+		sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+	}
+
+	while (rp->pending > 0) {
+		if (uring_enter(ring, 1, NULL) < 0 && errno != EINTR && errno != EBUSY) {
+			DEBUG("Waiting for cancellation failed");
+			return;
+		}
+		if (reap_completions(ring) != SP_OK)
+			DEBUG("Completions were lost during removal");
+	}
+}
+
+static void uring_free(struct sp_io_ring *ring)
+{
+	struct uring *uring = &ring->uring;
+
+	if (uring->fd >= 0)
+		close(uring->fd);
+	if (uring->map)
+		munmap(uring->map, uring->map_size);
+	if (uring->sqes)
+		munmap(uring->sqes, uring->sqes_size);
+	free(uring->buf_ring);
+}
+
+/* Returns 0 upon success, -1 if io_uring cannot be used. */
+static int uring_init(struct sp_io_ring *ring)
+{
+	struct uring *uring = &ring->uring;
+	struct io_uring_params params;
+	struct io_uring_buf_reg reg;
+	struct io_uring_probe *probe;
+	size_t sq_size, cq_size, buf_ring_size;
+	unsigned int i;
+	long page_size;
+
+	memset(uring, 0, sizeof(*uring));
+
+	memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_CQSIZE;
+	params.cq_entries = URING_CQ_ENTRIES;
+
+	if ((uring->fd = uring_setup(URING_SQ_ENTRIES, &params)) < 0) {
+		DEBUG("io_uring_setup() failed");
+		return -1;
+	}
+
+	if (!(params.features & IORING_FEAT_SINGLE_MMAP) ||
+			!(params.features & IORING_FEAT_EXT_ARG)) {
+		DEBUG("io_uring lacks required features");
+		goto fail;
+	}
+
+	sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	uring->map_size = sq_size > cq_size ? sq_size : cq_size;
+	uring->map = mmap(NULL, uring->map_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQ_RING);
+	if (uring->map == MAP_FAILED) {
+		uring->map = NULL;
+		DEBUG("Mapping io_uring queues failed");
+		goto fail;
+	}
+
+	uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	uring->sqes = mmap(NULL, uring->sqes_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQES);
+	if (uring->sqes == MAP_FAILED) {
+		uring->sqes = NULL;
+		DEBUG("Mapping io_uring submissions failed");
+		goto fail;
+	}
+
+	uring->sq_head = (unsigned int *) ((char *) uring->map + params.sq_off.head);
+	uring->sq_tail = (unsigned int *) ((char *) uring->map + params.sq_off.tail);
+	uring->sq_mask = *(unsigned int *) ((char *) uring->map + params.sq_off.ring_mask);
+	uring->sq_array = (unsigned int *) ((char *) uring->map + params.sq_off.array);
+	uring->sq_entries = params.sq_entries;
+	uring->sq_local_tail = *uring->sq_tail;
+	uring->cq_head = (unsigned int *) ((char *) uring->map + params.cq_off.head);
+	uring->cq_tail = (unsigned int *) ((char *) uring->map + params.cq_off.tail);
+	uring->cq_mask = *(unsigned int *) ((char *) uring->map + params.cq_off.ring_mask);
+	uring->cqes = (struct io_uring_cqe *) ((char *) uring->map + params.cq_off.cqes);
+
+	/* Register the pool, so that reads pick a buffer when data arrives. */
+	page_size = sysconf(_SC_PAGESIZE);
+	buf_ring_size = ring->num_buffers * sizeof(struct io_uring_buf);
+	if (posix_memalign((void **) &uring->buf_ring,
+			page_size > 0 ? (size_t) page_size : 4096, buf_ring_size) != 0) {
+		uring->buf_ring = NULL;
+		DEBUG("Buffer ring malloc failed");
+		goto fail;
+	}
+	memset(uring->buf_ring, 0, buf_ring_size);
+	uring->buf_mask = ring->num_buffers - 1;
+
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uintptr_t) uring->buf_ring;
+	reg.ring_entries = ring->num_buffers;
+	reg.bgid = BUFFER_GROUP;
+	if (uring_register(uring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+		DEBUG("Registering io_uring buffer ring failed");
+		goto fail;
+	}
+
+	for (i = 0; i < ring->num_buffers; i++)
+		provide_buffer(ring, i);
+
+	if ((probe = calloc(1, sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op)))) {
+		if (uring_register(uring->fd, IORING_REGISTER_PROBE, probe, 256) == 0 &&
+				probe->last_op >= OP_READ_MULTISHOT &&
+				(probe->ops[OP_READ_MULTISHOT].flags & IO_URING_OP_SUPPORTED))
+			uring->multishot = true;
+		free(probe);
+	}
+
+	DEBUG_FMT("Using io_uring with %s reads",
+		uring->multishot ? "multishot" : "rearmed");
+
+	return 0;
+
+fail:
+	uring_free(ring);
+	return -1;
+}
+
+#endif
+
+/* Write as much of a port's queue as it will take, in one call. */
+static enum sp_return poll_write(struct sp_io_ring *ring,
+	struct io_ring_port *rp)
+{
+	struct iovec iovs[MAX_WRITE_IOVS];
+	size_t submitted;
+	ssize_t result;
+	int num_iovs;
+
+	num_iovs = gather_writes(rp, iovs, &submitted);
+
+	result = writev(rp->fd, iovs, num_iovs);
+	ring->stats.syscalls++;
+
+	if (result < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return SP_OK;
+		return fail_write(ring, rp);
+	}
+
+	return complete_writes(ring, rp, result);
+}
+
+static enum sp_return poll_read(struct sp_io_ring *ring,
+	struct io_ring_port *rp)
+{
+	unsigned int id = ring->free_buffers[--ring->num_free];
+	ssize_t result;
+
+	result = read(rp->fd, io_buffer(ring, id), ring->buffer_size);
+	ring->stats.syscalls++;
+
+	if (result > 0)
+		return add_completion(ring, rp, SP_IO_RING_READ, (int) result,
+			io_buffer(ring, id), id, NULL);
+
+	ring->free_buffers[ring->num_free++] = id;
+
+	if (result < 0 && (errno == EAGAIN || errno == EINTR))
+		return SP_OK;
+
+	/* A hangup, or end of file. */
+	DEBUG_FMT("Read from port %s failed", rp->port->name);
+	rp->failed = true;
+
+	return add_completion(ring, rp, SP_IO_RING_READ, SP_ERR_FAIL, NULL, 0, NULL);
+}
+
+static enum sp_return poll_flush(struct sp_io_ring *ring)
+{
+	struct io_ring_port *rp;
+
+	while ((rp = ring->flush_head)) {
+		ring->flush_head = rp->flush_next;
+		rp->flushing = false;
+		if (rp->writes_head)
+			TRY(poll_write(ring, rp));
+	}
+
+	return SP_OK;
+}
+
+static int poll_wait(struct sp_io_ring *ring,
+	struct sp_io_completion *completions, unsigned int count,
+	struct timeout *timeout)
+{
+	struct io_ring_port *rp;
+	unsigned int num_fds, i;
+	short events, revents;
+#ifndef HAVE_PPOLL
+	int poll_timeout;
+#endif
+	int result;
+
+	TRY(poll_flush(ring));
+
+	if (ring->num_ports > ring->pollfds_size) {
+		free(ring->pollfds);
+		free(ring->poll_ports);
+		ring->poll_ports = NULL;
+		ring->pollfds_size = 0;
+		if (!(ring->pollfds = malloc(ring->num_ports * sizeof(struct pollfd))) ||
+				!(ring->poll_ports = malloc(ring->num_ports * sizeof(rp))))
+			return SP_ERR_MEM;
+		ring->pollfds_size = ring->num_ports;
+	}
+
+	while (ring->backlog_len == ring->backlog_head) {
+		num_fds = 0;
+		for (rp = ring->ports; rp; rp = rp->next) {
+			events = 0;
+			if (ring->num_free > 0 && !rp->failed)
+				events |= POLLIN;
+			if (rp->writes_head)
+				events |= POLLOUT;
+			if (!events)
+				continue;
+			ring->pollfds[num_fds].fd = rp->fd;
+			ring->pollfds[num_fds].events = events;
+			ring->pollfds[num_fds].revents = 0;
+			ring->poll_ports[num_fds] = rp;
+			num_fds++;
+		}
+
+		if (timeout_check(timeout))
+			return 0;
+
+#ifdef HAVE_PPOLL
+		result = ppoll(ring->pollfds, num_fds, timeout_timespec(timeout), NULL);
+#else
+		poll_timeout = (int) timeout_remaining_ms(timeout);
+		if (poll_timeout == 0)
+			poll_timeout = -1;
+		result = poll(ring->pollfds, num_fds, poll_timeout);
+#endif
+		ring->stats.syscalls++;
+
+		timeout_update(timeout);
+
+		if (result < 0) {
+			if (errno == EINTR)
+				continue;
+			return SP_ERR_FAIL;
+		}
+
+		for (i = 0; i < num_fds; i++) {
+			rp = ring->poll_ports[i];
+			events = ring->pollfds[i].events;
+			revents = ring->pollfds[i].revents;
+			if ((events & POLLOUT) && (revents & (POLLOUT | POLLERR | POLLHUP)))
+				TRY(poll_write(ring, rp));
+			if ((events & POLLIN) && (revents & (POLLIN | POLLERR | POLLHUP))) {
+				if (ring->num_free > 0)
+					TRY(poll_read(ring, rp));
+				else if (!rp->starved)
+					add_starved(ring, rp);
+			}
+		}
+	}
+
+	return (int) take_completions(ring, completions, count);
+}
+
+SP_API enum sp_return sp_new_io_ring(enum sp_io_ring_backend backend,
+	unsigned int num_buffers, size_t buffer_size,
+	struct sp_io_ring **ring_ptr)
+{
+	struct sp_io_ring *ring;
+	unsigned int i;
+
+	TRACE("%d, %d, %d, %p", backend, num_buffers, buffer_size, ring_ptr);
+
+	if (!ring_ptr)
+		RETURN_ERROR(SP_ERR_ARG, "Null result pointer");
+
+	*ring_ptr = NULL;
+
+	if (backend != SP_IO_RING_AUTO && backend != SP_IO_RING_URING &&
+			backend != SP_IO_RING_POLL)
+		RETURN_ERROR(SP_ERR_ARG, "Invalid backend");
+
+	if (num_buffers == 0 || num_buffers > MAX_IO_BUFFERS)
+		RETURN_ERROR(SP_ERR_ARG, "Invalid number of buffers");
+
+	if (buffer_size == 0 || buffer_size > INT_MAX)
+		RETURN_ERROR(SP_ERR_ARG, "Invalid buffer size");
+
+#ifndef USE_IO_URING
+	if (backend == SP_IO_RING_URING)
+		RETURN_ERROR(SP_ERR_SUPP, "io_uring not supported by this build");
+#endif
+
+	/* Buffer rings must have a power of two entries. */
+	while (num_buffers & (num_buffers - 1))
+		num_buffers += num_buffers & -num_buffers;
+
+	if (!(ring = calloc(1, sizeof(struct sp_io_ring))))
+		RETURN_ERROR(SP_ERR_MEM, "I/O ring malloc failed");
+
+	ring->num_buffers = num_buffers;
+	ring->buffer_size = buffer_size;
+
+	if (!(ring->pool = malloc((size_t) num_buffers * buffer_size))) {
+		free(ring);
+		RETURN_ERROR(SP_ERR_MEM, "I/O buffer pool malloc failed");
+	}
+
+#ifdef USE_IO_URING
+	if (backend != SP_IO_RING_POLL) {
+		if (uring_init(ring) == 0) {
+			ring->backend = SP_IO_RING_URING;
+		} else if (backend == SP_IO_RING_URING) {
+			free(ring->pool);
+			free(ring);
+			RETURN_ERROR(SP_ERR_SUPP, "io_uring not available");
+		}
+	}
+#endif
+
+	if (!ring->backend) {
+		DEBUG("Using poll() for I/O ring");
+		ring->backend = SP_IO_RING_POLL;
+		if (!(ring->free_buffers = malloc(num_buffers * sizeof(unsigned int)))) {
+			free(ring->pool);
+			free(ring);
+			RETURN_ERROR(SP_ERR_MEM, "Free buffer list malloc failed");
+		}
+		/* Hand out the lowest numbered buffers first. */
+		for (i = 0; i < num_buffers; i++)
+			ring->free_buffers[i] = num_buffers - 1 - i;
+		ring->num_free = num_buffers;
+	}
+
+	*ring_ptr = ring;
+
+	RETURN_OK();
+}
+
+SP_API enum sp_return sp_get_io_ring_backend(const struct sp_io_ring *ring)
+{
+	TRACE("%p", ring);
+
+	if (!ring)
+		RETURN_ERROR(SP_ERR_ARG, "Null ring");
+
+	RETURN_INT((int) ring->backend);
+}
+
+SP_API enum sp_return sp_io_ring_add_port(struct sp_io_ring *ring,
+	struct sp_port *port)
+{
+	struct io_ring_port *rp;
+
+	TRACE("%p, %p", ring, port);
+
+	if (!ring)
+		RETURN_ERROR(SP_ERR_ARG, "Null ring");
+
+	CHECK_OPEN_PORT();
+
+	if (port->io_ring)
+		RETURN_ERROR(SP_ERR_ARG, "Port already in an I/O ring");
+
+	if (port->reactor)
+		RETURN_ERROR(SP_ERR_ARG, "Port is in a reactor");
+
+	if (port->receiver)
+		RETURN_ERROR(SP_ERR_ARG, "Receive engine is running");
+
+	TRY(ensure_nonblocking(port));
+
+	if (!(rp = calloc(1, sizeof(struct io_ring_port))))
+		RETURN_ERROR(SP_ERR_MEM, "I/O ring port malloc failed");
+
+	rp->ring = ring;
+	rp->port = port;
+	rp->fd = port->fd;
+
+#ifdef USE_IO_URING
+	if (ring->backend == SP_IO_RING_URING && arm_read(ring, rp, true) != SP_OK) {
+		free(rp);
+		RETURN_FAIL("Queueing read failed");
+	}
+#endif
+
+	DEBUG_FMT("Adding port %s to I/O ring", port->name);
+
+	rp->next = ring->ports;
+	if (ring->ports)
+		ring->ports->prev = rp;
+	ring->ports = rp;
+	ring->num_ports++;
+	port->io_ring = rp;
+
+	RETURN_OK();
+}
+
+SP_PRIV void remove_io_ring_port(struct sp_port *port)
+{
+	struct io_ring_port *rp = port->io_ring;
+
+	DEBUG_FMT("Removing port %s from I/O ring", port->name);
+
+#ifdef USE_IO_URING
+	if (rp->ring->backend == SP_IO_RING_URING) {
+		uring_remove(rp->ring, rp);
+		unlink_port(rp->ring, rp);
+		/* The kernel may still refer to it, so leave it allocated. */
+		if (rp->pending == 0)
+			free(rp);
+		return;
+	}
+#endif
+
+	unlink_port(rp->ring, rp);
+	free(rp);
+}
+
+SP_API enum sp_return sp_io_ring_remove_port(struct sp_io_ring *ring,
+	struct sp_port *port)
+{
+	TRACE("%p, %p", ring, port);
+
+	if (!ring)
+		RETURN_ERROR(SP_ERR_ARG, "Null ring");
+
+	CHECK_PORT();
+
+	if (!port->io_ring || port->io_ring->ring != ring)
+		RETURN_ERROR(SP_ERR_ARG, "Port not in I/O ring");
+
+	remove_io_ring_port(port);
+
+	RETURN_OK();
+}
+
+SP_API enum sp_return sp_io_ring_write(struct sp_io_ring *ring,
+	struct sp_port *port, const void *buf, size_t count, void *user_data)
+{
+	struct io_ring_port *rp;
+	struct io_ring_write *write;
+
+	TRACE("%p, %p, %p, %d, %p", ring, port, buf, count, user_data);
+
+	if (!ring)
+		RETURN_ERROR(SP_ERR_ARG, "Null ring");
+
+	CHECK_PORT();
+
+	if (!(rp = port->io_ring) || rp->ring != ring)
+		RETURN_ERROR(SP_ERR_ARG, "Port not in I/O ring");
+
+	if (!buf)
+		RETURN_ERROR(SP_ERR_ARG, "Null buffer");
+
+	if (count == 0)
+		RETURN_ERROR(SP_ERR_ARG, "Zero count");
+
+	if (count > INT_MAX)
+		RETURN_ERROR(SP_ERR_ARG, "Count too large");
+
+	if (!(write = malloc(sizeof(struct io_ring_write))))
+		RETURN_ERROR(SP_ERR_MEM, "Write malloc failed");
+
+	write->buf = buf;
+	write->count = count;
+	write->user_data = user_data;
+	write->next = NULL;
+
+	if (rp->writes_tail)
+		rp->writes_tail->next = write;
+	else
+		rp->writes_head = write;
+	rp->writes_tail = write;
+
+	if (!rp->flushing) {
+		rp->flushing = true;
+		rp->flush_next = ring->flush_head;
+		ring->flush_head = rp;
+	}
+
+	RETURN_OK();
+}
+
+SP_API enum sp_return sp_io_ring_submit(struct sp_io_ring *ring)
+{
+	TRACE("%p", ring);
+
+	if (!ring)
+		RETURN_ERROR(SP_ERR_ARG, "Null ring");
+
+#ifdef USE_IO_URING
+	if (ring->backend == SP_IO_RING_URING) {
+		if (uring_flush(ring) != SP_OK)
+			RETURN_FAIL("Queueing writes failed");
+		if (ring->uring.to_submit > 0 && uring_enter(ring, 0, NULL) < 0 &&
+				errno != EINTR && errno != EBUSY)
+			RETURN_FAIL("io_uring_enter() failed");
+		RETURN_OK();
+	}
+#endif
+
+	switch (poll_flush(ring)) {
+	case SP_OK:
+		RETURN_OK();
+	case SP_ERR_MEM:
+		RETURN_ERROR(SP_ERR_MEM, "Completion malloc failed");
+	default:
+		RETURN_FAIL("Writing failed");
+	}
+}
+
+SP_API enum sp_return sp_io_ring_wait(struct sp_io_ring *ring,
+	struct sp_io_completion *completions, unsigned int count,
+	unsigned int timeout_ms)
+{
+	struct timeout timeout;
+	int result;
+
+	TRACE("%p, %p, %d, %d", ring, completions, count, timeout_ms);
+
+	if (!ring)
+		RETURN_ERROR(SP_ERR_ARG, "Null ring");
+
+	if (!completions)
+		RETURN_ERROR(SP_ERR_ARG, "Null completions");
+
+	if (count == 0)
+		RETURN_ERROR(SP_ERR_ARG, "Zero count");
+
+	timeout_start(&timeout, timeout_ms);
+
+	/* Return what is already collected without another system call. */
+	if (ring->backlog_len > ring->backlog_head && !ring->flush_head)
+		RETURN_INT((int) take_completions(ring, completions, count));
+
+#ifdef USE_IO_URING
+	if (ring->backend == SP_IO_RING_URING)
+		result = uring_wait(ring, completions, count, &timeout);
+	else
+#endif
+		result = poll_wait(ring, completions, count, &timeout);
+
+	if (result == SP_ERR_MEM)
+		RETURN_ERROR(SP_ERR_MEM, "Completion malloc failed");
+
+	if (result < 0)
+		RETURN_FAIL("Waiting for I/O ring failed");
+
+	if (result == 0)
+		DEBUG("Wait timed out");
+
+	RETURN_INT(result);
+}
+
+SP_API enum sp_return sp_release_io_buffer(struct sp_io_ring *ring,
+	unsigned int buffer_id)
+{
+	struct io_ring_port *rp;
+
+	TRACE("%p, %d", ring, buffer_id);
+
+	if (!ring)
+		RETURN_ERROR(SP_ERR_ARG, "Null ring");
+
+	if (buffer_id >= ring->num_buffers)
+		RETURN_ERROR(SP_ERR_ARG, "Invalid buffer");
+
+#ifdef USE_IO_URING
+	if (ring->backend == SP_IO_RING_URING)
+		provide_buffer(ring, buffer_id);
+	else
+#endif
+		ring->free_buffers[ring->num_free++] = buffer_id;
+
+	/* Resume reading the port which ran out of buffers first. */
+	if ((rp = ring->starved_head)) {
+		ring->starved_head = rp->starved_next;
+		if (!ring->starved_head)
+			ring->starved_tail = NULL;
+		rp->starved = false;
+#ifdef USE_IO_URING
+		if (ring->backend == SP_IO_RING_URING && arm_read(ring, rp, false) != SP_OK)
+			RETURN_FAIL("Queueing read failed");
+#endif
+	}
+
+	RETURN_OK();
+}
+
+SP_API enum sp_return sp_get_io_ring_stats(const struct sp_io_ring *ring,
+	struct sp_io_ring_stats *stats)
+{
+	TRACE("%p, %p", ring, stats);
+
+	if (!ring)
+		RETURN_ERROR(SP_ERR_ARG, "Null ring");
+
+	if (!stats)
+		RETURN_ERROR(SP_ERR_ARG, "Null stats");
+
+	*stats = ring->stats;
+
+	RETURN_OK();
+}
+
+SP_API void sp_free_io_ring(struct sp_io_ring *ring)
+{
+	TRACE("%p", ring);
+
+	if (!ring) {
+		DEBUG("Null ring");
+		RETURN();
+	}
+
+	while (ring->ports)
+		remove_io_ring_port(ring->ports->port);
+
+#ifdef USE_IO_URING
+	if (ring->backend == SP_IO_RING_URING)
+		uring_free(ring);
+#endif
+
+	free(ring->pollfds);
+	free(ring->poll_ports);
+	free(ring->free_buffers);
+	free(ring->backlog);
+	free(ring->pool);
+	free(ring);
+
+	RETURN();
+}
+
+#else
+
+SP_API enum sp_return sp_new_io_ring(enum sp_io_ring_backend backend,
+	unsigned int num_buffers, size_t buffer_size,
+	struct sp_io_ring **ring_ptr)
+{
+	TRACE("%d, %d, %d, %p", backend, num_buffers, buffer_size, ring_ptr);
+
+	if (ring_ptr)
+		*ring_ptr = NULL;
+
+	RETURN_ERROR(SP_ERR_SUPP, "I/O ring not supported on this platform");
+}
+
+SP_API enum sp_return sp_get_io_ring_backend(const struct sp_io_ring *ring)
+{
+	TRACE("%p", ring);
+
+	RETURN_ERROR(SP_ERR_SUPP, "I/O ring not supported on this platform");
+}
+
+SP_API enum sp_return sp_io_ring_add_port(struct sp_io_ring *ring,
+	struct sp_port *port)
+{
+	TRACE("%p, %p", ring, port);
+
+	RETURN_ERROR(SP_ERR_SUPP, "I/O ring not supported on this platform");
+}
+
+SP_API enum sp_return sp_io_ring_remove_port(struct sp_io_ring *ring,
+	struct sp_port *port)
+{
+	TRACE("%p, %p", ring, port);
+
+	RETURN_ERROR(SP_ERR_SUPP, "I/O ring not supported on this platform");
+}
+
+SP_API enum sp_return sp_io_ring_write(struct sp_io_ring *ring,
+	struct sp_port *port, const void *buf, size_t count, void *user_data)
+{
+	TRACE("%p, %p, %p, %d, %p", ring, port, buf, count, user_data);
+
+	RETURN_ERROR(SP_ERR_SUPP, "I/O ring not supported on this platform");
+}
+
+SP_API enum sp_return sp_io_ring_submit(struct sp_io_ring *ring)
+{
+	TRACE("%p", ring);
+
+	RETURN_ERROR(SP_ERR_SUPP, "I/O ring not supported on this platform");
+}
+
+SP_API enum sp_return sp_io_ring_wait(struct sp_io_ring *ring,
+	struct sp_io_completion *completions, unsigned int count,
+	unsigned int timeout_ms)
+{
+	TRACE("%p, %p, %d, %d", ring, completions, count, timeout_ms);
+
+	RETURN_ERROR(SP_ERR_SUPP, "I/O ring not supported on this platform");
+}
+
+SP_API enum sp_return sp_release_io_buffer(struct sp_io_ring *ring,
+	unsigned int buffer_id)
+{
+	TRACE("%p, %d", ring, buffer_id);
+
+	RETURN_ERROR(SP_ERR_SUPP, "I/O ring not supported on this platform");
+}
+
+SP_API enum sp_return sp_get_io_ring_stats(const struct sp_io_ring *ring,
+	struct sp_io_ring_stats *stats)
+{
+	TRACE("%p, %p", ring, stats);
+
+	RETURN_ERROR(SP_ERR_SUPP, "I/O ring not supported on this platform");
+}
+
+SP_API void sp_free_io_ring(struct sp_io_ring *ring)
+{
+	TRACE("%p", ring);
+
+	RETURN();
+}
+
+#endif
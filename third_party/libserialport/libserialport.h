@@ -197,8 +197,8 @@
  *
  * The library can output extensive tracing and debugging information. The
  * simplest way to use this is to set the environment variable
- * @c LIBSERIALPORT_DEBUG to any value; messages will then be output to the
- * standard error stream.
+ * @c LIBSERIALPORT_DEBUG to any value before the first message; messages
+ * will then be output to the standard error stream.
  *
  * This behaviour is implemented by a default debug message handling
  * callback. An alternative callback can be set using sp_set_debug_handler(),
@@ -207,6 +207,15 @@
  * No guarantees are made about the content of the debug output; it is chosen
  * to suit the needs of the developers and may change between releases.
  *
+ * Formatting every message is costly on busy read and write loops. The
+ * amount of output can be limited when building the library, by defining
+ * @c SP_TRACE_LEVEL as 0 (no output), 1 (errors only), 2 (errors and
+ * informational messages) or 3 (also every function call and return, the
+ * default); messages above that level are compiled out entirely. At run
+ * time, sp_start_trace() switches to recording messages as fixed-size binary
+ * events in per-thread ring buffers, which are formatted only when read
+ * back with sp_read_trace() and sp_format_trace_event().
+ *
  * @anchor Porting
  * Porting
  * -------
@@ -478,6 +487,19 @@ struct sp_event_set {
 	unsigned int count;
 };
 
+/**
+ * @struct sp_event_result
+ * Events that occurred on a port, as reported by sp_wait_events().
+ *
+ * @since 0.1.2
+ */
+struct sp_event_result {
+	/** Port on which the events occurred. */
+	struct sp_port *port;
+	/** Bitmask of the events that occurred. */
+	enum sp_event events;
+};
+
 /**
  * @defgroup Enumeration Port enumeration
  *
@@ -508,7 +530,34 @@ struct sp_event_set {
 SP_API enum sp_return sp_get_port_by_name(const char *portname, struct sp_port **port_ptr);
 
 /**
- * Free a port structure obtained from sp_get_port_by_name() or sp_copy_port().
+ * Obtain a pointer to a new sp_port structure representing the named port,
+ * deferring the gathering of its metadata.
+ *
+ * This works as sp_get_port_by_name(), except that the transport, USB and
+ * Bluetooth details and description of the port are only looked up when
+ * first requested from one of the functions that return them, and are then
+ * kept. Creating a port to open a known device name therefore does no
+ * system-specific device lookup at all, and does not fail if that lookup
+ * would have.
+ *
+ * Metadata requests may be made concurrently for the same port from
+ * several threads. The first of them gathers the details, and the others
+ * wait for it to finish.
+ *
+ * @param[in] portname The OS-specific name of a serial port. Must not be NULL.
+ * @param[out] port_ptr If any error is returned, the variable pointed to by
+ *                      port_ptr will be set to NULL. Otherwise, it will be set
+ *                      to point to the newly allocated port. Must not be NULL.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_get_port_by_name_lazy(const char *portname, struct sp_port **port_ptr);
+
+/**
+ * Free a port structure obtained from sp_get_port_by_name(),
+ * sp_get_port_by_name_lazy() or sp_copy_port().
  *
  * @param[in] port Pointer to a port structure. Must not be NULL.
  *
@@ -568,6 +617,361 @@ SP_API enum sp_return sp_copy_port(const struct sp_port *port, struct sp_port **
  */
 SP_API void sp_free_port_list(struct sp_port **ports);
 
+/**
+ * @struct sp_port_filter
+ * An opaque structure representing criteria for finding serial ports.
+ */
+struct sp_port_filter;
+
+/**
+ * Allocate a port filter.
+ *
+ * A new filter matches every port. Criteria are added to it using the
+ * sp_set_filter_*() functions, and a port must meet all of them to match.
+ *
+ * The filter should be freed after use by calling sp_free_port_filter().
+ *
+ * @param[out] filter_ptr If any error is returned, the variable pointed to by
+ *                        filter_ptr will be set to NULL. Otherwise, it will
+ *                        be set to point to the allocated filter. Must not be
+ *                        NULL.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_new_port_filter(struct sp_port_filter **filter_ptr);
+
+/**
+ * Free a port filter.
+ *
+ * @param[in] filter Pointer to a filter structure. Must not be NULL.
+ *
+ * @since 0.1.2
+ */
+SP_API void sp_free_port_filter(struct sp_port_filter *filter);
+
+/**
+ * Match ports by name.
+ *
+ * The pattern is matched against the whole port name, in which '*' matches
+ * any sequence of characters and '?' matches any single character.
+ *
+ * @param[in] filter Pointer to a filter structure. Must not be NULL.
+ * @param[in] pattern Pattern to match, or NULL to match any name.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_set_filter_name(struct sp_port_filter *filter, const char *pattern);
+
+/**
+ * Match ports by transport type.
+ *
+ * @param[in] filter Pointer to a filter structure. Must not be NULL.
+ * @param[in] transport Transport type to match.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_set_filter_transport(struct sp_port_filter *filter, enum sp_transport transport);
+
+/**
+ * Match USB ports by vendor and product ID.
+ *
+ * Setting either ID restricts the filter to USB ports.
+ *
+ * @param[in] filter Pointer to a filter structure. Must not be NULL.
+ * @param[in] usb_vid USB vendor ID to match, or -1 to match any.
+ * @param[in] usb_pid USB product ID to match, or -1 to match any.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_set_filter_usb_vid_pid(struct sp_port_filter *filter, int usb_vid, int usb_pid);
+
+/**
+ * Match USB ports by manufacturer string.
+ *
+ * The string is copied, and must match exactly.
+ *
+ * @param[in] filter Pointer to a filter structure. Must not be NULL.
+ * @param[in] usb_manufacturer Manufacturer to match, or NULL to match any.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_set_filter_usb_manufacturer(struct sp_port_filter *filter, const char *usb_manufacturer);
+
+/**
+ * Match USB ports by product string.
+ *
+ * The string is copied, and must match exactly.
+ *
+ * @param[in] filter Pointer to a filter structure. Must not be NULL.
+ * @param[in] usb_product Product to match, or NULL to match any.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_set_filter_usb_product(struct sp_port_filter *filter, const char *usb_product);
+
+/**
+ * Match USB ports by serial number.
+ *
+ * The string is copied, and must match exactly.
+ *
+ * @param[in] filter Pointer to a filter structure. Must not be NULL.
+ * @param[in] usb_serial Serial number to match, or NULL to match any.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_set_filter_usb_serial(struct sp_port_filter *filter, const char *usb_serial);
+
+/**
+ * Match Bluetooth ports by device address.
+ *
+ * The string is copied, and must match exactly.
+ *
+ * @param[in] filter Pointer to a filter structure. Must not be NULL.
+ * @param[in] bluetooth_address Address to match, or NULL to match any.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_set_filter_bluetooth_address(struct sp_port_filter *filter, const char *bluetooth_address);
+
+/**
+ * List the serial ports matching a filter.
+ *
+ * This works as sp_list_ports(), but only returns the ports which match
+ * the filter. Where the platform allows, ports are checked against the
+ * filter as they are found, so that metadata is only gathered in full for
+ * the ports which match.
+ *
+ * The list should be freed after use by calling sp_free_port_list().
+ *
+ * @param[in] filter Pointer to a filter structure. Must not be NULL.
+ * @param[out] list_ptr If any error is returned, the variable pointed to by
+ *                      list_ptr will be set to NULL. Otherwise, it will be set
+ *                      to point to the newly allocated array. Must not be NULL.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_list_ports_filtered(const struct sp_port_filter *filter, struct sp_port ***list_ptr);
+
+/**
+ * Find the first serial port matching a filter.
+ *
+ * Enumeration stops as soon as a matching port is found.
+ *
+ * The port should be freed after use by calling sp_free_port().
+ *
+ * @param[in] filter Pointer to a filter structure. Must not be NULL.
+ * @param[out] port_ptr If any error is returned, or no port matches, the
+ *                      variable pointed to by port_ptr will be set to NULL.
+ *                      Otherwise, it will be set to point to the newly
+ *                      allocated port. Must not be NULL.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_find_port(const struct sp_port_filter *filter, struct sp_port **port_ptr);
+
+/**
+ * @}
+ * @defgroup Monitoring Port monitoring
+ *
+ * Tracking ports as they are added to and removed from the system.
+ *
+ * A monitor keeps a snapshot of the ports on the system, which is built
+ * when it is created and updated as devices come and go. Rather than
+ * enumerating all ports again, it rescans only the devices named by the
+ * operating system's notifications.
+ *
+ * The monitor provides a file descriptor from sp_get_monitor_handle(),
+ * which becomes readable when notifications are pending, so that it can
+ * be waited on with poll() alongside other descriptors. Changes are then
+ * retrieved with sp_read_monitor_event() until it returns zero.
+ *
+ * Port structures returned by the functions in this section belong to
+ * the monitor. They remain valid until the next call to
+ * sp_read_monitor_event() or sp_free_monitor(), and must be copied with
+ * sp_copy_port() if they are needed for longer.
+ *
+ * On Linux, the monitor receives kernel uevents through a netlink
+ * socket, or watches /dev with inotify if that is not possible. Port
+ * monitoring is not yet supported on other platforms, where
+ * sp_new_monitor() returns SP_ERR_SUPP.
+ *
+ * @{
+ */
+
+/**
+ * @struct sp_monitor
+ * An opaque structure representing a port monitor.
+ */
+struct sp_monitor;
+
+/** Changes reported by a port monitor. */
+enum sp_monitor_event {
+	/** A port was added. @since 0.1.2 */
+	SP_MONITOR_ADDED = 1,
+	/** A port was removed. @since 0.1.2 */
+	SP_MONITOR_REMOVED = 2,
+	/** The metadata of a port changed. @since 0.1.2 */
+	SP_MONITOR_CHANGED = 3
+};
+
+/**
+ * Create a monitor and take a snapshot of the ports on the system.
+ *
+ * The ports present when the monitor is created are not reported as
+ * added.
+ *
+ * @param[out] monitor_ptr If any error is returned, the variable pointed to
+ *                         by monitor_ptr will be set to NULL. Otherwise, it
+ *                         will be set to point to the new monitor. Must not
+ *                         be NULL.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_new_monitor(struct sp_monitor **monitor_ptr);
+
+/**
+ * Get the file descriptor on which a monitor receives notifications.
+ *
+ * The descriptor becomes readable when sp_read_monitor_event() may have
+ * changes to report. It must not be read from or closed by the caller.
+ *
+ * @param[in] monitor Pointer to a monitor. Must not be NULL.
+ * @param[out] fd_ptr Pointer to a variable to store the file descriptor.
+ *                    Must not be NULL.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_get_monitor_handle(const struct sp_monitor *monitor,
+	int *fd_ptr);
+
+/**
+ * Get the next change detected by a monitor.
+ *
+ * This does not block. Pending notifications are processed and the
+ * affected devices rescanned when no earlier changes remain to be
+ * reported. If the system dropped notifications because they were not
+ * read quickly enough, all ports are rescanned instead, and the
+ * differences from the snapshot reported as changes.
+ *
+ * For SP_MONITOR_REMOVED, the port returned holds the last known details
+ * of the removed port. For SP_MONITOR_CHANGED, it holds the new details.
+ *
+ * @param[in] monitor Pointer to a monitor. Must not be NULL.
+ * @param[out] event_ptr Pointer to a variable to store the kind of change.
+ *                       Must not be NULL.
+ * @param[out] port_ptr Pointer to a variable to store the port affected, or
+ *                      NULL if there is no change to report. Must not be
+ *                      NULL.
+ *
+ * @return 1 if a change was reported, 0 if there are no more changes to
+ *         report, or a negative error code.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_read_monitor_event(struct sp_monitor *monitor,
+	enum sp_monitor_event *event_ptr, struct sp_port **port_ptr);
+
+/**
+ * Get the ports in a monitor's snapshot.
+ *
+ * @param[in] monitor Pointer to a monitor. Must not be NULL.
+ * @param[out] list_ptr Pointer to a variable to store a NULL-terminated
+ *                      array of ports, sorted by name. The array belongs to
+ *                      the monitor. Must not be NULL.
+ *
+ * @return The number of ports upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_get_monitor_ports(const struct sp_monitor *monitor,
+	struct sp_port * const **list_ptr);
+
+/**
+ * Find a port in a monitor's snapshot by name.
+ *
+ * @param[in] monitor Pointer to a monitor. Must not be NULL.
+ * @param[in] portname The name of the port, as returned by
+ *                     sp_get_port_name(). Must not be NULL.
+ * @param[out] port_ptr Pointer to a variable to store the port, or NULL if
+ *                      no port matches. Must not be NULL.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_find_monitor_port_by_name(const struct sp_monitor *monitor,
+	const char *portname, struct sp_port **port_ptr);
+
+/**
+ * Find a port in a monitor's snapshot by its USB bus number and address.
+ *
+ * If a USB device provides several ports, the one with the lowest name
+ * is returned.
+ *
+ * @param[in] monitor Pointer to a monitor. Must not be NULL.
+ * @param[in] usb_bus USB bus number.
+ * @param[in] usb_address USB device address.
+ * @param[out] port_ptr Pointer to a variable to store the port, or NULL if
+ *                      no port matches. Must not be NULL.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_find_monitor_port_by_usb(const struct sp_monitor *monitor,
+	int usb_bus, int usb_address, struct sp_port **port_ptr);
+
+/**
+ * Find a port in a monitor's snapshot by its USB serial number.
+ *
+ * If several ports share the serial number, the one with the lowest name
+ * is returned.
+ *
+ * @param[in] monitor Pointer to a monitor. Must not be NULL.
+ * @param[in] usb_serial USB serial number. Must not be NULL.
+ * @param[out] port_ptr Pointer to a variable to store the port, or NULL if
+ *                      no port matches. Must not be NULL.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_find_monitor_port_by_serial(const struct sp_monitor *monitor,
+	const char *usb_serial, struct sp_port **port_ptr);
+
+/**
+ * Free a monitor, including the ports in its snapshot.
+ *
+ * @param[in] monitor Pointer to a monitor. Must not be NULL.
+ *
+ * @since 0.1.2
+ */
+SP_API void sp_free_monitor(struct sp_monitor *monitor);
+
 /**
  * @}
  * @defgroup Ports Port handling
@@ -582,6 +986,9 @@ SP_API void sp_free_port_list(struct sp_port **ports);
 /**
  * Open the specified serial port.
  *
+ * On Linux, pseudo-terminals can also be opened. They have no modem control
+ * lines, which are then read as all deasserted.
+ *
  * @param[in] port Pointer to a port structure. Must not be NULL.
  * @param[in] flags Flags to use when opening the serial port.
  *
@@ -821,6 +1228,15 @@ SP_API enum sp_return sp_get_port_handle(const struct sp_port *port, void *resul
  * This saves you the work of allocating a temporary config, setting it
  * up, applying it to a port and then freeing it.
  *
+ * Batched changes
+ * ---------------
+ *
+ * To change several settings at once without allocating a config, call
+ * sp_begin_config(), then any of the direct functions, then
+ * sp_commit_config(). The changes are collected and applied together
+ * when committed, with a single termios write and only the control
+ * line changes actually needed.
+ *
  * @{
  */
 
@@ -868,6 +1284,11 @@ SP_API void sp_free_config(struct sp_port_config *config);
  * supported by libserialport, will be set to special values that are
  * ignored by sp_set_config().
  *
+ * The configuration is read from the device when the port is opened and
+ * cached while it remains open, so this call does not access the device.
+ * If the port may have been reconfigured by other means, call
+ * sp_refresh_config() first.
+ *
  * @param[in] port Pointer to a port structure. Must not be NULL.
  * @param[out] config Pointer to a configuration structure that will hold
  *                    the result. Upon errors the contents of the config
@@ -879,6 +1300,22 @@ SP_API void sp_free_config(struct sp_port_config *config);
  */
 SP_API enum sp_return sp_get_config(struct sp_port *port, struct sp_port_config *config);
 
+/**
+ * Re-read the configuration of the specified serial port from the device.
+ *
+ * libserialport caches the port configuration while a port is open, and
+ * only issues the system calls needed for settings which actually change.
+ * If the port may have been reconfigured outside of libserialport, call
+ * this function to bring the cached configuration up to date.
+ *
+ * @param[in] port Pointer to a port structure. Must not be NULL.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_refresh_config(struct sp_port *port);
+
 /**
  * Set the configuration for the specified serial port.
  *
@@ -898,6 +1335,63 @@ SP_API enum sp_return sp_get_config(struct sp_port *port, struct sp_port_config
  */
 SP_API enum sp_return sp_set_config(struct sp_port *port, const struct sp_port_config *config);
 
+/**
+ * Start collecting configuration changes for the specified serial port.
+ *
+ * Until sp_commit_config() or sp_abort_config() is called, sp_set_config(),
+ * sp_set_flowcontrol() and the direct setting functions such as
+ * sp_set_baudrate() do not change the port. Their settings are recorded,
+ * later calls overriding earlier ones, and applied by sp_commit_config().
+ * Invalid values are rejected with SP_ERR_ARG when they are set, and leave
+ * the collected changes as they were. Settings the port does not support
+ * are only reported by sp_commit_config().
+ *
+ * sp_get_config() keeps returning the configuration currently applied.
+ *
+ * @param[in] port Pointer to a port structure. Must not be NULL.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *         SP_ERR_ARG is returned if changes are already being collected.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_begin_config(struct sp_port *port);
+
+/**
+ * Apply the configuration changes collected since sp_begin_config().
+ *
+ * Settings which already have the requested value are skipped. All
+ * termios changes are made in one call; RTS and DTR levels are only
+ * written if they change.
+ *
+ * The changes are not applied atomically. Upon errors, some of them may
+ * already have been made, so the configuration of the serial port is
+ * unknown, and is re-read from the device before it is next used. The
+ * collected changes are kept, and the port is still collecting changes:
+ * call sp_commit_config() again to retry, or sp_abort_config() to
+ * discard them.
+ *
+ * @param[in] port Pointer to a port structure. Must not be NULL.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *         SP_ERR_ARG is returned if sp_begin_config() was not called.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_commit_config(struct sp_port *port);
+
+/**
+ * Discard the configuration changes collected since sp_begin_config().
+ *
+ * @param[in] port Pointer to a port structure. Must not be NULL.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *         SP_ERR_ARG is returned if sp_begin_config() was not called.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_abort_config(struct sp_port *port);
+
 /**
  * Set the baud rate for the specified serial port.
  *
@@ -1324,227 +1818,1816 @@ SP_API enum sp_return sp_set_flowcontrol(struct sp_port *port, enum sp_flowcontr
 SP_API enum sp_return sp_blocking_read(struct sp_port *port, void *buf, size_t count, unsigned int timeout_ms);
 
 /**
- * Read bytes from the specified serial port, returning as soon as any data is
- * available.
+ * Read bytes from the specified serial port, blocking until complete, with
+ * a timeout in nanoseconds.
  *
- * @warning If your program runs on Unix, defines its own signal handlers, and
- *          needs to abort blocking reads when these are called, then you
- *          should not use this function. It repeats system calls that return
- *          with EINTR. To be able to abort a read from a signal handler, you
- *          should implement your own blocking read using sp_nonblocking_read()
- *          together with a blocking method that makes sense for your program.
- *          E.g. you can obtain the file descriptor for an open port using
- *          sp_get_port_handle() and use this to call select() or pselect(),
- *          with appropriate arrangements to return if a signal is received.
+ * This works as sp_blocking_read(), but allows timeouts shorter than a
+ * millisecond, for request/response exchanges on fast links. Where ppoll()
+ * is available the timeout is passed on at full resolution. On Windows it
+ * is rounded up to a whole number of milliseconds.
  *
  * @param[in] port Pointer to a port structure. Must not be NULL.
  * @param[out] buf Buffer in which to store the bytes read. Must not be NULL.
- * @param[in] count Maximum number of bytes to read. Must not be zero.
- * @param[in] timeout_ms Timeout in milliseconds, or zero to wait indefinitely.
+ * @param[in] count Requested number of bytes to read.
+ * @param[in] timeout_ns Timeout in nanoseconds, or zero to wait indefinitely.
  *
  * @return The number of bytes read on success, or a negative error code. If
  *         the result is zero, the timeout was reached before any bytes were
- *         available. If timeout_ms is zero, the function will always return
- *         either at least one byte, or a negative error code.
+ *         available. If timeout_ns is zero, the function will always return
+ *         either the requested number of bytes or a negative error code.
  *
- * @since 0.1.1
+ * @since 0.1.2
  */
-SP_API enum sp_return sp_blocking_read_next(struct sp_port *port, void *buf, size_t count, unsigned int timeout_ms);
+SP_API enum sp_return sp_blocking_read_ns(struct sp_port *port, void *buf, size_t count, unsigned long long timeout_ns);
 
 /**
- * Read bytes from the specified serial port, without blocking.
+ * Read bytes from the specified serial port, blocking until complete, with
+ * a timeout in microseconds.
+ *
+ * This is sp_blocking_read_ns() with the timeout given in microseconds.
  *
  * @param[in] port Pointer to a port structure. Must not be NULL.
  * @param[out] buf Buffer in which to store the bytes read. Must not be NULL.
- * @param[in] count Maximum number of bytes to read.
+ * @param[in] count Requested number of bytes to read.
+ * @param[in] timeout_us Timeout in microseconds, or zero to wait indefinitely.
  *
- * @return The number of bytes read on success, or a negative error code. The
- *         number of bytes returned may be any number from zero to the maximum
- *         that was requested.
+ * @return As for sp_blocking_read_ns().
  *
- * @since 0.1.0
+ * @since 0.1.2
  */
-SP_API enum sp_return sp_nonblocking_read(struct sp_port *port, void *buf, size_t count);
+SP_API enum sp_return sp_blocking_read_us(struct sp_port *port, void *buf, size_t count, unsigned int timeout_us);
+
+/**
+ * A buffer in a vector of buffers, for sp_blocking_writev() and
+ * sp_blocking_readv().
+ *
+ * @since 0.1.2
+ */
+struct sp_iovec {
+	/** Pointer to the buffer. */
+	void *buf;
+	/** Size of the buffer in bytes. */
+	size_t count;
+};
+
+/**
+ * Read bytes from the specified serial port into a vector of buffers,
+ * blocking until complete.
+ *
+ * This behaves like sp_blocking_read() into the buffers joined end to end,
+ * filling each buffer before moving on to the next. On POSIX systems the
+ * buffers are passed to the OS together with readv(). On Windows the data
+ * is read into a staging buffer and then copied out.
+ *
+ * @param[in] port Pointer to a port structure. Must not be NULL.
+ * @param[in] iov Array of buffers to read into. May be NULL if iovcnt is zero.
+ * @param[in] iovcnt Number of buffers in the array.
+ * @param[in] timeout_ms Timeout in milliseconds, or zero to wait indefinitely.
+ *
+ * @return The number of bytes read on success, or a negative error code. If
+ *         the result is less than the total size of the buffers, the timeout
+ *         was reached before the read completed.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_blocking_readv(struct sp_port *port,
+	const struct sp_iovec *iov, unsigned int iovcnt, unsigned int timeout_ms);
+
+/**
+ * Read bytes from the specified serial port, returning as soon as any data is
+ * available.
+ *
+ * @warning If your program runs on Unix, defines its own signal handlers, and
+ *          needs to abort blocking reads when these are called, then you
+ *          should not use this function. It repeats system calls that return
+ *          with EINTR. To be able to abort a read from a signal handler, you
+ *          should implement your own blocking read using sp_nonblocking_read()
+ *          together with a blocking method that makes sense for your program.
+ *          E.g. you can obtain the file descriptor for an open port using
+ *          sp_get_port_handle() and use this to call select() or pselect(),
+ *          with appropriate arrangements to return if a signal is received.
+ *
+ * @param[in] port Pointer to a port structure. Must not be NULL.
+ * @param[out] buf Buffer in which to store the bytes read. Must not be NULL.
+ * @param[in] count Maximum number of bytes to read. Must not be zero.
+ * @param[in] timeout_ms Timeout in milliseconds, or zero to wait indefinitely.
+ *
+ * @return The number of bytes read on success, or a negative error code. If
+ *         the result is zero, the timeout was reached before any bytes were
+ *         available. If timeout_ms is zero, the function will always return
+ *         either at least one byte, or a negative error code.
+ *
+ * @since 0.1.1
+ */
+SP_API enum sp_return sp_blocking_read_next(struct sp_port *port, void *buf, size_t count, unsigned int timeout_ms);
+
+/**
+ * Length prefix formats, for sp_blocking_read_prefixed().
+ *
+ * @since 0.1.2
+ */
+enum sp_length_prefix {
+	/** One byte. */
+	SP_PREFIX_8 = 1,
+	/** Two bytes, most significant first. */
+	SP_PREFIX_16_BE = 2,
+	/** Two bytes, least significant first. */
+	SP_PREFIX_16_LE = 3,
+	/** Four bytes, most significant first. */
+	SP_PREFIX_32_BE = 4,
+	/** Four bytes, least significant first. */
+	SP_PREFIX_32_LE = 5
+};
+
+/**
+ * Read a frame ending with a delimiter byte from the specified serial port,
+ * blocking until a whole frame has been received.
+ *
+ * The framing functions sp_blocking_read_until(), sp_blocking_read_prefixed(),
+ * sp_blocking_read_slip() and sp_blocking_read_cobs() read from the port in
+ * bulk into a buffer kept for the port, and return one frame at a time.
+ * Data read beyond the end of a frame is kept for the next call. It is
+ * discarded by sp_flush() of the input buffer, or when the port is closed.
+ * Do not mix these functions with the other read functions on a port, as
+ * those do not see data which has already been buffered.
+ *
+ * The timeout applies to the whole frame. If it expires before the frame
+ * is complete, zero is returned, and the data received so far is kept so
+ * that a later call can complete the frame.
+ *
+ * If a frame is longer than the buffer provided, it is discarded and
+ * SP_ERR_FAIL is returned. The next call returns the frame after it.
+ *
+ * @param[in] port Pointer to a port structure. Must not be NULL.
+ * @param[out] buf Buffer to store the frame in, including the delimiter.
+ *                 Must not be NULL.
+ * @param[in] count Size of the buffer.
+ * @param[in] delimiter Byte value which ends a frame, such as '\n'.
+ * @param[in] timeout_ms Timeout in milliseconds, or zero to wait indefinitely.
+ *
+ * @return The length of the frame, including the delimiter, on success, or
+ *         a negative error code. If the result is zero, the timeout was
+ *         reached before a whole frame was received.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_blocking_read_until(struct sp_port *port, void *buf,
+	size_t count, unsigned char delimiter, unsigned int timeout_ms);
+
+/**
+ * Read a length-prefixed frame from the specified serial port, blocking
+ * until a whole frame has been received.
+ *
+ * The frame consists of a length, in the given format, followed by that
+ * number of bytes. Only the bytes after the length are returned. See
+ * sp_blocking_read_until() for buffering, timeout and error behaviour.
+ *
+ * @param[in] port Pointer to a port structure. Must not be NULL.
+ * @param[out] buf Buffer to store the frame contents in. Must not be NULL.
+ * @param[in] count Size of the buffer.
+ * @param[in] prefix Format of the length prefix.
+ * @param[in] timeout_ms Timeout in milliseconds, or zero to wait indefinitely.
+ *
+ * @return The length of the frame contents on success, or a negative error
+ *         code. If the result is zero, the timeout was reached before a
+ *         whole frame was received, or the frame was empty.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_blocking_read_prefixed(struct sp_port *port, void *buf,
+	size_t count, enum sp_length_prefix prefix, unsigned int timeout_ms);
+
+/**
+ * Read and decode a SLIP (RFC 1055) frame from the specified serial port,
+ * blocking until a whole frame has been received.
+ *
+ * Empty frames are skipped. A frame with an invalid escape sequence is
+ * discarded and SP_ERR_FAIL is returned. See sp_blocking_read_until() for
+ * buffering, timeout and error behaviour.
+ *
+ * @param[in] port Pointer to a port structure. Must not be NULL.
+ * @param[out] buf Buffer to store the decoded frame in. Must not be NULL.
+ * @param[in] count Size of the buffer.
+ * @param[in] timeout_ms Timeout in milliseconds, or zero to wait indefinitely.
+ *
+ * @return The length of the decoded frame on success, or a negative error
+ *         code. If the result is zero, the timeout was reached before a
+ *         whole frame was received.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_blocking_read_slip(struct sp_port *port, void *buf,
+	size_t count, unsigned int timeout_ms);
+
+/**
+ * Read and decode a COBS frame from the specified serial port, blocking
+ * until a whole frame has been received.
+ *
+ * Frames are delimited by zero bytes. Empty frames are skipped. A frame
+ * which is not validly encoded is discarded and SP_ERR_FAIL is returned.
+ * See sp_blocking_read_until() for buffering, timeout and error behaviour.
+ *
+ * @param[in] port Pointer to a port structure. Must not be NULL.
+ * @param[out] buf Buffer to store the decoded frame in. Must not be NULL.
+ * @param[in] count Size of the buffer.
+ * @param[in] timeout_ms Timeout in milliseconds, or zero to wait indefinitely.
+ *
+ * @return The length of the decoded frame on success, or a negative error
+ *         code. If the result is zero, the timeout was reached before a
+ *         whole frame was received.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_blocking_read_cobs(struct sp_port *port, void *buf,
+	size_t count, unsigned int timeout_ms);
+
+/**
+ * Read bytes from the specified serial port, without blocking.
+ *
+ * @param[in] port Pointer to a port structure. Must not be NULL.
+ * @param[out] buf Buffer in which to store the bytes read. Must not be NULL.
+ * @param[in] count Maximum number of bytes to read.
+ *
+ * @return The number of bytes read on success, or a negative error code. The
+ *         number of bytes returned may be any number from zero to the maximum
+ *         that was requested.
+ *
+ * @since 0.1.0
+ */
+SP_API enum sp_return sp_nonblocking_read(struct sp_port *port, void *buf, size_t count);
 
 /**
  * Write bytes to the specified serial port, blocking until complete.
  *
- * Note that this function only ensures that the accepted bytes have been
- * written to the OS; they may be held in driver or hardware buffers and not
- * yet physically transmitted. To check whether all written bytes have actually
- * been transmitted, use the sp_output_waiting() function. To wait until all
- * written bytes have actually been transmitted, use the sp_drain() function.
+ * Note that this function only ensures that the accepted bytes have been
+ * written to the OS; they may be held in driver or hardware buffers and not
+ * yet physically transmitted. To check whether all written bytes have actually
+ * been transmitted, use the sp_output_waiting() function. To wait until all
+ * written bytes have actually been transmitted, use the sp_drain() function.
+ *
+ * @warning If your program runs on Unix, defines its own signal handlers, and
+ *          needs to abort blocking writes when these are called, then you
+ *          should not use this function. It repeats system calls that return
+ *          with EINTR. To be able to abort a write from a signal handler, you
+ *          should implement your own blocking write using sp_nonblocking_write()
+ *          together with a blocking method that makes sense for your program.
+ *          E.g. you can obtain the file descriptor for an open port using
+ *          sp_get_port_handle() and use this to call select() or pselect(),
+ *          with appropriate arrangements to return if a signal is received.
+ *
+ * @param[in] port Pointer to a port structure. Must not be NULL.
+ * @param[in] buf Buffer containing the bytes to write. Must not be NULL.
+ * @param[in] count Requested number of bytes to write.
+ * @param[in] timeout_ms Timeout in milliseconds, or zero to wait indefinitely.
+ *
+ * @return The number of bytes written on success, or a negative error code.
+ *         If the number of bytes returned is less than that requested, the
+ *         timeout was reached before the requested number of bytes was
+ *         written. If timeout is zero, the function will always return
+ *         either the requested number of bytes or a negative error code. In
+ *         the event of an error there is no way to determine how many bytes
+ *         were sent before the error occurred.
+ *
+ * @since 0.1.0
+ */
+SP_API enum sp_return sp_blocking_write(struct sp_port *port, const void *buf, size_t count, unsigned int timeout_ms);
+
+/**
+ * Write bytes to the specified serial port, blocking until complete, with
+ * a timeout in nanoseconds.
+ *
+ * This works as sp_blocking_write(), but allows timeouts shorter than a
+ * millisecond. Where ppoll() is available the timeout is passed on at full
+ * resolution. On Windows it is rounded up to a whole number of
+ * milliseconds.
+ *
+ * @param[in] port Pointer to a port structure. Must not be NULL.
+ * @param[in] buf Buffer containing the bytes to write. Must not be NULL.
+ * @param[in] count Requested number of bytes to write.
+ * @param[in] timeout_ns Timeout in nanoseconds, or zero to wait indefinitely.
+ *
+ * @return The number of bytes written on success, or a negative error code.
+ *         If the result is zero, the timeout was reached before any bytes
+ *         were written. If timeout_ns is zero, the function will always
+ *         return either the requested number of bytes or a negative error
+ *         code.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_blocking_write_ns(struct sp_port *port, const void *buf, size_t count, unsigned long long timeout_ns);
+
+/**
+ * Write bytes to the specified serial port, blocking until complete, with
+ * a timeout in microseconds.
+ *
+ * This is sp_blocking_write_ns() with the timeout given in microseconds.
+ *
+ * @param[in] port Pointer to a port structure. Must not be NULL.
+ * @param[in] buf Buffer containing the bytes to write. Must not be NULL.
+ * @param[in] count Requested number of bytes to write.
+ * @param[in] timeout_us Timeout in microseconds, or zero to wait indefinitely.
+ *
+ * @return As for sp_blocking_write_ns().
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_blocking_write_us(struct sp_port *port, const void *buf, size_t count, unsigned int timeout_us);
+
+/**
+ * Write bytes from a vector of buffers to the specified serial port,
+ * blocking until complete.
+ *
+ * This behaves like sp_blocking_write() on the buffers joined end to end,
+ * but without copying them together first. On POSIX systems the buffers
+ * are passed to the OS together with writev(). On Windows they are
+ * copied into a staging buffer.
+ *
+ * @param[in] port Pointer to a port structure. Must not be NULL.
+ * @param[in] iov Array of buffers to write. May be NULL if iovcnt is zero.
+ * @param[in] iovcnt Number of buffers in the array.
+ * @param[in] timeout_ms Timeout in milliseconds, or zero to wait indefinitely.
+ *
+ * @return The number of bytes written on success, or a negative error code.
+ *         If the result is less than the total size of the buffers, the
+ *         timeout was reached before the write completed.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_blocking_writev(struct sp_port *port,
+	const struct sp_iovec *iov, unsigned int iovcnt, unsigned int timeout_ms);
+
+/**
+ * Write bytes to the specified serial port, without blocking.
+ *
+ * Note that this function only ensures that the accepted bytes have been
+ * written to the OS; they may be held in driver or hardware buffers and not
+ * yet physically transmitted. To check whether all written bytes have actually
+ * been transmitted, use the sp_output_waiting() function. To wait until all
+ * written bytes have actually been transmitted, use the sp_drain() function.
+ *
+ * @param[in] port Pointer to a port structure. Must not be NULL.
+ * @param[in] buf Buffer containing the bytes to write. Must not be NULL.
+ * @param[in] count Maximum number of bytes to write.
+ *
+ * @return The number of bytes written on success, or a negative error code.
+ *         The number of bytes returned may be any number from zero to the
+ *         maximum that was requested.
+ *
+ * @since 0.1.0
+ */
+SP_API enum sp_return sp_nonblocking_write(struct sp_port *port, const void *buf, size_t count);
+
+/**
+ * Gets the number of bytes waiting in the input buffer.
+ *
+ * @param[in] port Pointer to a port structure. Must not be NULL.
+ *
+ * @return Number of bytes waiting on success, a negative error code otherwise.
+ *
+ * @since 0.1.0
+ */
+SP_API enum sp_return sp_input_waiting(struct sp_port *port);
+
+/**
+ * Gets the number of bytes waiting in the output buffer.
+ *
+ * @param[in] port Pointer to a port structure. Must not be NULL.
+ *
+ * @return Number of bytes waiting on success, a negative error code otherwise.
+ *
+ * @since 0.1.0
+ */
+SP_API enum sp_return sp_output_waiting(struct sp_port *port);
+
+/**
+ * Flush serial port buffers. Data in the selected buffer(s) is discarded.
+ *
+ * @param[in] port Pointer to a port structure. Must not be NULL.
+ * @param[in] buffers Which buffer(s) to flush.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.0
+ */
+SP_API enum sp_return sp_flush(struct sp_port *port, enum sp_buffer buffers);
+
+/**
+ * Wait for buffered data to be transmitted.
+ *
+ * @warning If your program runs on Unix, defines its own signal handlers, and
+ *          needs to abort draining the output buffer when when these are
+ *          called, then you should not use this function. It repeats system
+ *          calls that return with EINTR. To be able to abort a drain from a
+ *          signal handler, you would need to implement your own blocking
+ *          drain by polling the result of sp_output_waiting().
+ *
+ * @param[in] port Pointer to a port structure. Must not be NULL.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.0
+ */
+SP_API enum sp_return sp_drain(struct sp_port *port);
+
+/**
+ * Function called when a queued write has finished.
+ *
+ * @param[in] port Pointer to the port structure the write was queued on.
+ * @param[in] buf The buffer passed to sp_queue_write().
+ * @param[in] written Number of bytes written. This is the full count passed
+ *                    to sp_queue_write(), unless the write was discarded
+ *                    because the port was closed.
+ * @param[in] user_data The user data passed to sp_queue_write().
+ *
+ * @since 0.1.2
+ */
+typedef void (*sp_write_callback)(struct sp_port *port, const void *buf,
+	size_t written, void *user_data);
+
+/**
+ * Queue a buffer to be written to the specified serial port.
+ *
+ * The write queue allows a program to stream data to a port without
+ * blocking, and without keeping track of partially written buffers.
+ * Buffers are not copied: each must remain valid until its callback has
+ * been called.
+ *
+ * Queued data is written by sp_process_write_queue(), which should be
+ * called after queueing data and whenever the port is ready for
+ * transmission, for instance when sp_wait_events() reports
+ * SP_EVENT_TX_READY. Queued buffers are submitted together, using a single
+ * writev() call where supported.
+ *
+ * Once the number of bytes in the queue reaches the limit set with
+ * sp_set_write_queue_limit(), further buffers are refused until the queue
+ * has drained. Other write functions should not be used while data is
+ * queued, as their data could be sent out of order. Closing the port
+ * discards the queue, calling each callback with the number of bytes
+ * actually written.
+ *
+ * @param[in] port Pointer to a port structure. Must not be NULL.
+ * @param[in] buf Buffer containing the bytes to write. Must not be NULL.
+ * @param[in] count Requested number of bytes to write.
+ * @param[in] callback Function to call when the buffer has been written,
+ *                     or NULL.
+ * @param[in] user_data Pointer to pass to the callback.
+ *
+ * @return The number of bytes queued on success, a negative error code
+ *         otherwise. If the result is zero, the queue is full and the
+ *         buffer was not queued.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_queue_write(struct sp_port *port, const void *buf,
+	size_t count, sp_write_callback callback, void *user_data);
+
+/**
+ * Write as much queued data as possible to the specified serial port,
+ * without blocking.
+ *
+ * Callbacks of buffers which have been written in full are called before
+ * this function returns.
+ *
+ * @param[in] port Pointer to a port structure. Must not be NULL.
+ *
+ * @return The number of bytes still queued on success, a negative error
+ *         code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_process_write_queue(struct sp_port *port);
+
+/**
+ * Set the high-water mark of the write queue of the specified serial port.
+ *
+ * sp_queue_write() refuses further buffers while at least this number of
+ * bytes is queued. The default is 64 KiB.
+ *
+ * @param[in] port Pointer to a port structure. Must not be NULL.
+ * @param[in] limit Limit in bytes, or zero for no limit.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_set_write_queue_limit(struct sp_port *port, size_t limit);
+
+/**
+ * @}
+ *
+ * @defgroup Chunks Pooled receive buffers
+ *
+ * Reading into reference-counted buffers from a pool.
+ *
+ * A chunk pool holds a fixed number of equally sized chunks, all allocated
+ * when the pool is created. The chunk reading functions read into a chunk
+ * taken from a pool and hand it to the caller, which holds one reference
+ * to it. Data can thus be passed on to other threads without copying it or
+ * allocating memory for each read: each consumer takes a reference with
+ * sp_retain_chunk() and drops it with sp_release_chunk(), and the chunk
+ * returns to its pool when the last reference is dropped.
+ *
+ * Chunks are taken from and returned to the pool without locking, and may
+ * be retained and released from any thread. A chunk must not be written to
+ * while it may be read by another holder. When every chunk is in use,
+ * reads fail with SP_ERR_MEM and leave the data in the port's receive
+ * buffer; sp_get_chunk_pool_stats() tells how often this happened, and the
+ * most chunks that were in use at once.
+ *
+ * @{
+ */
+
+/**
+ * @struct sp_chunk_pool
+ * An opaque structure representing a pool of receive chunks.
+ */
+struct sp_chunk_pool;
+
+/**
+ * A chunk of received data.
+ *
+ * @since 0.1.2
+ */
+struct sp_chunk {
+	/** The received data. The chunk has room for the pool's chunk size. */
+	unsigned char *data;
+	/** Number of bytes of data. */
+	size_t length;
+};
+
+/**
+ * Usage counters of a chunk pool.
+ *
+ * @since 0.1.2
+ */
+struct sp_chunk_pool_stats {
+	/** Size of each chunk in bytes. */
+	size_t chunk_size;
+	/** Number of chunks in the pool. */
+	unsigned int num_chunks;
+	/** Number of chunks currently in use. */
+	unsigned int in_use;
+	/** Highest number of chunks in use at once. */
+	unsigned int high_water;
+	/** Number of chunks handed out. */
+	unsigned long long allocations;
+	/** Number of times a chunk was needed while none was free. */
+	unsigned long long exhaustions;
+	/** Bytes of memory allocated for the pool. */
+	size_t memory;
+	/** Bytes of chunk memory currently in use. */
+	size_t memory_in_use;
+	/** Highest number of bytes of chunk memory in use at once. */
+	size_t memory_high_water;
+};
+
+/**
+ * Create a chunk pool.
+ *
+ * @param[in] chunk_size Size of each chunk in bytes. Must not be zero.
+ * @param[in] num_chunks Number of chunks. Must not be zero.
+ * @param[out] pool_ptr If any error is returned, the variable pointed to by
+ *                      pool_ptr will be set to NULL. Otherwise, it will be
+ *                      set to point to the new pool. Must not be NULL.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_new_chunk_pool(size_t chunk_size,
+	unsigned int num_chunks, struct sp_chunk_pool **pool_ptr);
+
+/**
+ * Read bytes from the specified serial port into a pooled chunk, blocking
+ * until the chunk is full.
+ *
+ * This behaves as sp_blocking_read() with a buffer of the pool's chunk
+ * size.
+ *
+ * @param[in] port Pointer to a port structure. Must not be NULL.
+ * @param[in] pool Pointer to a chunk pool. Must not be NULL.
+ * @param[in] timeout_ms Timeout in milliseconds, or zero to wait indefinitely.
+ * @param[out] chunk_ptr If any bytes were read, the variable pointed to by
+ *                       chunk_ptr will be set to point to a chunk holding
+ *                       them, which the caller must release with
+ *                       sp_release_chunk(). Otherwise, it will be set to
+ *                       NULL. Must not be NULL.
+ *
+ * @return The number of bytes read on success, or a negative error code. If
+ *         the result is less than the chunk size, the timeout was reached.
+ *         SP_ERR_MEM is returned when no chunk was free.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_blocking_read_chunk(struct sp_port *port,
+	struct sp_chunk_pool *pool, unsigned int timeout_ms,
+	struct sp_chunk **chunk_ptr);
+
+/**
+ * Read bytes from the specified serial port into a pooled chunk, returning
+ * as soon as any data is available.
+ *
+ * This behaves as sp_blocking_read_next() with a buffer of the pool's chunk
+ * size.
+ *
+ * @param[in] port Pointer to a port structure. Must not be NULL.
+ * @param[in] pool Pointer to a chunk pool. Must not be NULL.
+ * @param[in] timeout_ms Timeout in milliseconds, or zero to wait indefinitely.
+ * @param[out] chunk_ptr If any bytes were read, the variable pointed to by
+ *                       chunk_ptr will be set to point to a chunk holding
+ *                       them, which the caller must release with
+ *                       sp_release_chunk(). Otherwise, it will be set to
+ *                       NULL. Must not be NULL.
+ *
+ * @return The number of bytes read on success, or a negative error code. If
+ *         the result is zero, the timeout was reached before any bytes were
+ *         available. SP_ERR_MEM is returned when no chunk was free.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_blocking_read_next_chunk(struct sp_port *port,
+	struct sp_chunk_pool *pool, unsigned int timeout_ms,
+	struct sp_chunk **chunk_ptr);
+
+/**
+ * Read bytes from the specified serial port into a pooled chunk, without
+ * blocking.
+ *
+ * This behaves as sp_nonblocking_read() with a buffer of the pool's chunk
+ * size.
+ *
+ * @param[in] port Pointer to a port structure. Must not be NULL.
+ * @param[in] pool Pointer to a chunk pool. Must not be NULL.
+ * @param[out] chunk_ptr If any bytes were read, the variable pointed to by
+ *                       chunk_ptr will be set to point to a chunk holding
+ *                       them, which the caller must release with
+ *                       sp_release_chunk(). Otherwise, it will be set to
+ *                       NULL. Must not be NULL.
+ *
+ * @return The number of bytes read on success, or a negative error code.
+ *         SP_ERR_MEM is returned when no chunk was free.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_nonblocking_read_chunk(struct sp_port *port,
+	struct sp_chunk_pool *pool, struct sp_chunk **chunk_ptr);
+
+/**
+ * Take another reference to a chunk.
+ *
+ * @param[in] chunk Pointer to a chunk held by the caller. Must not be NULL.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_retain_chunk(struct sp_chunk *chunk);
+
+/**
+ * Drop a reference to a chunk, returning it to its pool if it was the last.
+ *
+ * @param[in] chunk Pointer to a chunk held by the caller. Must not be NULL.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_release_chunk(struct sp_chunk *chunk);
+
+/**
+ * Get the usage counters of a chunk pool.
+ *
+ * This may be called from any thread while the pool is in use.
+ *
+ * @param[in] pool Pointer to a chunk pool. Must not be NULL.
+ * @param[out] stats Pointer to a structure which will be filled in with the
+ *                   counters. Must not be NULL.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_get_chunk_pool_stats(struct sp_chunk_pool *pool,
+	struct sp_chunk_pool_stats *stats);
+
+/**
+ * Reset the allocation and exhaustion counts of a chunk pool, and lower its
+ * high-water marks to the current usage.
+ *
+ * @param[in] pool Pointer to a chunk pool. Must not be NULL.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_reset_chunk_pool_stats(struct sp_chunk_pool *pool);
+
+/**
+ * Free a chunk pool.
+ *
+ * Chunks still held remain valid, and the pool's memory is freed once the
+ * last of them is released.
+ *
+ * @param[in] pool Pointer to a chunk pool. Must not be NULL.
+ *
+ * @since 0.1.2
+ */
+SP_API void sp_free_chunk_pool(struct sp_chunk_pool *pool);
+
+/**
+ * @}
+ *
+ * @defgroup Waiting Waiting
+ *
+ * Waiting for events and timeout handling.
+ *
+ * See @ref await_events.c for an example of awaiting events on multiple ports.
+ *
+ * @{
+ */
+
+/**
+ * Allocate storage for a set of events.
+ *
+ * The user should allocate a variable of type struct sp_event_set *,
+ * then pass a pointer to this variable to receive the result.
+ *
+ * The result should be freed after use by calling sp_free_event_set().
+ *
+ * @param[out] result_ptr If any error is returned, the variable pointed to by
+ *                        result_ptr will be set to NULL. Otherwise, it will
+ *                        be set to point to the event set. Must not be NULL.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.0
+ */
+SP_API enum sp_return sp_new_event_set(struct sp_event_set **result_ptr);
+
+/**
+ * Add events to a struct sp_event_set for a given port.
+ *
+ * The port must first be opened by calling sp_open() using the same port
+ * structure.
+ *
+ * After the port is closed or the port structure freed, the results may
+ * no longer be valid.
+ *
+ * @param[in,out] event_set Event set to update. Must not be NULL.
+ * @param[in] port Pointer to a port structure. Must not be NULL.
+ * @param[in] mask Bitmask of events to be waited for.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.0
+ */
+SP_API enum sp_return sp_add_port_events(struct sp_event_set *event_set,
+	const struct sp_port *port, enum sp_event mask);
+
+/**
+ * Remove all events for a given port from a struct sp_event_set.
+ *
+ * This allows a port to be dropped from a long-lived event set, for instance
+ * when its device is unplugged, without rebuilding the set. The port may
+ * already have been closed.
+ *
+ * @param[in,out] event_set Event set to update. Must not be NULL.
+ * @param[in] port Pointer to a port structure. Must not be NULL.
+ *
+ * @return SP_OK upon success, a negative error code otherwise. SP_ERR_ARG is
+ *         returned if the port is not in the event set.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_remove_port_events(struct sp_event_set *event_set,
+	const struct sp_port *port);
+
+/**
+ * Replace the events waited for on a given port in a struct sp_event_set.
+ *
+ * Unlike sp_add_port_events(), which adds to the events already in the set,
+ * this sets the port's events to exactly those in the mask. A mask of zero
+ * removes the port from the set, as sp_remove_port_events() does.
+ *
+ * @param[in,out] event_set Event set to update. Must not be NULL.
+ * @param[in] port Pointer to a port structure. Must not be NULL.
+ * @param[in] mask Bitmask of events to be waited for.
+ *
+ * @return SP_OK upon success, a negative error code otherwise. SP_ERR_ARG is
+ *         returned if the port is not in the event set.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_modify_port_events(struct sp_event_set *event_set,
+	const struct sp_port *port, enum sp_event mask);
+
+/**
+ * Wait for any of a set of events to occur.
+ *
+ * @param[in] event_set Event set to wait on. Must not be NULL.
+ * @param[in] timeout_ms Timeout in milliseconds, or zero to wait indefinitely.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.0
+ */
+SP_API enum sp_return sp_wait(struct sp_event_set *event_set, unsigned int timeout_ms);
+
+/**
+ * Wait for any of a set of events to occur, with a timeout in nanoseconds.
+ *
+ * This works as sp_wait(), but allows timeouts shorter than a millisecond.
+ * Where ppoll() is available the timeout is passed on at full resolution.
+ * On Windows it is rounded up to a whole number of milliseconds.
+ *
+ * @param[in] event_set Event set to wait on. Must not be NULL.
+ * @param[in] timeout_ns Timeout in nanoseconds, or zero to wait indefinitely.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_wait_ns(struct sp_event_set *event_set, unsigned long long timeout_ns);
+
+/**
+ * Wait for any of a set of events to occur, with a timeout in microseconds.
+ *
+ * This is sp_wait_ns() with the timeout given in microseconds.
+ *
+ * @param[in] event_set Event set to wait on. Must not be NULL.
+ * @param[in] timeout_us Timeout in microseconds, or zero to wait indefinitely.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_wait_us(struct sp_event_set *event_set, unsigned int timeout_us);
+
+/**
+ * Wait for any of a set of events to occur, and report which ports they
+ * occurred on.
+ *
+ * Unlike sp_wait(), this function tells the caller which ports are ready,
+ * so there is no need to check every port in the set afterwards.
+ *
+ * On Linux, the first call creates an epoll instance for the event set, with
+ * which all ports in the set are registered once. Ports added afterwards are
+ * registered as they are added. Each call then costs time proportional to the
+ * number of ready ports rather than the size of the set, and does not allocate
+ * memory unless max_results grows.
+ *
+ * A port may be ready for more events than were requested for it; events that
+ * were not requested are not reported, except for SP_EVENT_ERROR, which is
+ * reported whenever an error or hangup occurs on the port.
+ *
+ * @param[in] event_set Event set to wait on. Must not be NULL.
+ * @param[out] results Array in which to store the results. Must not be NULL.
+ * @param[in] max_results Number of entries in the results array. Must not be
+ *                        zero.
+ * @param[in] timeout_ms Timeout in milliseconds, or zero to wait indefinitely.
+ *
+ * @return The number of results stored on success, or a negative error code.
+ *         If the result is zero, the timeout was reached before any events
+ *         occurred. If more ports are ready than max_results, the remaining
+ *         ports will be reported by the next call.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_wait_events(struct sp_event_set *event_set,
+	struct sp_event_result *results, unsigned int max_results,
+	unsigned int timeout_ms);
+
+/**
+ * Free a structure allocated by sp_new_event_set().
+ *
+ * @param[in] event_set Event set to free. Must not be NULL.
+ *
+ * @since 0.1.0
+ */
+SP_API void sp_free_event_set(struct sp_event_set *event_set);
+
+/**
+ * @}
+ *
+ * @defgroup Receiver Receive engine
+ *
+ * Receiving data into a ring buffer from a background thread.
+ *
+ * At high baud rates, an application which does not read from a port
+ * often enough can lose data when the operating system's receive buffer
+ * overflows. The receive engine avoids this by starting a dedicated
+ * thread which reads from the port as soon as data arrives, into a ring
+ * buffer allocated by libserialport.
+ *
+ * Received data is consumed in place: sp_acquire_received() returns a
+ * pointer to the next contiguous span of data in the ring buffer, and
+ * sp_release_received() hands the space back once it has been processed.
+ * If the ring buffer fills up, further data is discarded and counted in
+ * the statistics returned by sp_get_receiver_stats().
+ *
+ * While the receive engine is running, the read functions must not be
+ * used on the port, and return SP_ERR_ARG. The engine is stopped with
+ * sp_stop_receiver(), or when the port is closed.
+ *
+ * The receive engine is not supported on Windows, where these functions
+ * return SP_ERR_SUPP.
+ *
+ * @{
+ */
+
+/**
+ * Statistics of a port's receive engine.
+ *
+ * @since 0.1.2
+ */
+struct sp_receiver_stats {
+	/** Number of bytes read from the port and queued. */
+	unsigned long long received;
+	/** Number of bytes read from the port and discarded, as the buffer was full. */
+	unsigned long long dropped;
+	/** Number of times the buffer has filled up. */
+	unsigned int overflows;
+};
+
+/**
+ * Start the receive engine on the specified serial port.
+ *
+ * @param[in] port Pointer to an open port structure. Must not be NULL.
+ * @param[in] buffer_size Size of the ring buffer in bytes. This will be
+ *                        rounded up to a power of two, and may be at
+ *                        most 1 GiB.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_start_receiver(struct sp_port *port, size_t buffer_size);
+
+/**
+ * Stop the receive engine on the specified serial port.
+ *
+ * Any data still in the ring buffer is discarded. If another thread is
+ * waiting in sp_acquire_received(), it is woken and returns SP_ERR_ARG, and
+ * this function returns once it has done so. The same applies when the
+ * port is closed with the engine running.
+ *
+ * @param[in] port Pointer to a port structure. Must not be NULL.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_stop_receiver(struct sp_port *port);
+
+/**
+ * Get the number of bytes waiting in the receive engine's ring buffer.
+ *
+ * @param[in] port Pointer to a port structure. Must not be NULL.
+ *
+ * @return Number of bytes waiting on success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_received_waiting(struct sp_port *port);
+
+/**
+ * Wait for received data and get a pointer to it.
+ *
+ * Returns the next contiguous span of data in the ring buffer, which may be
+ * less than sp_received_waiting() reports if the data wraps around the end
+ * of the buffer. The span remains valid until it is released with
+ * sp_release_received(). Acquiring again without releasing returns the same
+ * data, possibly extended.
+ *
+ * If the reader thread has failed, for instance because the device was
+ * removed, SP_ERR_FAIL is returned once all data received before the
+ * failure has been consumed.
+ *
+ * @param[in] port Pointer to a port structure. Must not be NULL.
+ * @param[out] buf_ptr Pointer to a variable which will be set to point to
+ *                     the data, or to NULL if none is returned.
+ *                     Must not be NULL.
+ * @param[in] timeout_ms Timeout in milliseconds, or zero to wait indefinitely.
+ *
+ * @return The number of bytes available at *buf_ptr on success, or a negative
+ *         error code. If the result is zero, the timeout was reached before
+ *         any data arrived.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_acquire_received(struct sp_port *port,
+	const void **buf_ptr, unsigned int timeout_ms);
+
+/**
+ * Release received data which has been processed.
+ *
+ * @param[in] port Pointer to a port structure. Must not be NULL.
+ * @param[in] count Number of bytes to release, from the start of the span
+ *                  returned by sp_acquire_received(). Must not exceed the
+ *                  number of bytes waiting.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_release_received(struct sp_port *port, size_t count);
+
+/**
+ * Get the statistics of the receive engine on the specified serial port.
+ *
+ * @param[in] port Pointer to a port structure. Must not be NULL.
+ * @param[out] stats Pointer to a structure which will be filled in with the
+ *                   statistics. Must not be NULL.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_get_receiver_stats(struct sp_port *port,
+	struct sp_receiver_stats *stats);
+
+/**
+ * @}
+ *
+ * @defgroup Reactor Reactor
+ *
+ * Serving many ports from a small pool of worker threads.
+ *
+ * An application handling hundreds of ports can dedicate a thread to
+ * each, but the memory and context switches this costs grow with the
+ * number of ports. A reactor instead runs a fixed number of worker
+ * threads, each waiting for events on its share of the ports, and calls a
+ * function registered for each port when it becomes ready.
+ *
+ * Ports are assigned to the worker with the fewest ports when they are
+ * added. A worker which finds several ports ready at once wakes an idle
+ * worker, which then takes ports from the busy worker's queue, so a
+ * burst of traffic on one worker's ports is shared out.
+ *
+ * The callback for a port is never run by two workers at once. After it
+ * returns, the port is watched again for the events in its mask. The
+ * callback should read or write until the port would block, as it is
+ * called again only once the port has become ready again. It may call
+ * sp_reactor_modify_port() and sp_reactor_remove_port() for its port, and
+ * the port is removed from the reactor when it is closed.
+ *
+ * The reactor is only supported on Linux, where it uses epoll. On other
+ * platforms, sp_new_reactor() returns SP_ERR_SUPP.
+ *
+ * @{
+ */
+
+/**
+ * @struct sp_reactor
+ * An opaque structure representing a reactor.
+ */
+struct sp_reactor;
+
+/**
+ * Function called by a reactor worker when a port is ready.
+ *
+ * @ref SP_EVENT_ERROR is reported when the port has failed or hung up,
+ * even if it was not in the mask. The port is then not watched again
+ * until sp_reactor_modify_port() is called, and should normally be
+ * removed.
+ *
+ * @param[in] port Pointer to the port which is ready.
+ * @param[in] events The events which have occurred.
+ * @param[in] user_data The user data passed to sp_reactor_add_port().
+ *
+ * @since 0.1.2
+ */
+typedef void (*sp_reactor_callback)(struct sp_port *port, enum sp_event events,
+	void *user_data);
+
+/**
+ * Statistics of one worker of a reactor.
+ *
+ * @since 0.1.2
+ */
+struct sp_reactor_stats {
+	/** Number of ports assigned to the worker. */
+	unsigned int ports;
+	/** Number of callbacks run by the worker. */
+	unsigned long long dispatched;
+	/** Number of those callbacks taken from another worker's queue. */
+	unsigned long long stolen;
+};
+
+/**
+ * Create a reactor and start its worker threads.
+ *
+ * @param[in] num_workers Number of worker threads, or zero to start one for
+ *                        each online CPU.
+ * @param[out] reactor_ptr If any error is returned, the variable pointed to
+ *                         by reactor_ptr will be set to NULL. Otherwise, it
+ *                         will be set to point to the new reactor. Must not
+ *                         be NULL.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_new_reactor(unsigned int num_workers,
+	struct sp_reactor **reactor_ptr);
+
+/**
+ * Get the number of worker threads of a reactor.
+ *
+ * @param[in] reactor Pointer to a reactor. Must not be NULL.
+ *
+ * @return The number of workers upon success, a negative error code
+ *         otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_get_reactor_workers(const struct sp_reactor *reactor);
+
+/**
+ * Restrict a reactor worker thread to one CPU.
+ *
+ * @param[in] reactor Pointer to a reactor. Must not be NULL.
+ * @param[in] worker Index of the worker, from zero.
+ * @param[in] cpu Number of the CPU to run the worker on, from zero, or -1
+ *                to allow it to run on any CPU again.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_set_reactor_affinity(struct sp_reactor *reactor,
+	unsigned int worker, int cpu);
+
+/**
+ * Add an open port to a reactor.
+ *
+ * The port is put into non-blocking mode. A port can only be added to one
+ * reactor at a time, and not while its receive engine is running.
+ *
+ * @param[in] reactor Pointer to a reactor. Must not be NULL.
+ * @param[in] port Pointer to an open port. Must not be NULL.
+ * @param[in] mask Bitmask of events to watch for, from enum sp_event.
+ * @param[in] callback Function to call when the port is ready. Must not be
+ *                     NULL.
+ * @param[in] user_data Pointer to pass to the callback.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_reactor_add_port(struct sp_reactor *reactor,
+	struct sp_port *port, enum sp_event mask, sp_reactor_callback callback,
+	void *user_data);
+
+/**
+ * Change the events a reactor watches for on a port.
+ *
+ * This is typically used to watch for @ref SP_EVENT_TX_READY only while
+ * there is data waiting to be written. If the port's callback is running,
+ * the new mask takes effect when it returns.
+ *
+ * @param[in] reactor Pointer to the reactor the port was added to. Must not
+ *                    be NULL.
+ * @param[in] port Pointer to the port. Must not be NULL.
+ * @param[in] mask Bitmask of events to watch for, from enum sp_event.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_reactor_modify_port(struct sp_reactor *reactor,
+	struct sp_port *port, enum sp_event mask);
+
+/**
+ * Remove a port from a reactor.
+ *
+ * If the port's callback is running on a worker, this waits for it to
+ * return, so that the port and user data can be freed afterwards. When
+ * called from within the port's own callback, it does not wait.
+ *
+ * A callback may also remove other ports, and then waits for their
+ * callbacks as any other thread would. Two callbacks must therefore not
+ * remove each other's ports, and a callback must not remove a port whose
+ * callback may be waiting for it, as neither would then return.
+ *
+ * @param[in] reactor Pointer to the reactor the port was added to. Must not
+ *                    be NULL.
+ * @param[in] port Pointer to the port. Must not be NULL.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_reactor_remove_port(struct sp_reactor *reactor,
+	struct sp_port *port);
+
+/**
+ * Get the statistics of one worker of a reactor.
+ *
+ * @param[in] reactor Pointer to a reactor. Must not be NULL.
+ * @param[in] worker Index of the worker, from zero.
+ * @param[out] stats Pointer to a structure which will be filled in with the
+ *                   statistics. Must not be NULL.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_get_reactor_stats(const struct sp_reactor *reactor,
+	unsigned int worker, struct sp_reactor_stats *stats);
+
+/**
+ * Stop the worker threads of a reactor and free it.
+ *
+ * Ports still in the reactor are removed from it. This must not be called
+ * from within a reactor callback.
+ *
+ * @param[in] reactor Pointer to a reactor. Must not be NULL.
+ *
+ * @since 0.1.2
+ */
+SP_API void sp_free_reactor(struct sp_reactor *reactor);
+
+/**
+ * @}
+ *
+ * @defgroup IORing Completion-based I/O
+ *
+ * Reading and writing many ports with few system calls.
+ *
+ * An I/O ring keeps a read outstanding on each port added to it, and
+ * reports the data each read returns as a completion. Writes are queued
+ * with sp_io_ring_write() and reported as completions once written in
+ * full. Completions for all of a ring's ports are collected with one call
+ * to sp_io_ring_wait().
+ *
+ * Received data is read into buffers taken from a pool belonging to the
+ * ring. Each buffer reported in a read completion must be handed back with
+ * sp_release_io_buffer() once the data has been processed. While every
+ * buffer is in use, reading stops and data waits in the ports' receive
+ * buffers.
+ *
+ * On Linux, when built with the io_uring headers and run on a kernel with
+ * provided buffer rings (5.19 or later), the ring uses io_uring: reads
+ * stay queued in the kernel, data is read directly into the pool, and
+ * queued writes are submitted together with the next wait. Otherwise, the
+ * ring falls back to waiting for the ports with poll() and reading and
+ * writing each one which is ready. sp_get_io_ring_backend() tells which is
+ * in use.
+ *
+ * A ring and its ports must only be used from one thread at a time, and
+ * must not be read or written with other functions while in a ring; the
+ * read functions return SP_ERR_ARG for a port in a ring. A port
+ * is removed from its ring when it is closed. I/O rings are not supported
+ * on Windows, where sp_new_io_ring() returns SP_ERR_SUPP.
+ *
+ * @{
+ */
+
+/**
+ * @struct sp_io_ring
+ * An opaque structure representing an I/O ring.
+ */
+struct sp_io_ring;
+
+/** Mechanisms an I/O ring can use. */
+enum sp_io_ring_backend {
+	/** Use io_uring if available, otherwise poll(). */
+	SP_IO_RING_AUTO = 0,
+	/** Linux io_uring. */
+	SP_IO_RING_URING = 1,
+	/** poll() followed by non-blocking reads and writes. */
+	SP_IO_RING_POLL = 2
+};
+
+/** Operations reported by I/O ring completions. */
+enum sp_io_ring_op {
+	/** Data was received. */
+	SP_IO_RING_READ = 1,
+	/** A write queued with sp_io_ring_write() has finished. */
+	SP_IO_RING_WRITE = 2
+};
+
+/**
+ * The result of one operation of an I/O ring.
+ *
+ * @since 0.1.2
+ */
+struct sp_io_completion {
+	/** The port the operation was performed on. */
+	struct sp_port *port;
+	/** The kind of operation. */
+	enum sp_io_ring_op op;
+	/**
+	 * Number of bytes read or written, or SP_ERR_FAIL if the operation
+	 * failed. A failed read means the port has hung up or failed, and no
+	 * further reads are made on it.
+	 */
+	int result;
+	/**
+	 * For a read, the received data, in a buffer which must be released
+	 * with sp_release_io_buffer(). For a write, the buffer passed to
+	 * sp_io_ring_write().
+	 */
+	const void *buf;
+	/** For a read, the buffer to pass to sp_release_io_buffer(). */
+	unsigned int buffer_id;
+	/** For a write, the user data passed to sp_io_ring_write(). */
+	void *user_data;
+};
+
+/**
+ * Counters of an I/O ring's activity.
+ *
+ * @since 0.1.2
+ */
+struct sp_io_ring_stats {
+	/** Number of system calls made by the ring. */
+	unsigned long long syscalls;
+	/** Number of read completions reported. */
+	unsigned long long reads;
+	/** Number of write completions reported. */
+	unsigned long long writes;
+	/** Number of bytes received. */
+	unsigned long long bytes_read;
+	/** Number of bytes written. */
+	unsigned long long bytes_written;
+};
+
+/**
+ * Create an I/O ring.
  *
- * @warning If your program runs on Unix, defines its own signal handlers, and
- *          needs to abort blocking writes when these are called, then you
- *          should not use this function. It repeats system calls that return
- *          with EINTR. To be able to abort a write from a signal handler, you
- *          should implement your own blocking write using sp_nonblocking_write()
- *          together with a blocking method that makes sense for your program.
- *          E.g. you can obtain the file descriptor for an open port using
- *          sp_get_port_handle() and use this to call select() or pselect(),
- *          with appropriate arrangements to return if a signal is received.
+ * @param[in] backend The mechanism to use, normally @ref SP_IO_RING_AUTO.
+ *                    If @ref SP_IO_RING_URING is requested but not
+ *                    available, SP_ERR_SUPP is returned.
+ * @param[in] num_buffers Number of receive buffers in the ring's pool, from
+ *                        1 to 32768. It is rounded up to a power of two.
+ * @param[in] buffer_size Size of each receive buffer, in bytes.
+ * @param[out] ring_ptr If any error is returned, the variable pointed to by
+ *                      ring_ptr will be set to NULL. Otherwise, it will be
+ *                      set to point to the new ring. Must not be NULL.
  *
- * @param[in] port Pointer to a port structure. Must not be NULL.
- * @param[in] buf Buffer containing the bytes to write. Must not be NULL.
- * @param[in] count Requested number of bytes to write.
- * @param[in] timeout_ms Timeout in milliseconds, or zero to wait indefinitely.
+ * @return SP_OK upon success, a negative error code otherwise.
  *
- * @return The number of bytes written on success, or a negative error code.
- *         If the number of bytes returned is less than that requested, the
- *         timeout was reached before the requested number of bytes was
- *         written. If timeout is zero, the function will always return
- *         either the requested number of bytes or a negative error code. In
- *         the event of an error there is no way to determine how many bytes
- *         were sent before the error occurred.
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_new_io_ring(enum sp_io_ring_backend backend,
+	unsigned int num_buffers, size_t buffer_size,
+	struct sp_io_ring **ring_ptr);
+
+/**
+ * Get the mechanism used by an I/O ring.
  *
- * @since 0.1.0
+ * @param[in] ring Pointer to an I/O ring. Must not be NULL.
+ *
+ * @return @ref SP_IO_RING_URING or @ref SP_IO_RING_POLL upon success, a
+ *         negative error code otherwise.
+ *
+ * @since 0.1.2
  */
-SP_API enum sp_return sp_blocking_write(struct sp_port *port, const void *buf, size_t count, unsigned int timeout_ms);
+SP_API enum sp_return sp_get_io_ring_backend(const struct sp_io_ring *ring);
 
 /**
- * Write bytes to the specified serial port, without blocking.
+ * Add an open port to an I/O ring, and start reading from it.
  *
- * Note that this function only ensures that the accepted bytes have been
- * written to the OS; they may be held in driver or hardware buffers and not
- * yet physically transmitted. To check whether all written bytes have actually
- * been transmitted, use the sp_output_waiting() function. To wait until all
- * written bytes have actually been transmitted, use the sp_drain() function.
+ * The port is put into non-blocking mode. A port can only be added to one
+ * ring at a time, and not while it is in a reactor or its receive engine
+ * is running.
  *
- * @param[in] port Pointer to a port structure. Must not be NULL.
+ * @param[in] ring Pointer to an I/O ring. Must not be NULL.
+ * @param[in] port Pointer to an open port. Must not be NULL.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_io_ring_add_port(struct sp_io_ring *ring,
+	struct sp_port *port);
+
+/**
+ * Remove a port from an I/O ring.
+ *
+ * Outstanding operations on the port are cancelled, and writes not yet
+ * completed are discarded without being reported. Once this returns, the
+ * ring no longer uses the buffers of those writes. Completions already
+ * collected for the port remain to be returned by sp_io_ring_wait().
+ *
+ * @param[in] ring Pointer to the ring the port was added to. Must not be
+ *                 NULL.
+ * @param[in] port Pointer to the port. Must not be NULL.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_io_ring_remove_port(struct sp_io_ring *ring,
+	struct sp_port *port);
+
+/**
+ * Queue a write to a port in an I/O ring.
+ *
+ * The write is started by the next call to sp_io_ring_submit() or
+ * sp_io_ring_wait(), together with any other queued writes. Writes to a
+ * port are performed in order, and a completion is reported once all the
+ * data has been written. The buffer must remain valid until then.
+ *
+ * @param[in] ring Pointer to the ring the port was added to. Must not be
+ *                 NULL.
+ * @param[in] port Pointer to the port. Must not be NULL.
  * @param[in] buf Buffer containing the bytes to write. Must not be NULL.
- * @param[in] count Maximum number of bytes to write.
+ * @param[in] count Number of bytes to write, from 1 to INT_MAX.
+ * @param[in] user_data Pointer to report in the completion.
  *
- * @return The number of bytes written on success, or a negative error code.
- *         The number of bytes returned may be any number from zero to the
- *         maximum that was requested.
+ * @return SP_OK upon success, a negative error code otherwise.
  *
- * @since 0.1.0
+ * @since 0.1.2
  */
-SP_API enum sp_return sp_nonblocking_write(struct sp_port *port, const void *buf, size_t count);
+SP_API enum sp_return sp_io_ring_write(struct sp_io_ring *ring,
+	struct sp_port *port, const void *buf, size_t count, void *user_data);
 
 /**
- * Gets the number of bytes waiting in the input buffer.
+ * Start the writes queued on an I/O ring, without waiting.
+ *
+ * @param[in] ring Pointer to an I/O ring. Must not be NULL.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_io_ring_submit(struct sp_io_ring *ring);
+
+/**
+ * Start the writes queued on an I/O ring, and wait for completions.
+ *
+ * @param[in] ring Pointer to an I/O ring. Must not be NULL.
+ * @param[out] completions Array to fill in with completions. Must not be
+ *                         NULL.
+ * @param[in] count Size of the array. Must not be zero.
+ * @param[in] timeout_ms Timeout in milliseconds, or zero to wait
+ *                       indefinitely.
+ *
+ * @return The number of completions returned, which is zero if the timeout
+ *         elapsed first, or a negative error code upon failure.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_io_ring_wait(struct sp_io_ring *ring,
+	struct sp_io_completion *completions, unsigned int count,
+	unsigned int timeout_ms);
+
+/**
+ * Hand a receive buffer back to an I/O ring.
+ *
+ * @param[in] ring Pointer to an I/O ring. Must not be NULL.
+ * @param[in] buffer_id The buffer_id of the read completion.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_release_io_buffer(struct sp_io_ring *ring,
+	unsigned int buffer_id);
+
+/**
+ * Get the counters of an I/O ring.
+ *
+ * @param[in] ring Pointer to an I/O ring. Must not be NULL.
+ * @param[out] stats Pointer to a structure which will be filled in with the
+ *                   counters. Must not be NULL.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_get_io_ring_stats(const struct sp_io_ring *ring,
+	struct sp_io_ring_stats *stats);
+
+/**
+ * Free an I/O ring.
+ *
+ * Ports still in the ring are removed from it, and buffers reported by
+ * read completions become invalid.
+ *
+ * @param[in] ring Pointer to an I/O ring. Must not be NULL.
+ *
+ * @since 0.1.2
+ */
+SP_API void sp_free_io_ring(struct sp_io_ring *ring);
+
+/**
+ * @}
+ *
+ * @defgroup Latency Latency control
+ *
+ * Reducing the latency between data arriving at a port and the
+ * application receiving it.
+ *
+ * Request/response protocols are often limited by the time it takes for
+ * received data to pass through the operating system, rather than by the
+ * baud rate. On Linux, several settings affect this:
+ *
+ * - The low-latency flag of a serial driver, set with sp_set_low_latency(),
+ *   asks the driver to pass received data to the line discipline
+ *   immediately rather than deferring it to a work queue.
+ *
+ * - The latency timer of USB-serial adapters which support it, such as
+ *   FTDI devices, controls how long the adapter buffers received data
+ *   before sending it to the host. It is accessed with
+ *   sp_get_latency_timer() and sp_set_latency_timer().
+ *
+ * - sp_blocking_read_vmin() waits for data using the terminal's VMIN and
+ *   VTIME settings, so that the kernel completes a read as soon as enough
+ *   bytes have arrived, without a separate poll() call.
+ *
+ * These functions return SP_ERR_SUPP on platforms, drivers or devices
+ * which do not support the corresponding setting.
+ *
+ * @{
+ */
+
+/**
+ * Set or clear the low-latency flag of a serial port's driver.
+ *
+ * This uses the ASYNC_LOW_LATENCY flag of the TIOCSSERIAL ioctl on Linux.
+ * Drivers which do not implement TIOCSSERIAL cause SP_ERR_FAIL to be
+ * returned.
  *
  * @param[in] port Pointer to a port structure. Must not be NULL.
+ * @param[in] enable Non-zero to set the flag, zero to clear it.
  *
- * @return Number of bytes waiting on success, a negative error code otherwise.
+ * @return SP_OK upon success, a negative error code otherwise.
  *
- * @since 0.1.0
+ * @since 0.1.2
  */
-SP_API enum sp_return sp_input_waiting(struct sp_port *port);
+SP_API enum sp_return sp_set_low_latency(struct sp_port *port, int enable);
 
 /**
- * Gets the number of bytes waiting in the output buffer.
+ * Get the latency timer of a USB-serial adapter.
+ *
+ * The port does not need to be open. Root privileges are not normally
+ * required to read the latency timer.
  *
  * @param[in] port Pointer to a port structure. Must not be NULL.
+ * @param[out] timer_ms Pointer to a variable to store the latency timer
+ *                      in milliseconds. Must not be NULL.
  *
- * @return Number of bytes waiting on success, a negative error code otherwise.
+ * @return SP_OK upon success, SP_ERR_SUPP if the device has no latency
+ *         timer, or another negative error code otherwise.
  *
- * @since 0.1.0
+ * @since 0.1.2
  */
-SP_API enum sp_return sp_output_waiting(struct sp_port *port);
+SP_API enum sp_return sp_get_latency_timer(struct sp_port *port, int *timer_ms);
 
 /**
- * Flush serial port buffers. Data in the selected buffer(s) is discarded.
+ * Set the latency timer of a USB-serial adapter.
+ *
+ * The port does not need to be open, but writing the latency timer
+ * usually requires write access to the device's sysfs attributes.
  *
  * @param[in] port Pointer to a port structure. Must not be NULL.
- * @param[in] buffers Which buffer(s) to flush.
+ * @param[in] timer_ms Latency timer in milliseconds, from 0 to 255.
  *
- * @return SP_OK upon success, a negative error code otherwise.
+ * @return SP_OK upon success, SP_ERR_SUPP if the device has no latency
+ *         timer, or another negative error code otherwise.
  *
- * @since 0.1.0
+ * @since 0.1.2
  */
-SP_API enum sp_return sp_flush(struct sp_port *port, enum sp_buffer buffers);
+SP_API enum sp_return sp_set_latency_timer(struct sp_port *port, int timer_ms);
 
 /**
- * Wait for buffered data to be transmitted.
+ * Read bytes from the specified serial port, blocking in the kernel
+ * according to the terminal's VMIN and VTIME settings.
  *
- * @warning If your program runs on Unix, defines its own signal handlers, and
- *          needs to abort draining the output buffer when when these are
- *          called, then you should not use this function. It repeats system
- *          calls that return with EINTR. To be able to abort a drain from a
- *          signal handler, you would need to implement your own blocking
- *          drain by polling the result of sp_output_waiting().
+ * The behaviour depends on the parameters as follows:
+ *
+ * - If min_bytes and interbyte_timeout_ms are both non-zero, the read
+ *   blocks until at least one byte is received, then returns once
+ *   min_bytes have been received, or once no further byte has been
+ *   received for interbyte_timeout_ms.
+ *
+ * - If min_bytes is non-zero and interbyte_timeout_ms is zero, the read
+ *   blocks until min_bytes have been received.
+ *
+ * - If min_bytes is zero and interbyte_timeout_ms is non-zero, the read
+ *   returns as soon as any data is available, or with no data after
+ *   interbyte_timeout_ms.
+ *
+ * - If both are zero, the read returns immediately with whatever data is
+ *   available.
+ *
+ * In all cases, at most count bytes are returned by a single call.
+ *
+ * The timeout has a resolution of 100 milliseconds and is rounded up.
+ * The VMIN and VTIME settings are only written to the port when they
+ * change from the previous call.
+ *
+ * This function is not supported on Windows, where it returns SP_ERR_SUPP.
+ * It must not be used while the receive engine is running on the port, or
+ * while the port is in a reactor or an I/O ring, and returns SP_ERR_ARG if
+ * it is.
  *
  * @param[in] port Pointer to a port structure. Must not be NULL.
+ * @param[out] buf Buffer in which to store the bytes read. Must not be NULL.
+ * @param[in] count Maximum number of bytes to read. Must not be zero.
+ * @param[in] min_bytes Minimum number of bytes to wait for, from 0 to 255.
+ * @param[in] interbyte_timeout_ms Timeout in milliseconds, from 0 to 25500.
  *
- * @return SP_OK upon success, a negative error code otherwise.
+ * @return The number of bytes read on success, or a negative error code.
+ *         If the result is zero, the timeout expired before any data was
+ *         received.
  *
- * @since 0.1.0
+ * @since 0.1.2
  */
-SP_API enum sp_return sp_drain(struct sp_port *port);
+SP_API enum sp_return sp_blocking_read_vmin(struct sp_port *port, void *buf,
+	size_t count, unsigned int min_bytes, unsigned int interbyte_timeout_ms);
 
 /**
  * @}
  *
- * @defgroup Waiting Waiting
+ * @defgroup Timestamps Timestamped reads
  *
- * Waiting for events and timeout handling.
+ * Reading data tagged with the time at which it arrived.
  *
- * See @ref await_events.c for an example of awaiting events on multiple ports.
+ * sp_read_timestamped() reads one chunk of data at a time, and records the
+ * monotonic clock as soon as the wait for data ends, before the data is
+ * read. Each chunk is also tagged with its offset in the stream of bytes
+ * read this way, so that gaps and ordering can be checked.
+ *
+ * Data only reaches the application once the driver and the line
+ * discipline have passed it on, so the timestamp is that of the last byte
+ * of a chunk becoming available. The arrival of earlier bytes in the chunk
+ * can be estimated from the character time at the configured baud rate,
+ * using sp_get_byte_timestamp().
  *
  * @{
  */
 
 /**
- * Allocate storage for a set of events.
+ * Timing information for a chunk of data read by sp_read_timestamped().
  *
- * The user should allocate a variable of type struct sp_event_set *,
- * then pass a pointer to this variable to receive the result.
+ * @since 0.1.2
+ */
+struct sp_timestamp {
+	/** Monotonic time at which the data was found available, in ns. */
+	unsigned long long time_ns;
+	/** Offset of the first byte of the chunk in the stream read. */
+	unsigned long long offset;
+	/** Number of bytes in the chunk. */
+	size_t count;
+	/** Time to receive one character at the configured settings in ns,
+	 *  or zero if unknown. */
+	unsigned int byte_time_ns;
+};
+
+/**
+ * Read one chunk of bytes from the serial port, with its arrival time.
  *
- * The result should be freed after use by calling sp_free_event_set().
+ * This waits until data is available or the timeout expires, records the
+ * time, and then reads as many bytes as are available, up to count.
  *
- * @param[out] result_ptr If any error is returned, the variable pointed to by
- *                        result_ptr will be set to NULL. Otherwise, it will
- *                        be set to point to the event set. Must not be NULL.
+ * The time is taken from the same monotonic clock that is used for
+ * timeouts, which is CLOCK_MONOTONIC where available. Stream offsets count
+ * the bytes read with this function since the port was opened.
  *
- * @return SP_OK upon success, a negative error code otherwise.
+ * This function is not supported on Windows, where it returns SP_ERR_SUPP.
+ * It must not be used while the receive engine is running on the port, or
+ * while the port is in an I/O ring, and returns SP_ERR_ARG if it is.
  *
- * @since 0.1.0
+ * @param[in] port Pointer to a port structure. Must not be NULL.
+ * @param[out] buf Buffer in which to store the bytes read. Must not be NULL.
+ * @param[in] count Maximum number of bytes to read. Must not be zero.
+ * @param[in] timeout_ms Timeout in milliseconds, or zero to wait indefinitely.
+ * @param[out] timestamp Timing information for the chunk. Must not be NULL.
+ *
+ * @return The number of bytes read on success, or a negative error code.
+ *         If the result is zero, the timeout expired before any data was
+ *         received, and the timestamp is not valid.
+ *
+ * @since 0.1.2
  */
-SP_API enum sp_return sp_new_event_set(struct sp_event_set **result_ptr);
+SP_API enum sp_return sp_read_timestamped(struct sp_port *port, void *buf,
+	size_t count, unsigned int timeout_ms, struct sp_timestamp *timestamp);
 
 /**
- * Add events to a struct sp_event_set for a given port.
+ * Estimate the arrival time of one byte of a timestamped chunk.
  *
- * The port must first be opened by calling sp_open() using the same port
- * structure.
+ * Bytes are assumed to have arrived back to back, ending with the last
+ * byte of the chunk at the time of the chunk.
  *
- * After the port is closed or the port structure freed, the results may
- * no longer be valid.
+ * @param[in] timestamp Timing information for a chunk. Must not be NULL.
+ * @param[in] index Index of the byte in the chunk.
+ * @param[out] time_ns Estimated monotonic arrival time of the byte, in ns.
+ *                     Must not be NULL.
  *
- * @param[in,out] event_set Event set to update. Must not be NULL.
- * @param[in] port Pointer to a port structure. Must not be NULL.
- * @param[in] mask Bitmask of events to be waited for.
+ * @return SP_OK upon success, SP_ERR_SUPP if the character time is not
+ *         known, or another negative error code otherwise.
  *
- * @return SP_OK upon success, a negative error code otherwise.
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_get_byte_timestamp(const struct sp_timestamp *timestamp,
+	size_t index, unsigned long long *time_ns);
+
+/**
+ * @}
  *
- * @since 0.1.0
+ * @defgroup Statistics Statistics
+ *
+ * Counting the I/O performed on a port.
+ *
+ * Each port keeps counters of the bytes it has transferred and the system
+ * calls made to do so, along with a histogram of the time spent waiting
+ * for the port to become ready in the blocking read and write functions.
+ * The counters are updated with relaxed atomic operations, so a snapshot
+ * may be taken from any thread without locking, at the cost of the values
+ * in it not being captured at a single instant.
+ *
+ * Reads made by the receive engine's thread are not included; they are
+ * counted by sp_get_receiver_stats() instead.
+ *
+ * @{
  */
-SP_API enum sp_return sp_add_port_events(struct sp_event_set *event_set,
-	const struct sp_port *port, enum sp_event mask);
 
 /**
- * Wait for any of a set of events to occur.
+ * Number of buckets in the wait time histogram of sp_port_stats.
+ *
+ * @since 0.1.2
+ */
+#define SP_STATS_HISTOGRAM_SIZE 24
+
+/**
+ * I/O statistics of a port.
+ *
+ * @since 0.1.2
+ */
+struct sp_port_stats {
+	/** Number of bytes read from the port. */
+	unsigned long long bytes_read;
+	/** Number of bytes written to the port. */
+	unsigned long long bytes_written;
+	/** Number of read system calls made. */
+	unsigned long long reads;
+	/** Number of write system calls made. */
+	unsigned long long writes;
+	/**
+	 * Number of reads, within blocking reads, which returned fewer bytes
+	 * than were still wanted before the timeout, so that the blocking
+	 * read had to wait for more data.
+	 */
+	unsigned long long short_reads;
+	/** Number of blocking reads and writes which ended on their timeout. */
+	unsigned long long timeouts;
+	/** Number of system calls repeated after EINTR or EAGAIN. */
+	unsigned long long retries;
+	/** Number of waits for the port to become ready. */
+	unsigned long long waits;
+	/**
+	 * Histogram of wait times. Bucket 0 counts waits shorter than 1 us,
+	 * and bucket i counts waits from 2^(i-1) us up to 2^i us. The last
+	 * bucket also counts all longer waits.
+	 */
+	unsigned long long wait_histogram[SP_STATS_HISTOGRAM_SIZE];
+	/**
+	 * Hardware overruns, or -1 if not available. This and the error
+	 * counts below are kept by the driver, and are read with TIOCGICOUNT
+	 * on Linux while the port is open. They are not available otherwise.
+	 */
+	long long overruns;
+	/** Receive buffer overruns in the driver, or -1 if not available. */
+	long long buffer_overruns;
+	/** Framing errors, or -1 if not available. */
+	long long frame_errors;
+	/** Parity errors, or -1 if not available. */
+	long long parity_errors;
+	/** Break conditions received, or -1 if not available. */
+	long long breaks;
+};
+
+/**
+ * Take a snapshot of the statistics of a port.
  *
- * @param[in] event_set Event set to wait on. Must not be NULL.
- * @param[in] timeout_ms Timeout in milliseconds, or zero to wait indefinitely.
+ * This may be called from any thread while the port is in use.
+ *
+ * @param[in] port Pointer to a port structure. Must not be NULL.
+ * @param[out] stats Statistics structure to fill in. Must not be NULL.
  *
  * @return SP_OK upon success, a negative error code otherwise.
  *
- * @since 0.1.0
+ * @since 0.1.2
  */
-SP_API enum sp_return sp_wait(struct sp_event_set *event_set, unsigned int timeout_ms);
+SP_API enum sp_return sp_get_port_stats(struct sp_port *port, struct sp_port_stats *stats);
 
 /**
- * Free a structure allocated by sp_new_event_set().
+ * Reset the counters of a port to zero.
  *
- * @param[in] event_set Event set to free. Must not be NULL.
+ * Counts kept by the driver are not affected.
  *
- * @since 0.1.0
+ * @param[in] port Pointer to a port structure. Must not be NULL.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
  */
-SP_API void sp_free_event_set(struct sp_event_set *event_set);
+SP_API enum sp_return sp_reset_port_stats(struct sp_port *port);
 
 /**
  * @}
@@ -1674,6 +3757,11 @@ SP_API void sp_set_debug_handler(void (*handler)(const char *format, ...));
  * environment variable LIBSERIALPORT_DEBUG is set. Otherwise, they are
  * ignored.
  *
+ * The variable is only looked up on the first message, and the result
+ * kept, so that messages which are ignored cost no environment search.
+ * Setting or unsetting it afterwards has no effect; use
+ * sp_set_debug_handler() to turn the output on or off at run time.
+ *
  * @param[in] format The format string to use. Must not be NULL.
  * @param[in] ... The variable length argument list to use.
  *
@@ -1681,6 +3769,108 @@ SP_API void sp_set_debug_handler(void (*handler)(const char *format, ...));
  */
 SP_API void sp_default_debug_handler(const char *format, ...);
 
+/** Maximum number of arguments recorded with a trace event. */
+#define SP_TRACE_MAX_ARGS 6
+
+/** Space for the string arguments of a trace event, including terminators. */
+#define SP_TRACE_STRING_SIZE 48
+
+/**
+ * @struct sp_trace_event
+ * A debug message recorded in binary form.
+ *
+ * The message is stored as its format string and raw arguments, so
+ * recording it needs no formatting. String arguments are copied into
+ * @ref strings, truncated if necessary, and their argument slots hold the
+ * offset of the copy.
+ *
+ * @since 0.1.2
+ */
+struct sp_trace_event {
+	/** Monotonic time at which the message was recorded, in nanoseconds. */
+	unsigned long long time_ns;
+	/** Number of the thread which recorded the message, counting from 1. */
+	unsigned long long thread;
+	/** Format string of the message, as for printf(). Owned by the library. */
+	const char *format;
+	/** Raw values of the arguments, in the order they appear in the format. */
+	unsigned long long args[SP_TRACE_MAX_ARGS];
+	/** Copies of the string arguments. */
+	char strings[SP_TRACE_STRING_SIZE];
+};
+
+/**
+ * Start recording debug messages into per-thread ring buffers.
+ *
+ * While tracing, debug messages are recorded as binary events instead of
+ * being passed to the debug handler. Recording takes no locks and does no
+ * formatting; each thread writes to a ring of its own, which is allocated
+ * when it first records a message. When a ring is full, its oldest events
+ * are overwritten.
+ *
+ * The ring of a thread which has exited is kept until all of its events
+ * have been read with sp_read_trace(), which then frees it. An existing
+ * ring keeps its size if tracing is restarted with a different one.
+ *
+ * @param[in] ring_size Number of events each thread's ring can hold. Will
+ *                      be rounded up to a power of two. Must not be zero.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_start_trace(size_t ring_size);
+
+/**
+ * Stop recording debug messages.
+ *
+ * Messages are passed to the debug handler again. Events which have
+ * already been recorded can still be read with sp_read_trace().
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_stop_trace(void);
+
+/**
+ * Read recorded trace events, removing them from the rings.
+ *
+ * Events are returned in order for each thread, one thread's ring after
+ * another; sort them by @ref sp_trace_event::time_ns for a global order.
+ * Events which were overwritten before they could be read are skipped.
+ *
+ * This function may be called while other threads are recording, but
+ * must not be called from more than one thread at a time.
+ *
+ * @param[out] events Buffer to receive the events. Must not be NULL.
+ * @param[in] count Maximum number of events to read.
+ *
+ * @return The number of events read on success, or a negative error code.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_read_trace(struct sp_trace_event *events, size_t count);
+
+/**
+ * Format a recorded trace event as text.
+ *
+ * This produces the same message that the debug handler would have been
+ * given, without the trailing newline. It must be called in the process
+ * which recorded the event, since the event refers to the format string.
+ *
+ * @param[in] event The event to format. Must not be NULL.
+ * @param[out] buf Buffer to receive the message. Must not be NULL.
+ * @param[in] size Size of the buffer. The message is truncated if it does
+ *                 not fit, and is always terminated.
+ *
+ * @return SP_OK upon success, a negative error code otherwise.
+ *
+ * @since 0.1.2
+ */
+SP_API enum sp_return sp_format_trace_event(const struct sp_trace_event *event,
+                                            char *buf, size_t size);
+
 /** @} */
 
 /**
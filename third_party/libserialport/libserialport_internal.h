@@ -34,6 +34,8 @@
 #define _DEFAULT_SOURCE 1 /* for glibc >= 2.20 */
 /* For clock_gettime and associated types. */
 #define _POSIX_C_SOURCE 199309L
+/* For ppoll. */
+#define _GNU_SOURCE 1
 #endif
 
 #ifdef LIBSERIALPORT_ATBUILD
@@ -41,6 +43,11 @@
 #include <config.h>
 #endif
 
+/* Lets the poll() fallback be built, and tested, where epoll is available. */
+#ifdef NO_EPOLL
+#undef HAVE_SYS_EPOLL_H
+#endif
+
 #ifdef LIBSERIALPORT_MSBUILD
 /* If building with MS tools, define necessary things that
    would otherwise appear in config.h. */
@@ -59,6 +66,7 @@
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <limits.h>
 #ifdef _WIN32
 #include <windows.h>
 #include <tchar.h>
@@ -75,13 +83,13 @@
  * and this worst-case value is found on x64. */
 #define WRITEFILE_MAX_SIZE 33525760
 #else
-#include <limits.h>
 #include <termios.h>
 #include <sys/ioctl.h>
 #include <sys/time.h>
 #include <time.h>
 #include <poll.h>
 #include <unistd.h>
+#include <sys/uio.h>
 #ifdef HAVE_SYS_FILE_H
 #include <sys/file.h>
 #endif
@@ -97,8 +105,12 @@
 #define kIOMainPortDefault kIOMasterPortDefault
 #endif
 #endif
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
 #ifdef __linux__
 #include <dirent.h>
+#include <sys/sysmacros.h>
 /* Android only has linux/serial.h from platform 21 onwards. */
 #if !(defined(__ANDROID__) && (__ANDROID_API__ < 21))
 #include <linux/serial.h>
@@ -134,6 +146,91 @@
 #define USE_TERMIOS_SPEED
 #endif
 
+struct sp_port_config {
+	int baudrate;
+	int bits;
+	enum sp_parity parity;
+	int stopbits;
+	enum sp_rts rts;
+	enum sp_cts cts;
+	enum sp_dtr dtr;
+	enum sp_dsr dsr;
+	enum sp_xonxoff xon_xoff;
+};
+
+struct port_data {
+#ifdef _WIN32
+	DCB dcb;
+#else
+	struct termios term;
+	int controlbits;
+	int termiox_supported;
+	int rts_flow;
+	int cts_flow;
+	int dtr_flow;
+	int dsr_flow;
+#endif
+};
+
+/* A buffer passed to sp_queue_write(), waiting to be written. */
+struct write_request {
+	struct write_request *next;
+	const void *buf;
+	size_t count;
+	sp_write_callback callback;
+	void *user_data;
+};
+
+/* Default high-water mark of a port's write queue, in bytes. */
+#define DEFAULT_WRITE_QUEUE_LIMIT 65536
+
+struct write_queue {
+	struct write_request *head, *tail;
+	/* Bytes of the head request already written. */
+	size_t offset;
+	/* Bytes queued and not yet written. */
+	size_t bytes;
+	/* High-water mark, above which no more requests are accepted. */
+	size_t limit;
+};
+
+/*
+ * I/O counters of a port. They are only ever updated with relaxed atomic
+ * adds, so that they can be read from any thread without locking.
+ */
+struct port_stats {
+	unsigned long long bytes_read, bytes_written;
+	unsigned long long reads, writes;
+	unsigned long long short_reads, timeouts, retries, waits;
+	unsigned long long wait_histogram[SP_STATS_HISTOGRAM_SIZE];
+};
+
+#ifdef _MSC_VER
+#define STAT_ADD(port, field, n) \
+	InterlockedExchangeAdd64((volatile LONG64 *) &(port)->stats.field, (LONG64) (n))
+#define STAT_LOAD(var) \
+	((unsigned long long) InterlockedCompareExchange64((volatile LONG64 *) &(var), 0, 0))
+#define STAT_STORE(var, value) \
+	InterlockedExchange64((volatile LONG64 *) &(var), (LONG64) (value))
+#else
+#define STAT_ADD(port, field, n) \
+	__atomic_fetch_add(&(port)->stats.field, (unsigned long long) (n), __ATOMIC_RELAXED)
+#define STAT_LOAD(var) __atomic_load_n(&(var), __ATOMIC_RELAXED)
+#define STAT_STORE(var, value) __atomic_store_n(&(var), (value), __ATOMIC_RELAXED)
+#endif
+
+/* Data read ahead by the framing functions. */
+struct frame_buffer {
+	unsigned char *data;
+	size_t size;
+	/* Unconsumed data lies between start and end. */
+	size_t start, end;
+	/* Bytes of an oversized length-prefixed frame still to be discarded. */
+	size_t skip;
+	/* Whether to discard data up to the next delimiter. */
+	bool resync;
+};
+
 struct sp_port {
 	char *name;
 	char *description;
@@ -146,6 +243,10 @@ struct sp_port {
 	char *usb_product;
 	char *usb_serial;
 	char *bluetooth_address;
+	/* If set, a single block holding all of the strings above. */
+	char *strings;
+	/* Whether the metadata above is gathered yet, changed atomically. */
+	int details_state;
 #ifdef _WIN32
 	char *usb_path;
 	HANDLE hdl;
@@ -160,33 +261,30 @@ struct sp_port {
 	BOOL wait_running;
 #else
 	int fd;
+	/* Background receive engine, if started. */
+	struct receiver *receiver;
+	/* Number of calls using the receive engine, which stopping waits for. */
+	unsigned int receiver_users;
+	/* Registration with a reactor, if added to one. */
+	struct reactor_port *reactor;
+	/* Registration with an I/O ring, if added to one. */
+	struct io_ring_port *io_ring;
+	/* Whether O_NONBLOCK has been cleared for sp_blocking_read_vmin(). */
+	bool fd_blocking;
 #endif
-};
-
-struct sp_port_config {
-	int baudrate;
-	int bits;
-	enum sp_parity parity;
-	int stopbits;
-	enum sp_rts rts;
-	enum sp_cts cts;
-	enum sp_dtr dtr;
-	enum sp_dsr dsr;
-	enum sp_xonxoff xon_xoff;
-};
-
-struct port_data {
-#ifdef _WIN32
-	DCB dcb;
-#else
-	struct termios term;
-	int controlbits;
-	int termiox_supported;
-	int rts_flow;
-	int cts_flow;
-	int dtr_flow;
-	int dsr_flow;
-#endif
+	/* Bytes read by sp_read_timestamped() since the port was opened. */
+	unsigned long long timestamp_offset;
+	/* Port state as last read from or written to the device. */
+	struct port_data data;
+	struct sp_port_config config;
+	/* Whether data and config are valid; cleared when the port is closed. */
+	bool config_valid;
+	struct write_queue write_queue;
+	struct frame_buffer frame_buffer;
+	struct port_stats stats;
+	/* Changes collected between sp_begin_config() and sp_commit_config(). */
+	struct sp_port_config staged;
+	bool staging;
 };
 
 #ifdef _WIN32
@@ -195,6 +293,30 @@ typedef HANDLE event_handle;
 typedef int event_handle;
 #endif
 
+/*
+ * Private state of an event set. The public struct sp_event_set is always
+ * allocated by sp_new_event_set() as the first member of this structure.
+ */
+struct event_set_data {
+	struct sp_event_set set;
+	/* Port owning each handle in set.handles. */
+	struct sp_port **ports;
+	/* Allocated length of the handle, mask, port and pollfd arrays. */
+	unsigned int capacity;
+#ifndef _WIN32
+	/* poll() array matching set.handles, kept up to date as it changes. */
+	struct pollfd *pollfds;
+#endif
+#ifdef HAVE_SYS_EPOLL_H
+	/* Persistent epoll instance, created by the first sp_wait_events(). */
+	int epoll_fd;
+	struct epoll_event *epoll_events;
+	unsigned int epoll_events_size;
+#endif
+};
+
+#define EVENT_SET_DATA(event_set) ((struct event_set_data *) (event_set))
+
 /* Standard baud rates. */
 #ifdef _WIN32
 #define BAUD_TYPE DWORD
@@ -213,24 +335,56 @@ struct std_baudrate {
 
 extern void (*sp_debug_handler)(const char *format, ...);
 
+/*
+ * Compile-time trace levels. Messages above SP_TRACE_LEVEL are compiled out,
+ * so e.g. building with -DSP_TRACE_LEVEL=1 removes all per-call formatting
+ * from the read and write paths while still reporting errors.
+ */
+#define SP_TRACE_LEVEL_NONE 0
+/* Errors returned by the library. */
+#define SP_TRACE_LEVEL_ERROR 1
+/* Informational messages from inside functions. */
+#define SP_TRACE_LEVEL_DEBUG 2
+/* Every public function call and return value. */
+#define SP_TRACE_LEVEL_CALLS 3
+
+#ifndef SP_TRACE_LEVEL
+#define SP_TRACE_LEVEL SP_TRACE_LEVEL_CALLS
+#endif
+
+/* Per-thread capacity of the trace rings, or zero when not tracing. */
+extern size_t sp_trace_ring_size;
+
+SP_PRIV void trace_record(const char *format, ...);
+
 /* Debug output macros. */
-#define DEBUG_FMT(fmt, ...) do { \
-	if (sp_debug_handler) \
-		sp_debug_handler(fmt ".\n", __VA_ARGS__); \
+#define LOG_FMT(level, fmt, ...) do { \
+	if (SP_TRACE_LEVEL >= (level)) { \
+		if (sp_trace_ring_size) \
+			trace_record(fmt, __VA_ARGS__); \
+		else if (sp_debug_handler) \
+			sp_debug_handler(fmt ".\n", __VA_ARGS__); \
+	} \
 } while (0)
+#define DEBUG_FMT(fmt, ...) LOG_FMT(SP_TRACE_LEVEL_DEBUG, fmt, __VA_ARGS__)
 #define DEBUG(msg) DEBUG_FMT(msg, NULL)
-#define DEBUG_ERROR(err, msg) DEBUG_FMT("%s returning " #err ": " msg, __func__)
+#define DEBUG_ERROR(err, msg) \
+	LOG_FMT(SP_TRACE_LEVEL_ERROR, "%s returning " #err ": " msg, __func__)
 #define DEBUG_FAIL(msg) do {               \
-	char *errmsg = sp_last_error_message(); \
-	DEBUG_FMT("%s returning SP_ERR_FAIL: " msg ": %s", __func__, errmsg); \
-	sp_free_error_message(errmsg); \
+	if (SP_TRACE_LEVEL >= SP_TRACE_LEVEL_ERROR && \
+	    (sp_trace_ring_size || sp_debug_handler)) { \
+		char *errmsg = sp_last_error_message(); \
+		LOG_FMT(SP_TRACE_LEVEL_ERROR, "%s returning SP_ERR_FAIL: " msg ": %s", \
+			__func__, errmsg); \
+		sp_free_error_message(errmsg); \
+	} \
 } while (0);
 #define RETURN() do { \
-	DEBUG_FMT("%s returning", __func__); \
+	LOG_FMT(SP_TRACE_LEVEL_CALLS, "%s returning", __func__); \
 	return; \
 } while (0)
 #define RETURN_CODE(x) do { \
-	DEBUG_FMT("%s returning " #x, __func__); \
+	LOG_FMT(SP_TRACE_LEVEL_CALLS, "%s returning " #x, __func__); \
 	return x; \
 } while (0)
 #define RETURN_CODEVAL(x) do { \
@@ -254,61 +408,158 @@ extern void (*sp_debug_handler)(const char *format, ...);
 } while (0)
 #define RETURN_INT(x) do { \
 	int _x = x; \
-	DEBUG_FMT("%s returning %d", __func__, _x); \
+	LOG_FMT(SP_TRACE_LEVEL_CALLS, "%s returning %d", __func__, _x); \
 	return _x; \
 } while (0)
 #define RETURN_STRING(x) do { \
 	char *_x = x; \
-	DEBUG_FMT("%s returning %s", __func__, _x); \
+	LOG_FMT(SP_TRACE_LEVEL_CALLS, "%s returning %s", __func__, _x); \
 	return _x; \
 } while (0)
 #define RETURN_POINTER(x) do { \
 	void *_x = x; \
-	DEBUG_FMT("%s returning %p", __func__, _x); \
+	LOG_FMT(SP_TRACE_LEVEL_CALLS, "%s returning %p", __func__, _x); \
 	return _x; \
 } while (0)
 #define SET_ERROR(val, err, msg) do { DEBUG_ERROR(err, msg); val = err; } while (0)
 #define SET_FAIL(val, msg) do { DEBUG_FAIL(msg); val = SP_ERR_FAIL; } while (0)
-#define TRACE(fmt, ...) DEBUG_FMT("%s(" fmt ") called", __func__, __VA_ARGS__)
-#define TRACE_VOID() DEBUG_FMT("%s() called", __func__)
+#define TRACE(fmt, ...) \
+	LOG_FMT(SP_TRACE_LEVEL_CALLS, "%s(" fmt ") called", __func__, __VA_ARGS__)
+#define TRACE_VOID() LOG_FMT(SP_TRACE_LEVEL_CALLS, "%s() called", __func__)
 
 #define TRY(x) do { int retval = x; if (retval != SP_OK) RETURN_CODEVAL(retval); } while (0)
 
-SP_PRIV struct sp_port **list_append(struct sp_port **list, const char *portname);
+#define CHECK_PORT() do { \
+	if (!port) \
+		RETURN_ERROR(SP_ERR_ARG, "Null port"); \
+	if (!port->name) \
+		RETURN_ERROR(SP_ERR_ARG, "Null port name"); \
+} while (0)
+#ifdef _WIN32
+#define CHECK_PORT_HANDLE() do { \
+	if (port->hdl == INVALID_HANDLE_VALUE) \
+		RETURN_ERROR(SP_ERR_ARG, "Port not open"); \
+} while (0)
+#else
+#define CHECK_PORT_HANDLE() do { \
+	if (port->fd < 0) \
+		RETURN_ERROR(SP_ERR_ARG, "Port not open"); \
+} while (0)
+#endif
+#define CHECK_OPEN_PORT() do { \
+	CHECK_PORT(); \
+	CHECK_PORT_HANDLE(); \
+} while (0)
+/*
+ * Reads would race the receive engine or an I/O ring for data, so they are
+ * refused while either owns the port. Reactor callbacks read with the
+ * ordinary functions, so a port in a reactor may still be read.
+ */
+#ifdef _WIN32
+#define CHECK_READ_OWNER() do { } while (0)
+#else
+#define CHECK_READ_OWNER() do { \
+	if (port->receiver) \
+		RETURN_ERROR(SP_ERR_ARG, "Receive engine is running"); \
+	if (port->io_ring) \
+		RETURN_ERROR(SP_ERR_ARG, "Port is in an I/O ring"); \
+} while (0)
+#endif
+
+/* Criteria for port enumeration. Unset fields are NULL or negative. */
+struct sp_port_filter {
+	char *name;
+	int transport;
+	int usb_vid;
+	int usb_pid;
+	char *usb_manufacturer;
+	char *usb_product;
+	char *usb_serial;
+	char *bluetooth_address;
+};
+
+/* A port list under construction, grown geometrically. */
+struct port_list {
+	/* NULL-terminated array, as returned by sp_list_ports(). */
+	struct sp_port **ports;
+	size_t count, size;
+	/* Ports not matching the filter, if any, are left out. */
+	const struct sp_port_filter *filter;
+	/* If non-zero, enumeration may stop once this many ports are found. */
+	size_t limit;
+};
+
+SP_PRIV bool list_append(struct port_list *list, const char *portname);
+SP_PRIV bool match_glob(const char *pattern, const char *string);
+SP_PRIV bool match_port(const struct sp_port_filter *filter,
+	const struct sp_port *port);
+SP_PRIV enum sp_return set_port_strings(struct sp_port *port,
+	const char *description, const char *usb_manufacturer,
+	const char *usb_product, const char *usb_serial,
+	const char *bluetooth_address);
 
 /* OS-specific Helper functions. */
 SP_PRIV enum sp_return get_port_details(struct sp_port *port);
-SP_PRIV enum sp_return list_ports(struct sp_port ***list);
+SP_PRIV enum sp_return list_ports(struct port_list *list);
+#ifdef __linux__
+SP_PRIV void get_root(char *root, size_t size);
+SP_PRIV enum sp_return get_tty_port(const char *tty, struct sp_port **port_ptr);
+SP_PRIV enum sp_return get_latency_timer(struct sp_port *port, int *timer_ms);
+SP_PRIV enum sp_return set_latency_timer(struct sp_port *port, int timer_ms);
+#endif
 
 /* Timing abstraction */
 
+/*
+ * A point or span on the monotonic clock. Ticks are nanoseconds, except
+ * on Windows where they are performance counter ticks.
+ */
 struct time {
-#ifdef _WIN32
 	int64_t ticks;
-#else
-	struct timeval tv;
-#endif
 };
 
 struct timeout {
-	unsigned int ms, limit_ms;
+	/* Duration of the timeout, or zero to wait indefinitely. */
+	uint64_t ns;
+	unsigned int limit_ms;
 	struct time start, now, end, delta, delta_max;
 	struct timeval delta_tv;
+#ifndef _WIN32
+	struct timespec delta_ts;
+#endif
 	bool calls_started, overflow;
 };
 
 SP_PRIV void time_get(struct time *time);
 SP_PRIV void time_set_ms(struct time *time, unsigned int ms);
+SP_PRIV void time_set_ns(struct time *time, uint64_t ns);
 SP_PRIV void time_add(const struct time *a, const struct time *b, struct time *result);
 SP_PRIV void time_sub(const struct time *a, const struct time *b, struct time *result);
 SP_PRIV bool time_greater(const struct time *a, const struct time *b);
 SP_PRIV void time_as_timeval(const struct time *time, struct timeval *tv);
 SP_PRIV unsigned int time_as_ms(const struct time *time);
+SP_PRIV uint64_t time_as_ns(const struct time *time);
 SP_PRIV void timeout_start(struct timeout *timeout, unsigned int timeout_ms);
+SP_PRIV void timeout_start_ns(struct timeout *timeout, uint64_t timeout_ns);
 SP_PRIV void timeout_limit(struct timeout *timeout, unsigned int limit_ms);
 SP_PRIV bool timeout_check(struct timeout *timeout);
 SP_PRIV void timeout_update(struct timeout *timeout);
 SP_PRIV struct timeval *timeout_timeval(struct timeout *timeout);
+SP_PRIV struct timespec *timeout_timespec(struct timeout *timeout);
 SP_PRIV unsigned int timeout_remaining_ms(struct timeout *timeout);
 
+#ifndef _WIN32
+SP_PRIV int wait_fd(int fd, short events, struct timeout *timeout);
+SP_PRIV int wait_port(struct sp_port *port, short events,
+	struct timeout *timeout, struct time *end);
+SP_PRIV void stop_receiver(struct sp_port *port);
+SP_PRIV void remove_reactor_port(struct sp_port *port);
+SP_PRIV void remove_io_ring_port(struct sp_port *port);
+SP_PRIV enum sp_return ensure_nonblocking(struct sp_port *port);
+#endif
+SP_PRIV void discard_write_queue(struct sp_port *port);
+SP_PRIV struct sp_chunk *get_pool_chunk(struct sp_chunk_pool *pool);
+SP_PRIV void clear_frame_buffer(struct sp_port *port);
+SP_PRIV void free_frame_buffer(struct sp_port *port);
+
 #endif
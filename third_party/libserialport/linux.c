@@ -23,15 +23,112 @@
 #include "libserialport_internal.h"
 
 /*
- * The 'e' modifier for O_CLOEXEC is glibc >= 2.7 only, hence not
- * portable, so provide an own wrapper for this functionality.
+ * Get the directory under which sysfs and /dev are found. This is empty,
+ * meaning the filesystem root, unless the LIBSERIALPORT_ROOT environment
+ * variable points to another tree, such as a synthetic one for testing.
  */
-static FILE *fopen_cloexec_rdonly(const char *pathname)
+SP_PRIV void get_root(char *root, size_t size)
 {
-	int fd;
-	if ((fd = open(pathname, O_RDONLY | O_CLOEXEC)) < 0)
+	const char *env = getenv("LIBSERIALPORT_ROOT");
+	size_t len;
+
+	root[0] = 0;
+
+	if (!env || !*env)
+		return;
+
+#ifdef HAVE_REALPATH
+	/* Port names are canonicalized, so the prefix must be too. */
+	char path[PATH_MAX];
+	if (realpath(env, path))
+		env = path;
+#endif
+	snprintf(root, size, "%s", env);
+
+	len = strlen(root);
+	while (len > 0 && root[len - 1] == '/')
+		root[--len] = 0;
+}
+
+/* Get the tty name of a port, i.e. its name without the /dev/ prefix. */
+static const char *get_tty_name(const struct sp_port *port, const char *root)
+{
+	size_t len = strlen(root);
+
+	if (strncmp(port->name, root, len) || strncmp(port->name + len, "/dev/", 5))
 		return NULL;
-	return fdopen(fd, "r");
+
+	return port->name + len + 5;
+}
+
+/*
+ * Read a sysfs attribute relative to a directory with a single read()
+ * call, and strip the trailing newline. Returns the length of the value,
+ * or -1 if the attribute could not be read.
+ */
+static int read_attr(int dir_fd, const char *name, char *buf, size_t size)
+{
+	ssize_t len;
+	int fd;
+
+	if ((fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC)) < 0)
+		return -1;
+	len = read(fd, buf, size - 1);
+	close(fd);
+	if (len < 0)
+		return -1;
+	buf[len] = 0;
+	if (len > 0 && buf[len - 1] == '\n')
+		buf[--len] = 0;
+	return (int) len;
+}
+
+/*
+ * Read the identity of a USB device from its sysfs directory. Returns
+ * false if the directory is not that of a USB device.
+ */
+static bool read_usb_ids(int dir_fd, int *bus, int *address,
+	unsigned int *vid, unsigned int *pid)
+{
+	char value[16];
+
+	if (read_attr(dir_fd, "busnum", value, sizeof(value)) < 0 ||
+			sscanf(value, "%d", bus) != 1)
+		return false;
+	if (read_attr(dir_fd, "devnum", value, sizeof(value)) < 0 ||
+			sscanf(value, "%d", address) != 1)
+		return false;
+	if (read_attr(dir_fd, "idVendor", value, sizeof(value)) < 0 ||
+			sscanf(value, "%4x", vid) != 1)
+		return false;
+	if (read_attr(dir_fd, "idProduct", value, sizeof(value)) < 0 ||
+			sscanf(value, "%4x", pid) != 1)
+		return false;
+	return true;
+}
+
+/*
+ * Walk up from the sysfs directory of a USB interface to that of its USB
+ * device, reading the device identity on the way. Returns a directory fd
+ * for the device, or -1 if none was found.
+ */
+static int open_usb_device(int dev_fd, int *bus, int *address,
+	unsigned int *vid, unsigned int *pid)
+{
+	int usb_fd = dev_fd, parent_fd, i;
+
+	for (i = 0; i < 5; i++) {
+		parent_fd = openat(usb_fd, "..", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (usb_fd != dev_fd)
+			close(usb_fd);
+		if ((usb_fd = parent_fd) < 0)
+			return -1;
+		if (read_usb_ids(usb_fd, bus, address, vid, pid))
+			return usb_fd;
+	}
+
+	close(usb_fd);
+	return -1;
 }
 
 SP_PRIV enum sp_return get_port_details(struct sp_port *port)
@@ -45,210 +142,268 @@ SP_PRIV enum sp_return get_port_details(struct sp_port *port)
 	unsigned int vid, pid;
 	char manufacturer[128], product[128], serial[128];
 	char baddr[32];
-	const char dir_name[] = "/sys/class/tty/%s/device/%s%s";
-	char sub_dir[32] = "", link_name[PATH_MAX], file_name[PATH_MAX];
-	char *ptr, *dev = port->name + 5;
-	FILE *file;
-	int i, count;
+	char root[PATH_MAX], link_name[PATH_MAX], file_name[PATH_MAX];
+	const char *dev, *desc = NULL, *usb_manufacturer = NULL;
+	const char *usb_product = NULL, *usb_serial = NULL, *bluetooth_address = NULL;
+	int class_fd, dev_fd, usb_fd;
+	int count;
 	struct stat statbuf;
 
-	if (strncmp(port->name, "/dev/", 5))
+	get_root(root, sizeof(root));
+
+	if (!(dev = get_tty_name(port, root)))
 		RETURN_ERROR(SP_ERR_ARG, "Device name not recognized");
 
-	snprintf(link_name, sizeof(link_name), "/sys/class/tty/%s", dev);
-	if (lstat(link_name, &statbuf) == -1)
+	if (snprintf(file_name, sizeof(file_name), "%s/sys/class/tty", root)
+			>= (int) sizeof(file_name))
+		RETURN_ERROR(SP_ERR_ARG, "Root path too long");
+	if ((class_fd = open(file_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
 		RETURN_ERROR(SP_ERR_ARG, "Device not found");
-	if (!S_ISLNK(statbuf.st_mode))
-		snprintf(link_name, sizeof(link_name), "/sys/class/tty/%s/device", dev);
-	count = readlink(link_name, file_name, sizeof(file_name));
-	if (count <= 0 || count >= (int)(sizeof(file_name) - 1))
+
+	snprintf(link_name, sizeof(link_name), "%s/device", dev);
+	if (fstatat(class_fd, dev, &statbuf, AT_SYMLINK_NOFOLLOW) == -1) {
+		close(class_fd);
+		RETURN_ERROR(SP_ERR_ARG, "Device not found");
+	}
+	count = readlinkat(class_fd, S_ISLNK(statbuf.st_mode) ? dev : link_name,
+		file_name, sizeof(file_name));
+	if (count <= 0 || count >= (int)(sizeof(file_name) - 1)) {
+		close(class_fd);
 		RETURN_ERROR(SP_ERR_ARG, "Device not found");
+	}
 	file_name[count] = 0;
 	if (strstr(file_name, "bluetooth"))
 		port->transport = SP_TRANSPORT_BLUETOOTH;
 	else if (strstr(file_name, "usb"))
 		port->transport = SP_TRANSPORT_USB;
 
-	if (port->transport == SP_TRANSPORT_USB) {
-		for (i = 0; i < 5; i++) {
-			strcat(sub_dir, "../");
-
-			snprintf(file_name, sizeof(file_name), dir_name, dev, sub_dir, "busnum");
-			if (!(file = fopen_cloexec_rdonly(file_name)))
-				continue;
-			count = fscanf(file, "%d", &bus);
-			fclose(file);
-			if (count != 1)
-				continue;
-
-			snprintf(file_name, sizeof(file_name), dir_name, dev, sub_dir, "devnum");
-			if (!(file = fopen_cloexec_rdonly(file_name)))
-				continue;
-			count = fscanf(file, "%d", &address);
-			fclose(file);
-			if (count != 1)
-				continue;
-
-			snprintf(file_name, sizeof(file_name), dir_name, dev, sub_dir, "idVendor");
-			if (!(file = fopen_cloexec_rdonly(file_name)))
-				continue;
-			count = fscanf(file, "%4x", &vid);
-			fclose(file);
-			if (count != 1)
-				continue;
-
-			snprintf(file_name, sizeof(file_name), dir_name, dev, sub_dir, "idProduct");
-			if (!(file = fopen_cloexec_rdonly(file_name)))
-				continue;
-			count = fscanf(file, "%4x", &pid);
-			fclose(file);
-			if (count != 1)
-				continue;
+	dev_fd = openat(class_fd, link_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	close(class_fd);
 
+	if (port->transport == SP_TRANSPORT_USB && dev_fd >= 0) {
+		usb_fd = open_usb_device(dev_fd, &bus, &address, &vid, &pid);
+		if (usb_fd >= 0) {
 			port->usb_bus = bus;
 			port->usb_address = address;
 			port->usb_vid = vid;
 			port->usb_pid = pid;
 
-			snprintf(file_name, sizeof(file_name), dir_name, dev, sub_dir, "product");
-			if ((file = fopen_cloexec_rdonly(file_name))) {
-				if ((ptr = fgets(description, sizeof(description), file))) {
-					ptr = description + strlen(description) - 1;
-					if (ptr >= description && *ptr == '\n')
-						*ptr = 0;
-					port->description = strdup(description);
-				}
-				fclose(file);
-			}
-			if (!file || !ptr)
-				port->description = strdup(dev);
-
-			snprintf(file_name, sizeof(file_name), dir_name, dev, sub_dir, "manufacturer");
-			if ((file = fopen_cloexec_rdonly(file_name))) {
-				if ((ptr = fgets(manufacturer, sizeof(manufacturer), file))) {
-					ptr = manufacturer + strlen(manufacturer) - 1;
-					if (ptr >= manufacturer && *ptr == '\n')
-						*ptr = 0;
-					port->usb_manufacturer = strdup(manufacturer);
-				}
-				fclose(file);
-			}
+			if (read_attr(usb_fd, "product", product, sizeof(product)) >= 0)
+				desc = usb_product = product;
+			else
+				desc = dev;
 
-			snprintf(file_name, sizeof(file_name), dir_name, dev, sub_dir, "product");
-			if ((file = fopen_cloexec_rdonly(file_name))) {
-				if ((ptr = fgets(product, sizeof(product), file))) {
-					ptr = product + strlen(product) - 1;
-					if (ptr >= product && *ptr == '\n')
-						*ptr = 0;
-					port->usb_product = strdup(product);
-				}
-				fclose(file);
-			}
+			if (read_attr(usb_fd, "manufacturer", manufacturer, sizeof(manufacturer)) >= 0)
+				usb_manufacturer = manufacturer;
 
-			snprintf(file_name, sizeof(file_name), dir_name, dev, sub_dir, "serial");
-			if ((file = fopen_cloexec_rdonly(file_name))) {
-				if ((ptr = fgets(serial, sizeof(serial), file))) {
-					ptr = serial + strlen(serial) - 1;
-					if (ptr >= serial && *ptr == '\n')
-						*ptr = 0;
-					port->usb_serial = strdup(serial);
-				}
-				fclose(file);
-			}
+			if (read_attr(usb_fd, "serial", serial, sizeof(serial)) >= 0)
+				usb_serial = serial;
 
 			/* If present, add serial to description for better identification. */
-			if (port->usb_serial && strlen(port->usb_serial)) {
-				snprintf(description, sizeof(description),
-					"%s - %s", port->description, port->usb_serial);
-				if (port->description)
-					free(port->description);
-				port->description = strdup(description);
+			if (usb_serial && strlen(usb_serial)) {
+				/* The result is truncated to fit, as the other strings are. */
+				if (snprintf(description, sizeof(description),
+						"%s - %s", desc, usb_serial) >= 0)
+					desc = description;
 			}
 
-			break;
+			close(usb_fd);
 		}
-	} else {
-		port->description = strdup(dev);
-
-		if (port->transport == SP_TRANSPORT_BLUETOOTH) {
-			snprintf(file_name, sizeof(file_name), dir_name, dev, "", "address");
-			if ((file = fopen_cloexec_rdonly(file_name))) {
-				if ((ptr = fgets(baddr, sizeof(baddr), file))) {
-					ptr = baddr + strlen(baddr) - 1;
-					if (ptr >= baddr && *ptr == '\n')
-						*ptr = 0;
-					port->bluetooth_address = strdup(baddr);
-				}
-				fclose(file);
-			}
+	} else if (port->transport != SP_TRANSPORT_USB) {
+		desc = dev;
+
+		if (port->transport == SP_TRANSPORT_BLUETOOTH && dev_fd >= 0) {
+			if (read_attr(dev_fd, "address", baddr, sizeof(baddr)) >= 0)
+				bluetooth_address = baddr;
 		}
 	}
 
+	if (dev_fd >= 0)
+		close(dev_fd);
+
+	TRY(set_port_strings(port, desc, usb_manufacturer, usb_product,
+		usb_serial, bluetooth_address));
+
 	RETURN_OK();
 }
 
-SP_PRIV enum sp_return list_ports(struct sp_port ***list)
+/* Compare a sysfs attribute against a filter string, if one is set. */
+static bool match_attr(int dir_fd, const char *name, const char *value)
 {
-	char name[PATH_MAX], target[PATH_MAX];
-	struct dirent *entry;
+	char buf[128];
+
+	if (!value)
+		return true;
+	if (read_attr(dir_fd, name, buf, sizeof(buf)) < 0)
+		return false;
+	return strcmp(buf, value) == 0;
+}
+
+/*
+ * Check a tty against a port filter using only the sysfs attributes the
+ * filter refers to, so that ports which cannot match are skipped without
+ * gathering all of their metadata. Ports which pass are still checked
+ * against the full filter once built.
+ */
+static bool prefilter_tty(int class_fd, const char *tty, const char *name,
+	enum sp_transport transport, const struct sp_port_filter *filter)
+{
+	char link_name[NAME_MAX + 8];
+	int bus, address, dev_fd, usb_fd;
+	unsigned int vid, pid;
+	bool usb, bluetooth, match;
+
+	if (filter->name && !match_glob(filter->name, name))
+		return false;
+	if (filter->transport >= 0 && (int) transport != filter->transport)
+		return false;
+
+	usb = filter->usb_vid >= 0 || filter->usb_pid >= 0 ||
+		filter->usb_manufacturer || filter->usb_product || filter->usb_serial;
+	bluetooth = filter->bluetooth_address != NULL;
+
+	if (!usb && !bluetooth)
+		return true;
+	if ((usb && transport != SP_TRANSPORT_USB) ||
+			(bluetooth && transport != SP_TRANSPORT_BLUETOOTH))
+		return false;
+
+	snprintf(link_name, sizeof(link_name), "%s/device", tty);
+	if ((dev_fd = openat(class_fd, link_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+		return false;
+
+	if (bluetooth) {
+		match = match_attr(dev_fd, "address", filter->bluetooth_address);
+	} else if ((usb_fd = open_usb_device(dev_fd, &bus, &address, &vid, &pid)) >= 0) {
+		match = (filter->usb_vid < 0 || (int) vid == filter->usb_vid) &&
+			(filter->usb_pid < 0 || (int) pid == filter->usb_pid) &&
+			match_attr(usb_fd, "serial", filter->usb_serial) &&
+			match_attr(usb_fd, "product", filter->usb_product) &&
+			match_attr(usb_fd, "manufacturer", filter->usb_manufacturer);
+		close(usb_fd);
+	} else {
+		match = false;
+	}
+
+	close(dev_fd);
+
+	return match;
+}
+
+/*
+ * Check whether a tty in /sys/class/tty is a serial port and, if so, get
+ * its device path. The file type from readdir() may be given to avoid a
+ * stat() call, or DT_UNKNOWN otherwise. If a filter is given, ports which
+ * cannot match it are rejected before any probing of the device.
+ */
+static bool is_serial_tty(int class_fd, const char *root, const char *tty,
+	unsigned char type, const struct sp_port_filter *filter,
+	char *name, size_t size)
+{
+	enum sp_transport transport = SP_TRANSPORT_NATIVE;
+	char target[PATH_MAX], buf[NAME_MAX + 8], value[16];
 #ifdef HAVE_STRUCT_SERIAL_STRUCT
 	struct serial_struct serial_info;
 	int ioctl_result;
 #endif
-	char buf[sizeof(entry->d_name) + 23];
-	int len, fd;
+	struct stat statbuf;
+	bool is_link;
+	int len, fd, port_type;
+
+	if (type != DT_UNKNOWN) {
+		is_link = (type == DT_LNK);
+	} else {
+		if (fstatat(class_fd, tty, &statbuf, AT_SYMLINK_NOFOLLOW) == -1)
+			return false;
+		is_link = S_ISLNK(statbuf.st_mode);
+	}
+	if (is_link)
+		snprintf(buf, sizeof(buf), "%s", tty);
+	else
+		snprintf(buf, sizeof(buf), "%s/device", tty);
+	len = readlinkat(class_fd, buf, target, sizeof(target));
+	if (len <= 0 || len >= (int)(sizeof(target) - 1))
+		return false;
+	target[len] = 0;
+	if (strstr(target, "virtual"))
+		return false;
+	if (snprintf(name, size, "%s/dev/%s", root, tty) >= (int) size)
+		return false;
+	DEBUG_FMT("Found device %s", name);
+	if (filter) {
+		if (strstr(target, "bluetooth"))
+			transport = SP_TRANSPORT_BLUETOOTH;
+		else if (strstr(target, "usb"))
+			transport = SP_TRANSPORT_USB;
+		if (!prefilter_tty(class_fd, tty, name, transport, filter)) {
+			DEBUG("Device does not match filter, skipping");
+			return false;
+		}
+	}
+	if (strstr(target, "serial8250")) {
+		/*
+		 * The serial8250 driver has a hardcoded number of ports, of
+		 * which only those with a known UART type actually exist.
+		 * serial_core exports the type in sysfs, which saves opening
+		 * each port; older kernels only report it through an ioctl.
+		 */
+		snprintf(buf, sizeof(buf), "%s/type", tty);
+		if (read_attr(class_fd, buf, value, sizeof(value)) > 0 &&
+				sscanf(value, "%d", &port_type) == 1) {
+			/* A type of 0 is PORT_UNKNOWN. */
+			if (port_type == 0) {
+				DEBUG("Port type is unknown, skipping");
+				return false;
+			}
+			return true;
+		}
+		DEBUG("serial8250 device, attempting to open");
+		if ((fd = open(name, O_RDWR | O_NONBLOCK | O_NOCTTY | O_CLOEXEC)) < 0) {
+			DEBUG("Open failed, skipping");
+			return false;
+		}
+#ifdef HAVE_STRUCT_SERIAL_STRUCT
+		ioctl_result = ioctl(fd, TIOCGSERIAL, &serial_info);
+#endif
+		close(fd);
+#ifdef HAVE_STRUCT_SERIAL_STRUCT
+		if (ioctl_result != 0) {
+			DEBUG("ioctl failed, skipping");
+			return false;
+		}
+		if (serial_info.type == PORT_UNKNOWN) {
+			DEBUG("Port type is unknown, skipping");
+			return false;
+		}
+#endif
+	}
+	return true;
+}
+
+SP_PRIV enum sp_return list_ports(struct port_list *list)
+{
+	char root[PATH_MAX], name[PATH_MAX];
+	struct dirent *entry;
 	DIR *dir;
 	int ret = SP_OK;
-	struct stat statbuf;
 
 	DEBUG("Enumerating tty devices");
-	if (!(dir = opendir("/sys/class/tty")))
+	get_root(root, sizeof(root));
+
+	if (snprintf(name, sizeof(name), "%s/sys/class/tty", root) >= (int) sizeof(name))
+		RETURN_ERROR(SP_ERR_ARG, "Root path too long");
+	if (!(dir = opendir(name)))
 		RETURN_FAIL("Could not open /sys/class/tty");
 
 	DEBUG("Iterating over results");
 	while ((entry = readdir(dir))) {
-		snprintf(buf, sizeof(buf), "/sys/class/tty/%s", entry->d_name);
-		if (lstat(buf, &statbuf) == -1)
-			continue;
-		if (!S_ISLNK(statbuf.st_mode))
-			snprintf(buf, sizeof(buf), "/sys/class/tty/%s/device", entry->d_name);
-		len = readlink(buf, target, sizeof(target));
-		if (len <= 0 || len >= (int)(sizeof(target) - 1))
-			continue;
-		target[len] = 0;
-		if (strstr(target, "virtual"))
+		if (list->limit && list->count >= list->limit)
+			break;
+		if (!is_serial_tty(dirfd(dir), root, entry->d_name, entry->d_type,
+				list->filter, name, sizeof(name)))
 			continue;
-		snprintf(name, sizeof(name), "/dev/%s", entry->d_name);
-		DEBUG_FMT("Found device %s", name);
-		if (strstr(target, "serial8250")) {
-			/*
-			 * The serial8250 driver has a hardcoded number of ports.
-			 * The only way to tell which actually exist on a given system
-			 * is to try to open them and make an ioctl call.
-			 */
-			DEBUG("serial8250 device, attempting to open");
-			if ((fd = open(name, O_RDWR | O_NONBLOCK | O_NOCTTY | O_CLOEXEC)) < 0) {
-				DEBUG("Open failed, skipping");
-				continue;
-			}
-#ifdef HAVE_STRUCT_SERIAL_STRUCT
-			ioctl_result = ioctl(fd, TIOCGSERIAL, &serial_info);
-#endif
-			close(fd);
-#ifdef HAVE_STRUCT_SERIAL_STRUCT
-			if (ioctl_result != 0) {
-				DEBUG("ioctl failed, skipping");
-				continue;
-			}
-			if (serial_info.type == PORT_UNKNOWN) {
-				DEBUG("Port type is unknown, skipping");
-				continue;
-			}
-#endif
-		}
 		DEBUG_FMT("Found port %s", name);
-		*list = list_append(*list, name);
-		if (!*list) {
+		if (!list_append(list, name)) {
 			SET_ERROR(ret, SP_ERR_MEM, "List append failed");
 			break;
 		}
@@ -257,3 +412,96 @@ SP_PRIV enum sp_return list_ports(struct sp_port ***list)
 
 	return ret;
 }
+
+SP_PRIV enum sp_return get_tty_port(const char *tty, struct sp_port **port_ptr)
+{
+	char root[PATH_MAX], name[PATH_MAX];
+	int class_fd;
+	bool serial;
+
+	*port_ptr = NULL;
+
+	get_root(root, sizeof(root));
+
+	if (snprintf(name, sizeof(name), "%s/sys/class/tty", root) >= (int) sizeof(name))
+		RETURN_ERROR(SP_ERR_ARG, "Root path too long");
+	if ((class_fd = open(name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+		RETURN_FAIL("Could not open /sys/class/tty");
+
+	serial = is_serial_tty(class_fd, root, tty, DT_UNKNOWN, NULL,
+		name, sizeof(name));
+	close(class_fd);
+
+	if (!serial)
+		RETURN_OK();
+
+	DEBUG_FMT("Found port %s", name);
+
+	/* The device may have gone away again since it was checked. */
+	if (sp_get_port_by_name(name, port_ptr) == SP_ERR_MEM)
+		RETURN_ERROR(SP_ERR_MEM, "Port structure malloc failed");
+
+	RETURN_OK();
+}
+
+/* Build the path of a port's latency_timer attribute, as used by ftdi_sio. */
+static enum sp_return latency_timer_path(struct sp_port *port,
+	char *path, size_t size)
+{
+	char root[PATH_MAX];
+	const char *dev;
+
+	get_root(root, sizeof(root));
+
+	if (!(dev = get_tty_name(port, root)))
+		RETURN_ERROR(SP_ERR_ARG, "Device name not recognized");
+
+	if (snprintf(path, size, "%s/sys/class/tty/%s/device/latency_timer",
+			root, dev) >= (int) size)
+		RETURN_ERROR(SP_ERR_ARG, "Device name too long");
+
+	if (access(path, F_OK) < 0)
+		RETURN_ERROR(SP_ERR_SUPP, "Device has no latency timer");
+
+	RETURN_OK();
+}
+
+SP_PRIV enum sp_return get_latency_timer(struct sp_port *port, int *timer_ms)
+{
+	char path[PATH_MAX], value[8];
+
+	TRY(latency_timer_path(port, path, sizeof(path)));
+
+	if (read_attr(AT_FDCWD, path, value, sizeof(value)) < 0)
+		RETURN_FAIL("Could not read latency timer");
+
+	if (sscanf(value, "%d", timer_ms) != 1)
+		RETURN_ERROR(SP_ERR_FAIL, "Could not parse latency timer");
+
+	DEBUG_FMT("Latency timer of port %s is %d ms", port->name, *timer_ms);
+
+	RETURN_OK();
+}
+
+SP_PRIV enum sp_return set_latency_timer(struct sp_port *port, int timer_ms)
+{
+	char path[PATH_MAX], value[8];
+	int fd, len;
+	ssize_t result;
+
+	TRY(latency_timer_path(port, path, sizeof(path)));
+
+	DEBUG_FMT("Setting latency timer of port %s to %d ms", port->name, timer_ms);
+
+	/* Truncate as a shell redirection does, for attributes that are files. */
+	if ((fd = open(path, O_WRONLY | O_TRUNC | O_CLOEXEC)) < 0)
+		RETURN_FAIL("Could not open latency timer");
+	len = snprintf(value, sizeof(value), "%d", timer_ms);
+	result = write(fd, value, len);
+	close(fd);
+
+	if (result != len)
+		RETURN_FAIL("Could not write latency timer");
+
+	RETURN_OK();
+}
@@ -193,7 +193,7 @@ SP_PRIV enum sp_return get_port_details(struct sp_port *port)
 	RETURN_OK();
 }
 
-SP_PRIV enum sp_return list_ports(struct sp_port ***list)
+SP_PRIV enum sp_return list_ports(struct port_list *list)
 {
 	CFMutableDictionaryRef classes;
 	io_iterator_t iter;
@@ -226,7 +226,7 @@ SP_PRIV enum sp_return list_ports(struct sp_port ***list)
 			CFRelease(cf_path);
 			if (result) {
 				DEBUG_FMT("Found port %s", path);
-				if (!(*list = list_append(*list, path))) {
+				if (!list_append(list, path)) {
 					SET_ERROR(ret, SP_ERR_MEM, "List append failed");
 					IOObjectRelease(port);
 					goto out;
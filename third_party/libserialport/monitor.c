@@ -0,0 +1,866 @@
+/*
+ * This file is part of the libserialport project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libserialport_internal.h"
+
+#ifdef __linux__
+
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+/* Initial number of slots in a port index, including the terminating NULL. */
+#define INITIAL_INDEX_SIZE 16
+
+/* Netlink multicast group on which the kernel sends uevents. */
+#define UEVENT_GROUP 1
+
+/*
+ * Ports sorted by a key, for binary search. Ties are broken by name, so
+ * that every port has a unique position. The array is NULL-terminated.
+ */
+struct port_index {
+	struct sp_port **ports;
+	size_t count, size;
+};
+
+typedef int (*port_compare)(const struct sp_port *a, const struct sp_port *b);
+
+struct monitor_event {
+	struct monitor_event *next;
+	enum sp_monitor_event event;
+	struct sp_port *port;
+};
+
+struct sp_monitor {
+	int fd;
+	/* Whether fd is a netlink socket, rather than an inotify instance. */
+	bool netlink;
+	struct port_index by_name;
+	struct port_index by_usb;
+	struct port_index by_serial;
+	/* Changes not yet returned by sp_read_monitor_event(). */
+	struct monitor_event *head, *tail;
+	/* Ports which have left the snapshot but may still be referenced. */
+	struct port_index retired;
+};
+
+static int compare_strings(const char *a, const char *b)
+{
+	if (!a || !b)
+		return !a - !b;
+	return strcmp(a, b);
+}
+
+static int compare_name(const struct sp_port *a, const struct sp_port *b)
+{
+	return strcmp(a->name, b->name);
+}
+
+static int compare_usb(const struct sp_port *a, const struct sp_port *b)
+{
+	if (a->usb_bus != b->usb_bus)
+		return a->usb_bus < b->usb_bus ? -1 : 1;
+	if (a->usb_address != b->usb_address)
+		return a->usb_address < b->usb_address ? -1 : 1;
+	return strcmp(a->name, b->name);
+}
+
+static int compare_serial(const struct sp_port *a, const struct sp_port *b)
+{
+	int result = strcmp(a->usb_serial, b->usb_serial);
+
+	return result ? result : strcmp(a->name, b->name);
+}
+
+static bool has_usb_address(const struct sp_port *port)
+{
+	return port->usb_bus >= 0 && port->usb_address >= 0;
+}
+
+static bool has_usb_serial(const struct sp_port *port)
+{
+	return port->usb_serial && port->usb_serial[0];
+}
+
+/* Find the first position whose port does not sort before the key. */
+static size_t index_search(const struct port_index *index,
+	const struct sp_port *key, port_compare compare)
+{
+	size_t low = 0, high = index->count, mid;
+
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		if (compare(index->ports[mid], key) < 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+/* Make room for one more port, so that a following insert cannot fail. */
+static enum sp_return index_reserve(struct port_index *index)
+{
+	struct sp_port **ports;
+	size_t size;
+
+	if (index->count + 2 <= index->size)
+		RETURN_OK();
+
+	size = index->size ? index->size * 2 : INITIAL_INDEX_SIZE;
+
+	if (!(ports = realloc(index->ports, sizeof(struct sp_port *) * size)))
+		RETURN_ERROR(SP_ERR_MEM, "Port index realloc failed");
+
+	index->ports = ports;
+	index->size = size;
+	index->ports[index->count] = NULL;
+
+	RETURN_OK();
+}
+
+static void index_insert(struct port_index *index, struct sp_port *port,
+	port_compare compare)
+{
+	size_t pos = compare ? index_search(index, port, compare) : index->count;
+
+	memmove(&index->ports[pos + 1], &index->ports[pos],
+		sizeof(struct sp_port *) * (index->count - pos));
+	index->ports[pos] = port;
+	index->ports[++index->count] = NULL;
+}
+
+static void index_remove(struct port_index *index, struct sp_port *port,
+	port_compare compare)
+{
+	size_t pos = index_search(index, port, compare);
+
+	if (pos == index->count || index->ports[pos] != port)
+		return;
+
+	memmove(&index->ports[pos], &index->ports[pos + 1],
+		sizeof(struct sp_port *) * (index->count - pos));
+	index->count--;
+}
+
+static void free_retired(struct sp_monitor *monitor)
+{
+	size_t i;
+
+	for (i = 0; i < monitor->retired.count; i++)
+		sp_free_port(monitor->retired.ports[i]);
+	monitor->retired.count = 0;
+}
+
+/*
+ * Make room for a port to be added to the snapshot and another to leave
+ * it, so that the snapshot can be updated without any failure.
+ */
+static enum sp_return reserve_port(struct sp_monitor *monitor)
+{
+	TRY(index_reserve(&monitor->by_name));
+	TRY(index_reserve(&monitor->by_usb));
+	TRY(index_reserve(&monitor->by_serial));
+	TRY(index_reserve(&monitor->retired));
+
+	RETURN_OK();
+}
+
+/* Add a port to the snapshot, taking ownership of it. */
+static void insert_port(struct sp_monitor *monitor, struct sp_port *port)
+{
+	index_insert(&monitor->by_name, port, compare_name);
+	if (has_usb_address(port))
+		index_insert(&monitor->by_usb, port, compare_usb);
+	if (has_usb_serial(port))
+		index_insert(&monitor->by_serial, port, compare_serial);
+}
+
+/*
+ * Remove a port from the snapshot. It is kept until the changes already
+ * returned to the caller are out of use.
+ */
+static void remove_port(struct sp_monitor *monitor, struct sp_port *port)
+{
+	index_remove(&monitor->by_name, port, compare_name);
+	if (has_usb_address(port))
+		index_remove(&monitor->by_usb, port, compare_usb);
+	if (has_usb_serial(port))
+		index_remove(&monitor->by_serial, port, compare_serial);
+
+	index_insert(&monitor->retired, port, NULL);
+}
+
+static struct sp_port *find_port(const struct port_index *index,
+	const struct sp_port *key, port_compare compare)
+{
+	size_t pos = index_search(index, key, compare);
+
+	return pos < index->count ? index->ports[pos] : NULL;
+}
+
+static bool same_details(const struct sp_port *a, const struct sp_port *b)
+{
+	return a->transport == b->transport &&
+		a->usb_bus == b->usb_bus &&
+		a->usb_address == b->usb_address &&
+		a->usb_vid == b->usb_vid &&
+		a->usb_pid == b->usb_pid &&
+		!compare_strings(a->description, b->description) &&
+		!compare_strings(a->usb_manufacturer, b->usb_manufacturer) &&
+		!compare_strings(a->usb_product, b->usb_product) &&
+		!compare_strings(a->usb_serial, b->usb_serial) &&
+		!compare_strings(a->bluetooth_address, b->bluetooth_address);
+}
+
+static enum sp_return queue_event(struct sp_monitor *monitor,
+	enum sp_monitor_event event, struct sp_port *port)
+{
+	struct monitor_event *entry;
+
+	if (!(entry = malloc(sizeof(struct monitor_event))))
+		RETURN_ERROR(SP_ERR_MEM, "Monitor event malloc failed");
+
+	entry->next = NULL;
+	entry->event = event;
+	entry->port = port;
+
+	if (monitor->tail)
+		monitor->tail->next = entry;
+	else
+		monitor->head = entry;
+	monitor->tail = entry;
+
+	RETURN_OK();
+}
+
+/*
+ * Replace a port in the snapshot with its rescanned state, either of which
+ * may be NULL, and queue the change if there is one. Takes ownership of
+ * the new port, freeing it if it is unchanged or on failure.
+ */
+static enum sp_return replace_port(struct sp_monitor *monitor,
+	struct sp_port *old, struct sp_port *port)
+{
+	enum sp_return ret;
+
+	if (old && port && same_details(old, port)) {
+		sp_free_port(port);
+		RETURN_OK();
+	}
+
+	if ((ret = reserve_port(monitor)) != SP_OK ||
+			(ret = queue_event(monitor, !old ? SP_MONITOR_ADDED :
+				!port ? SP_MONITOR_REMOVED : SP_MONITOR_CHANGED,
+				port ? port : old)) != SP_OK) {
+		if (port)
+			sp_free_port(port);
+		RETURN_CODEVAL(ret);
+	}
+
+	if (old)
+		remove_port(monitor, old);
+	if (port)
+		insert_port(monitor, port);
+
+	RETURN_OK();
+}
+
+/* Rescan a single tty, and queue a change if it differs from the snapshot. */
+static enum sp_return update_tty(struct sp_monitor *monitor, const char *tty)
+{
+	struct sp_port *port, *old, key;
+	char root[PATH_MAX], name[PATH_MAX];
+
+	DEBUG_FMT("Rescanning %s", tty);
+
+	TRY(get_tty_port(tty, &port));
+
+	if (port) {
+		old = find_port(&monitor->by_name, port, compare_name);
+	} else {
+		get_root(root, sizeof(root));
+		if (snprintf(name, sizeof(name), "%s/dev/%s", root, tty) >= (int) sizeof(name))
+			RETURN_OK();
+		key.name = name;
+		old = find_port(&monitor->by_name, &key, compare_name);
+	}
+
+	if (old && strcmp(old->name, port ? port->name : name))
+		old = NULL;
+
+	if (!old && !port)
+		RETURN_OK();
+
+	RETURN_CODEVAL(replace_port(monitor, old, port));
+}
+
+/* Enumerate all ports into a new list. */
+static enum sp_return scan_ports(struct port_list *list)
+{
+	enum sp_return ret;
+
+	list->count = 0;
+	list->size = INITIAL_INDEX_SIZE;
+	list->filter = NULL;
+	list->limit = 0;
+
+	if (!(list->ports = malloc(sizeof(struct sp_port *) * list->size)))
+		RETURN_ERROR(SP_ERR_MEM, "Port list malloc failed");
+
+	list->ports[0] = NULL;
+
+	if ((ret = list_ports(list)) != SP_OK) {
+		sp_free_port_list(list->ports);
+		RETURN_CODEVAL(ret);
+	}
+
+	RETURN_OK();
+}
+
+/* Free the ports of a list from the given position on, and the list. */
+static void free_ports_from(struct port_list *list, size_t pos)
+{
+	for (; pos < list->count; pos++)
+		sp_free_port(list->ports[pos]);
+	free(list->ports);
+}
+
+static int compare_name_ptr(const void *a, const void *b)
+{
+	return compare_name(*(struct sp_port * const *) a,
+		*(struct sp_port * const *) b);
+}
+
+/*
+ * Rescan all ports after notifications have been lost, and queue the
+ * differences from the snapshot: first the removals, then additions and
+ * changes in order of name.
+ */
+static enum sp_return rescan_ports(struct sp_monitor *monitor)
+{
+	struct port_list list;
+	struct sp_port *old;
+	enum sp_return ret;
+	size_t i;
+
+	DEBUG("Rescanning all ports");
+
+	TRY(scan_ports(&list));
+
+	qsort(list.ports, list.count, sizeof(struct sp_port *), compare_name_ptr);
+
+	/* Going backwards, removals do not move the ports still to check. */
+	for (i = monitor->by_name.count; i-- > 0; ) {
+		old = monitor->by_name.ports[i];
+		if (bsearch(&old, list.ports, list.count, sizeof(struct sp_port *),
+				compare_name_ptr))
+			continue;
+		if ((ret = replace_port(monitor, old, NULL)) != SP_OK) {
+			free_ports_from(&list, 0);
+			RETURN_CODEVAL(ret);
+		}
+	}
+
+	for (i = 0; i < list.count; i++) {
+		old = find_port(&monitor->by_name, list.ports[i], compare_name);
+		if (old && strcmp(old->name, list.ports[i]->name))
+			old = NULL;
+		/* The port is taken over or freed, even on failure. */
+		if ((ret = replace_port(monitor, old, list.ports[i])) != SP_OK) {
+			free_ports_from(&list, i + 1);
+			RETURN_CODEVAL(ret);
+		}
+	}
+
+	free(list.ports);
+
+	RETURN_OK();
+}
+
+/* Get the tty named by a kernel uevent for the tty subsystem, if any. */
+static const char *uevent_tty(const char *buf, size_t len)
+{
+	const char *ptr, *end = buf + len, *devname = NULL;
+	bool is_tty = false;
+
+	/* The message is a header followed by KEY=value strings. */
+	for (ptr = buf; ptr < end; ptr += strlen(ptr) + 1) {
+		if (!strcmp(ptr, "SUBSYSTEM=tty"))
+			is_tty = true;
+		else if (!strncmp(ptr, "DEVNAME=", 8))
+			devname = ptr + 8;
+	}
+
+	if (!is_tty || !devname)
+		return NULL;
+
+	/* Ports in subdirectories of /dev are not enumerated. */
+	if (strchr(devname, '/'))
+		return NULL;
+
+	return devname;
+}
+
+static enum sp_return read_netlink(struct sp_monitor *monitor)
+{
+	char buf[8192];
+	struct sockaddr_nl addr;
+	socklen_t addr_len;
+	const char *tty;
+	ssize_t len;
+
+	while (1) {
+		addr_len = sizeof(addr);
+		len = recvfrom(monitor->fd, buf, sizeof(buf) - 1, 0,
+			(struct sockaddr *) &addr, &addr_len);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				break;
+			/* Notifications were lost, so compare every port. */
+			if (errno == ENOBUFS) {
+				DEBUG("Netlink receive buffer overflowed");
+				TRY(rescan_ports(monitor));
+				continue;
+			}
+			RETURN_FAIL("recvfrom() failed");
+		}
+		/* Only trust messages sent by the kernel. */
+		if (addr.nl_pid != 0)
+			continue;
+		buf[len] = 0;
+		if ((tty = uevent_tty(buf, len)))
+			TRY(update_tty(monitor, tty));
+	}
+
+	RETURN_OK();
+}
+
+static enum sp_return read_inotify(struct sp_monitor *monitor)
+{
+	/* Aligned for struct inotify_event. */
+	long buf[4096 / sizeof(long)];
+	const struct inotify_event *event;
+	const char *ptr, *prev;
+	ssize_t len;
+
+	while (1) {
+		len = read(monitor->fd, buf, sizeof(buf));
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				break;
+			RETURN_FAIL("read() failed");
+		}
+		prev = NULL;
+		for (ptr = (const char *) buf; ptr < (const char *) buf + len;
+				ptr += sizeof(struct inotify_event) + event->len) {
+			event = (const struct inotify_event *) ptr;
+			/* Notifications were lost, so compare every port. */
+			if (event->mask & IN_Q_OVERFLOW) {
+				DEBUG("Inotify queue overflowed");
+				TRY(rescan_ports(monitor));
+				prev = NULL;
+				continue;
+			}
+			if (!event->len || event->mask & IN_ISDIR)
+				continue;
+			/* Consecutive events for one file need only one rescan. */
+			if (prev && !strcmp(prev, event->name))
+				continue;
+			TRY(update_tty(monitor, event->name));
+			prev = event->name;
+		}
+	}
+
+	RETURN_OK();
+}
+
+static enum sp_return open_netlink(struct sp_monitor *monitor)
+{
+	struct sockaddr_nl addr;
+
+	if ((monitor->fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK,
+			NETLINK_KOBJECT_UEVENT)) < 0)
+		RETURN_FAIL("socket() failed");
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = UEVENT_GROUP;
+
+	if (bind(monitor->fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		close(monitor->fd);
+		monitor->fd = -1;
+		RETURN_FAIL("bind() failed");
+	}
+
+	monitor->netlink = true;
+
+	RETURN_OK();
+}
+
+static enum sp_return open_inotify(struct sp_monitor *monitor, const char *root)
+{
+	char path[PATH_MAX];
+
+	if (snprintf(path, sizeof(path), "%s/dev", root) >= (int) sizeof(path))
+		RETURN_ERROR(SP_ERR_ARG, "Root path too long");
+
+	if ((monitor->fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK)) < 0)
+		RETURN_FAIL("inotify_init1() failed");
+
+	if (inotify_add_watch(monitor->fd, path, IN_CREATE | IN_DELETE |
+			IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO) < 0) {
+		close(monitor->fd);
+		monitor->fd = -1;
+		RETURN_FAIL("inotify_add_watch() failed");
+	}
+
+	monitor->netlink = false;
+
+	RETURN_OK();
+}
+
+SP_API enum sp_return sp_new_monitor(struct sp_monitor **monitor_ptr)
+{
+	struct sp_monitor *monitor;
+	struct port_list list;
+	char root[PATH_MAX];
+	enum sp_return ret;
+	size_t i;
+
+	TRACE("%p", monitor_ptr);
+
+	if (!monitor_ptr)
+		RETURN_ERROR(SP_ERR_ARG, "Null result pointer");
+
+	*monitor_ptr = NULL;
+
+	if (!(monitor = calloc(1, sizeof(struct sp_monitor))))
+		RETURN_ERROR(SP_ERR_MEM, "Monitor malloc failed");
+
+	/*
+	 * Start watching before taking the snapshot, so that no change is
+	 * missed. Changes which are already included are not reported, as
+	 * the rescan finds the port unchanged.
+	 */
+	get_root(root, sizeof(root));
+	if (root[0] || open_netlink(monitor) != SP_OK) {
+		DEBUG("Using inotify to monitor ports");
+		if ((ret = open_inotify(monitor, root)) != SP_OK) {
+			free(monitor);
+			RETURN_CODEVAL(ret);
+		}
+	} else {
+		DEBUG("Using netlink to monitor ports");
+	}
+
+	/* The snapshot always has an array, even if it holds no ports. */
+	if ((ret = reserve_port(monitor)) != SP_OK ||
+			(ret = scan_ports(&list)) != SP_OK) {
+		sp_free_monitor(monitor);
+		RETURN_CODEVAL(ret);
+	}
+
+	for (i = 0; i < list.count; i++) {
+		if ((ret = reserve_port(monitor)) != SP_OK) {
+			/* Free the ports not yet taken over by the monitor. */
+			free_ports_from(&list, i);
+			sp_free_monitor(monitor);
+			RETURN_CODEVAL(ret);
+		}
+		insert_port(monitor, list.ports[i]);
+	}
+
+	/* The ports now belong to the monitor. */
+	free(list.ports);
+
+	DEBUG_FMT("Monitoring %d ports", monitor->by_name.count);
+
+	*monitor_ptr = monitor;
+
+	RETURN_OK();
+}
+
+SP_API enum sp_return sp_get_monitor_handle(const struct sp_monitor *monitor,
+	int *fd_ptr)
+{
+	TRACE("%p, %p", monitor, fd_ptr);
+
+	if (!monitor)
+		RETURN_ERROR(SP_ERR_ARG, "Null monitor");
+
+	if (!fd_ptr)
+		RETURN_ERROR(SP_ERR_ARG, "Null result pointer");
+
+	*fd_ptr = monitor->fd;
+
+	RETURN_OK();
+}
+
+SP_API enum sp_return sp_read_monitor_event(struct sp_monitor *monitor,
+	enum sp_monitor_event *event_ptr, struct sp_port **port_ptr)
+{
+	struct monitor_event *entry;
+
+	TRACE("%p, %p, %p", monitor, event_ptr, port_ptr);
+
+	if (!monitor)
+		RETURN_ERROR(SP_ERR_ARG, "Null monitor");
+
+	if (!event_ptr || !port_ptr)
+		RETURN_ERROR(SP_ERR_ARG, "Null result pointer");
+
+	*port_ptr = NULL;
+
+	if (!monitor->head) {
+		/* Ports returned by earlier calls are no longer in use. */
+		free_retired(monitor);
+
+		if (monitor->netlink)
+			TRY(read_netlink(monitor));
+		else
+			TRY(read_inotify(monitor));
+	}
+
+	if (!(entry = monitor->head))
+		RETURN_INT(0);
+
+	monitor->head = entry->next;
+	if (!monitor->head)
+		monitor->tail = NULL;
+
+	*event_ptr = entry->event;
+	*port_ptr = entry->port;
+	free(entry);
+
+	DEBUG_FMT("Port %s %s", (*port_ptr)->name,
+		*event_ptr == SP_MONITOR_ADDED ? "added" :
+		*event_ptr == SP_MONITOR_REMOVED ? "removed" : "changed");
+
+	RETURN_INT(1);
+}
+
+SP_API enum sp_return sp_get_monitor_ports(const struct sp_monitor *monitor,
+	struct sp_port * const **list_ptr)
+{
+	TRACE("%p, %p", monitor, list_ptr);
+
+	if (!monitor)
+		RETURN_ERROR(SP_ERR_ARG, "Null monitor");
+
+	if (!list_ptr)
+		RETURN_ERROR(SP_ERR_ARG, "Null result pointer");
+
+	*list_ptr = monitor->by_name.ports;
+
+	RETURN_INT((int) monitor->by_name.count);
+}
+
+SP_API enum sp_return sp_find_monitor_port_by_name(const struct sp_monitor *monitor,
+	const char *portname, struct sp_port **port_ptr)
+{
+	struct sp_port key, *port;
+
+	TRACE("%p, %s, %p", monitor, portname, port_ptr);
+
+	if (!port_ptr)
+		RETURN_ERROR(SP_ERR_ARG, "Null result pointer");
+
+	*port_ptr = NULL;
+
+	if (!monitor)
+		RETURN_ERROR(SP_ERR_ARG, "Null monitor");
+
+	if (!portname)
+		RETURN_ERROR(SP_ERR_ARG, "Null port name");
+
+	key.name = (char *) portname;
+	port = find_port(&monitor->by_name, &key, compare_name);
+
+	if (port && !strcmp(port->name, portname))
+		*port_ptr = port;
+
+	RETURN_OK();
+}
+
+SP_API enum sp_return sp_find_monitor_port_by_usb(const struct sp_monitor *monitor,
+	int usb_bus, int usb_address, struct sp_port **port_ptr)
+{
+	struct sp_port key, *port;
+
+	TRACE("%p, %d, %d, %p", monitor, usb_bus, usb_address, port_ptr);
+
+	if (!port_ptr)
+		RETURN_ERROR(SP_ERR_ARG, "Null result pointer");
+
+	*port_ptr = NULL;
+
+	if (!monitor)
+		RETURN_ERROR(SP_ERR_ARG, "Null monitor");
+
+	/* The empty name sorts before all others with the same address. */
+	key.name = "";
+	key.usb_bus = usb_bus;
+	key.usb_address = usb_address;
+	port = find_port(&monitor->by_usb, &key, compare_usb);
+
+	if (port && port->usb_bus == usb_bus && port->usb_address == usb_address)
+		*port_ptr = port;
+
+	RETURN_OK();
+}
+
+SP_API enum sp_return sp_find_monitor_port_by_serial(const struct sp_monitor *monitor,
+	const char *usb_serial, struct sp_port **port_ptr)
+{
+	struct sp_port key, *port;
+
+	TRACE("%p, %s, %p", monitor, usb_serial, port_ptr);
+
+	if (!port_ptr)
+		RETURN_ERROR(SP_ERR_ARG, "Null result pointer");
+
+	*port_ptr = NULL;
+
+	if (!monitor)
+		RETURN_ERROR(SP_ERR_ARG, "Null monitor");
+
+	if (!usb_serial)
+		RETURN_ERROR(SP_ERR_ARG, "Null serial number");
+
+	key.name = "";
+	key.usb_serial = (char *) usb_serial;
+	port = find_port(&monitor->by_serial, &key, compare_serial);
+
+	if (port && !strcmp(port->usb_serial, usb_serial))
+		*port_ptr = port;
+
+	RETURN_OK();
+}
+
+SP_API void sp_free_monitor(struct sp_monitor *monitor)
+{
+	struct monitor_event *entry;
+	size_t i;
+
+	TRACE("%p", monitor);
+
+	if (!monitor) {
+		DEBUG("Null monitor");
+		RETURN();
+	}
+
+	DEBUG("Freeing monitor");
+
+	while ((entry = monitor->head)) {
+		monitor->head = entry->next;
+		free(entry);
+	}
+
+	for (i = 0; i < monitor->by_name.count; i++)
+		sp_free_port(monitor->by_name.ports[i]);
+	free_retired(monitor);
+
+	free(monitor->by_name.ports);
+	free(monitor->by_usb.ports);
+	free(monitor->by_serial.ports);
+	free(monitor->retired.ports);
+
+	if (monitor->fd >= 0)
+		close(monitor->fd);
+
+	free(monitor);
+
+	RETURN();
+}
+
+#else
+
+SP_API enum sp_return sp_new_monitor(struct sp_monitor **monitor_ptr)
+{
+	TRACE("%p", monitor_ptr);
+
+	if (!monitor_ptr)
+		RETURN_ERROR(SP_ERR_ARG, "Null result pointer");
+
+	*monitor_ptr = NULL;
+
+	RETURN_ERROR(SP_ERR_SUPP, "Monitoring not supported on this platform");
+}
+
+SP_API enum sp_return sp_get_monitor_handle(const struct sp_monitor *monitor,
+	int *fd_ptr)
+{
+	TRACE("%p, %p", monitor, fd_ptr);
+
+	RETURN_ERROR(SP_ERR_SUPP, "Monitoring not supported on this platform");
+}
+
+SP_API enum sp_return sp_read_monitor_event(struct sp_monitor *monitor,
+	enum sp_monitor_event *event_ptr, struct sp_port **port_ptr)
+{
+	TRACE("%p, %p, %p", monitor, event_ptr, port_ptr);
+
+	RETURN_ERROR(SP_ERR_SUPP, "Monitoring not supported on this platform");
+}
+
+SP_API enum sp_return sp_get_monitor_ports(const struct sp_monitor *monitor,
+	struct sp_port * const **list_ptr)
+{
+	TRACE("%p, %p", monitor, list_ptr);
+
+	RETURN_ERROR(SP_ERR_SUPP, "Monitoring not supported on this platform");
+}
+
+SP_API enum sp_return sp_find_monitor_port_by_name(const struct sp_monitor *monitor,
+	const char *portname, struct sp_port **port_ptr)
+{
+	TRACE("%p, %s, %p", monitor, portname, port_ptr);
+
+	RETURN_ERROR(SP_ERR_SUPP, "Monitoring not supported on this platform");
+}
+
+SP_API enum sp_return sp_find_monitor_port_by_usb(const struct sp_monitor *monitor,
+	int usb_bus, int usb_address, struct sp_port **port_ptr)
+{
+	TRACE("%p, %d, %d, %p", monitor, usb_bus, usb_address, port_ptr);
+
+	RETURN_ERROR(SP_ERR_SUPP, "Monitoring not supported on this platform");
+}
+
+SP_API enum sp_return sp_find_monitor_port_by_serial(const struct sp_monitor *monitor,
+	const char *usb_serial, struct sp_port **port_ptr)
+{
+	TRACE("%p, %s, %p", monitor, usb_serial, port_ptr);
+
+	RETURN_ERROR(SP_ERR_SUPP, "Monitoring not supported on this platform");
+}
+
+SP_API void sp_free_monitor(struct sp_monitor *monitor)
+{
+	TRACE("%p", monitor);
+
+	RETURN();
+}
+
+#endif
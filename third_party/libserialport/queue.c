@@ -0,0 +1,208 @@
+/*
+ * This file is part of the libserialport project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libserialport_internal.h"
+
+/* Maximum number of queued buffers submitted in one writev() call. */
+#define MAX_WRITE_IOVS 64
+
+/*
+ * Account for bytes written from the head of the queue, and complete the
+ * requests which have been written in full. Each request is unlinked before
+ * its callback runs, so that the callback may queue further writes.
+ */
+static void complete_writes(struct sp_port *port, size_t written)
+{
+	struct write_queue *queue = &port->write_queue;
+	struct write_request *req;
+	size_t remaining;
+
+	queue->bytes -= written;
+
+	while ((req = queue->head)) {
+		remaining = req->count - queue->offset;
+		if (written < remaining) {
+			queue->offset += written;
+			break;
+		}
+		written -= remaining;
+
+		queue->head = req->next;
+		if (!queue->head)
+			queue->tail = NULL;
+		queue->offset = 0;
+
+		if (req->callback)
+			req->callback(port, req->buf, req->count, req->user_data);
+		free(req);
+	}
+}
+
+SP_PRIV void discard_write_queue(struct sp_port *port)
+{
+	struct write_queue *queue = &port->write_queue;
+	struct write_request *req;
+	size_t written;
+
+	while ((req = queue->head)) {
+		written = queue->offset;
+
+		queue->head = req->next;
+		if (!queue->head)
+			queue->tail = NULL;
+		queue->offset = 0;
+		queue->bytes -= req->count - written;
+
+		if (req->callback)
+			req->callback(port, req->buf, written, req->user_data);
+		free(req);
+	}
+}
+
+SP_API enum sp_return sp_queue_write(struct sp_port *port, const void *buf,
+                                     size_t count, sp_write_callback callback,
+                                     void *user_data)
+{
+	struct write_queue *queue;
+	struct write_request *req;
+
+	TRACE("%p, %p, %d, %p, %p", port, buf, count, callback, user_data);
+
+	CHECK_OPEN_PORT();
+
+	if (!buf)
+		RETURN_ERROR(SP_ERR_ARG, "Null buffer");
+
+	if (count == 0)
+		RETURN_ERROR(SP_ERR_ARG, "Zero count");
+
+	if (count > INT_MAX)
+		RETURN_ERROR(SP_ERR_ARG, "Count too large");
+
+	queue = &port->write_queue;
+
+	if (queue->limit && queue->bytes >= queue->limit) {
+		DEBUG_FMT("Write queue of port %s is full", port->name);
+		RETURN_INT(0);
+	}
+
+	if (!(req = malloc(sizeof(struct write_request))))
+		RETURN_ERROR(SP_ERR_MEM, "Write request malloc failed");
+
+	req->next = NULL;
+	req->buf = buf;
+	req->count = count;
+	req->callback = callback;
+	req->user_data = user_data;
+
+	if (queue->tail)
+		queue->tail->next = req;
+	else
+		queue->head = req;
+	queue->tail = req;
+	queue->bytes += count;
+
+	DEBUG_FMT("Queued %d bytes for port %s, %d bytes pending",
+		count, port->name, queue->bytes);
+
+	RETURN_INT((int) count);
+}
+
+SP_API enum sp_return sp_process_write_queue(struct sp_port *port)
+{
+	struct write_queue *queue;
+
+	TRACE("%p", port);
+
+	CHECK_OPEN_PORT();
+
+	queue = &port->write_queue;
+
+#ifdef _WIN32
+	int result;
+
+	while (queue->head) {
+		result = sp_nonblocking_write(port,
+			(const char *) queue->head->buf + queue->offset,
+			queue->head->count - queue->offset);
+		if (result < 0)
+			RETURN_CODEVAL(result);
+		if (result == 0)
+			break;
+		complete_writes(port, result);
+	}
+#else
+	struct iovec iovs[MAX_WRITE_IOVS];
+	struct write_request *req;
+	size_t submitted;
+	ssize_t result;
+	int num_iovs;
+
+	TRY(ensure_nonblocking(port));
+
+	while (queue->head) {
+		/* Gather as many queued buffers as possible into one call. */
+		num_iovs = 0;
+		submitted = 0;
+		for (req = queue->head; req && num_iovs < MAX_WRITE_IOVS; req = req->next) {
+			iovs[num_iovs].iov_base = (char *) req->buf;
+			iovs[num_iovs].iov_len = req->count;
+			if (req == queue->head) {
+				iovs[num_iovs].iov_base = (char *) req->buf + queue->offset;
+				iovs[num_iovs].iov_len -= queue->offset;
+			}
+			submitted += iovs[num_iovs].iov_len;
+			num_iovs++;
+		}
+
+		result = writev(port->fd, iovs, num_iovs);
+		STAT_ADD(port, writes, 1);
+
+		if (result < 0) {
+			if (errno == EINTR) {
+				STAT_ADD(port, retries, 1);
+				continue;
+			}
+			if (errno == EAGAIN)
+				break;
+			RETURN_FAIL("writev() failed");
+		}
+
+		STAT_ADD(port, bytes_written, result);
+		complete_writes(port, result);
+
+		if ((size_t) result < submitted)
+			/* The output buffer is full. */
+			break;
+	}
+#endif
+
+	DEBUG_FMT("%d bytes remain queued for port %s", queue->bytes, port->name);
+
+	RETURN_INT(queue->bytes > INT_MAX ? INT_MAX : (int) queue->bytes);
+}
+
+SP_API enum sp_return sp_set_write_queue_limit(struct sp_port *port, size_t limit)
+{
+	TRACE("%p, %d", port, limit);
+
+	CHECK_PORT();
+
+	port->write_queue.limit = limit;
+
+	RETURN_OK();
+}
@@ -0,0 +1,797 @@
+/*
+ * This file is part of the libserialport project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libserialport_internal.h"
+
+#ifdef __linux__
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+
+/* Largest number of events collected by one epoll_wait() call. */
+#define MAX_READY_EVENTS 64
+
+/* Largest number of worker threads in a reactor. */
+#define MAX_REACTOR_WORKERS 1024
+
+#define VALID_EVENTS (SP_EVENT_RX_READY | SP_EVENT_TX_READY | SP_EVENT_ERROR)
+
+/*
+ * A port's registration with a reactor. Each port is watched by the epoll
+ * instance of one worker, its owner, and its state is protected by the
+ * owner's lock, whichever worker runs its callback.
+ *
+ * Ports are registered with EPOLLONESHOT, so that an event is delivered
+ * once and the port is then disarmed until its callback has run. Events
+ * for a port are thus never queued twice, nor handled by two workers at
+ * once.
+ */
+struct reactor_port {
+	struct sp_port *port;
+	int fd;
+	struct reactor_worker *owner;
+	sp_reactor_callback callback;
+	void *user_data;
+	enum sp_event mask;
+	/* Events to pass to the callback, while queued. */
+	enum sp_event events;
+	/* Whether the port is registered with epoll and not yet triggered. */
+	bool armed;
+	bool queued;
+	bool running;
+	/* Set on removal; the registration is then freed by its owner. */
+	bool removed;
+	/* Set while sp_reactor_remove_port() waits for the callback to return. */
+	bool waiting;
+	/* The owner's list of ports. */
+	struct reactor_port *prev, *next;
+	/* The owner's ready queue, or its list of removed ports to free. */
+	struct reactor_port *queue_next;
+};
+
+struct reactor_worker {
+	struct sp_reactor *reactor;
+	pthread_t thread;
+	pid_t tid;
+	int epoll_fd;
+	/* Written to wake the worker from epoll_wait(). */
+	int wake_fd;
+	pthread_mutex_t lock;
+	/* Signalled when a callback returns, and when the thread starts. */
+	pthread_cond_t cond;
+	struct reactor_port *ports;
+	unsigned int num_ports;
+	struct reactor_port *queue_head, *queue_tail;
+	unsigned int queue_length;
+	struct reactor_port *garbage;
+	/*
+	 * 1 while waiting in epoll_wait(), and 2 once another worker has
+	 * claimed it to steal work, so that each sleeper is woken only once.
+	 */
+	int sleeping;
+	unsigned long long dispatched;
+	unsigned long long stolen;
+};
+
+struct sp_reactor {
+	unsigned int num_workers;
+	int stopping;
+	struct reactor_worker *workers;
+};
+
+/* Port whose callback the current thread is running, if any. */
+static __thread struct reactor_port *current_port;
+
+static uint32_t epoll_events(enum sp_event mask)
+{
+	uint32_t events = EPOLLONESHOT;
+
+	if (mask & SP_EVENT_RX_READY)
+		events |= EPOLLIN;
+	if (mask & SP_EVENT_TX_READY)
+		events |= EPOLLOUT;
+
+	return events;
+}
+
+/* Watch a port again for the events in its mask. Called with its owner locked. */
+static int arm_port(struct reactor_port *rp, int op)
+{
+	struct epoll_event event;
+
+	memset(&event, 0, sizeof(event));
+	event.events = epoll_events(rp->mask);
+	event.data.ptr = rp;
+
+	if (epoll_ctl(rp->owner->epoll_fd, op, rp->fd, &event) < 0)
+		return -1;
+
+	rp->armed = true;
+
+	return 0;
+}
+
+/* Called with the owner locked, once no worker can refer to the port. */
+static void discard_port(struct reactor_port *rp)
+{
+	rp->queue_next = rp->owner->garbage;
+	rp->owner->garbage = rp;
+}
+
+static void free_garbage(struct reactor_worker *worker)
+{
+	struct reactor_port *rp;
+
+	pthread_mutex_lock(&worker->lock);
+	while ((rp = worker->garbage)) {
+		worker->garbage = rp->queue_next;
+		free(rp);
+	}
+	pthread_mutex_unlock(&worker->lock);
+}
+
+static void wake_worker(struct reactor_worker *worker)
+{
+	uint64_t value = 1;
+
+	if (write(worker->wake_fd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+		DEBUG_ERROR(SP_ERR_FAIL, "Reactor worker wakeup failed");
+}
+
+/* Wake up to count sleeping workers, so that they can steal queued ports. */
+static void wake_thieves(struct reactor_worker *self, unsigned int count)
+{
+	struct sp_reactor *reactor = self->reactor;
+	struct reactor_worker *worker;
+	unsigned int i;
+	int sleeping;
+
+	for (i = 0; i < reactor->num_workers && count > 0; i++) {
+		worker = &reactor->workers[i];
+		sleeping = 1;
+		if (worker == self || !__atomic_compare_exchange_n(&worker->sleeping,
+				&sleeping, 2, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+			continue;
+		wake_worker(worker);
+		count--;
+	}
+}
+
+/* Queue the ports reported ready by epoll_wait(). Returns how many were queued. */
+static unsigned int queue_events(struct reactor_worker *worker,
+		struct epoll_event *events, int count)
+{
+	struct reactor_port *rp;
+	unsigned int queued = 0;
+	uint64_t value;
+	int i;
+
+	pthread_mutex_lock(&worker->lock);
+
+	for (i = 0; i < count; i++) {
+		if (!(rp = events[i].data.ptr)) {
+			/* Wakeup. */
+			while (read(worker->wake_fd, &value, sizeof(value)) > 0)
+				;
+			continue;
+		}
+
+		rp->armed = false;
+		if (rp->removed)
+			continue;
+
+		rp->events = 0;
+		if (events[i].events & EPOLLIN)
+			rp->events |= SP_EVENT_RX_READY;
+		if (events[i].events & EPOLLOUT)
+			rp->events |= SP_EVENT_TX_READY;
+		if (events[i].events & (EPOLLERR | EPOLLHUP))
+			rp->events |= SP_EVENT_ERROR;
+
+		rp->queue_next = NULL;
+		if (worker->queue_tail)
+			worker->queue_tail->queue_next = rp;
+		else
+			worker->queue_head = rp;
+		worker->queue_tail = rp;
+		rp->queued = true;
+		queued++;
+	}
+
+	__atomic_store_n(&worker->queue_length, worker->queue_length + queued,
+		__ATOMIC_RELAXED);
+
+	pthread_mutex_unlock(&worker->lock);
+
+	return queued;
+}
+
+/*
+ * Run the callback of the first port in the queue of a worker, which may
+ * be another worker than the one calling. Returns false if it was empty.
+ */
+static bool run_queued(struct reactor_worker *self, struct reactor_worker *owner)
+{
+	struct reactor_port *rp;
+	enum sp_event events;
+
+	pthread_mutex_lock(&owner->lock);
+
+	if (!(rp = owner->queue_head)) {
+		pthread_mutex_unlock(&owner->lock);
+		return false;
+	}
+
+	owner->queue_head = rp->queue_next;
+	if (!owner->queue_head)
+		owner->queue_tail = NULL;
+	__atomic_store_n(&owner->queue_length, owner->queue_length - 1,
+		__ATOMIC_RELAXED);
+	rp->queued = false;
+
+	if (rp->removed) {
+		discard_port(rp);
+		pthread_mutex_unlock(&owner->lock);
+		return true;
+	}
+
+	rp->running = true;
+	events = rp->events;
+
+	pthread_mutex_unlock(&owner->lock);
+
+	__atomic_add_fetch(&self->dispatched, 1, __ATOMIC_RELAXED);
+	if (self != owner)
+		__atomic_add_fetch(&self->stolen, 1, __ATOMIC_RELAXED);
+
+	current_port = rp;
+	rp->callback(rp->port, events, rp->user_data);
+	current_port = NULL;
+
+	pthread_mutex_lock(&owner->lock);
+
+	rp->running = false;
+	if (rp->waiting) {
+		/* The waiting remover discards the port. */
+		pthread_cond_broadcast(&owner->cond);
+	} else if (rp->removed) {
+		discard_port(rp);
+	} else if (!(events & SP_EVENT_ERROR) && !rp->armed) {
+		/* After an error, wait for sp_reactor_modify_port(). */
+		if (arm_port(rp, EPOLL_CTL_MOD) < 0)
+			DEBUG_ERROR(SP_ERR_FAIL, "Rearming reactor port failed");
+	}
+
+	pthread_mutex_unlock(&owner->lock);
+
+	return true;
+}
+
+/* Take a port from the busiest other worker's queue and run it. */
+static bool steal_work(struct reactor_worker *self)
+{
+	struct sp_reactor *reactor = self->reactor;
+	struct reactor_worker *victim = NULL;
+	unsigned int i, length, longest = 0;
+
+	for (i = 0; i < reactor->num_workers; i++) {
+		if (&reactor->workers[i] == self)
+			continue;
+		length = __atomic_load_n(&reactor->workers[i].queue_length,
+			__ATOMIC_RELAXED);
+		if (length > longest) {
+			longest = length;
+			victim = &reactor->workers[i];
+		}
+	}
+
+	return victim && run_queued(self, victim);
+}
+
+static void *worker_thread(void *arg)
+{
+	struct reactor_worker *worker = arg;
+	struct epoll_event events[MAX_READY_EVENTS];
+	unsigned int queued;
+	int count;
+
+	pthread_mutex_lock(&worker->lock);
+	worker->tid = (pid_t) syscall(SYS_gettid);
+	pthread_cond_broadcast(&worker->cond);
+	pthread_mutex_unlock(&worker->lock);
+
+	while (!__atomic_load_n(&worker->reactor->stopping, __ATOMIC_ACQUIRE)) {
+		/* Run this worker's queue first, then help the others. */
+		if (run_queued(worker, worker) || steal_work(worker))
+			continue;
+
+		/*
+		 * Removed ports can only be freed between calls to epoll_wait(),
+		 * as events it returns may still refer to them until queued.
+		 */
+		free_garbage(worker);
+
+		__atomic_store_n(&worker->sleeping, 1, __ATOMIC_SEQ_CST);
+		count = epoll_wait(worker->epoll_fd, events, MAX_READY_EVENTS, -1);
+		__atomic_store_n(&worker->sleeping, 0, __ATOMIC_SEQ_CST);
+
+		if (count < 0) {
+			if (errno == EINTR)
+				continue;
+			DEBUG_ERROR(SP_ERR_FAIL, "Reactor epoll_wait() failed");
+			break;
+		}
+
+		queued = queue_events(worker, events, count);
+		if (queued > 1)
+			wake_thieves(worker, queued - 1);
+	}
+
+	return NULL;
+}
+
+static void free_reactor(struct sp_reactor *reactor, unsigned int num_started)
+{
+	struct reactor_worker *worker;
+	struct reactor_port *rp;
+	unsigned int i;
+
+	__atomic_store_n(&reactor->stopping, 1, __ATOMIC_RELEASE);
+
+	for (i = 0; i < num_started; i++)
+		wake_worker(&reactor->workers[i]);
+	for (i = 0; i < num_started; i++)
+		pthread_join(reactor->workers[i].thread, NULL);
+
+	for (i = 0; i < reactor->num_workers; i++) {
+		worker = &reactor->workers[i];
+		while ((rp = worker->queue_head)) {
+			worker->queue_head = rp->queue_next;
+			if (rp->removed)
+				free(rp);
+		}
+		while ((rp = worker->ports)) {
+			worker->ports = rp->next;
+			rp->port->reactor = NULL;
+			free(rp);
+		}
+		while ((rp = worker->garbage)) {
+			worker->garbage = rp->queue_next;
+			free(rp);
+		}
+		if (worker->epoll_fd >= 0)
+			close(worker->epoll_fd);
+		if (worker->wake_fd >= 0)
+			close(worker->wake_fd);
+		pthread_cond_destroy(&worker->cond);
+		pthread_mutex_destroy(&worker->lock);
+	}
+
+	free(reactor->workers);
+	free(reactor);
+}
+
+SP_API enum sp_return sp_new_reactor(unsigned int num_workers,
+	struct sp_reactor **reactor_ptr)
+{
+	struct sp_reactor *reactor;
+	struct reactor_worker *worker;
+	struct epoll_event event;
+	unsigned int i;
+	long cpus;
+	int ret;
+
+	TRACE("%d, %p", num_workers, reactor_ptr);
+
+	if (!reactor_ptr)
+		RETURN_ERROR(SP_ERR_ARG, "Null result pointer");
+
+	*reactor_ptr = NULL;
+
+	if (num_workers == 0) {
+		cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		num_workers = cpus > 0 ? (unsigned int) cpus : 1;
+	}
+
+	if (num_workers > MAX_REACTOR_WORKERS)
+		RETURN_ERROR(SP_ERR_ARG, "Too many workers");
+
+	DEBUG_FMT("Creating reactor with %d workers", num_workers);
+
+	if (!(reactor = calloc(1, sizeof(struct sp_reactor))))
+		RETURN_ERROR(SP_ERR_MEM, "Reactor malloc failed");
+
+	if (!(reactor->workers = calloc(num_workers, sizeof(struct reactor_worker)))) {
+		free(reactor);
+		RETURN_ERROR(SP_ERR_MEM, "Reactor workers malloc failed");
+	}
+
+	reactor->num_workers = num_workers;
+
+	for (i = 0; i < num_workers; i++) {
+		worker = &reactor->workers[i];
+		worker->reactor = reactor;
+		pthread_mutex_init(&worker->lock, NULL);
+		pthread_cond_init(&worker->cond, NULL);
+		worker->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		worker->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	}
+
+	for (i = 0; i < num_workers; i++) {
+		worker = &reactor->workers[i];
+		if (worker->wake_fd < 0 || worker->epoll_fd < 0) {
+			free_reactor(reactor, 0);
+			RETURN_FAIL("Creating reactor descriptors failed");
+		}
+		memset(&event, 0, sizeof(event));
+		event.events = EPOLLIN;
+		event.data.ptr = NULL;
+		if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->wake_fd, &event) < 0) {
+			free_reactor(reactor, 0);
+			RETURN_FAIL("epoll_ctl() failed");
+		}
+	}
+
+	for (i = 0; i < num_workers; i++) {
+		worker = &reactor->workers[i];
+		if ((ret = pthread_create(&worker->thread, NULL, worker_thread, worker)) != 0) {
+			free_reactor(reactor, i);
+			errno = ret;
+			RETURN_FAIL("pthread_create() failed");
+		}
+	}
+
+	/* Wait for the thread IDs needed by sp_set_reactor_affinity(). */
+	for (i = 0; i < num_workers; i++) {
+		worker = &reactor->workers[i];
+		pthread_mutex_lock(&worker->lock);
+		while (worker->tid == 0)
+			pthread_cond_wait(&worker->cond, &worker->lock);
+		pthread_mutex_unlock(&worker->lock);
+	}
+
+	*reactor_ptr = reactor;
+
+	RETURN_OK();
+}
+
+SP_API enum sp_return sp_get_reactor_workers(const struct sp_reactor *reactor)
+{
+	TRACE("%p", reactor);
+
+	if (!reactor)
+		RETURN_ERROR(SP_ERR_ARG, "Null reactor");
+
+	RETURN_INT((int) reactor->num_workers);
+}
+
+SP_API enum sp_return sp_set_reactor_affinity(struct sp_reactor *reactor,
+	unsigned int worker, int cpu)
+{
+	cpu_set_t set;
+	int i;
+
+	TRACE("%p, %d, %d", reactor, worker, cpu);
+
+	if (!reactor)
+		RETURN_ERROR(SP_ERR_ARG, "Null reactor");
+
+	if (worker >= reactor->num_workers)
+		RETURN_ERROR(SP_ERR_ARG, "Invalid worker");
+
+	if (cpu < -1 || cpu >= CPU_SETSIZE)
+		RETURN_ERROR(SP_ERR_ARG, "Invalid CPU");
+
+	CPU_ZERO(&set);
+	if (cpu >= 0) {
+		CPU_SET(cpu, &set);
+	} else {
+		for (i = 0; i < CPU_SETSIZE; i++)
+			CPU_SET(i, &set);
+	}
+
+	/* By thread ID rather than pthread_setaffinity_np(), which Android lacks. */
+	if (sched_setaffinity(reactor->workers[worker].tid, sizeof(set), &set) < 0)
+		RETURN_FAIL("sched_setaffinity() failed");
+
+	RETURN_OK();
+}
+
+SP_API enum sp_return sp_reactor_add_port(struct sp_reactor *reactor,
+	struct sp_port *port, enum sp_event mask, sp_reactor_callback callback,
+	void *user_data)
+{
+	struct reactor_worker *worker = NULL;
+	struct reactor_port *rp;
+	unsigned int i, num_ports, fewest = UINT_MAX;
+
+	TRACE("%p, %p, %d, %p, %p", reactor, port, mask, callback, user_data);
+
+	if (!reactor)
+		RETURN_ERROR(SP_ERR_ARG, "Null reactor");
+
+	CHECK_OPEN_PORT();
+
+	if (!callback)
+		RETURN_ERROR(SP_ERR_ARG, "Null callback");
+
+	if (mask & ~VALID_EVENTS)
+		RETURN_ERROR(SP_ERR_ARG, "Invalid event mask");
+
+	if (port->reactor)
+		RETURN_ERROR(SP_ERR_ARG, "Port already in a reactor");
+
+	if (port->receiver)
+		RETURN_ERROR(SP_ERR_ARG, "Receive engine is running");
+
+	if (port->io_ring)
+		RETURN_ERROR(SP_ERR_ARG, "Port is in an I/O ring");
+
+	TRY(ensure_nonblocking(port));
+
+	for (i = 0; i < reactor->num_workers; i++) {
+		num_ports = __atomic_load_n(&reactor->workers[i].num_ports,
+			__ATOMIC_RELAXED);
+		if (num_ports < fewest) {
+			fewest = num_ports;
+			worker = &reactor->workers[i];
+		}
+	}
+
+	if (!(rp = calloc(1, sizeof(struct reactor_port))))
+		RETURN_ERROR(SP_ERR_MEM, "Reactor port malloc failed");
+
+	rp->port = port;
+	rp->fd = port->fd;
+	rp->owner = worker;
+	rp->callback = callback;
+	rp->user_data = user_data;
+	rp->mask = mask;
+
+	DEBUG_FMT("Adding port %s to reactor worker %d", port->name,
+		(int) (worker - reactor->workers));
+
+	pthread_mutex_lock(&worker->lock);
+
+	if (arm_port(rp, EPOLL_CTL_ADD) < 0) {
+		pthread_mutex_unlock(&worker->lock);
+		free(rp);
+		RETURN_FAIL("epoll_ctl() failed");
+	}
+
+	rp->next = worker->ports;
+	if (worker->ports)
+		worker->ports->prev = rp;
+	worker->ports = rp;
+	__atomic_store_n(&worker->num_ports, worker->num_ports + 1, __ATOMIC_RELAXED);
+	port->reactor = rp;
+
+	pthread_mutex_unlock(&worker->lock);
+
+	RETURN_OK();
+}
+
+SP_API enum sp_return sp_reactor_modify_port(struct sp_reactor *reactor,
+	struct sp_port *port, enum sp_event mask)
+{
+	struct reactor_port *rp;
+	int ret = 0;
+
+	TRACE("%p, %p, %d", reactor, port, mask);
+
+	if (!reactor)
+		RETURN_ERROR(SP_ERR_ARG, "Null reactor");
+
+	CHECK_PORT();
+
+	if (mask & ~VALID_EVENTS)
+		RETURN_ERROR(SP_ERR_ARG, "Invalid event mask");
+
+	if (!(rp = port->reactor) || rp->owner->reactor != reactor)
+		RETURN_ERROR(SP_ERR_ARG, "Port not in reactor");
+
+	pthread_mutex_lock(&rp->owner->lock);
+
+	rp->mask = mask;
+	/* A queued or running port is rearmed once its callback returns. */
+	if (!rp->queued && !rp->running)
+		ret = arm_port(rp, EPOLL_CTL_MOD);
+
+	pthread_mutex_unlock(&rp->owner->lock);
+
+	if (ret < 0)
+		RETURN_FAIL("epoll_ctl() failed");
+
+	RETURN_OK();
+}
+
+SP_PRIV void remove_reactor_port(struct sp_port *port)
+{
+	struct reactor_port *rp = port->reactor;
+	struct reactor_worker *owner = rp->owner;
+
+	DEBUG_FMT("Removing port %s from reactor", port->name);
+
+	pthread_mutex_lock(&owner->lock);
+
+	if (epoll_ctl(owner->epoll_fd, EPOLL_CTL_DEL, rp->fd, NULL) < 0)
+		DEBUG("epoll_ctl() removal failed, ignoring");
+
+	rp->removed = true;
+	port->reactor = NULL;
+
+	if (rp->prev)
+		rp->prev->next = rp->next;
+	else
+		owner->ports = rp->next;
+	if (rp->next)
+		rp->next->prev = rp->prev;
+	__atomic_store_n(&owner->num_ports, owner->num_ports - 1, __ATOMIC_RELAXED);
+
+	/*
+	 * Wait for a running callback, unless it is the one removing its own
+	 * port. A callback removing another port waits like any other thread.
+	 */
+	if (rp->running && current_port != rp) {
+		rp->waiting = true;
+		while (rp->running)
+			pthread_cond_wait(&owner->cond, &owner->lock);
+		discard_port(rp);
+	} else if (!rp->queued && !rp->running) {
+		discard_port(rp);
+	}
+	/* Otherwise, whichever worker finishes with the port discards it. */
+
+	pthread_mutex_unlock(&owner->lock);
+}
+
+SP_API enum sp_return sp_reactor_remove_port(struct sp_reactor *reactor,
+	struct sp_port *port)
+{
+	TRACE("%p, %p", reactor, port);
+
+	if (!reactor)
+		RETURN_ERROR(SP_ERR_ARG, "Null reactor");
+
+	CHECK_PORT();
+
+	if (!port->reactor || port->reactor->owner->reactor != reactor)
+		RETURN_ERROR(SP_ERR_ARG, "Port not in reactor");
+
+	remove_reactor_port(port);
+
+	RETURN_OK();
+}
+
+SP_API enum sp_return sp_get_reactor_stats(const struct sp_reactor *reactor,
+	unsigned int worker, struct sp_reactor_stats *stats)
+{
+	const struct reactor_worker *w;
+
+	TRACE("%p, %d, %p", reactor, worker, stats);
+
+	if (!reactor)
+		RETURN_ERROR(SP_ERR_ARG, "Null reactor");
+
+	if (!stats)
+		RETURN_ERROR(SP_ERR_ARG, "Null stats");
+
+	if (worker >= reactor->num_workers)
+		RETURN_ERROR(SP_ERR_ARG, "Invalid worker");
+
+	w = &reactor->workers[worker];
+	stats->ports = __atomic_load_n(&w->num_ports, __ATOMIC_RELAXED);
+	stats->dispatched = __atomic_load_n(&w->dispatched, __ATOMIC_RELAXED);
+	stats->stolen = __atomic_load_n(&w->stolen, __ATOMIC_RELAXED);
+
+	RETURN_OK();
+}
+
+SP_API void sp_free_reactor(struct sp_reactor *reactor)
+{
+	TRACE("%p", reactor);
+
+	if (!reactor) {
+		DEBUG("Null reactor");
+		RETURN();
+	}
+
+	free_reactor(reactor, reactor->num_workers);
+
+	RETURN();
+}
+
+#else
+
+SP_API enum sp_return sp_new_reactor(unsigned int num_workers,
+	struct sp_reactor **reactor_ptr)
+{
+	TRACE("%d, %p", num_workers, reactor_ptr);
+
+	if (reactor_ptr)
+		*reactor_ptr = NULL;
+
+	RETURN_ERROR(SP_ERR_SUPP, "Reactor not supported on this platform");
+}
+
+SP_API enum sp_return sp_get_reactor_workers(const struct sp_reactor *reactor)
+{
+	TRACE("%p", reactor);
+
+	RETURN_ERROR(SP_ERR_SUPP, "Reactor not supported on this platform");
+}
+
+SP_API enum sp_return sp_set_reactor_affinity(struct sp_reactor *reactor,
+	unsigned int worker, int cpu)
+{
+	TRACE("%p, %d, %d", reactor, worker, cpu);
+
+	RETURN_ERROR(SP_ERR_SUPP, "Reactor not supported on this platform");
+}
+
+SP_API enum sp_return sp_reactor_add_port(struct sp_reactor *reactor,
+	struct sp_port *port, enum sp_event mask, sp_reactor_callback callback,
+	void *user_data)
+{
+	TRACE("%p, %p, %d, %p, %p", reactor, port, mask, callback, user_data);
+
+	RETURN_ERROR(SP_ERR_SUPP, "Reactor not supported on this platform");
+}
+
+SP_API enum sp_return sp_reactor_modify_port(struct sp_reactor *reactor,
+	struct sp_port *port, enum sp_event mask)
+{
+	TRACE("%p, %p, %d", reactor, port, mask);
+
+	RETURN_ERROR(SP_ERR_SUPP, "Reactor not supported on this platform");
+}
+
+SP_API enum sp_return sp_reactor_remove_port(struct sp_reactor *reactor,
+	struct sp_port *port)
+{
+	TRACE("%p, %p", reactor, port);
+
+	RETURN_ERROR(SP_ERR_SUPP, "Reactor not supported on this platform");
+}
+
+SP_API enum sp_return sp_get_reactor_stats(const struct sp_reactor *reactor,
+	unsigned int worker, struct sp_reactor_stats *stats)
+{
+	TRACE("%p, %d, %p", reactor, worker, stats);
+
+	RETURN_ERROR(SP_ERR_SUPP, "Reactor not supported on this platform");
+}
+
+SP_API void sp_free_reactor(struct sp_reactor *reactor)
+{
+	TRACE("%p", reactor);
+
+	RETURN();
+}
+
+#ifndef _WIN32
+SP_PRIV void remove_reactor_port(struct sp_port *port)
+{
+	/* Ports are never added to a reactor on this platform. */
+	(void) port;
+}
+#endif
+
+#endif
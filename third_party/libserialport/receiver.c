@@ -0,0 +1,506 @@
+/*
+ * This file is part of the libserialport project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libserialport_internal.h"
+
+#ifndef _WIN32
+
+#include <pthread.h>
+#include <sched.h>
+
+/* Largest ring size, so that a span length always fits in a return code. */
+#define MAX_RECEIVER_SIZE (1u << 30)
+
+/*
+ * Receive engine state. The ring is a single-producer, single-consumer
+ * queue: only the reader thread advances head, and only the consumer
+ * advances tail. Both count bytes since the start and are masked to index
+ * the buffer, so head - tail is always the number of bytes queued.
+ */
+struct receiver {
+	int fd;
+	pthread_t thread;
+	unsigned char *buf;
+	size_t size;
+	size_t head;
+	size_t tail;
+	/* Statistics, written by the reader thread only. */
+	unsigned long long received;
+	unsigned long long dropped;
+	unsigned int overflows;
+	/* errno of the read failure which stopped the reader thread. */
+	int error;
+	/* Set by the consumer while it sleeps waiting for data. */
+	int waiting;
+	/* Set by sp_stop_receiver() to turn away a waiting consumer. */
+	int stopping;
+	/* Written by the reader thread to wake the consumer. */
+	int wake_pipe[2];
+	/* Closed by sp_stop_receiver() to stop the reader thread. */
+	int stop_pipe[2];
+};
+
+static void wake_consumer(struct receiver *rx)
+{
+	/* Order the head or error update before the check of the waiting flag. */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&rx->waiting, __ATOMIC_SEQ_CST)) {
+		/* The pipe is non-blocking; if it is full a wakeup is pending. */
+		if (write(rx->wake_pipe[1], "", 1) < 0 && errno != EAGAIN)
+			DEBUG_ERROR(SP_ERR_FAIL, "Receiver wakeup failed");
+	}
+}
+
+/*
+ * Get the receive engine of a port for the duration of a call, so that
+ * stopping it from another thread waits until the call has returned.
+ * Returns NULL if the engine is not running.
+ */
+static struct receiver *enter_receiver(struct sp_port *port)
+{
+	struct receiver *rx;
+
+	/* Pairs with the store in stop_receiver(): one sees the other. */
+	__atomic_add_fetch(&port->receiver_users, 1, __ATOMIC_SEQ_CST);
+
+	if (!(rx = __atomic_load_n(&port->receiver, __ATOMIC_SEQ_CST)))
+		__atomic_sub_fetch(&port->receiver_users, 1, __ATOMIC_RELEASE);
+
+	return rx;
+}
+
+static void leave_receiver(struct sp_port *port)
+{
+	__atomic_sub_fetch(&port->receiver_users, 1, __ATOMIC_RELEASE);
+}
+
+static void *reader_thread(void *arg)
+{
+	struct receiver *rx = arg;
+	struct pollfd pollfds[2];
+	unsigned char discard[256];
+	size_t head, tail, space, offset;
+	bool full = false;
+	ssize_t result;
+
+	pollfds[0].fd = rx->fd;
+	pollfds[0].events = POLLIN;
+	pollfds[1].fd = rx->stop_pipe[0];
+	pollfds[1].events = POLLIN;
+
+	while (1) {
+		if (poll(pollfds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		if (pollfds[1].revents)
+			/* Stop requested. */
+			return NULL;
+
+		head = rx->head;
+		tail = __atomic_load_n(&rx->tail, __ATOMIC_ACQUIRE);
+		space = rx->size - (head - tail);
+
+		if (space == 0) {
+			/* Ring is full: drain the device so the tty layer keeps up. */
+			result = read(rx->fd, discard, sizeof(discard));
+			if (result > 0) {
+				__atomic_store_n(&rx->dropped, rx->dropped + result,
+					__ATOMIC_RELAXED);
+				if (!full)
+					__atomic_store_n(&rx->overflows, rx->overflows + 1,
+						__ATOMIC_RELAXED);
+				full = true;
+				continue;
+			}
+		} else {
+			full = false;
+			/* Read straight into the ring, up to the end of the buffer. */
+			offset = head & (rx->size - 1);
+			if (space > rx->size - offset)
+				space = rx->size - offset;
+			result = read(rx->fd, rx->buf + offset, space);
+			if (result > 0) {
+				__atomic_store_n(&rx->head, head + result, __ATOMIC_RELEASE);
+				__atomic_store_n(&rx->received, rx->received + result,
+					__ATOMIC_RELAXED);
+				wake_consumer(rx);
+				continue;
+			}
+		}
+
+		if (result < 0 && (errno == EINTR || errno == EAGAIN))
+			continue;
+
+		if (result == 0) {
+			if (!(pollfds[0].revents & POLLHUP))
+				continue;
+			/* Readable with no data and hung up: the device is gone. */
+			errno = EIO;
+		}
+
+		break;
+	}
+
+	__atomic_store_n(&rx->error, errno ? errno : EIO, __ATOMIC_SEQ_CST);
+	wake_consumer(rx);
+
+	/* Wait for sp_stop_receiver(). */
+	while (poll(&pollfds[1], 1, -1) < 0 && errno == EINTR)
+		;
+
+	return NULL;
+}
+
+static void free_receiver(struct receiver *rx)
+{
+	unsigned int i;
+
+	for (i = 0; i < 2; i++) {
+		if (rx->wake_pipe[i] >= 0)
+			close(rx->wake_pipe[i]);
+		if (rx->stop_pipe[i] >= 0)
+			close(rx->stop_pipe[i]);
+	}
+
+	free(rx->buf);
+	free(rx);
+}
+
+static int open_pipe(int fds[2])
+{
+	unsigned int i;
+
+	if (pipe(fds) < 0)
+		return -1;
+
+	for (i = 0; i < 2; i++) {
+		if (fcntl(fds[i], F_SETFD, FD_CLOEXEC) < 0 ||
+				fcntl(fds[i], F_SETFL, O_NONBLOCK) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+SP_API enum sp_return sp_start_receiver(struct sp_port *port, size_t buffer_size)
+{
+	struct receiver *rx;
+	size_t size;
+	int ret;
+
+	TRACE("%p, %d", port, buffer_size);
+
+	CHECK_OPEN_PORT();
+
+	if (port->receiver)
+		RETURN_ERROR(SP_ERR_ARG, "Receiver already running");
+
+	if (port->reactor)
+		RETURN_ERROR(SP_ERR_ARG, "Port is in a reactor");
+
+	if (port->io_ring)
+		RETURN_ERROR(SP_ERR_ARG, "Port is in an I/O ring");
+
+	if (buffer_size == 0 || buffer_size > MAX_RECEIVER_SIZE)
+		RETURN_ERROR(SP_ERR_ARG, "Invalid buffer size");
+
+	/* The reader thread relies on the port being non-blocking. */
+	TRY(ensure_nonblocking(port));
+
+	/* Round up to a power of two, so that positions can be masked. */
+	for (size = 1; size < buffer_size; size <<= 1)
+		;
+
+	DEBUG_FMT("Starting receiver on port %s with %d byte buffer",
+		port->name, size);
+
+	if (!(rx = calloc(1, sizeof(struct receiver))))
+		RETURN_ERROR(SP_ERR_MEM, "Receiver malloc failed");
+
+	rx->fd = port->fd;
+	rx->size = size;
+	rx->wake_pipe[0] = rx->wake_pipe[1] = -1;
+	rx->stop_pipe[0] = rx->stop_pipe[1] = -1;
+
+	if (!(rx->buf = malloc(size))) {
+		free_receiver(rx);
+		RETURN_ERROR(SP_ERR_MEM, "Receiver buffer malloc failed");
+	}
+
+	if (open_pipe(rx->wake_pipe) < 0 || open_pipe(rx->stop_pipe) < 0) {
+		free_receiver(rx);
+		RETURN_FAIL("pipe() failed");
+	}
+
+	if ((ret = pthread_create(&rx->thread, NULL, reader_thread, rx)) != 0) {
+		free_receiver(rx);
+		errno = ret;
+		RETURN_FAIL("pthread_create() failed");
+	}
+
+	port->receiver = rx;
+
+	RETURN_OK();
+}
+
+SP_PRIV void stop_receiver(struct sp_port *port)
+{
+	struct receiver *rx = port->receiver;
+
+	DEBUG_FMT("Stopping receiver on port %s", port->name);
+
+	/* Turn away new calls, then wake and wait out those in progress. */
+	__atomic_store_n(&port->receiver, NULL, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&rx->stopping, 1, __ATOMIC_SEQ_CST);
+	if (write(rx->wake_pipe[1], "", 1) < 0 && errno != EAGAIN)
+		DEBUG_ERROR(SP_ERR_FAIL, "Receiver wakeup failed");
+	while (__atomic_load_n(&port->receiver_users, __ATOMIC_ACQUIRE))
+		sched_yield();
+
+	close(rx->stop_pipe[1]);
+	rx->stop_pipe[1] = -1;
+	pthread_join(rx->thread, NULL);
+
+	free_receiver(rx);
+}
+
+SP_API enum sp_return sp_stop_receiver(struct sp_port *port)
+{
+	TRACE("%p", port);
+
+	CHECK_OPEN_PORT();
+
+	if (!port->receiver)
+		RETURN_ERROR(SP_ERR_ARG, "Receiver not running");
+
+	stop_receiver(port);
+
+	RETURN_OK();
+}
+
+SP_API enum sp_return sp_received_waiting(struct sp_port *port)
+{
+	struct receiver *rx;
+	int count;
+
+	TRACE("%p", port);
+
+	CHECK_OPEN_PORT();
+
+	if (!(rx = enter_receiver(port)))
+		RETURN_ERROR(SP_ERR_ARG, "Receiver not running");
+
+	count = (int) (__atomic_load_n(&rx->head, __ATOMIC_ACQUIRE) - rx->tail);
+
+	leave_receiver(port);
+
+	RETURN_INT(count);
+}
+
+static enum sp_return acquire_received(struct receiver *rx,
+                                       const void **buf_ptr,
+                                       unsigned int timeout_ms)
+{
+	struct timeout timeout;
+	size_t head, offset, count;
+	char drain[16];
+	int result;
+
+	TRACE("%p, %p, %d", rx, buf_ptr, timeout_ms);
+
+	timeout_start(&timeout, timeout_ms);
+
+	while ((head = __atomic_load_n(&rx->head, __ATOMIC_ACQUIRE)) == rx->tail) {
+		if (__atomic_load_n(&rx->stopping, __ATOMIC_ACQUIRE))
+			RETURN_ERROR(SP_ERR_ARG, "Receiver stopped while waiting");
+
+		if ((errno = __atomic_load_n(&rx->error, __ATOMIC_ACQUIRE)))
+			RETURN_FAIL("Receiver stopped");
+
+		if (timeout_check(&timeout))
+			RETURN_INT(0);
+
+		/* Announce that we will sleep, then check again before doing so. */
+		__atomic_store_n(&rx->waiting, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&rx->head, __ATOMIC_SEQ_CST) != rx->tail ||
+				__atomic_load_n(&rx->error, __ATOMIC_SEQ_CST) ||
+				__atomic_load_n(&rx->stopping, __ATOMIC_SEQ_CST)) {
+			__atomic_store_n(&rx->waiting, 0, __ATOMIC_RELAXED);
+			continue;
+		}
+
+		result = wait_fd(rx->wake_pipe[0], POLLIN, &timeout);
+
+		__atomic_store_n(&rx->waiting, 0, __ATOMIC_RELAXED);
+		while (read(rx->wake_pipe[0], drain, sizeof(drain)) > 0)
+			;
+
+		timeout_update(&timeout);
+
+		if (result < 0 && errno != EINTR)
+			RETURN_FAIL("poll() failed");
+	}
+
+	/* Return the readable span up to the end of the buffer. */
+	offset = rx->tail & (rx->size - 1);
+	count = head - rx->tail;
+	if (count > rx->size - offset)
+		count = rx->size - offset;
+
+	*buf_ptr = rx->buf + offset;
+
+	RETURN_INT((int) count);
+}
+
+SP_API enum sp_return sp_acquire_received(struct sp_port *port,
+                                          const void **buf_ptr,
+                                          unsigned int timeout_ms)
+{
+	struct receiver *rx;
+	int result;
+
+	TRACE("%p, %p, %d", port, buf_ptr, timeout_ms);
+
+	CHECK_OPEN_PORT();
+
+	if (!buf_ptr)
+		RETURN_ERROR(SP_ERR_ARG, "Null result pointer");
+
+	*buf_ptr = NULL;
+
+	if (!(rx = enter_receiver(port)))
+		RETURN_ERROR(SP_ERR_ARG, "Receiver not running");
+
+	result = acquire_received(rx, buf_ptr, timeout_ms);
+
+	leave_receiver(port);
+
+	return result;
+}
+
+SP_API enum sp_return sp_release_received(struct sp_port *port, size_t count)
+{
+	struct receiver *rx;
+
+	TRACE("%p, %d", port, count);
+
+	CHECK_OPEN_PORT();
+
+	if (!(rx = enter_receiver(port)))
+		RETURN_ERROR(SP_ERR_ARG, "Receiver not running");
+
+	if (count > __atomic_load_n(&rx->head, __ATOMIC_ACQUIRE) - rx->tail) {
+		leave_receiver(port);
+		RETURN_ERROR(SP_ERR_ARG, "Count exceeds received data");
+	}
+
+	/* Hand the space back to the reader thread. */
+	__atomic_store_n(&rx->tail, rx->tail + count, __ATOMIC_RELEASE);
+
+	leave_receiver(port);
+
+	RETURN_OK();
+}
+
+SP_API enum sp_return sp_get_receiver_stats(struct sp_port *port,
+                                            struct sp_receiver_stats *stats)
+{
+	struct receiver *rx;
+
+	TRACE("%p, %p", port, stats);
+
+	CHECK_OPEN_PORT();
+
+	if (!stats)
+		RETURN_ERROR(SP_ERR_ARG, "Null result pointer");
+
+	if (!(rx = enter_receiver(port)))
+		RETURN_ERROR(SP_ERR_ARG, "Receiver not running");
+
+	stats->received = __atomic_load_n(&rx->received, __ATOMIC_RELAXED);
+	stats->dropped = __atomic_load_n(&rx->dropped, __ATOMIC_RELAXED);
+	stats->overflows = __atomic_load_n(&rx->overflows, __ATOMIC_RELAXED);
+
+	leave_receiver(port);
+
+	RETURN_OK();
+}
+
+#else /* _WIN32 */
+
+SP_API enum sp_return sp_start_receiver(struct sp_port *port, size_t buffer_size)
+{
+	TRACE("%p, %d", port, buffer_size);
+
+	CHECK_OPEN_PORT();
+
+	RETURN_ERROR(SP_ERR_SUPP, "Receiver not supported on this platform");
+}
+
+SP_API enum sp_return sp_stop_receiver(struct sp_port *port)
+{
+	TRACE("%p", port);
+
+	CHECK_OPEN_PORT();
+
+	RETURN_ERROR(SP_ERR_SUPP, "Receiver not supported on this platform");
+}
+
+SP_API enum sp_return sp_received_waiting(struct sp_port *port)
+{
+	TRACE("%p", port);
+
+	CHECK_OPEN_PORT();
+
+	RETURN_ERROR(SP_ERR_SUPP, "Receiver not supported on this platform");
+}
+
+SP_API enum sp_return sp_acquire_received(struct sp_port *port,
+                                          const void **buf_ptr,
+                                          unsigned int timeout_ms)
+{
+	TRACE("%p, %p, %d", port, buf_ptr, timeout_ms);
+
+	CHECK_OPEN_PORT();
+
+	RETURN_ERROR(SP_ERR_SUPP, "Receiver not supported on this platform");
+}
+
+SP_API enum sp_return sp_release_received(struct sp_port *port, size_t count)
+{
+	TRACE("%p, %d", port, count);
+
+	CHECK_OPEN_PORT();
+
+	RETURN_ERROR(SP_ERR_SUPP, "Receiver not supported on this platform");
+}
+
+SP_API enum sp_return sp_get_receiver_stats(struct sp_port *port,
+                                            struct sp_receiver_stats *stats)
+{
+	TRACE("%p, %p", port, stats);
+
+	CHECK_OPEN_PORT();
+
+	RETURN_ERROR(SP_ERR_SUPP, "Receiver not supported on this platform");
+}
+
+#endif
@@ -22,6 +22,9 @@
  */
 
 #include "libserialport_internal.h"
+#ifndef _WIN32
+#include <sched.h>
+#endif
 
 static const struct std_baudrate std_baudrates[] = {
 #ifdef _WIN32
@@ -45,6 +48,41 @@ static const struct std_baudrate std_baudrates[] = {
 
 #define NUM_STD_BAUDRATES ARRAY_SIZE(std_baudrates)
 
+/* Initial number of slots in a port list, including the terminating NULL. */
+#define INITIAL_LIST_SIZE 16
+
+/* States of a port's metadata, as gathered by load_port_details(). */
+#define DETAILS_LOADED 0
+#define DETAILS_PENDING 1
+#define DETAILS_LOADING 2
+
+#ifdef _MSC_VER
+#define DETAILS_STATE(port) \
+	InterlockedCompareExchange((volatile LONG *) &(port)->details_state, 0, 0)
+#define CLAIM_DETAILS(port) \
+	(InterlockedCompareExchange((volatile LONG *) &(port)->details_state, \
+		DETAILS_LOADING, DETAILS_PENDING) == DETAILS_PENDING)
+#define SET_DETAILS_LOADED(port) \
+	InterlockedExchange((volatile LONG *) &(port)->details_state, DETAILS_LOADED)
+#else
+#define DETAILS_STATE(port) \
+	__atomic_load_n(&(port)->details_state, __ATOMIC_ACQUIRE)
+#define CLAIM_DETAILS(port) \
+	claim_details(&(port)->details_state)
+#define SET_DETAILS_LOADED(port) \
+	__atomic_store_n(&(port)->details_state, DETAILS_LOADED, __ATOMIC_RELEASE)
+
+#ifndef NO_PORT_METADATA
+static bool claim_details(int *state)
+{
+	int expected = DETAILS_PENDING;
+
+	return __atomic_compare_exchange_n(state, &expected, DETAILS_LOADING,
+		false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE);
+}
+#endif
+#endif
+
 void (*sp_debug_handler)(const char *format, ...) = sp_default_debug_handler;
 
 static enum sp_return get_config(struct sp_port *port, struct port_data *data,
@@ -53,7 +91,11 @@ static enum sp_return get_config(struct sp_port *port, struct port_data *data,
 static enum sp_return set_config(struct sp_port *port, struct port_data *data,
 	const struct sp_port_config *config);
 
-SP_API enum sp_return sp_get_port_by_name(const char *portname, struct sp_port **port_ptr)
+static void clear_config(struct sp_port_config *config);
+static enum sp_return refresh_config(struct sp_port *port);
+
+static enum sp_return new_port(const char *portname, bool lazy,
+                               struct sp_port **port_ptr)
 {
 	struct sp_port *port;
 #ifndef NO_PORT_METADATA
@@ -61,8 +103,6 @@ SP_API enum sp_return sp_get_port_by_name(const char *portname, struct sp_port *
 #endif
 	size_t len;
 
-	TRACE("%s, %p", portname, port_ptr);
-
 	if (!port_ptr)
 		RETURN_ERROR(SP_ERR_ARG, "Null result pointer");
 
@@ -87,16 +127,13 @@ SP_API enum sp_return sp_get_port_by_name(const char *portname, struct sp_port *
 	portname = pathbuf;
 #endif
 
-	if (!(port = malloc(sizeof(struct sp_port))))
-		RETURN_ERROR(SP_ERR_MEM, "Port structure malloc failed");
-
 	len = strlen(portname) + 1;
 
-	if (!(port->name = malloc(len))) {
-		free(port);
-		RETURN_ERROR(SP_ERR_MEM, "Port name malloc failed");
-	}
+	/* The name is stored in the same block, directly after the structure. */
+	if (!(port = malloc(sizeof(struct sp_port) + len)))
+		RETURN_ERROR(SP_ERR_MEM, "Port structure malloc failed");
 
+	port->name = (char *) (port + 1);
 	memcpy(port->name, portname, len);
 
 #ifdef _WIN32
@@ -106,8 +143,22 @@ SP_API enum sp_return sp_get_port_by_name(const char *portname, struct sp_port *
 	port->write_buf_size = 0;
 #else
 	port->fd = -1;
+	port->receiver = NULL;
+	port->receiver_users = 0;
+	port->reactor = NULL;
+	port->io_ring = NULL;
+	port->fd_blocking = false;
 #endif
 
+	port->config_valid = false;
+	port->timestamp_offset = 0;
+	port->staging = false;
+
+	memset(&port->write_queue, 0, sizeof(struct write_queue));
+	port->write_queue.limit = DEFAULT_WRITE_QUEUE_LIMIT;
+	memset(&port->frame_buffer, 0, sizeof(struct frame_buffer));
+	memset(&port->stats, 0, sizeof(struct port_stats));
+
 	port->description = NULL;
 	port->transport = SP_TRANSPORT_NATIVE;
 	port->usb_bus = -1;
@@ -118,9 +169,11 @@ SP_API enum sp_return sp_get_port_by_name(const char *portname, struct sp_port *
 	port->usb_product = NULL;
 	port->usb_serial = NULL;
 	port->bluetooth_address = NULL;
+	port->strings = NULL;
+	port->details_state = lazy ? DETAILS_PENDING : DETAILS_LOADED;
 
 #ifndef NO_PORT_METADATA
-	if ((ret = get_port_details(port)) != SP_OK) {
+	if (!lazy && (ret = get_port_details(port)) != SP_OK) {
 		sp_free_port(port);
 		return ret;
 	}
@@ -131,6 +184,59 @@ SP_API enum sp_return sp_get_port_by_name(const char *portname, struct sp_port *
 	RETURN_OK();
 }
 
+SP_API enum sp_return sp_get_port_by_name(const char *portname, struct sp_port **port_ptr)
+{
+	TRACE("%s, %p", portname, port_ptr);
+
+	RETURN_CODEVAL(new_port(portname, false, port_ptr));
+}
+
+SP_API enum sp_return sp_get_port_by_name_lazy(const char *portname, struct sp_port **port_ptr)
+{
+	TRACE("%s, %p", portname, port_ptr);
+
+	RETURN_CODEVAL(new_port(portname, true, port_ptr));
+}
+
+/*
+ * Gather the metadata of a port created by sp_get_port_by_name_lazy(), on
+ * the first request for any of it. A port whose details cannot be found
+ * is left with the defaults, as is done when there is no metadata support.
+ *
+ * Getters may race on a lazy port, so one thread claims the loading and
+ * the others wait until it has published the details.
+ */
+static void load_port_details(const struct sp_port *port)
+{
+#ifndef NO_PORT_METADATA
+	struct sp_port *lazy_port = (struct sp_port *) port;
+
+	if (DETAILS_STATE(port) == DETAILS_LOADED)
+		return;
+
+	if (CLAIM_DETAILS(lazy_port)) {
+		DEBUG_FMT("Getting deferred details of port %s", port->name);
+
+		if (get_port_details(lazy_port) != SP_OK)
+			DEBUG_FMT("Details of port %s are not available", port->name);
+
+		SET_DETAILS_LOADED(lazy_port);
+		return;
+	}
+
+	/* Another getter is gathering the details, so wait for it. */
+	while (DETAILS_STATE(port) != DETAILS_LOADED) {
+#ifdef _WIN32
+		SwitchToThread();
+#else
+		sched_yield();
+#endif
+	}
+#else
+	(void) port;
+#endif
+}
+
 SP_API char *sp_get_port_name(const struct sp_port *port)
 {
 	TRACE("%p", port);
@@ -145,7 +251,12 @@ SP_API char *sp_get_port_description(const struct sp_port *port)
 {
 	TRACE("%p", port);
 
-	if (!port || !port->description)
+	if (!port)
+		return NULL;
+
+	load_port_details(port);
+
+	if (!port->description)
 		return NULL;
 
 	RETURN_STRING(port->description);
@@ -155,7 +266,12 @@ SP_API enum sp_transport sp_get_port_transport(const struct sp_port *port)
 {
 	TRACE("%p", port);
 
-	RETURN_INT(port ? port->transport : SP_TRANSPORT_NATIVE);
+	if (!port)
+		RETURN_INT(SP_TRANSPORT_NATIVE);
+
+	load_port_details(port);
+
+	RETURN_INT(port->transport);
 }
 
 SP_API enum sp_return sp_get_port_usb_bus_address(const struct sp_port *port,
@@ -165,6 +281,9 @@ SP_API enum sp_return sp_get_port_usb_bus_address(const struct sp_port *port,
 
 	if (!port)
 		RETURN_ERROR(SP_ERR_ARG, "Null port");
+
+	load_port_details(port);
+
 	if (port->transport != SP_TRANSPORT_USB)
 		RETURN_ERROR(SP_ERR_ARG, "Port does not use USB transport");
 	if (port->usb_bus < 0 || port->usb_address < 0)
@@ -185,6 +304,9 @@ SP_API enum sp_return sp_get_port_usb_vid_pid(const struct sp_port *port,
 
 	if (!port)
 		RETURN_ERROR(SP_ERR_ARG, "Null port");
+
+	load_port_details(port);
+
 	if (port->transport != SP_TRANSPORT_USB)
 		RETURN_ERROR(SP_ERR_ARG, "Port does not use USB transport");
 	if (port->usb_vid < 0 || port->usb_pid < 0)
@@ -202,7 +324,12 @@ SP_API char *sp_get_port_usb_manufacturer(const struct sp_port *port)
 {
 	TRACE("%p", port);
 
-	if (!port || port->transport != SP_TRANSPORT_USB || !port->usb_manufacturer)
+	if (!port)
+		return NULL;
+
+	load_port_details(port);
+
+	if (port->transport != SP_TRANSPORT_USB || !port->usb_manufacturer)
 		return NULL;
 
 	RETURN_STRING(port->usb_manufacturer);
@@ -212,7 +339,12 @@ SP_API char *sp_get_port_usb_product(const struct sp_port *port)
 {
 	TRACE("%p", port);
 
-	if (!port || port->transport != SP_TRANSPORT_USB || !port->usb_product)
+	if (!port)
+		return NULL;
+
+	load_port_details(port);
+
+	if (port->transport != SP_TRANSPORT_USB || !port->usb_product)
 		return NULL;
 
 	RETURN_STRING(port->usb_product);
@@ -222,7 +354,12 @@ SP_API char *sp_get_port_usb_serial(const struct sp_port *port)
 {
 	TRACE("%p", port);
 
-	if (!port || port->transport != SP_TRANSPORT_USB || !port->usb_serial)
+	if (!port)
+		return NULL;
+
+	load_port_details(port);
+
+	if (port->transport != SP_TRANSPORT_USB || !port->usb_serial)
 		return NULL;
 
 	RETURN_STRING(port->usb_serial);
@@ -232,8 +369,12 @@ SP_API char *sp_get_port_bluetooth_address(const struct sp_port *port)
 {
 	TRACE("%p", port);
 
-	if (!port || port->transport != SP_TRANSPORT_BLUETOOTH
-	    || !port->bluetooth_address)
+	if (!port)
+		return NULL;
+
+	load_port_details(port);
+
+	if (port->transport != SP_TRANSPORT_BLUETOOTH || !port->bluetooth_address)
 		return NULL;
 
 	RETURN_STRING(port->bluetooth_address);
@@ -278,7 +419,82 @@ SP_API enum sp_return sp_copy_port(const struct sp_port *port,
 
 	DEBUG("Copying port structure");
 
-	RETURN_INT(sp_get_port_by_name(port->name, copy_ptr));
+	/* A copy made while the details are being loaded gathers its own. */
+	RETURN_CODEVAL(new_port(port->name,
+		DETAILS_STATE(port) != DETAILS_LOADED, copy_ptr));
+}
+
+/* Free the metadata strings of a port, however they were allocated. */
+static void free_port_strings(struct sp_port *port)
+{
+	if (port->strings) {
+		free(port->strings);
+		port->strings = NULL;
+	} else {
+		if (port->description)
+			free(port->description);
+		if (port->usb_manufacturer)
+			free(port->usb_manufacturer);
+		if (port->usb_product)
+			free(port->usb_product);
+		if (port->usb_serial)
+			free(port->usb_serial);
+		if (port->bluetooth_address)
+			free(port->bluetooth_address);
+	}
+
+	port->description = NULL;
+	port->usb_manufacturer = NULL;
+	port->usb_product = NULL;
+	port->usb_serial = NULL;
+	port->bluetooth_address = NULL;
+}
+
+/*
+ * Set the metadata strings of a port, copying them into a single block
+ * so that they can be freed with one call. NULL strings are left unset.
+ */
+SP_PRIV enum sp_return set_port_strings(struct sp_port *port,
+	const char *description, const char *usb_manufacturer,
+	const char *usb_product, const char *usb_serial,
+	const char *bluetooth_address)
+{
+	const char *values[] = {
+		description, usb_manufacturer, usb_product, usb_serial,
+		bluetooth_address,
+	};
+	char **fields[] = {
+		&port->description, &port->usb_manufacturer, &port->usb_product,
+		&port->usb_serial, &port->bluetooth_address,
+	};
+	size_t lengths[ARRAY_SIZE(values)], total = 0;
+	unsigned int i;
+	char *ptr;
+
+	for (i = 0; i < ARRAY_SIZE(values); i++) {
+		lengths[i] = values[i] ? strlen(values[i]) + 1 : 0;
+		total += lengths[i];
+	}
+
+	free_port_strings(port);
+
+	if (total == 0)
+		RETURN_OK();
+
+	if (!(ptr = malloc(total)))
+		RETURN_ERROR(SP_ERR_MEM, "Port strings malloc failed");
+
+	port->strings = ptr;
+
+	for (i = 0; i < ARRAY_SIZE(values); i++) {
+		if (!values[i])
+			continue;
+		memcpy(ptr, values[i], lengths[i]);
+		*fields[i] = ptr;
+		ptr += lengths[i];
+	}
+
+	RETURN_OK();
 }
 
 SP_API void sp_free_port(struct sp_port *port)
@@ -292,58 +508,135 @@ SP_API void sp_free_port(struct sp_port *port)
 
 	DEBUG("Freeing port structure");
 
-	if (port->name)
-		free(port->name);
-	if (port->description)
-		free(port->description);
-	if (port->usb_manufacturer)
-		free(port->usb_manufacturer);
-	if (port->usb_product)
-		free(port->usb_product);
-	if (port->usb_serial)
-		free(port->usb_serial);
-	if (port->bluetooth_address)
-		free(port->bluetooth_address);
+	free_port_strings(port);
 #ifdef _WIN32
 	if (port->usb_path)
 		free(port->usb_path);
 	if (port->write_buf)
 		free(port->write_buf);
+#else
+	if (port->reactor)
+		remove_reactor_port(port);
+	if (port->io_ring)
+		remove_io_ring_port(port);
+	if (port->receiver)
+		stop_receiver(port);
 #endif
+	discard_write_queue(port);
+	free_frame_buffer(port);
 
 	free(port);
 
 	RETURN();
 }
 
-SP_PRIV struct sp_port **list_append(struct sp_port **list,
-                                     const char *portname)
+SP_PRIV bool list_append(struct port_list *list, const char *portname)
 {
-	void *tmp;
-	size_t count;
+	struct sp_port **ports;
+	size_t size;
+
+	/* Leave room for the terminating NULL. */
+	if (list->count + 2 > list->size) {
+		size = list->size * 2;
+		if (!(ports = realloc(list->ports, sizeof(struct sp_port *) * size)))
+			return false;
+		list->ports = ports;
+		list->size = size;
+	}
+	if (list->limit && list->count >= list->limit)
+		return true;
+	if (sp_get_port_by_name(portname, &list->ports[list->count]) != SP_OK)
+		return false;
+	if (list->filter && !match_port(list->filter, list->ports[list->count])) {
+		sp_free_port(list->ports[list->count]);
+		list->ports[list->count] = NULL;
+		return true;
+	}
+	list->ports[++list->count] = NULL;
+	return true;
+}
 
-	for (count = 0; list[count]; count++)
-		;
-	if (!(tmp = realloc(list, sizeof(struct sp_port *) * (count + 2))))
-		goto fail;
-	list = tmp;
-	if (sp_get_port_by_name(portname, &list[count]) != SP_OK)
-		goto fail;
-	list[count + 1] = NULL;
-	return list;
-
-fail:
-	sp_free_port_list(list);
-	return NULL;
+SP_PRIV bool match_glob(const char *pattern, const char *string)
+{
+	const char *star = NULL, *resume = NULL;
+
+	while (*string) {
+		if (*pattern == '*') {
+			/* Try matching nothing first, then backtrack to here. */
+			star = pattern++;
+			resume = string;
+		} else if (*pattern == '?' || *pattern == *string) {
+			pattern++;
+			string++;
+		} else if (star) {
+			pattern = star + 1;
+			string = ++resume;
+		} else {
+			return false;
+		}
+	}
+
+	while (*pattern == '*')
+		pattern++;
+
+	return !*pattern;
 }
 
-SP_API enum sp_return sp_list_ports(struct sp_port ***list_ptr)
+SP_PRIV bool match_port(const struct sp_port_filter *filter,
+	const struct sp_port *port)
 {
+	if (filter->name && !match_glob(filter->name, port->name))
+		return false;
+	if (filter->transport >= 0 && (int) port->transport != filter->transport)
+		return false;
+	if (filter->usb_vid >= 0 && port->usb_vid != filter->usb_vid)
+		return false;
+	if (filter->usb_pid >= 0 && port->usb_pid != filter->usb_pid)
+		return false;
+#define MATCH_STRING(x) \
+	if (filter->x && (!port->x || strcmp(filter->x, port->x))) \
+		return false
+	MATCH_STRING(usb_manufacturer);
+	MATCH_STRING(usb_product);
+	MATCH_STRING(usb_serial);
+	MATCH_STRING(bluetooth_address);
+#undef MATCH_STRING
+	return true;
+}
+
 #ifndef NO_ENUMERATION
-	struct sp_port **list;
+/* Enumerate the ports matching a filter, stopping early at a limit if set. */
+static enum sp_return enumerate_ports(const struct sp_port_filter *filter,
+	size_t limit, struct sp_port ***list_ptr)
+{
+	struct port_list list;
 	int ret;
+
+	list.count = 0;
+	list.size = INITIAL_LIST_SIZE;
+	list.filter = filter;
+	list.limit = limit;
+
+	if (!(list.ports = malloc(sizeof(struct sp_port *) * list.size)))
+		RETURN_ERROR(SP_ERR_MEM, "Port list malloc failed");
+
+	list.ports[0] = NULL;
+
+	ret = list_ports(&list);
+
+	if (ret == SP_OK) {
+		*list_ptr = list.ports;
+	} else {
+		sp_free_port_list(list.ports);
+		*list_ptr = NULL;
+	}
+
+	RETURN_CODEVAL(ret);
+}
 #endif
 
+SP_API enum sp_return sp_list_ports(struct sp_port ***list_ptr)
+{
 	TRACE("%p", list_ptr);
 
 	if (!list_ptr)
@@ -356,21 +649,62 @@ SP_API enum sp_return sp_list_ports(struct sp_port ***list_ptr)
 #else
 	DEBUG("Enumerating ports");
 
-	if (!(list = malloc(sizeof(struct sp_port *))))
-		RETURN_ERROR(SP_ERR_MEM, "Port list malloc failed");
+	RETURN_CODEVAL(enumerate_ports(NULL, 0, list_ptr));
+#endif
+}
 
-	list[0] = NULL;
+SP_API enum sp_return sp_list_ports_filtered(const struct sp_port_filter *filter,
+                                             struct sp_port ***list_ptr)
+{
+	TRACE("%p, %p", filter, list_ptr);
 
-	ret = list_ports(&list);
+	if (!list_ptr)
+		RETURN_ERROR(SP_ERR_ARG, "Null result pointer");
 
-	if (ret == SP_OK) {
-		*list_ptr = list;
-	} else {
-		sp_free_port_list(list);
-		*list_ptr = NULL;
-	}
+	*list_ptr = NULL;
 
-	RETURN_CODEVAL(ret);
+	if (!filter)
+		RETURN_ERROR(SP_ERR_ARG, "Null filter");
+
+#ifdef NO_ENUMERATION
+	RETURN_ERROR(SP_ERR_SUPP, "Enumeration not supported on this platform");
+#else
+	DEBUG("Enumerating matching ports");
+
+	RETURN_CODEVAL(enumerate_ports(filter, 0, list_ptr));
+#endif
+}
+
+SP_API enum sp_return sp_find_port(const struct sp_port_filter *filter,
+                                   struct sp_port **port_ptr)
+{
+#ifndef NO_ENUMERATION
+	struct sp_port **list;
+#endif
+
+	TRACE("%p, %p", filter, port_ptr);
+
+	if (!port_ptr)
+		RETURN_ERROR(SP_ERR_ARG, "Null result pointer");
+
+	*port_ptr = NULL;
+
+	if (!filter)
+		RETURN_ERROR(SP_ERR_ARG, "Null filter");
+
+#ifdef NO_ENUMERATION
+	RETURN_ERROR(SP_ERR_SUPP, "Enumeration not supported on this platform");
+#else
+	DEBUG("Finding first matching port");
+
+	TRY(enumerate_ports(filter, 1, &list));
+
+	/* Take the port out of the list, so that only the list is freed. */
+	*port_ptr = list[0];
+	list[0] = NULL;
+	sp_free_port_list(list);
+
+	RETURN_OK();
 #endif
 }
 
@@ -394,27 +728,124 @@ SP_API void sp_free_port_list(struct sp_port **list)
 	RETURN();
 }
 
-#define CHECK_PORT() do { \
-	if (!port) \
-		RETURN_ERROR(SP_ERR_ARG, "Null port"); \
-	if (!port->name) \
-		RETURN_ERROR(SP_ERR_ARG, "Null port name"); \
-} while (0)
-#ifdef _WIN32
-#define CHECK_PORT_HANDLE() do { \
-	if (port->hdl == INVALID_HANDLE_VALUE) \
-		RETURN_ERROR(SP_ERR_ARG, "Port not open"); \
-} while (0)
-#else
-#define CHECK_PORT_HANDLE() do { \
-	if (port->fd < 0) \
-		RETURN_ERROR(SP_ERR_ARG, "Port not open"); \
-} while (0)
-#endif
-#define CHECK_OPEN_PORT() do { \
-	CHECK_PORT(); \
-	CHECK_PORT_HANDLE(); \
-} while (0)
+SP_API enum sp_return sp_new_port_filter(struct sp_port_filter **filter_ptr)
+{
+	struct sp_port_filter *filter;
+
+	TRACE("%p", filter_ptr);
+
+	if (!filter_ptr)
+		RETURN_ERROR(SP_ERR_ARG, "Null result pointer");
+
+	*filter_ptr = NULL;
+
+	if (!(filter = calloc(1, sizeof(struct sp_port_filter))))
+		RETURN_ERROR(SP_ERR_MEM, "Filter malloc failed");
+
+	filter->transport = -1;
+	filter->usb_vid = -1;
+	filter->usb_pid = -1;
+
+	*filter_ptr = filter;
+
+	RETURN_OK();
+}
+
+SP_API void sp_free_port_filter(struct sp_port_filter *filter)
+{
+	TRACE("%p", filter);
+
+	if (!filter) {
+		DEBUG("Null filter");
+		RETURN();
+	}
+
+	free(filter->name);
+	free(filter->usb_manufacturer);
+	free(filter->usb_product);
+	free(filter->usb_serial);
+	free(filter->bluetooth_address);
+	free(filter);
+
+	RETURN();
+}
+
+/* Replace a string criterion of a filter with a copy of value, or clear it. */
+static enum sp_return set_filter_string(char **field, const char *value)
+{
+	char *copy = NULL;
+
+	if (value && !(copy = strdup(value)))
+		RETURN_ERROR(SP_ERR_MEM, "Filter string strdup failed");
+
+	free(*field);
+	*field = copy;
+
+	RETURN_OK();
+}
+
+SP_API enum sp_return sp_set_filter_name(struct sp_port_filter *filter,
+                                         const char *pattern)
+{
+	TRACE("%p, %s", filter, pattern);
+
+	if (!filter)
+		RETURN_ERROR(SP_ERR_ARG, "Null filter");
+
+	TRY(set_filter_string(&filter->name, pattern));
+
+	RETURN_OK();
+}
+
+SP_API enum sp_return sp_set_filter_transport(struct sp_port_filter *filter,
+                                              enum sp_transport transport)
+{
+	TRACE("%p, %d", filter, transport);
+
+	if (!filter)
+		RETURN_ERROR(SP_ERR_ARG, "Null filter");
+
+	if (transport != SP_TRANSPORT_NATIVE && transport != SP_TRANSPORT_USB &&
+			transport != SP_TRANSPORT_BLUETOOTH)
+		RETURN_ERROR(SP_ERR_ARG, "Invalid transport");
+
+	filter->transport = transport;
+
+	RETURN_OK();
+}
+
+SP_API enum sp_return sp_set_filter_usb_vid_pid(struct sp_port_filter *filter,
+                                                int usb_vid, int usb_pid)
+{
+	TRACE("%p, %d, %d", filter, usb_vid, usb_pid);
+
+	if (!filter)
+		RETURN_ERROR(SP_ERR_ARG, "Null filter");
+
+	if (usb_vid > 0xFFFF || usb_pid > 0xFFFF)
+		RETURN_ERROR(SP_ERR_ARG, "Invalid USB ID");
+
+	filter->usb_vid = usb_vid < 0 ? -1 : usb_vid;
+	filter->usb_pid = usb_pid < 0 ? -1 : usb_pid;
+
+	RETURN_OK();
+}
+
+#define FILTER_STRING(x) \
+SP_API enum sp_return sp_set_filter_##x(struct sp_port_filter *filter, \
+                                        const char *x) \
+{ \
+	TRACE("%p, %s", filter, x); \
+	if (!filter) \
+		RETURN_ERROR(SP_ERR_ARG, "Null filter"); \
+	TRY(set_filter_string(&filter->x, x)); \
+	RETURN_OK(); \
+}
+
+FILTER_STRING(usb_manufacturer)
+FILTER_STRING(usb_product)
+FILTER_STRING(usb_serial)
+FILTER_STRING(bluetooth_address)
 
 #ifdef WIN32
 /** To be called after port receive buffer is emptied. */
@@ -456,7 +887,7 @@ static enum sp_return restart_wait(struct sp_port *port)
 SP_API enum sp_return sp_open(struct sp_port *port, enum sp_mode flags)
 {
 	struct port_data data;
-	struct sp_port_config config;
+	struct sp_port_config config, changes;
 	enum sp_return ret;
 
 	TRACE("%p, 0x%x", port, flags);
@@ -549,6 +980,9 @@ SP_API enum sp_return sp_open(struct sp_port *port, enum sp_mode flags)
 	if ((port->fd = open(port->name, flags_local)) < 0)
 		RETURN_FAIL("open() failed");
 
+	port->fd_blocking = false;
+	port->timestamp_offset = 0;
+
 	/*
 	 * On POSIX in the default case the file descriptor of a serial port
 	 * is not opened exclusively. Therefore the settings of a port are
@@ -651,13 +1085,25 @@ SP_API enum sp_return sp_open(struct sp_port *port, enum sp_mode flags)
 		RETURN_FAIL("ClearCommError() failed");
 #endif
 
-	ret = set_config(port, &data, &config);
+	/*
+	 * Other settings are left as they were read, so that no redundant
+	 * control line ioctls are made. The baud rate is always applied, as
+	 * the Windows write buffer is sized from it.
+	 */
+	clear_config(&changes);
+	changes.baudrate = config.baudrate;
+
+	ret = set_config(port, &data, &changes);
 
 	if (ret < 0) {
 		sp_close(port);
 		RETURN_CODEVAL(ret);
 	}
 
+	port->data = data;
+	port->config = config;
+	port->config_valid = true;
+
 	RETURN_OK();
 }
 
@@ -669,6 +1115,12 @@ SP_API enum sp_return sp_close(struct sp_port *port)
 
 	DEBUG_FMT("Closing port %s", port->name);
 
+	port->config_valid = false;
+	port->staging = false;
+
+	discard_write_queue(port);
+	free_frame_buffer(port);
+
 #ifdef _WIN32
 	/* Returns non-zero upon success, 0 upon failure. */
 	if (CloseHandle(port->hdl) == 0)
@@ -690,6 +1142,14 @@ SP_API enum sp_return sp_close(struct sp_port *port)
 		port->write_buf = NULL;
 	}
 #else
+	/* Worker threads must be done with the descriptor before it is closed. */
+	if (port->reactor)
+		remove_reactor_port(port);
+	if (port->io_ring)
+		remove_io_ring_port(port);
+	if (port->receiver)
+		stop_receiver(port);
+
 	/* Returns 0 upon success, -1 upon failure. */
 	if (close(port->fd) == -1)
 		RETURN_FAIL("close() failed");
@@ -739,6 +1199,10 @@ SP_API enum sp_return sp_flush(struct sp_port *port, enum sp_buffer buffers)
 	if (tcflush(port->fd, flags) < 0)
 		RETURN_FAIL("tcflush() failed");
 #endif
+
+	if (buffers & SP_BUF_INPUT)
+		clear_frame_buffer(port);
+
 	RETURN_OK();
 }
 
@@ -799,21 +1263,238 @@ static enum sp_return await_write_completion(struct sp_port *port)
 
 	RETURN_OK();
 }
-#endif
-
-SP_API enum sp_return sp_blocking_write(struct sp_port *port, const void *buf,
-                                        size_t count, unsigned int timeout_ms)
+#else
+/*
+ * Wait for a descriptor to become ready for the given poll() events, for at
+ * most the time remaining in the timeout. Unlike select(), this works for
+ * descriptors of any number, and its cost does not grow with the value of
+ * the descriptor. Returns a positive value if the descriptor is ready, zero if
+ * the timeout expired, or -1 with errno set upon failure.
+ */
+SP_PRIV int wait_fd(int fd, short events, struct timeout *timeout)
 {
-	TRACE("%p, %p, %d, %d", port, buf, count, timeout_ms);
+	struct pollfd pollfd;
+
+	pollfd.fd = fd;
+	pollfd.events = events;
+	pollfd.revents = 0;
+
+#ifdef HAVE_PPOLL
+	return ppoll(&pollfd, 1, timeout_timespec(timeout), NULL);
+#else
+	unsigned int remaining_ms = timeout_remaining_ms(timeout);
+	int poll_timeout, result;
+
+	if (timeout->ns == 0)
+		poll_timeout = -1;
+	else if (remaining_ms > INT_MAX)
+		poll_timeout = INT_MAX;
+	else
+		poll_timeout = (int) remaining_ms;
+
+	result = poll(&pollfd, 1, poll_timeout);
+
+	if (result == 0 && poll_timeout == INT_MAX) {
+		/* Only part of a very long timeout elapsed; have caller repeat. */
+		errno = EINTR;
+		return -1;
+	}
+
+	return result;
+#endif
+}
+
+/*
+ * Wait on a port's fd, recording the wait in the port statistics. If end
+ * is not NULL, it receives the time at which the wait ended.
+ */
+SP_PRIV int wait_port(struct sp_port *port, short events,
+	struct timeout *timeout, struct time *end)
+{
+	struct time start, now, elapsed;
+	uint64_t us;
+	unsigned int bucket;
+	int result;
+
+	time_get(&start);
+	result = wait_fd(port->fd, events, timeout);
+	time_get(&now);
+
+	if (end)
+		*end = now;
+
+	time_sub(&now, &start, &elapsed);
+	us = time_as_ns(&elapsed) / 1000;
+	for (bucket = 0; us && bucket < SP_STATS_HISTOGRAM_SIZE - 1; bucket++)
+		us >>= 1;
+
+	STAT_ADD(port, waits, 1);
+	STAT_ADD(port, wait_histogram[bucket], 1);
+	if (result < 0 && errno == EINTR)
+		STAT_ADD(port, retries, 1);
+
+	return result;
+}
+
+/*
+ * Set O_NONBLOCK again if sp_blocking_read_vmin() has cleared it. All
+ * other I/O paths rely on the port being non-blocking.
+ */
+SP_PRIV enum sp_return ensure_nonblocking(struct sp_port *port)
+{
+	int flags;
+
+	if (!port->fd_blocking)
+		RETURN_OK();
+
+	if ((flags = fcntl(port->fd, F_GETFL)) < 0)
+		RETURN_FAIL("fcntl() failed");
+
+	if (fcntl(port->fd, F_SETFL, flags | O_NONBLOCK) < 0)
+		RETURN_FAIL("fcntl() failed");
+
+	port->fd_blocking = false;
+
+	RETURN_OK();
+}
+
+/* Number of buffers passed to each readv() or writev() call. */
+#define MAX_IOVS 16
+
+/*
+ * Fill an array of struct iovec with the buffers remaining from the given
+ * position in a vector, skipping empty ones. Returns the number filled in.
+ */
+static int window_iovecs(struct iovec *window, const struct sp_iovec *iov,
+	unsigned int iovcnt, unsigned int index, size_t offset)
+{
+	int num = 0;
+
+	for (; index < iovcnt && num < MAX_IOVS; index++, offset = 0) {
+		if (iov[index].count == offset)
+			continue;
+		window[num].iov_base = (char *) iov[index].buf + offset;
+		window[num].iov_len = iov[index].count - offset;
+		num++;
+	}
+
+	return num;
+}
+
+/* Move a position in a vector of buffers forward by a number of bytes. */
+static void advance_iovecs(const struct sp_iovec *iov, unsigned int iovcnt,
+	unsigned int *index, size_t *offset, size_t bytes)
+{
+	while (*index < iovcnt && bytes >= iov[*index].count - *offset) {
+		bytes -= iov[*index].count - *offset;
+		(*index)++;
+		*offset = 0;
+	}
+
+	*offset += bytes;
+}
+
+/*
+ * Read into or write from a vector of buffers, waiting with poll() until
+ * count bytes have been transferred or the timeout has expired. This is
+ * the loop behind all of the blocking read and write functions. Events is
+ * POLLIN to read or POLLOUT to write.
+ */
+static enum sp_return blocking_transfer(struct sp_port *port, short events,
+	const struct sp_iovec *iov, unsigned int iovcnt, size_t count,
+	uint64_t timeout_ns)
+{
+	size_t transferred = 0, offset = 0;
+	unsigned int index = 0;
+	struct iovec window[MAX_IOVS];
+	struct timeout timeout;
+	ssize_t result;
+	int num;
+
+	TRACE("%p, %d, %p, %d, %d, %llu", port, events, iov, iovcnt, count,
+		(unsigned long long) timeout_ns);
+
+	TRY(ensure_nonblocking(port));
+
+	timeout_start_ns(&timeout, timeout_ns);
+
+	/* Loop until we have transferred the requested number of bytes. */
+	while (transferred < count) {
+
+		if (timeout_check(&timeout))
+			break;
+
+		result = wait_port(port, events, &timeout, NULL);
+
+		timeout_update(&timeout);
+
+		if (result < 0) {
+			if (errno == EINTR) {
+				DEBUG("poll() call was interrupted, repeating");
+				continue;
+			} else {
+				RETURN_FAIL("poll() failed");
+			}
+		} else if (result == 0) {
+			/* Timeout has expired. */
+			break;
+		}
+
+		num = window_iovecs(window, iov, iovcnt, index, offset);
+
+		if (events == POLLIN) {
+			result = readv(port->fd, window, num);
+			STAT_ADD(port, reads, 1);
+		} else {
+			result = writev(port->fd, window, num);
+			STAT_ADD(port, writes, 1);
+		}
+
+		if (result < 0) {
+			if (errno == EAGAIN) {
+				/* This shouldn't happen because we did a poll() first, but handle anyway. */
+				STAT_ADD(port, retries, 1);
+				continue;
+			} else if (events == POLLIN) {
+				/* This is an actual failure. */
+				RETURN_FAIL("readv() failed");
+			} else {
+				RETURN_FAIL("writev() failed");
+			}
+		}
+
+		if (events == POLLIN) {
+			STAT_ADD(port, bytes_read, result);
+			/* Only part of the data had arrived; wait for the rest. */
+			if ((size_t) result < count - transferred)
+				STAT_ADD(port, short_reads, 1);
+		} else {
+			STAT_ADD(port, bytes_written, result);
+		}
+		transferred += result;
+		advance_iovecs(iov, iovcnt, &index, &offset, result);
+	}
 
+	if (transferred < count) {
+		DEBUG("Transfer timed out");
+		STAT_ADD(port, timeouts, 1);
+	}
+
+	RETURN_INT((int) transferred);
+}
+#endif
+
+static enum sp_return blocking_write(struct sp_port *port, const void *buf,
+                                    size_t count, uint64_t timeout_ns)
+{
 	CHECK_OPEN_PORT();
 
 	if (!buf)
 		RETURN_ERROR(SP_ERR_ARG, "Null buffer");
 
-	if (timeout_ms)
-		DEBUG_FMT("Writing %d bytes to port %s, timeout %d ms",
-			count, port->name, timeout_ms);
+	if (timeout_ns)
+		DEBUG_FMT("Writing %d bytes to port %s, timeout %llu ns",
+			count, port->name, (unsigned long long) timeout_ns);
 	else
 		DEBUG_FMT("Writing %d bytes to port %s, no timeout",
 			count, port->name);
@@ -828,7 +1509,7 @@ SP_API enum sp_return sp_blocking_write(struct sp_port *port, const void *buf,
 	bool result;
 	struct timeout timeout;
 
-	timeout_start(&timeout, timeout_ms);
+	timeout_start_ns(&timeout, timeout_ns);
 
 	TRY(await_write_completion(port));
 
@@ -855,6 +1536,7 @@ SP_API enum sp_return sp_blocking_write(struct sp_port *port, const void *buf,
 		/* Start write. */
 
 		result = WriteFile(port->hdl, write_ptr, write_size, NULL, &port->write_ovl);
+		STAT_ADD(port, writes, 1);
 
 		timeout_update(&timeout);
 
@@ -866,6 +1548,7 @@ SP_API enum sp_return sp_blocking_write(struct sp_port *port, const void *buf,
 			if (GetOverlappedResult(port->hdl, &port->write_ovl, &bytes_written, TRUE) == 0) {
 				if (GetLastError() == ERROR_SEM_TIMEOUT) {
 					DEBUG("Write timed out");
+					STAT_ADD(port, timeouts, 1);
 					break;
 				} else {
 					RETURN_FAIL("GetOverlappedResult() failed");
@@ -876,65 +1559,115 @@ SP_API enum sp_return sp_blocking_write(struct sp_port *port, const void *buf,
 			RETURN_FAIL("WriteFile() failed");
 		}
 
+		STAT_ADD(port, bytes_written, bytes_written);
 		write_ptr += bytes_written;
 		total_bytes_written += bytes_written;
 	}
 
 	RETURN_INT((int) total_bytes_written);
 #else
-	size_t bytes_written = 0;
-	unsigned char *ptr = (unsigned char *) buf;
-	struct timeout timeout;
-	fd_set fds;
-	ssize_t result;
+	struct sp_iovec iov;
 
-	timeout_start(&timeout, timeout_ms);
+	iov.buf = (void *) buf;
+	iov.count = count;
 
-	FD_ZERO(&fds);
-	FD_SET(port->fd, &fds);
+	return blocking_transfer(port, POLLOUT, &iov, 1, count, timeout_ns);
+#endif
+}
 
-	/* Loop until we have written the requested number of bytes. */
-	while (bytes_written < count) {
+SP_API enum sp_return sp_blocking_write(struct sp_port *port, const void *buf,
+                                        size_t count, unsigned int timeout_ms)
+{
+	TRACE("%p, %p, %d, %d", port, buf, count, timeout_ms);
 
-		if (timeout_check(&timeout))
-			break;
+	return blocking_write(port, buf, count, (uint64_t) timeout_ms * 1000000);
+}
 
-		result = select(port->fd + 1, NULL, &fds, NULL, timeout_timeval(&timeout));
+SP_API enum sp_return sp_blocking_write_ns(struct sp_port *port, const void *buf,
+                                           size_t count, unsigned long long timeout_ns)
+{
+	TRACE("%p, %p, %d, %llu", port, buf, count, timeout_ns);
 
-		timeout_update(&timeout);
+	return blocking_write(port, buf, count, timeout_ns);
+}
 
-		if (result < 0) {
-			if (errno == EINTR) {
-				DEBUG("select() call was interrupted, repeating");
-				continue;
-			} else {
-				RETURN_FAIL("select() failed");
-			}
-		} else if (result == 0) {
-			/* Timeout has expired. */
-			break;
-		}
+SP_API enum sp_return sp_blocking_write_us(struct sp_port *port, const void *buf,
+                                           size_t count, unsigned int timeout_us)
+{
+	TRACE("%p, %p, %d, %d", port, buf, count, timeout_us);
 
-		/* Do write. */
-		result = write(port->fd, ptr, count - bytes_written);
+	return blocking_write(port, buf, count, (uint64_t) timeout_us * 1000);
+}
 
-		if (result < 0) {
-			if (errno == EAGAIN)
-				/* This shouldn't happen because we did a select() first, but handle anyway. */
-				continue;
-			else
-				/* This is an actual failure. */
-				RETURN_FAIL("write() failed");
-		}
+/* Check a vector of buffers and get the total number of bytes in it. */
+static enum sp_return check_iovecs(const struct sp_iovec *iov,
+	unsigned int iovcnt, size_t *total)
+{
+	unsigned int i;
+
+	if (!iov && iovcnt > 0)
+		RETURN_ERROR(SP_ERR_ARG, "Null buffer vector");
+
+	*total = 0;
 
-		bytes_written += result;
-		ptr += result;
+	for (i = 0; i < iovcnt; i++) {
+		if (!iov[i].buf && iov[i].count > 0)
+			RETURN_ERROR(SP_ERR_ARG, "Null buffer");
+		if (iov[i].count > INT_MAX - *total)
+			RETURN_ERROR(SP_ERR_ARG, "Total count too large");
+		*total += iov[i].count;
 	}
 
-	if (bytes_written < count)
-		DEBUG("Write timed out");
+	RETURN_OK();
+}
+
+SP_API enum sp_return sp_blocking_writev(struct sp_port *port,
+                                         const struct sp_iovec *iov,
+                                         unsigned int iovcnt,
+                                         unsigned int timeout_ms)
+{
+	size_t count;
+
+	TRACE("%p, %p, %d, %d", port, iov, iovcnt, timeout_ms);
+
+	CHECK_OPEN_PORT();
+
+	TRY(check_iovecs(iov, iovcnt, &count));
+
+	if (timeout_ms)
+		DEBUG_FMT("Writing %d bytes from %d buffers to port %s, timeout %d ms",
+			count, iovcnt, port->name, timeout_ms);
+	else
+		DEBUG_FMT("Writing %d bytes from %d buffers to port %s, no timeout",
+			count, iovcnt, port->name);
+
+	if (count == 0)
+		RETURN_INT(0);
+
+#ifdef _WIN32
+	/* Stage the buffers into one, and write that. */
+	unsigned char *staged, *ptr;
+	unsigned int i;
+	int ret;
+
+	if (!(staged = malloc(count)))
+		RETURN_ERROR(SP_ERR_MEM, "Staging buffer malloc failed");
 
-	RETURN_INT(bytes_written);
+	for (i = 0, ptr = staged; i < iovcnt; ptr += iov[i].count, i++)
+		if (iov[i].count > 0)
+			memcpy(ptr, iov[i].buf, iov[i].count);
+
+	ret = sp_blocking_write(port, staged, count, timeout_ms);
+
+	free(staged);
+
+	if (ret < 0)
+		RETURN_CODEVAL(ret);
+
+	RETURN_INT(ret);
+#else
+	return blocking_transfer(port, POLLOUT, iov, iovcnt, count,
+		(uint64_t) timeout_ms * 1000000);
 #endif
 }
 
@@ -998,10 +1731,18 @@ SP_API enum sp_return sp_nonblocking_write(struct sp_port *port,
 
 	DEBUG("All bytes written immediately");
 
+	STAT_ADD(port, writes, 1);
+	STAT_ADD(port, bytes_written, buf_bytes);
+
 	RETURN_INT((int) buf_bytes);
 #else
+	ssize_t written;
+
+	TRY(ensure_nonblocking(port));
+
 	/* Returns the number of bytes written, or -1 upon failure. */
-	ssize_t written = write(port->fd, buf, count);
+	written = write(port->fd, buf, count);
+	STAT_ADD(port, writes, 1);
 
 	if (written < 0) {
 		if (errno == EAGAIN)
@@ -1010,6 +1751,7 @@ SP_API enum sp_return sp_nonblocking_write(struct sp_port *port,
 		else
 			RETURN_FAIL("write() failed");
 	} else {
+		STAT_ADD(port, bytes_written, written);
 		RETURN_INT(written);
 	}
 #endif
@@ -1035,19 +1777,18 @@ static enum sp_return restart_wait_if_needed(struct sp_port *port, unsigned int
 }
 #endif
 
-SP_API enum sp_return sp_blocking_read(struct sp_port *port, void *buf,
-                                       size_t count, unsigned int timeout_ms)
+static enum sp_return blocking_read(struct sp_port *port, void *buf,
+                                   size_t count, uint64_t timeout_ns)
 {
-	TRACE("%p, %p, %d, %d", port, buf, count, timeout_ms);
-
 	CHECK_OPEN_PORT();
+	CHECK_READ_OWNER();
 
 	if (!buf)
 		RETURN_ERROR(SP_ERR_ARG, "Null buffer");
 
-	if (timeout_ms)
-		DEBUG_FMT("Reading %d bytes from port %s, timeout %d ms",
-			count, port->name, timeout_ms);
+	if (timeout_ns)
+		DEBUG_FMT("Reading %d bytes from port %s, timeout %llu ns",
+			count, port->name, (unsigned long long) timeout_ns);
 	else
 		DEBUG_FMT("Reading %d bytes from port %s, no timeout",
 			count, port->name);
@@ -1057,6 +1798,10 @@ SP_API enum sp_return sp_blocking_read(struct sp_port *port, void *buf,
 
 #ifdef _WIN32
 	DWORD bytes_read;
+	/* Windows only has millisecond timeouts, so round up. */
+	uint64_t timeout_ms_64 = (timeout_ns + 999999) / 1000000;
+	DWORD timeout_ms = timeout_ms_64 > MAXDWORD - 1 ?
+		MAXDWORD - 1 : (DWORD) timeout_ms_64;
 
 	/* Set timeout. */
 	if (port->timeouts.ReadIntervalTimeout != 0 ||
@@ -1082,68 +1827,103 @@ SP_API enum sp_return sp_blocking_read(struct sp_port *port, void *buf,
 		RETURN_FAIL("ReadFile() failed");
 	}
 
+	STAT_ADD(port, reads, 1);
+	STAT_ADD(port, bytes_read, bytes_read);
+	if (bytes_read < count)
+		STAT_ADD(port, timeouts, 1);
+
 	TRY(restart_wait_if_needed(port, bytes_read));
 
 	RETURN_INT((int) bytes_read);
 
 #else
-	size_t bytes_read = 0;
-	unsigned char *ptr = (unsigned char *) buf;
-	struct timeout timeout;
-	fd_set fds;
-	ssize_t result;
+	struct sp_iovec iov;
 
-	timeout_start(&timeout, timeout_ms);
+	iov.buf = buf;
+	iov.count = count;
+
+	return blocking_transfer(port, POLLIN, &iov, 1, count, timeout_ns);
+#endif
+}
 
-	FD_ZERO(&fds);
-	FD_SET(port->fd, &fds);
+SP_API enum sp_return sp_blocking_read(struct sp_port *port, void *buf,
+                                       size_t count, unsigned int timeout_ms)
+{
+	TRACE("%p, %p, %d, %d", port, buf, count, timeout_ms);
 
-	/* Loop until we have the requested number of bytes. */
-	while (bytes_read < count) {
+	return blocking_read(port, buf, count, (uint64_t) timeout_ms * 1000000);
+}
 
-		if (timeout_check(&timeout))
-			/* Timeout has expired. */
-			break;
+SP_API enum sp_return sp_blocking_read_ns(struct sp_port *port, void *buf,
+                                          size_t count, unsigned long long timeout_ns)
+{
+	TRACE("%p, %p, %d, %llu", port, buf, count, timeout_ns);
 
-		result = select(port->fd + 1, &fds, NULL, NULL, timeout_timeval(&timeout));
+	return blocking_read(port, buf, count, timeout_ns);
+}
 
-		timeout_update(&timeout);
+SP_API enum sp_return sp_blocking_read_us(struct sp_port *port, void *buf,
+                                          size_t count, unsigned int timeout_us)
+{
+	TRACE("%p, %p, %d, %d", port, buf, count, timeout_us);
 
-		if (result < 0) {
-			if (errno == EINTR) {
-				DEBUG("select() call was interrupted, repeating");
-				continue;
-			} else {
-				RETURN_FAIL("select() failed");
-			}
-		} else if (result == 0) {
-			/* Timeout has expired. */
-			break;
-		}
+	return blocking_read(port, buf, count, (uint64_t) timeout_us * 1000);
+}
 
-		/* Do read. */
-		result = read(port->fd, ptr, count - bytes_read);
+SP_API enum sp_return sp_blocking_readv(struct sp_port *port,
+                                        const struct sp_iovec *iov,
+                                        unsigned int iovcnt,
+                                        unsigned int timeout_ms)
+{
+	size_t count;
 
-		if (result < 0) {
-			if (errno == EAGAIN)
-				/*
-				 * This shouldn't happen because we did a
-				 * select() first, but handle anyway.
-				 */
-				continue;
-			else
-				/* This is an actual failure. */
-				RETURN_FAIL("read() failed");
-		}
+	TRACE("%p, %p, %d, %d", port, iov, iovcnt, timeout_ms);
+
+	CHECK_OPEN_PORT();
+	CHECK_READ_OWNER();
+
+	TRY(check_iovecs(iov, iovcnt, &count));
+
+	if (timeout_ms)
+		DEBUG_FMT("Reading %d bytes into %d buffers from port %s, timeout %d ms",
+			count, iovcnt, port->name, timeout_ms);
+	else
+		DEBUG_FMT("Reading %d bytes into %d buffers from port %s, no timeout",
+			count, iovcnt, port->name);
+
+	if (count == 0)
+		RETURN_INT(0);
 
-		bytes_read += result;
-		ptr += result;
+#ifdef _WIN32
+	/* Read into one staging buffer, then scatter the data. */
+	unsigned char *staged, *ptr;
+	unsigned int i;
+	size_t remaining, chunk;
+	int ret;
+
+	if (!(staged = malloc(count)))
+		RETURN_ERROR(SP_ERR_MEM, "Staging buffer malloc failed");
+
+	ret = sp_blocking_read(port, staged, count, timeout_ms);
+
+	for (i = 0, ptr = staged, remaining = ret > 0 ? ret : 0;
+			i < iovcnt && remaining > 0; i++) {
+		chunk = iov[i].count < remaining ? iov[i].count : remaining;
+		if (chunk > 0)
+			memcpy(iov[i].buf, ptr, chunk);
+		ptr += chunk;
+		remaining -= chunk;
 	}
 
-	if (bytes_read < count)
-		DEBUG("Read timed out");
+	free(staged);
 
-	RETURN_INT(bytes_read);
+	if (ret < 0)
+		RETURN_CODEVAL(ret);
+
+	RETURN_INT(ret);
+#else
+	return blocking_transfer(port, POLLIN, iov, iovcnt, count,
+		(uint64_t) timeout_ms * 1000000);
 #endif
 }
 
@@ -1153,6 +1933,7 @@ SP_API enum sp_return sp_blocking_read_next(struct sp_port *port, void *buf,
 	TRACE("%p, %p, %d, %d", port, buf, count, timeout_ms);
 
 	CHECK_OPEN_PORT();
+	CHECK_READ_OWNER();
 
 	if (!buf)
 		RETURN_ERROR(SP_ERR_ARG, "Null buffer");
@@ -1204,8 +1985,13 @@ SP_API enum sp_return sp_blocking_read_next(struct sp_port *port, void *buf,
 		} else {
 			RETURN_FAIL("ReadFile() failed");
 		}
+		STAT_ADD(port, reads, 1);
 	}
 
+	STAT_ADD(port, bytes_read, bytes_read);
+	if (bytes_read == 0)
+		STAT_ADD(port, timeouts, 1);
+
 	TRY(restart_wait_if_needed(port, bytes_read));
 
 	RETURN_INT(bytes_read);
@@ -1213,13 +1999,11 @@ SP_API enum sp_return sp_blocking_read_next(struct sp_port *port, void *buf,
 #else
 	size_t bytes_read = 0;
 	struct timeout timeout;
-	fd_set fds;
 	ssize_t result;
 
-	timeout_start(&timeout, timeout_ms);
+	TRY(ensure_nonblocking(port));
 
-	FD_ZERO(&fds);
-	FD_SET(port->fd, &fds);
+	timeout_start(&timeout, timeout_ms);
 
 	/* Loop until we have at least one byte, or timeout is reached. */
 	while (bytes_read == 0) {
@@ -1228,16 +2012,16 @@ SP_API enum sp_return sp_blocking_read_next(struct sp_port *port, void *buf,
 			/* Timeout has expired. */
 			break;
 
-		result = select(port->fd + 1, &fds, NULL, NULL, timeout_timeval(&timeout));
+		result = wait_port(port, POLLIN, &timeout, NULL);
 
 		timeout_update(&timeout);
 
 		if (result < 0) {
 			if (errno == EINTR) {
-				DEBUG("select() call was interrupted, repeating");
+				DEBUG("poll() call was interrupted, repeating");
 				continue;
 			} else {
-				RETURN_FAIL("select() failed");
+				RETURN_FAIL("poll() failed");
 			}
 		} else if (result == 0) {
 			/* Timeout has expired. */
@@ -1246,21 +2030,27 @@ SP_API enum sp_return sp_blocking_read_next(struct sp_port *port, void *buf,
 
 		/* Do read. */
 		result = read(port->fd, buf, count);
+		STAT_ADD(port, reads, 1);
 
 		if (result < 0) {
-			if (errno == EAGAIN)
-				/* This shouldn't happen because we did a select() first, but handle anyway. */
+			if (errno == EAGAIN) {
+				/* This shouldn't happen because we did a poll() first, but handle anyway. */
+				STAT_ADD(port, retries, 1);
 				continue;
-			else
+			} else {
 				/* This is an actual failure. */
 				RETURN_FAIL("read() failed");
+			}
 		}
 
+		STAT_ADD(port, bytes_read, result);
 		bytes_read = result;
 	}
 
-	if (bytes_read == 0)
+	if (bytes_read == 0) {
 		DEBUG("Read timed out");
+		STAT_ADD(port, timeouts, 1);
+	}
 
 	RETURN_INT(bytes_read);
 #endif
@@ -1272,6 +2062,7 @@ SP_API enum sp_return sp_nonblocking_read(struct sp_port *port, void *buf,
 	TRACE("%p, %p, %d", port, buf, count);
 
 	CHECK_OPEN_PORT();
+	CHECK_READ_OWNER();
 
 	if (!buf)
 		RETURN_ERROR(SP_ERR_ARG, "Null buffer");
@@ -1301,14 +2092,21 @@ SP_API enum sp_return sp_nonblocking_read(struct sp_port *port, void *buf,
 	if (GetOverlappedResult(port->hdl, &port->read_ovl, &bytes_read, FALSE) == 0)
 		RETURN_FAIL("GetOverlappedResult() failed");
 
+	STAT_ADD(port, reads, 1);
+	STAT_ADD(port, bytes_read, bytes_read);
+
 	TRY(restart_wait_if_needed(port, bytes_read));
 
 	RETURN_INT(bytes_read);
 #else
 	ssize_t bytes_read;
 
+	TRY(ensure_nonblocking(port));
+
 	/* Returns the number of bytes read, or -1 upon failure. */
-	if ((bytes_read = read(port->fd, buf, count)) < 0) {
+	bytes_read = read(port->fd, buf, count);
+	STAT_ADD(port, reads, 1);
+	if (bytes_read < 0) {
 		if (errno == EAGAIN)
 			/* No bytes available. */
 			bytes_read = 0;
@@ -1316,20 +2114,303 @@ SP_API enum sp_return sp_nonblocking_read(struct sp_port *port, void *buf,
 			/* This is an actual failure. */
 			RETURN_FAIL("read() failed");
 	}
+	STAT_ADD(port, bytes_read, bytes_read);
 	RETURN_INT(bytes_read);
 #endif
 }
 
-SP_API enum sp_return sp_input_waiting(struct sp_port *port)
+SP_API enum sp_return sp_blocking_read_vmin(struct sp_port *port, void *buf,
+                                            size_t count, unsigned int min_bytes,
+                                            unsigned int interbyte_timeout_ms)
 {
-	TRACE("%p", port);
+	TRACE("%p, %p, %d, %d, %d", port, buf, count, min_bytes,
+		interbyte_timeout_ms);
 
 	CHECK_OPEN_PORT();
 
-	DEBUG_FMT("Checking input bytes waiting on port %s", port->name);
+	if (!buf)
+		RETURN_ERROR(SP_ERR_ARG, "Null buffer");
 
-#ifdef _WIN32
-	DWORD errors;
+	if (count == 0)
+		RETURN_ERROR(SP_ERR_ARG, "Zero count");
+
+	if (count > INT_MAX)
+		RETURN_ERROR(SP_ERR_ARG, "Count too large");
+
+	if (min_bytes > 255)
+		RETURN_ERROR(SP_ERR_ARG, "Minimum byte count too large");
+
+	if (interbyte_timeout_ms > 25500)
+		RETURN_ERROR(SP_ERR_ARG, "Timeout too large");
+
+#ifdef _WIN32
+	RETURN_ERROR(SP_ERR_SUPP, "VMIN/VTIME reads not supported");
+#else
+	/* VTIME is in tenths of a second. */
+	cc_t vmin = (cc_t) min_bytes;
+	cc_t vtime = (cc_t) ((interbyte_timeout_ms + 99) / 100);
+	struct termios term;
+	int flags;
+	ssize_t result;
+
+	CHECK_READ_OWNER();
+
+	/* A blocking read would hold up the reactor's worker. */
+	if (port->reactor)
+		RETURN_ERROR(SP_ERR_ARG, "Port is in a reactor");
+
+	if (!port->config_valid)
+		TRY(refresh_config(port));
+
+	if (port->data.term.c_cc[VMIN] != vmin ||
+			port->data.term.c_cc[VTIME] != vtime) {
+		DEBUG_FMT("Setting VMIN=%d, VTIME=%d on port %s",
+			vmin, vtime, port->name);
+		term = port->data.term;
+		term.c_cc[VMIN] = vmin;
+		term.c_cc[VTIME] = vtime;
+		if (tcsetattr(port->fd, TCSANOW, &term) < 0) {
+			/* The device may have been partially reconfigured. */
+			port->config_valid = false;
+			RETURN_FAIL("tcsetattr() failed");
+		}
+		port->data.term.c_cc[VMIN] = vmin;
+		port->data.term.c_cc[VTIME] = vtime;
+	}
+
+	/* VMIN and VTIME only take effect when O_NONBLOCK is clear. */
+	if (!port->fd_blocking) {
+		if ((flags = fcntl(port->fd, F_GETFL)) < 0)
+			RETURN_FAIL("fcntl() failed");
+		if (fcntl(port->fd, F_SETFL, flags & ~O_NONBLOCK) < 0)
+			RETURN_FAIL("fcntl() failed");
+		port->fd_blocking = true;
+	}
+
+	DEBUG_FMT("Reading up to %d bytes from port %s, VMIN=%d, VTIME=%d",
+		count, port->name, vmin, vtime);
+
+	while ((result = read(port->fd, buf, count)) < 0) {
+		STAT_ADD(port, reads, 1);
+		if (errno != EINTR)
+			RETURN_FAIL("read() failed");
+		DEBUG("read() call was interrupted, repeating");
+		STAT_ADD(port, retries, 1);
+	}
+
+	STAT_ADD(port, reads, 1);
+	STAT_ADD(port, bytes_read, result);
+	if (result == 0)
+		STAT_ADD(port, timeouts, 1);
+
+	DEBUG_FMT("Read %d bytes from port %s", result, port->name);
+
+	RETURN_INT((int) result);
+#endif
+}
+
+SP_API enum sp_return sp_read_timestamped(struct sp_port *port, void *buf,
+                                          size_t count, unsigned int timeout_ms,
+                                          struct sp_timestamp *timestamp)
+{
+	TRACE("%p, %p, %d, %d, %p", port, buf, count, timeout_ms, timestamp);
+
+	CHECK_OPEN_PORT();
+	CHECK_READ_OWNER();
+
+	if (!buf)
+		RETURN_ERROR(SP_ERR_ARG, "Null buffer");
+
+	if (count == 0)
+		RETURN_ERROR(SP_ERR_ARG, "Zero count");
+
+	if (count > INT_MAX)
+		RETURN_ERROR(SP_ERR_ARG, "Count too large");
+
+	if (!timestamp)
+		RETURN_ERROR(SP_ERR_ARG, "Null result pointer");
+
+	memset(timestamp, 0, sizeof(struct sp_timestamp));
+
+#ifdef _WIN32
+	RETURN_ERROR(SP_ERR_SUPP, "Timestamped reads not supported");
+#else
+	struct sp_port_config *config = &port->config;
+	struct timeout timeout;
+	struct time now;
+	unsigned int frame_bits;
+	ssize_t result;
+
+	TRY(ensure_nonblocking(port));
+
+	if (!port->config_valid)
+		TRY(refresh_config(port));
+
+	timeout_start(&timeout, timeout_ms);
+
+	while (1) {
+		if (timeout_check(&timeout)) {
+			STAT_ADD(port, timeouts, 1);
+			RETURN_INT(0);
+		}
+
+		/* The time is taken straight after poll() returns. */
+		result = wait_port(port, POLLIN, &timeout, &now);
+
+		timeout_update(&timeout);
+
+		if (result < 0) {
+			if (errno == EINTR) {
+				DEBUG("poll() call was interrupted, repeating");
+				continue;
+			}
+			RETURN_FAIL("poll() failed");
+		} else if (result == 0) {
+			STAT_ADD(port, timeouts, 1);
+			RETURN_INT(0);
+		}
+
+		result = read(port->fd, buf, count);
+		STAT_ADD(port, reads, 1);
+
+		if (result > 0)
+			break;
+		if (result == 0 || errno == EAGAIN || errno == EINTR) {
+			/* Spurious wakeup, or the data was taken elsewhere. */
+			STAT_ADD(port, retries, 1);
+			continue;
+		}
+		RETURN_FAIL("read() failed");
+	}
+
+	STAT_ADD(port, bytes_read, result);
+
+	timestamp->time_ns = time_as_ns(&now);
+	timestamp->offset = port->timestamp_offset;
+	timestamp->count = (size_t) result;
+
+	/* A character is a start bit, the data bits, any parity bit and the stop bits. */
+	if (config->baudrate > 0 && config->bits > 0 && config->stopbits > 0) {
+		frame_bits = 1 + config->bits + config->stopbits +
+			(config->parity > SP_PARITY_NONE ? 1 : 0);
+		timestamp->byte_time_ns = (unsigned int)
+			(frame_bits * 1000000000ULL / (unsigned int) config->baudrate);
+	}
+
+	port->timestamp_offset += (unsigned long long) result;
+
+	DEBUG_FMT("Read %d bytes from port %s at offset %llu", result, port->name,
+		timestamp->offset);
+
+	RETURN_INT((int) result);
+#endif
+}
+
+SP_API enum sp_return sp_get_byte_timestamp(const struct sp_timestamp *timestamp,
+                                            size_t index,
+                                            unsigned long long *time_ns)
+{
+	TRACE("%p, %d, %p", timestamp, index, time_ns);
+
+	if (!timestamp)
+		RETURN_ERROR(SP_ERR_ARG, "Null timestamp");
+
+	if (!time_ns)
+		RETURN_ERROR(SP_ERR_ARG, "Null result pointer");
+
+	if (index >= timestamp->count)
+		RETURN_ERROR(SP_ERR_ARG, "Index beyond chunk");
+
+	if (timestamp->byte_time_ns == 0)
+		RETURN_ERROR(SP_ERR_SUPP, "Character time not known");
+
+	*time_ns = timestamp->time_ns - (unsigned long long)
+		(timestamp->count - 1 - index) * timestamp->byte_time_ns;
+
+	RETURN_OK();
+}
+
+SP_API enum sp_return sp_get_port_stats(struct sp_port *port,
+                                        struct sp_port_stats *stats)
+{
+	unsigned int i;
+
+	TRACE("%p, %p", port, stats);
+
+	CHECK_PORT();
+
+	if (!stats)
+		RETURN_ERROR(SP_ERR_ARG, "Null result pointer");
+
+	stats->bytes_read = STAT_LOAD(port->stats.bytes_read);
+	stats->bytes_written = STAT_LOAD(port->stats.bytes_written);
+	stats->reads = STAT_LOAD(port->stats.reads);
+	stats->writes = STAT_LOAD(port->stats.writes);
+	stats->short_reads = STAT_LOAD(port->stats.short_reads);
+	stats->timeouts = STAT_LOAD(port->stats.timeouts);
+	stats->retries = STAT_LOAD(port->stats.retries);
+	stats->waits = STAT_LOAD(port->stats.waits);
+	for (i = 0; i < SP_STATS_HISTOGRAM_SIZE; i++)
+		stats->wait_histogram[i] = STAT_LOAD(port->stats.wait_histogram[i]);
+
+	stats->overruns = -1;
+	stats->buffer_overruns = -1;
+	stats->frame_errors = -1;
+	stats->parity_errors = -1;
+	stats->breaks = -1;
+
+#if defined(__linux__) && defined(HAVE_STRUCT_SERIAL_STRUCT) && defined(TIOCGICOUNT)
+	struct serial_icounter_struct icount;
+
+	if (port->fd >= 0) {
+		/* Drivers without error counters reject the ioctl. */
+		if (ioctl(port->fd, TIOCGICOUNT, &icount) == 0) {
+			stats->overruns = icount.overrun;
+			stats->buffer_overruns = icount.buf_overrun;
+			stats->frame_errors = icount.frame;
+			stats->parity_errors = icount.parity;
+			stats->breaks = icount.brk;
+		} else {
+			DEBUG("TIOCGICOUNT ioctl failed, driver counts not available");
+		}
+	}
+#endif
+
+	RETURN_OK();
+}
+
+SP_API enum sp_return sp_reset_port_stats(struct sp_port *port)
+{
+	unsigned int i;
+
+	TRACE("%p", port);
+
+	CHECK_PORT();
+
+	STAT_STORE(port->stats.bytes_read, 0);
+	STAT_STORE(port->stats.bytes_written, 0);
+	STAT_STORE(port->stats.reads, 0);
+	STAT_STORE(port->stats.writes, 0);
+	STAT_STORE(port->stats.short_reads, 0);
+	STAT_STORE(port->stats.timeouts, 0);
+	STAT_STORE(port->stats.retries, 0);
+	STAT_STORE(port->stats.waits, 0);
+	for (i = 0; i < SP_STATS_HISTOGRAM_SIZE; i++)
+		STAT_STORE(port->stats.wait_histogram[i], 0);
+
+	RETURN_OK();
+}
+
+SP_API enum sp_return sp_input_waiting(struct sp_port *port)
+{
+	TRACE("%p", port);
+
+	CHECK_OPEN_PORT();
+
+	DEBUG_FMT("Checking input bytes waiting on port %s", port->name);
+
+#ifdef _WIN32
+	DWORD errors;
 	COMSTAT comstat;
 
 	if (ClearCommError(port->hdl, &errors, &comstat) == 0)
@@ -1374,7 +2455,7 @@ SP_API enum sp_return sp_output_waiting(struct sp_port *port)
 
 SP_API enum sp_return sp_new_event_set(struct sp_event_set **result_ptr)
 {
-	struct sp_event_set *result;
+	struct event_set_data *result;
 
 	TRACE("%p", result_ptr);
 
@@ -1383,44 +2464,216 @@ SP_API enum sp_return sp_new_event_set(struct sp_event_set **result_ptr)
 
 	*result_ptr = NULL;
 
-	if (!(result = malloc(sizeof(struct sp_event_set))))
+	if (!(result = malloc(sizeof(struct event_set_data))))
 		RETURN_ERROR(SP_ERR_MEM, "sp_event_set malloc() failed");
 
-	memset(result, 0, sizeof(struct sp_event_set));
+	memset(result, 0, sizeof(struct event_set_data));
 
-	*result_ptr = result;
+#ifdef HAVE_SYS_EPOLL_H
+	result->epoll_fd = -1;
+#endif
+
+	*result_ptr = &result->set;
 
 	RETURN_OK();
 }
 
-static enum sp_return add_handle(struct sp_event_set *event_set,
-		event_handle handle, enum sp_event mask)
+#ifdef HAVE_SYS_EPOLL_H
+/* Register or update handle i of an event set with its epoll instance. */
+static enum sp_return epoll_update(struct event_set_data *data,
+		unsigned int i, int op)
 {
+	struct epoll_event event;
+
+	TRACE("%p, %d, %d", data, i, op);
+
+	memset(&event, 0, sizeof(event));
+
+	if (data->set.masks[i] & SP_EVENT_RX_READY)
+		event.events |= EPOLLIN;
+	if (data->set.masks[i] & SP_EVENT_TX_READY)
+		event.events |= EPOLLOUT;
+	if (data->set.masks[i] & SP_EVENT_ERROR)
+		event.events |= EPOLLERR;
+
+	event.data.ptr = data->ports[i];
+
+	if (epoll_ctl(data->epoll_fd, op,
+			((int *) data->set.handles)[i], &event) < 0)
+		RETURN_FAIL("epoll_ctl() failed");
+
+	RETURN_OK();
+}
+#endif
+
+/* Grow the arrays of an event set geometrically, so adds are amortized O(1). */
+static enum sp_return grow_event_set(struct event_set_data *data)
+{
+	struct sp_event_set *event_set = &data->set;
+	unsigned int capacity = data->capacity ? data->capacity * 2 : 8;
 	void *new_handles;
 	enum sp_event *new_masks;
+	struct sp_port **new_ports;
+#ifndef _WIN32
+	struct pollfd *new_pollfds;
+#endif
 
-	TRACE("%p, %d, %d", event_set, handle, mask);
+	TRACE("%p", data);
+
+	DEBUG_FMT("Growing event set to %d handles", capacity);
 
 	if (!(new_handles = realloc(event_set->handles,
-			sizeof(event_handle) * (event_set->count + 1))))
+			sizeof(event_handle) * capacity)))
 		RETURN_ERROR(SP_ERR_MEM, "Handle array realloc() failed");
 
 	event_set->handles = new_handles;
 
 	if (!(new_masks = realloc(event_set->masks,
-			sizeof(enum sp_event) * (event_set->count + 1))))
+			sizeof(enum sp_event) * capacity)))
 		RETURN_ERROR(SP_ERR_MEM, "Mask array realloc() failed");
 
 	event_set->masks = new_masks;
 
-	((event_handle *) event_set->handles)[event_set->count] = handle;
-	event_set->masks[event_set->count] = mask;
+	if (!(new_ports = realloc(data->ports,
+			sizeof(struct sp_port *) * capacity)))
+		RETURN_ERROR(SP_ERR_MEM, "Port array realloc() failed");
+
+	data->ports = new_ports;
+
+#ifndef _WIN32
+	if (!(new_pollfds = realloc(data->pollfds,
+			sizeof(struct pollfd) * capacity)))
+		RETURN_ERROR(SP_ERR_MEM, "pollfd array realloc() failed");
+
+	data->pollfds = new_pollfds;
+#endif
+
+	data->capacity = capacity;
+
+	RETURN_OK();
+}
+
+/* Bring the poll() and epoll state for handle i in line with its mask. */
+static enum sp_return update_handle(struct event_set_data *data,
+		unsigned int i, bool added)
+{
+	TRACE("%p, %d, %d", data, i, added);
+
+#ifdef _WIN32
+	(void)data;
+	(void)i;
+	(void)added;
+#else
+	struct pollfd *pollfd = &data->pollfds[i];
+
+	pollfd->fd = ((int *) data->set.handles)[i];
+	pollfd->events = 0;
+	pollfd->revents = 0;
+	if (data->set.masks[i] & SP_EVENT_RX_READY)
+		pollfd->events |= POLLIN;
+	if (data->set.masks[i] & SP_EVENT_TX_READY)
+		pollfd->events |= POLLOUT;
+	if (data->set.masks[i] & SP_EVENT_ERROR)
+		pollfd->events |= POLLERR;
+#endif
+#ifdef HAVE_SYS_EPOLL_H
+	if (data->epoll_fd >= 0)
+		TRY(epoll_update(data, i, added ? EPOLL_CTL_ADD : EPOLL_CTL_MOD));
+#endif
+
+	RETURN_OK();
+}
+
+/*
+ * Change the mask of handle i. If the change cannot be applied, the old
+ * mask is put back, so that the set still matches what is registered.
+ */
+static enum sp_return set_handle_mask(struct event_set_data *data,
+		unsigned int i, enum sp_event mask)
+{
+	enum sp_event old_mask = data->set.masks[i];
+	enum sp_return ret;
+
+	TRACE("%p, %d, %d", data, i, mask);
+
+	data->set.masks[i] = mask;
+
+	if ((ret = update_handle(data, i, false)) != SP_OK) {
+		data->set.masks[i] = old_mask;
+		update_handle(data, i, false);
+		RETURN_CODEVAL(ret);
+	}
+
+	RETURN_OK();
+}
+
+static enum sp_return add_handle(struct sp_event_set *event_set,
+		event_handle handle, enum sp_event mask, struct sp_port *port)
+{
+	struct event_set_data *data = EVENT_SET_DATA(event_set);
+	enum sp_return ret;
+	unsigned int i;
+
+	TRACE("%p, %d, %d", event_set, handle, mask);
+
+	/* A handle may only appear once; merge masks for repeated adds. */
+	for (i = 0; i < event_set->count; i++) {
+		if (((event_handle *) event_set->handles)[i] == handle) {
+			TRY(set_handle_mask(data, i, event_set->masks[i] | mask));
+			RETURN_OK();
+		}
+	}
+
+	if (event_set->count == data->capacity)
+		TRY(grow_event_set(data));
+
+	i = event_set->count;
+
+	((event_handle *) event_set->handles)[i] = handle;
+	event_set->masks[i] = mask;
+	data->ports[i] = port;
+
+	if ((ret = update_handle(data, i, true)) != SP_OK)
+		RETURN_CODEVAL(ret);
 
 	event_set->count++;
 
 	RETURN_OK();
 }
 
+/* Remove handle i from an event set, moving the last handle into its place. */
+static void remove_handle(struct event_set_data *data, unsigned int i)
+{
+	struct sp_event_set *event_set = &data->set;
+	unsigned int last = event_set->count - 1;
+
+	TRACE("%p, %d", data, i);
+
+#ifdef HAVE_SYS_EPOLL_H
+	/*
+	 * The kernel drops closed descriptors from the epoll set by itself,
+	 * so failure here just means the port was closed before removal.
+	 */
+	if (data->epoll_fd >= 0 && epoll_ctl(data->epoll_fd, EPOLL_CTL_DEL,
+			((int *) event_set->handles)[i], NULL) < 0)
+		DEBUG("epoll_ctl() removal failed, ignoring");
+#endif
+
+	if (i != last) {
+		((event_handle *) event_set->handles)[i] =
+			((event_handle *) event_set->handles)[last];
+		event_set->masks[i] = event_set->masks[last];
+		data->ports[i] = data->ports[last];
+#ifndef _WIN32
+		data->pollfds[i] = data->pollfds[last];
+#endif
+	}
+
+	event_set->count--;
+
+	RETURN();
+}
+
 SP_API enum sp_return sp_add_port_events(struct sp_event_set *event_set,
 	const struct sp_port *port, enum sp_event mask)
 {
@@ -1429,83 +2682,340 @@ SP_API enum sp_return sp_add_port_events(struct sp_event_set *event_set,
 	if (!event_set)
 		RETURN_ERROR(SP_ERR_ARG, "Null event set");
 
-	if (!port)
-		RETURN_ERROR(SP_ERR_ARG, "Null port");
+	if (!port)
+		RETURN_ERROR(SP_ERR_ARG, "Null port");
+
+	if (mask > (SP_EVENT_RX_READY | SP_EVENT_TX_READY | SP_EVENT_ERROR))
+		RETURN_ERROR(SP_ERR_ARG, "Invalid event mask");
+
+	if (!mask)
+		RETURN_OK();
+
+#ifdef _WIN32
+	enum sp_event handle_mask;
+	if ((handle_mask = mask & SP_EVENT_TX_READY))
+		TRY(add_handle(event_set, port->write_ovl.hEvent, handle_mask,
+				(struct sp_port *) port));
+	if ((handle_mask = mask & (SP_EVENT_RX_READY | SP_EVENT_ERROR)))
+		TRY(add_handle(event_set, port->wait_ovl.hEvent, handle_mask,
+				(struct sp_port *) port));
+#else
+	TRY(add_handle(event_set, port->fd, mask, (struct sp_port *) port));
+#endif
+
+	RETURN_OK();
+}
+
+SP_API enum sp_return sp_remove_port_events(struct sp_event_set *event_set,
+	const struct sp_port *port)
+{
+	struct event_set_data *data = EVENT_SET_DATA(event_set);
+	bool found = false;
+	unsigned int i;
+
+	TRACE("%p, %p", event_set, port);
+
+	if (!event_set)
+		RETURN_ERROR(SP_ERR_ARG, "Null event set");
+
+	if (!port)
+		RETURN_ERROR(SP_ERR_ARG, "Null port");
+
+	/* Walk backwards, as removal moves the last handle into the gap. */
+	for (i = event_set->count; i-- > 0; ) {
+		if (data->ports[i] == port) {
+			remove_handle(data, i);
+			found = true;
+		}
+	}
+
+	if (!found)
+		RETURN_ERROR(SP_ERR_ARG, "Port not in event set");
+
+	RETURN_OK();
+}
+
+SP_API enum sp_return sp_modify_port_events(struct sp_event_set *event_set,
+	const struct sp_port *port, enum sp_event mask)
+{
+	TRACE("%p, %p, %d", event_set, port, mask);
+
+	if (!event_set)
+		RETURN_ERROR(SP_ERR_ARG, "Null event set");
+
+	if (!port)
+		RETURN_ERROR(SP_ERR_ARG, "Null port");
+
+	if (mask > (SP_EVENT_RX_READY | SP_EVENT_TX_READY | SP_EVENT_ERROR))
+		RETURN_ERROR(SP_ERR_ARG, "Invalid event mask");
+
+	if (!mask)
+		RETURN_INT(sp_remove_port_events(event_set, port));
+
+#ifdef _WIN32
+	/* Events are spread over two handles per port, so replace them. */
+	TRY(sp_remove_port_events(event_set, port));
+	TRY(sp_add_port_events(event_set, port, mask));
+#else
+	struct event_set_data *data = EVENT_SET_DATA(event_set);
+	unsigned int i;
+
+	for (i = 0; i < event_set->count; i++)
+		if (data->ports[i] == port)
+			break;
+
+	if (i == event_set->count)
+		RETURN_ERROR(SP_ERR_ARG, "Port not in event set");
+
+	TRY(set_handle_mask(data, i, mask));
+#endif
+
+	RETURN_OK();
+}
+
+SP_API void sp_free_event_set(struct sp_event_set *event_set)
+{
+	struct event_set_data *data = EVENT_SET_DATA(event_set);
+
+	TRACE("%p", event_set);
+
+	if (!event_set) {
+		DEBUG("Null event set");
+		RETURN();
+	}
+
+	DEBUG("Freeing event set");
+
+	if (event_set->handles)
+		free(event_set->handles);
+	if (event_set->masks)
+		free(event_set->masks);
+	if (data->ports)
+		free(data->ports);
+#ifndef _WIN32
+	if (data->pollfds)
+		free(data->pollfds);
+#endif
+#ifdef HAVE_SYS_EPOLL_H
+	if (data->epoll_fd >= 0)
+		close(data->epoll_fd);
+	if (data->epoll_events)
+		free(data->epoll_events);
+#endif
+
+	free(data);
+
+	RETURN();
+}
+
+#if !defined(_WIN32) && !defined(HAVE_SYS_EPOLL_H)
+/* Map poll() result flags to the events they represent. */
+static enum sp_event poll_revents(short revents)
+{
+	enum sp_event events = 0;
+
+	if (revents & POLLIN)
+		events |= SP_EVENT_RX_READY;
+	if (revents & POLLOUT)
+		events |= SP_EVENT_TX_READY;
+	if (revents & (POLLERR | POLLHUP | POLLNVAL))
+		events |= SP_EVENT_ERROR;
+
+	return events;
+}
+#endif
+
+#ifndef _WIN32
+/*
+ * Wait on the poll() array of an event set. Returns the number of ready
+ * handles, which is zero if the timeout expired, or a negative error code.
+ */
+static int poll_event_set(struct event_set_data *data, uint64_t timeout_ns)
+{
+	struct sp_event_set *event_set = &data->set;
+	struct timeout timeout;
+#ifndef HAVE_PPOLL
+	int poll_timeout;
+#endif
+	int result;
+
+	TRACE("%p, %llu", data, (unsigned long long) timeout_ns);
+
+	timeout_start_ns(&timeout, timeout_ns);
+	timeout_limit(&timeout, INT_MAX);
+
+	/* Loop until an event occurs. */
+	while (1) {
+
+		if (timeout_check(&timeout)) {
+			DEBUG("Wait timed out");
+			RETURN_INT(0);
+		}
+
+#ifdef HAVE_PPOLL
+		result = ppoll(data->pollfds, event_set->count,
+			timeout_timespec(&timeout), NULL);
+#else
+		poll_timeout = (int) timeout_remaining_ms(&timeout);
+		if (poll_timeout == 0)
+			poll_timeout = -1;
+
+		result = poll(data->pollfds, event_set->count, poll_timeout);
+#endif
+
+		timeout_update(&timeout);
+
+		if (result < 0) {
+			if (errno == EINTR) {
+				DEBUG("poll() call was interrupted, repeating");
+				continue;
+			} else {
+				RETURN_FAIL("poll() failed");
+			}
+		} else if (result == 0) {
+			DEBUG("poll() timed out");
+			if (!timeout.overflow)
+				RETURN_INT(0);
+		} else {
+			DEBUG("poll() completed");
+			RETURN_INT(result);
+		}
+	}
+}
+#endif
+
+static enum sp_return wait_event_set(struct sp_event_set *event_set,
+                                     uint64_t timeout_ns)
+{
+	if (!event_set)
+		RETURN_ERROR(SP_ERR_ARG, "Null event set");
+
+#ifdef _WIN32
+	/* Windows only has millisecond timeouts, so round up. */
+	uint64_t timeout_ms = (timeout_ns + 999999) / 1000000;
 
-	if (mask > (SP_EVENT_RX_READY | SP_EVENT_TX_READY | SP_EVENT_ERROR))
-		RETURN_ERROR(SP_ERR_ARG, "Invalid event mask");
+	if (timeout_ms >= INFINITE)
+		timeout_ms = INFINITE - 1;
 
-	if (!mask)
-		RETURN_OK();
+	if (WaitForMultipleObjects(event_set->count, event_set->handles, FALSE,
+			timeout_ms ? (DWORD) timeout_ms : INFINITE) == WAIT_FAILED)
+		RETURN_FAIL("WaitForMultipleObjects() failed");
 
-#ifdef _WIN32
-	enum sp_event handle_mask;
-	if ((handle_mask = mask & SP_EVENT_TX_READY))
-		TRY(add_handle(event_set, port->write_ovl.hEvent, handle_mask));
-	if ((handle_mask = mask & (SP_EVENT_RX_READY | SP_EVENT_ERROR)))
-		TRY(add_handle(event_set, port->wait_ovl.hEvent, handle_mask));
+	RETURN_OK();
 #else
-	TRY(add_handle(event_set, port->fd, mask));
-#endif
+	int result = poll_event_set(EVENT_SET_DATA(event_set), timeout_ns);
+
+	if (result < 0)
+		RETURN_CODEVAL(result);
 
 	RETURN_OK();
+#endif
 }
 
-SP_API void sp_free_event_set(struct sp_event_set *event_set)
+SP_API enum sp_return sp_wait(struct sp_event_set *event_set,
+                              unsigned int timeout_ms)
 {
-	TRACE("%p", event_set);
+	TRACE("%p, %d", event_set, timeout_ms);
 
-	if (!event_set) {
-		DEBUG("Null event set");
-		RETURN();
-	}
+	return wait_event_set(event_set, (uint64_t) timeout_ms * 1000000);
+}
 
-	DEBUG("Freeing event set");
+SP_API enum sp_return sp_wait_ns(struct sp_event_set *event_set,
+                                 unsigned long long timeout_ns)
+{
+	TRACE("%p, %llu", event_set, timeout_ns);
 
-	if (event_set->handles)
-		free(event_set->handles);
-	if (event_set->masks)
-		free(event_set->masks);
+	return wait_event_set(event_set, timeout_ns);
+}
 
-	free(event_set);
+SP_API enum sp_return sp_wait_us(struct sp_event_set *event_set,
+                                 unsigned int timeout_us)
+{
+	TRACE("%p, %d", event_set, timeout_us);
 
-	RETURN();
+	return wait_event_set(event_set, (uint64_t) timeout_us * 1000);
 }
 
-SP_API enum sp_return sp_wait(struct sp_event_set *event_set,
-                              unsigned int timeout_ms)
+SP_API enum sp_return sp_wait_events(struct sp_event_set *event_set,
+                                     struct sp_event_result *results,
+                                     unsigned int max_results,
+                                     unsigned int timeout_ms)
 {
-	TRACE("%p, %d", event_set, timeout_ms);
+	struct event_set_data *data = EVENT_SET_DATA(event_set);
+	unsigned int i;
+
+	TRACE("%p, %p, %d, %d", event_set, results, max_results, timeout_ms);
 
 	if (!event_set)
 		RETURN_ERROR(SP_ERR_ARG, "Null event set");
 
+	if (!results)
+		RETURN_ERROR(SP_ERR_ARG, "Null results");
+
+	if (max_results == 0)
+		RETURN_ERROR(SP_ERR_ARG, "Zero result count");
+
 #ifdef _WIN32
-	if (WaitForMultipleObjects(event_set->count, event_set->handles, FALSE,
-			timeout_ms ? timeout_ms : INFINITE) == WAIT_FAILED)
+	HANDLE *handles = event_set->handles;
+	unsigned int num_results = 0;
+	DWORD wait_result;
+
+	wait_result = WaitForMultipleObjects(event_set->count, handles, FALSE,
+			timeout_ms ? timeout_ms : INFINITE);
+
+	if (wait_result == WAIT_FAILED)
 		RETURN_FAIL("WaitForMultipleObjects() failed");
 
-	RETURN_OK();
-#else
+	if (wait_result == WAIT_TIMEOUT) {
+		DEBUG("Wait timed out");
+		RETURN_INT(0);
+	}
+
+	/* Collect every handle that is now signalled, one result per port. */
+	for (i = 0; i < event_set->count && num_results < max_results; i++) {
+		if (WaitForSingleObject(handles[i], 0) != WAIT_OBJECT_0)
+			continue;
+		if (num_results > 0 && results[num_results - 1].port == data->ports[i]) {
+			results[num_results - 1].events |= event_set->masks[i];
+		} else {
+			results[num_results].port = data->ports[i];
+			results[num_results].events = event_set->masks[i];
+			num_results++;
+		}
+	}
+
+	RETURN_INT(num_results);
+#elif defined(HAVE_SYS_EPOLL_H)
+	struct epoll_event *new_events;
 	struct timeout timeout;
+	enum sp_return ret;
 	int poll_timeout;
 	int result;
-	struct pollfd *pollfds;
-	unsigned int i;
 
-	if (!(pollfds = malloc(sizeof(struct pollfd) * event_set->count)))
-		RETURN_ERROR(SP_ERR_MEM, "pollfds malloc() failed");
+	if (data->epoll_fd < 0) {
+		DEBUG("Creating epoll instance for event set");
 
-	for (i = 0; i < event_set->count; i++) {
-		pollfds[i].fd = ((int *)event_set->handles)[i];
-		pollfds[i].events = 0;
-		pollfds[i].revents = 0;
-		if (event_set->masks[i] & SP_EVENT_RX_READY)
-			pollfds[i].events |= POLLIN;
-		if (event_set->masks[i] & SP_EVENT_TX_READY)
-			pollfds[i].events |= POLLOUT;
-		if (event_set->masks[i] & SP_EVENT_ERROR)
-			pollfds[i].events |= POLLERR;
+		if ((data->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+			RETURN_FAIL("epoll_create1() failed");
+
+		for (i = 0; i < event_set->count; i++) {
+			if ((ret = epoll_update(data, i, EPOLL_CTL_ADD)) != SP_OK) {
+				close(data->epoll_fd);
+				data->epoll_fd = -1;
+				RETURN_CODEVAL(ret);
+			}
+		}
+	}
+
+	if (max_results > INT_MAX)
+		max_results = INT_MAX;
+
+	if (data->epoll_events_size < max_results) {
+		if (!(new_events = realloc(data->epoll_events,
+				sizeof(struct epoll_event) * max_results)))
+			RETURN_ERROR(SP_ERR_MEM, "epoll_event array realloc() failed");
+		data->epoll_events = new_events;
+		data->epoll_events_size = max_results;
 	}
 
 	timeout_start(&timeout, timeout_ms);
@@ -1516,37 +3026,64 @@ SP_API enum sp_return sp_wait(struct sp_event_set *event_set,
 
 		if (timeout_check(&timeout)) {
 			DEBUG("Wait timed out");
-			break;
+			RETURN_INT(0);
 		}
 
 		poll_timeout = (int) timeout_remaining_ms(&timeout);
 		if (poll_timeout == 0)
 			poll_timeout = -1;
 
-		result = poll(pollfds, event_set->count, poll_timeout);
+		result = epoll_wait(data->epoll_fd, data->epoll_events,
+				(int) max_results, poll_timeout);
 
 		timeout_update(&timeout);
 
 		if (result < 0) {
 			if (errno == EINTR) {
-				DEBUG("poll() call was interrupted, repeating");
+				DEBUG("epoll_wait() call was interrupted, repeating");
 				continue;
 			} else {
-				free(pollfds);
-				RETURN_FAIL("poll() failed");
+				RETURN_FAIL("epoll_wait() failed");
 			}
 		} else if (result == 0) {
-			DEBUG("poll() timed out");
+			DEBUG("epoll_wait() timed out");
 			if (!timeout.overflow)
-				break;
+				RETURN_INT(0);
 		} else {
-			DEBUG("poll() completed");
+			DEBUG("epoll_wait() completed");
 			break;
 		}
 	}
 
-	free(pollfds);
-	RETURN_OK();
+	for (i = 0; i < (unsigned int) result; i++) {
+		uint32_t events = data->epoll_events[i].events;
+		results[i].port = data->epoll_events[i].data.ptr;
+		results[i].events = 0;
+		if (events & EPOLLIN)
+			results[i].events |= SP_EVENT_RX_READY;
+		if (events & EPOLLOUT)
+			results[i].events |= SP_EVENT_TX_READY;
+		if (events & (EPOLLERR | EPOLLHUP))
+			results[i].events |= SP_EVENT_ERROR;
+	}
+
+	RETURN_INT(result);
+#else
+	unsigned int num_results = 0;
+	int result = poll_event_set(data, (uint64_t) timeout_ms * 1000000);
+
+	if (result < 0)
+		RETURN_CODEVAL(result);
+
+	for (i = 0; i < event_set->count && num_results < max_results; i++) {
+		if (!data->pollfds[i].revents)
+			continue;
+		results[num_results].port = data->ports[i];
+		results[num_results].events = poll_revents(data->pollfds[i].revents);
+		num_results++;
+	}
+
+	RETURN_INT(num_results);
 #endif
 }
 
@@ -1662,6 +3199,29 @@ static enum sp_return set_flow(int fd, struct port_data *data)
 }
 #endif /* USE_TERMIOX */
 
+#ifndef _WIN32
+/*
+ * Check whether a descriptor is the slave side of a pseudo-terminal, which
+ * has no modem control lines to read.
+ */
+static bool is_pseudo_terminal(int fd)
+{
+#ifdef __linux__
+	struct stat st;
+
+	if (fstat(fd, &st) < 0 || !S_ISCHR(st.st_mode))
+		return false;
+
+	/* Unix98 pseudo-terminal slaves use majors 136 to 143. */
+	return major(st.st_rdev) >= 136 && major(st.st_rdev) <= 143;
+#else
+	(void) fd;
+
+	return false;
+#endif
+}
+#endif
+
 static enum sp_return get_config(struct sp_port *port, struct port_data *data,
 	struct sp_port_config *config)
 {
@@ -1768,8 +3328,13 @@ static enum sp_return get_config(struct sp_port *port, struct port_data *data,
 	if (tcgetattr(port->fd, &data->term) < 0)
 		RETURN_FAIL("tcgetattr() failed");
 
-	if (ioctl(port->fd, TIOCMGET, &data->controlbits) < 0)
-		RETURN_FAIL("TIOCMGET ioctl failed");
+	if (ioctl(port->fd, TIOCMGET, &data->controlbits) < 0) {
+		/* Pseudo-terminals have no modem control lines. */
+		if ((errno != ENOTTY && errno != EINVAL) ||
+				!is_pseudo_terminal(port->fd))
+			RETURN_FAIL("TIOCMGET ioctl failed");
+		data->controlbits = 0;
+	}
 
 #ifdef USE_TERMIOX
 	int ret = get_flow(port->fd, data);
@@ -2029,8 +3594,12 @@ static enum sp_return set_config(struct sp_port *port, struct port_data *data,
 		}
 	}
 
-	if (!SetCommState(port->hdl, &data->dcb))
-		RETURN_FAIL("SetCommState() failed");
+	/* Skip the call if the port is known to be in this state already. */
+	if (!port->config_valid ||
+			memcmp(&data->dcb, &port->data.dcb, sizeof(DCB)) != 0) {
+		if (!SetCommState(port->hdl, &data->dcb))
+			RETURN_FAIL("SetCommState() failed");
+	}
 
 #else /* !_WIN32 */
 
@@ -2238,8 +3807,12 @@ static enum sp_return set_config(struct sp_port *port, struct port_data *data,
 		}
 	}
 
-	if (tcsetattr(port->fd, TCSANOW, &data->term) < 0)
-		RETURN_FAIL("tcsetattr() failed");
+	/* Skip the call if the port is known to be in this state already. */
+	if (!port->config_valid ||
+			memcmp(&data->term, &port->data.term, sizeof(struct termios)) != 0) {
+		if (tcsetattr(port->fd, TCSANOW, &data->term) < 0)
+			RETURN_FAIL("tcsetattr() failed");
+	}
 
 #ifdef __APPLE__
 	if (baud_nonstd != B0) {
@@ -2254,8 +3827,16 @@ static enum sp_return set_config(struct sp_port *port, struct port_data *data,
 	}
 #elif defined(__linux__)
 #ifdef USE_TERMIOS_SPEED
-	if (baud_nonstd)
+	if (baud_nonstd) {
 		TRY(set_baudrate(port->fd, config->baudrate));
+		/*
+		 * The rate was set outside data->term, so read back the speed
+		 * bits the device now reports, or a later switch back to the
+		 * previous standard rate would match the cache and be skipped.
+		 */
+		if (tcgetattr(port->fd, &data->term) < 0)
+			RETURN_FAIL("tcgetattr() failed");
+	}
 #endif
 #ifdef USE_TERMIOX
 	if (data->termiox_supported)
@@ -2268,6 +3849,137 @@ static enum sp_return set_config(struct sp_port *port, struct port_data *data,
 	RETURN_OK();
 }
 
+/* Mark every setting in a configuration as one to be left alone. */
+static void clear_config(struct sp_port_config *config)
+{
+	config->baudrate = -1;
+	config->bits = -1;
+	config->parity = -1;
+	config->stopbits = -1;
+	config->rts = -1;
+	config->cts = -1;
+	config->dtr = -1;
+	config->dsr = -1;
+	config->xon_xoff = -1;
+}
+
+/* Re-read the port configuration from the device into the cache. */
+static enum sp_return refresh_config(struct sp_port *port)
+{
+	port->config_valid = false;
+
+	TRY(get_config(port, &port->data, &port->config));
+
+	port->config_valid = true;
+
+	RETURN_OK();
+}
+
+/* Overwrite settings in a configuration with those set in another. */
+static void merge_config(struct sp_port_config *dest,
+	const struct sp_port_config *src)
+{
+#define MERGE(x) if (src->x >= 0) dest->x = src->x
+	MERGE(baudrate);
+	MERGE(bits);
+	MERGE(parity);
+	MERGE(stopbits);
+	MERGE(rts);
+	MERGE(cts);
+	MERGE(dtr);
+	MERGE(dsr);
+	MERGE(xon_xoff);
+#undef MERGE
+}
+
+/*
+ * Check that each setting in a configuration is one set_config() accepts,
+ * so that staged changes are rejected when made, as direct ones are.
+ * Settings the port cannot support are still only found on commit.
+ */
+static enum sp_return check_config(const struct sp_port_config *config)
+{
+	if (config->bits >= 0 && (config->bits < 5 || config->bits > 8))
+		RETURN_ERROR(SP_ERR_ARG, "Invalid data bits setting");
+	if (config->parity > SP_PARITY_SPACE)
+		RETURN_ERROR(SP_ERR_ARG, "Invalid parity setting");
+	if (config->stopbits >= 0 && (config->stopbits < 1 || config->stopbits > 2))
+		RETURN_ERROR(SP_ERR_ARG, "Invalid stop bits setting");
+	if (config->rts > SP_RTS_FLOW_CONTROL)
+		RETURN_ERROR(SP_ERR_ARG, "Invalid RTS setting");
+	if (config->cts > SP_CTS_FLOW_CONTROL)
+		RETURN_ERROR(SP_ERR_ARG, "Invalid CTS setting");
+	if (config->dtr > SP_DTR_FLOW_CONTROL)
+		RETURN_ERROR(SP_ERR_ARG, "Invalid DTR setting");
+	if (config->dsr > SP_DSR_FLOW_CONTROL)
+		RETURN_ERROR(SP_ERR_ARG, "Invalid DSR setting");
+	if (config->xon_xoff > SP_XONXOFF_INOUT)
+		RETURN_ERROR(SP_ERR_ARG, "Invalid XON/XOFF setting");
+
+	RETURN_OK();
+}
+
+/*
+ * Apply a configuration on top of the cached port state. Settings which
+ * already have the requested value are dropped, so that only the system
+ * calls needed for the actual changes are made.
+ *
+ * Between sp_begin_config() and sp_commit_config(), the configuration is
+ * only added to the staged changes.
+ */
+static enum sp_return apply_config(struct sp_port *port,
+	const struct sp_port_config *config)
+{
+	struct port_data data;
+	struct sp_port_config changes = *config;
+	const struct sp_port_config *cached = &port->config;
+	enum sp_return ret;
+
+	if (port->staging) {
+		TRY(check_config(config));
+		merge_config(&port->staged, config);
+		RETURN_OK();
+	}
+
+	if (!port->config_valid)
+		TRY(refresh_config(port));
+
+#define UNCHANGED(x) (changes.x < 0 || changes.x == cached->x)
+	if (UNCHANGED(baudrate))
+		changes.baudrate = -1;
+	if (UNCHANGED(bits))
+		changes.bits = -1;
+	if (UNCHANGED(parity))
+		changes.parity = -1;
+	if (UNCHANGED(stopbits))
+		changes.stopbits = -1;
+	if (UNCHANGED(xon_xoff))
+		changes.xon_xoff = -1;
+	/* RTS/CTS and DTR/DSR are validated as pairs, so keep them together. */
+	if (UNCHANGED(rts) && UNCHANGED(cts)) {
+		changes.rts = -1;
+		changes.cts = -1;
+	}
+	if (UNCHANGED(dtr) && UNCHANGED(dsr)) {
+		changes.dtr = -1;
+		changes.dsr = -1;
+	}
+#undef UNCHANGED
+
+	data = port->data;
+
+	if ((ret = set_config(port, &data, &changes)) < 0) {
+		/* The device may have been partially reconfigured. */
+		port->config_valid = false;
+		RETURN_CODEVAL(ret);
+	}
+
+	port->data = data;
+	merge_config(&port->config, config);
+
+	RETURN_OK();
+}
+
 SP_API enum sp_return sp_new_config(struct sp_port_config **config_ptr)
 {
 	struct sp_port_config *config;
@@ -2282,14 +3994,7 @@ SP_API enum sp_return sp_new_config(struct sp_port_config **config_ptr)
 	if (!(config = malloc(sizeof(struct sp_port_config))))
 		RETURN_ERROR(SP_ERR_MEM, "Config malloc failed");
 
-	config->baudrate = -1;
-	config->bits = -1;
-	config->parity = -1;
-	config->stopbits = -1;
-	config->rts = -1;
-	config->cts = -1;
-	config->dtr = -1;
-	config->dsr = -1;
+	clear_config(config);
 
 	*config_ptr = config;
 
@@ -2311,8 +4016,6 @@ SP_API void sp_free_config(struct sp_port_config *config)
 SP_API enum sp_return sp_get_config(struct sp_port *port,
                                     struct sp_port_config *config)
 {
-	struct port_data data;
-
 	TRACE("%p, %p", port, config);
 
 	CHECK_OPEN_PORT();
@@ -2320,7 +4023,21 @@ SP_API enum sp_return sp_get_config(struct sp_port *port,
 	if (!config)
 		RETURN_ERROR(SP_ERR_ARG, "Null config");
 
-	TRY(get_config(port, &data, config));
+	if (!port->config_valid)
+		TRY(refresh_config(port));
+
+	*config = port->config;
+
+	RETURN_OK();
+}
+
+SP_API enum sp_return sp_refresh_config(struct sp_port *port)
+{
+	TRACE("%p", port);
+
+	CHECK_OPEN_PORT();
+
+	TRY(refresh_config(port));
 
 	RETURN_OK();
 }
@@ -2328,9 +4045,6 @@ SP_API enum sp_return sp_get_config(struct sp_port *port,
 SP_API enum sp_return sp_set_config(struct sp_port *port,
                                     const struct sp_port_config *config)
 {
-	struct port_data data;
-	struct sp_port_config prev_config;
-
 	TRACE("%p, %p", port, config);
 
 	CHECK_OPEN_PORT();
@@ -2338,21 +4052,79 @@ SP_API enum sp_return sp_set_config(struct sp_port *port,
 	if (!config)
 		RETURN_ERROR(SP_ERR_ARG, "Null config");
 
-	TRY(get_config(port, &data, &prev_config));
-	TRY(set_config(port, &data, config));
+	TRY(apply_config(port, config));
+
+	RETURN_OK();
+}
+
+SP_API enum sp_return sp_begin_config(struct sp_port *port)
+{
+	TRACE("%p", port);
+
+	CHECK_OPEN_PORT();
+
+	if (port->staging)
+		RETURN_ERROR(SP_ERR_ARG, "Configuration change already in progress");
+
+	DEBUG_FMT("Staging configuration changes for port %s", port->name);
+
+	if (!port->config_valid)
+		TRY(refresh_config(port));
+
+	clear_config(&port->staged);
+	port->staging = true;
+
+	RETURN_OK();
+}
+
+SP_API enum sp_return sp_commit_config(struct sp_port *port)
+{
+	enum sp_return ret;
+
+	TRACE("%p", port);
+
+	CHECK_OPEN_PORT();
+
+	if (!port->staging)
+		RETURN_ERROR(SP_ERR_ARG, "No configuration change in progress");
+
+	DEBUG_FMT("Committing configuration changes for port %s", port->name);
+
+	port->staging = false;
+
+	if ((ret = apply_config(port, &port->staged)) < 0) {
+		/* Keep the changes, so that they can be retried or aborted. */
+		port->staging = true;
+		RETURN_CODEVAL(ret);
+	}
+
+	RETURN_OK();
+}
+
+SP_API enum sp_return sp_abort_config(struct sp_port *port)
+{
+	TRACE("%p", port);
+
+	CHECK_OPEN_PORT();
+
+	if (!port->staging)
+		RETURN_ERROR(SP_ERR_ARG, "No configuration change in progress");
+
+	DEBUG_FMT("Discarding configuration changes for port %s", port->name);
+
+	port->staging = false;
 
 	RETURN_OK();
 }
 
 #define CREATE_ACCESSORS(x, type) \
 SP_API enum sp_return sp_set_##x(struct sp_port *port, type x) { \
-	struct port_data data; \
 	struct sp_port_config config; \
 	TRACE("%p, %d", port, x); \
 	CHECK_OPEN_PORT(); \
-	TRY(get_config(port, &data, &config)); \
+	clear_config(&config); \
 	config.x = x; \
-	TRY(set_config(port, &data, &config)); \
+	TRY(apply_config(port, &config)); \
 	RETURN_OK(); \
 } \
 SP_API enum sp_return sp_get_config_##x(const struct sp_port_config *config, \
@@ -2422,20 +4194,94 @@ SP_API enum sp_return sp_set_config_flowcontrol(struct sp_port_config *config,
 SP_API enum sp_return sp_set_flowcontrol(struct sp_port *port,
                                          enum sp_flowcontrol flowcontrol)
 {
-	struct port_data data;
 	struct sp_port_config config;
 
 	TRACE("%p, %d", port, flowcontrol);
 
 	CHECK_OPEN_PORT();
 
-	TRY(get_config(port, &data, &config));
+	if (!port->config_valid)
+		TRY(refresh_config(port));
+
+	config = port->config;
+	if (port->staging)
+		merge_config(&config, &port->staged);
 
 	TRY(sp_set_config_flowcontrol(&config, flowcontrol));
 
-	TRY(set_config(port, &data, &config));
+	TRY(apply_config(port, &config));
+
+	RETURN_OK();
+}
+
+SP_API enum sp_return sp_set_low_latency(struct sp_port *port, int enable)
+{
+	TRACE("%p, %d", port, enable);
+
+	CHECK_OPEN_PORT();
+
+	DEBUG_FMT("%s low latency mode on port %s",
+		enable ? "Enabling" : "Disabling", port->name);
+
+#if defined(HAVE_STRUCT_SERIAL_STRUCT) && defined(ASYNC_LOW_LATENCY)
+	struct serial_struct serial_info;
+
+	if (ioctl(port->fd, TIOCGSERIAL, &serial_info) < 0)
+		RETURN_FAIL("TIOCGSERIAL ioctl failed");
+
+	if (!enable == !(serial_info.flags & ASYNC_LOW_LATENCY))
+		RETURN_OK();
+
+	if (enable)
+		serial_info.flags |= ASYNC_LOW_LATENCY;
+	else
+		serial_info.flags &= ~ASYNC_LOW_LATENCY;
+
+	if (ioctl(port->fd, TIOCSSERIAL, &serial_info) < 0)
+		RETURN_FAIL("TIOCSSERIAL ioctl failed");
+
+	RETURN_OK();
+#else
+	RETURN_ERROR(SP_ERR_SUPP, "Low latency mode not supported");
+#endif
+}
+
+SP_API enum sp_return sp_get_latency_timer(struct sp_port *port, int *timer_ms)
+{
+	TRACE("%p, %p", port, timer_ms);
+
+	if (!timer_ms)
+		RETURN_ERROR(SP_ERR_ARG, "Null result pointer");
+
+	*timer_ms = 0;
+
+	CHECK_PORT();
+
+#ifdef __linux__
+	TRY(get_latency_timer(port, timer_ms));
+
+	RETURN_OK();
+#else
+	RETURN_ERROR(SP_ERR_SUPP, "Latency timer not supported");
+#endif
+}
+
+SP_API enum sp_return sp_set_latency_timer(struct sp_port *port, int timer_ms)
+{
+	TRACE("%p, %d", port, timer_ms);
+
+	CHECK_PORT();
+
+	if (timer_ms < 0 || timer_ms > 255)
+		RETURN_ERROR(SP_ERR_ARG, "Invalid latency timer");
+
+#ifdef __linux__
+	TRY(set_latency_timer(port, timer_ms));
 
 	RETURN_OK();
+#else
+	RETURN_ERROR(SP_ERR_SUPP, "Latency timer not supported");
+#endif
 }
 
 SP_API enum sp_return sp_get_signals(struct sp_port *port,
@@ -2572,12 +4418,19 @@ SP_API void sp_set_debug_handler(void (*handler)(const char *format, ...))
 
 SP_API void sp_default_debug_handler(const char *format, ...)
 {
+	/* Looked up once; -1 until then. Racing threads store the same value. */
+	static volatile int enabled = -1;
 	va_list args;
+
+	if (enabled < 0)
+		enabled = getenv("LIBSERIALPORT_DEBUG") != NULL;
+
+	if (!enabled)
+		return;
+
 	va_start(args, format);
-	if (getenv("LIBSERIALPORT_DEBUG")) {
-		fputs("sp: ", stderr);
-		vfprintf(stderr, format, args);
-	}
+	fputs("sp: ", stderr);
+	vfprintf(stderr, format, args);
 	va_end(args);
 }
 
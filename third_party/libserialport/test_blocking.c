@@ -0,0 +1,511 @@
+#include "config.h"
+#include "libserialport.h"
+#include "libserialport_internal.h"
+#include "test_util.h"
+#include <assert.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+/*
+ * Blocking read and write tests, run against a pseudo-terminal.
+ */
+
+/* Above FD_SETSIZE, which select() could not have waited on. */
+#define HIGH_FD 1500
+
+/* More buffers than are passed to one readv() or writev() call. */
+#define NUM_IOVS 24
+/* More than the pseudo-terminal buffers, so transfers are partial. */
+#define VECTOR_BYTES (NUM_IOVS * 6000)
+
+#define BENCHMARK_MESSAGES 2000
+
+static int master;
+static unsigned char vector_data[VECTOR_BYTES];
+static unsigned char vector_received[VECTOR_BYTES];
+
+/*
+ * Split a buffer into a vector of irregular pieces, some of them empty,
+ * so that transfers end part way through buffers and at their boundaries.
+ */
+static void split_iovecs(struct sp_iovec *iov, unsigned char *buf)
+{
+	size_t offset = 0, size;
+	int i;
+
+	for (i = 0; i < NUM_IOVS; i++) {
+		if (i == NUM_IOVS - 1)
+			size = VECTOR_BYTES - offset;
+		else if (i % 5 == 2)
+			size = 0;
+		else
+			size = 1000 + (i * 3001) % 9000;
+		assert(offset + size <= VECTOR_BYTES);
+		iov[i].buf = buf + offset;
+		iov[i].count = size;
+		offset += size;
+	}
+}
+
+/* Read everything sent to the master side, in small pieces. */
+static void *master_reader(void *arg)
+{
+	size_t total = 0, size = *(size_t *) arg;
+	ssize_t result;
+
+	while (total < size) {
+		result = read(master, vector_received + total,
+			size - total < 777 ? size - total : 777);
+		assert(result > 0);
+		total += result;
+	}
+
+	return NULL;
+}
+
+/* Write to the master side in small pieces, pausing between them. */
+static void *master_writer(void *arg)
+{
+	size_t total = 0, size = *(size_t *) arg, piece;
+
+	while (total < size) {
+		piece = size - total < 4321 ? size - total : 4321;
+		assert(write(master, vector_data + total, piece) == (ssize_t) piece);
+		total += piece;
+		sleep_ms(1);
+	}
+
+	return NULL;
+}
+
+static void *delayed_writer(void *arg)
+{
+	const char *data = arg;
+
+	sleep_ms(20);
+	assert(write(master, data, strlen(data)) == (ssize_t) strlen(data));
+
+	return NULL;
+}
+
+static void test_high_fd(void)
+{
+	struct sp_port *port;
+	struct rlimit limit;
+	pthread_t writer;
+	char buf[16];
+
+	printf("Reading and writing through descriptor %d\n", HIGH_FD);
+
+	assert(getrlimit(RLIMIT_NOFILE, &limit) == 0);
+	if (limit.rlim_cur <= HIGH_FD) {
+		if (limit.rlim_max <= HIGH_FD) {
+			printf("Descriptor limit too low, skipped\n");
+			return;
+		}
+		limit.rlim_cur = HIGH_FD + 1;
+		assert(setrlimit(RLIMIT_NOFILE, &limit) == 0);
+	}
+
+	master = open_pty_port(0, &port);
+	assert(dup2(port->fd, HIGH_FD) == HIGH_FD);
+	close(port->fd);
+	port->fd = HIGH_FD;
+
+	assert(sp_blocking_write(port, "hello", 5, 100) == 5);
+	assert(read(master, buf, sizeof(buf)) == 5);
+	assert(memcmp(buf, "hello", 5) == 0);
+
+	/* The read has to wait for the data. */
+	assert(pthread_create(&writer, NULL, delayed_writer, "world") == 0);
+	assert(sp_blocking_read(port, buf, 5, 1000) == 5);
+	assert(memcmp(buf, "world", 5) == 0);
+	assert(pthread_join(writer, NULL) == 0);
+
+	/* With no data, the wait times out. */
+	assert(sp_blocking_read(port, buf, 1, 20) == 0);
+
+	close_pty_port(master, port);
+}
+
+static void test_short_reads(void)
+{
+	struct sp_port_stats stats;
+	struct sp_port *port;
+	pthread_t writer;
+	char buf[8];
+
+	printf("Counting short reads apart from timeouts\n");
+
+	master = open_pty_port(0, &port);
+	assert(sp_reset_port_stats(port) == SP_OK);
+
+	/* Half the data is there at once, and the rest arrives in time. */
+	assert(write(master, "ab", 2) == 2);
+	assert(pthread_create(&writer, NULL, delayed_writer, "cd") == 0);
+	assert(sp_blocking_read(port, buf, 4, 1000) == 4);
+	assert(memcmp(buf, "abcd", 4) == 0);
+	assert(pthread_join(writer, NULL) == 0);
+	assert(sp_get_port_stats(port, &stats) == SP_OK);
+	assert(stats.short_reads == 1);
+	assert(stats.timeouts == 0);
+
+	/* Nothing arrives at all. */
+	assert(sp_blocking_read(port, buf, 4, 10) == 0);
+	assert(sp_get_port_stats(port, &stats) == SP_OK);
+	assert(stats.short_reads == 1);
+	assert(stats.timeouts == 1);
+
+	close_pty_port(master, port);
+}
+
+/* Time a VMIN/VTIME read, in milliseconds. */
+static int timed_vmin_read(struct sp_port *port, char *buf, size_t count,
+		unsigned int min_bytes, unsigned int timeout_ms, unsigned long long *ms)
+{
+	unsigned long long start = now_ns();
+	int result;
+
+	result = sp_blocking_read_vmin(port, buf, count, min_bytes, timeout_ms);
+	*ms = (now_ns() - start) / 1000000;
+
+	return result;
+}
+
+static void ignore_events(struct sp_port *port, enum sp_event events,
+		void *user_data)
+{
+	(void) port;
+	(void) events;
+	(void) user_data;
+}
+
+static void test_vmin(void)
+{
+	struct sp_reactor *reactor;
+	struct sp_port *port;
+	struct termios term;
+	unsigned long long ms;
+	pthread_t writer;
+	char buf[16];
+	int flags;
+
+	printf("Reading with VMIN and VTIME\n");
+
+	master = open_pty_port(0, &port);
+
+	/* Neither: whatever is there, at once. */
+	assert(timed_vmin_read(port, buf, sizeof(buf), 0, 0, &ms) == 0);
+	assert(ms < 50);
+	assert(write(master, "ab", 2) == 2);
+	sleep_ms(10);
+	assert(timed_vmin_read(port, buf, sizeof(buf), 0, 0, &ms) == 2);
+	assert(memcmp(buf, "ab", 2) == 0);
+
+	/* VTIME only: a timeout for the first byte. */
+	assert(timed_vmin_read(port, buf, sizeof(buf), 0, 100, &ms) == 0);
+	assert(ms >= 90);
+	assert(pthread_create(&writer, NULL, delayed_writer, "c") == 0);
+	assert(timed_vmin_read(port, buf, sizeof(buf), 0, 1000, &ms) == 1);
+	assert(buf[0] == 'c');
+	assert(ms < 500);
+	assert(pthread_join(writer, NULL) == 0);
+
+	/* VMIN only: wait for that many bytes, however long they take. */
+	assert(write(master, "de", 2) == 2);
+	assert(pthread_create(&writer, NULL, delayed_writer, "fg") == 0);
+	assert(timed_vmin_read(port, buf, sizeof(buf), 4, 0, &ms) == 4);
+	assert(memcmp(buf, "defg", 4) == 0);
+	assert(ms >= 15);
+	assert(pthread_join(writer, NULL) == 0);
+
+	/* Both: the timer restarts with each byte, and ends a short read. */
+	assert(write(master, "hij", 3) == 3);
+	assert(timed_vmin_read(port, buf, sizeof(buf), 10, 100, &ms) == 3);
+	assert(memcmp(buf, "hij", 3) == 0);
+	assert(ms >= 90 && ms < 500);
+
+	printf("Caching the settings between calls\n");
+
+	/* Each change of settings is kept in the cache, which stays valid. */
+	assert(port->config_valid);
+	assert(port->data.term.c_cc[VMIN] == 10 && port->data.term.c_cc[VTIME] == 1);
+	assert(timed_vmin_read(port, buf, sizeof(buf), 0, 0, &ms) == 0);
+	assert(port->config_valid);
+	assert(port->data.term.c_cc[VMIN] == 0 && port->data.term.c_cc[VTIME] == 0);
+	/* The cache matches the device. */
+	assert(tcgetattr(port->fd, &term) == 0);
+	assert(term.c_iflag == port->data.term.c_iflag);
+	assert(term.c_oflag == port->data.term.c_oflag);
+	assert(term.c_cflag == port->data.term.c_cflag);
+	assert(term.c_lflag == port->data.term.c_lflag);
+	assert(memcmp(term.c_cc, port->data.term.c_cc, sizeof(term.c_cc)) == 0);
+	assert(sp_set_baudrate(port, 9600) == SP_OK);
+	assert(port->config_valid);
+
+	printf("Restoring non-blocking mode for other reads\n");
+
+	assert(port->fd_blocking);
+	assert(!(fcntl(port->fd, F_GETFL) & O_NONBLOCK));
+	/* Would block forever if O_NONBLOCK was still clear. */
+	assert(sp_nonblocking_read(port, buf, sizeof(buf)) == 0);
+	assert(!port->fd_blocking);
+	assert((flags = fcntl(port->fd, F_GETFL)) >= 0 && (flags & O_NONBLOCK));
+
+	assert(sp_blocking_read_vmin(port, buf, sizeof(buf), 0, 0) == 0);
+	assert(port->fd_blocking);
+	assert(sp_blocking_read(port, buf, 1, 10) == 0);
+	assert(!port->fd_blocking);
+	assert(fcntl(port->fd, F_GETFL) & O_NONBLOCK);
+
+	printf("Refusing ports owned by other engines\n");
+
+	assert(sp_new_reactor(1, &reactor) == SP_OK);
+	assert(sp_reactor_add_port(reactor, port, SP_EVENT_RX_READY,
+		ignore_events, NULL) == SP_OK);
+	assert(sp_blocking_read_vmin(port, buf, sizeof(buf), 0, 0) == SP_ERR_ARG);
+	assert(sp_reactor_remove_port(reactor, port) == SP_OK);
+	sp_free_reactor(reactor);
+
+	assert(sp_start_receiver(port, 64) == SP_OK);
+	assert(sp_blocking_read_vmin(port, buf, sizeof(buf), 0, 0) == SP_ERR_ARG);
+	assert(sp_stop_receiver(port) == SP_OK);
+
+	close_pty_port(master, port);
+}
+
+static void test_short_timeouts(void)
+{
+	struct sp_event_set *event_set;
+	struct sp_port *port;
+	unsigned long long start, elapsed;
+	pthread_t writer;
+	char buf[8];
+	int result;
+
+	printf("Timing out after less than a millisecond\n");
+
+	master = open_pty_port(0, &port);
+
+	/* Nothing arrives, so the reads end at their timeouts. */
+	start = now_ns();
+	assert(sp_blocking_read_ns(port, buf, 1, 300000) == 0);
+	elapsed = now_ns() - start;
+	printf("300 us read timeout took %llu us\n", elapsed / 1000);
+	assert(elapsed >= 300000 && elapsed < 20000000);
+
+	start = now_ns();
+	assert(sp_blocking_read_us(port, buf, 1, 500) == 0);
+	elapsed = now_ns() - start;
+	printf("500 us read timeout took %llu us\n", elapsed / 1000);
+	assert(elapsed >= 500000 && elapsed < 20000000);
+
+	/* Data which arrives in time is read in full. */
+	assert(pthread_create(&writer, NULL, delayed_writer, "abcd") == 0);
+	assert(sp_blocking_read_ns(port, buf, 4, 1000000000) == 4);
+	assert(memcmp(buf, "abcd", 4) == 0);
+	assert(pthread_join(writer, NULL) == 0);
+	assert(pthread_create(&writer, NULL, delayed_writer, "efgh") == 0);
+	assert(sp_blocking_read_us(port, buf, 4, 1000000) == 4);
+	assert(memcmp(buf, "efgh", 4) == 0);
+	assert(pthread_join(writer, NULL) == 0);
+
+	assert(sp_blocking_write_ns(port, "ij", 2, 1000000) == 2);
+	assert(sp_blocking_write_us(port, "kl", 2, 1000) == 2);
+	sleep_ms(10);
+	assert(read(master, buf, sizeof(buf)) == 4);
+	assert(memcmp(buf, "ijkl", 4) == 0);
+
+	/* With nothing read from the master side, the write times out. */
+	start = now_ns();
+	result = sp_blocking_write_us(port, vector_data, VECTOR_BYTES, 500);
+	elapsed = now_ns() - start;
+	assert(result > 0 && result < VECTOR_BYTES);
+	assert(elapsed >= 500000 && elapsed < 20000000);
+	assert(sp_blocking_write_ns(port, vector_data, 1, 200000) == 0);
+	assert(sp_flush(port, SP_BUF_BOTH) == SP_OK);
+
+	assert(sp_new_event_set(&event_set) == SP_OK);
+	assert(sp_add_port_events(event_set, port, SP_EVENT_RX_READY) == SP_OK);
+	start = now_ns();
+	assert(sp_wait_us(event_set, 500) == SP_OK);
+	elapsed = now_ns() - start;
+	assert(elapsed >= 500000 && elapsed < 20000000);
+	start = now_ns();
+	assert(sp_wait_ns(event_set, 300000) == SP_OK);
+	elapsed = now_ns() - start;
+	assert(elapsed >= 300000 && elapsed < 20000000);
+	sp_free_event_set(event_set);
+
+	close_pty_port(master, port);
+}
+
+static void test_vectored(void)
+{
+	struct sp_iovec iov[NUM_IOVS];
+	struct sp_port_stats stats;
+	struct sp_port *port;
+	pthread_t thread;
+	size_t size = VECTOR_BYTES;
+
+	printf("Writing and reading %d buffers\n", NUM_IOVS);
+
+	master = open_pty_port(0, &port);
+
+	/* The reader takes the data in pieces, so writev() completes partially. */
+	memset(vector_received, 0, sizeof(vector_received));
+	split_iovecs(iov, vector_data);
+	assert(sp_reset_port_stats(port) == SP_OK);
+	assert(pthread_create(&thread, NULL, master_reader, &size) == 0);
+	assert(sp_blocking_writev(port, iov, NUM_IOVS, 5000) == VECTOR_BYTES);
+	assert(pthread_join(thread, NULL) == 0);
+	assert(memcmp(vector_received, vector_data, VECTOR_BYTES) == 0);
+	assert(sp_get_port_stats(port, &stats) == SP_OK);
+	printf("%llu bytes in %llu writes\n", stats.bytes_written, stats.writes);
+	assert(stats.bytes_written == VECTOR_BYTES);
+	assert(stats.writes > 2);
+	assert(stats.timeouts == 0);
+
+	/* The writer sends the data in pieces, so readv() completes partially. */
+	memset(vector_received, 0, sizeof(vector_received));
+	split_iovecs(iov, vector_received);
+	assert(sp_reset_port_stats(port) == SP_OK);
+	assert(pthread_create(&thread, NULL, master_writer, &size) == 0);
+	assert(sp_blocking_readv(port, iov, NUM_IOVS, 5000) == VECTOR_BYTES);
+	assert(pthread_join(thread, NULL) == 0);
+	assert(memcmp(vector_received, vector_data, VECTOR_BYTES) == 0);
+	assert(sp_get_port_stats(port, &stats) == SP_OK);
+	printf("%llu bytes in %llu reads\n", stats.bytes_read, stats.reads);
+	assert(stats.bytes_read == VECTOR_BYTES);
+	assert(stats.reads > 2);
+	assert(stats.timeouts == 0);
+
+	close_pty_port(master, port);
+}
+
+static void test_vectored_timeouts(void)
+{
+	struct sp_iovec iov[NUM_IOVS];
+	struct sp_port_stats stats;
+	struct sp_port *port;
+	unsigned long long start, elapsed;
+	int result;
+
+	printf("Timing out vectored transfers\n");
+
+	master = open_pty_port(0, &port);
+	assert(sp_reset_port_stats(port) == SP_OK);
+
+	/* Some of the data arrives, ending part way through the second buffer. */
+	memset(vector_received, 0, sizeof(vector_received));
+	split_iovecs(iov, vector_received);
+	assert(write(master, vector_data, iov[0].count + 10) ==
+		(ssize_t) iov[0].count + 10);
+	start = now_ns();
+	result = sp_blocking_readv(port, iov, NUM_IOVS, 50);
+	elapsed = now_ns() - start;
+	assert(result == (int) iov[0].count + 10);
+	assert(memcmp(vector_received, vector_data, result) == 0);
+	assert(vector_received[result] == 0);
+	assert(elapsed >= 45000000);
+
+	/* With nothing read from the master side, the write fills it and stops. */
+	split_iovecs(iov, vector_data);
+	start = now_ns();
+	result = sp_blocking_writev(port, iov, NUM_IOVS, 50);
+	elapsed = now_ns() - start;
+	printf("Wrote %d of %d bytes before the timeout\n", result, VECTOR_BYTES);
+	assert(result > 0 && result < VECTOR_BYTES);
+	assert(elapsed >= 45000000);
+
+	assert(sp_get_port_stats(port, &stats) == SP_OK);
+	assert(stats.timeouts == 2);
+
+	close_pty_port(master, port);
+}
+
+/*
+ * Compare sending a message made of a header, payload and trailer with
+ * one write per part, with one vectored write, and by copying the parts
+ * into one buffer for a single write.
+ */
+static void benchmark_vectored(int mode)
+{
+	static const char *names[] = {
+		"Three writes", "One vectored write", "Copy and one write"
+	};
+	unsigned char header[8], payload[48], trailer[4], message[60];
+	struct sp_iovec iov[3];
+	struct sp_port_stats stats;
+	struct sp_port *port;
+	pthread_t thread;
+	size_t size = (size_t) BENCHMARK_MESSAGES * sizeof(message);
+	unsigned long long start;
+	int i;
+
+	assert(size <= sizeof(vector_received));
+
+	master = open_pty_port(0, &port);
+	memset(header, 'h', sizeof(header));
+	memset(payload, 'p', sizeof(payload));
+	memset(trailer, 't', sizeof(trailer));
+	iov[0].buf = header;
+	iov[0].count = sizeof(header);
+	iov[1].buf = payload;
+	iov[1].count = sizeof(payload);
+	iov[2].buf = trailer;
+	iov[2].count = sizeof(trailer);
+
+	assert(sp_reset_port_stats(port) == SP_OK);
+	assert(pthread_create(&thread, NULL, master_reader, &size) == 0);
+	start = now_ns();
+	for (i = 0; i < BENCHMARK_MESSAGES; i++) {
+		switch (mode) {
+		case 0:
+			assert(sp_blocking_write(port, header, sizeof(header), 5000) == sizeof(header));
+			assert(sp_blocking_write(port, payload, sizeof(payload), 5000) == sizeof(payload));
+			assert(sp_blocking_write(port, trailer, sizeof(trailer), 5000) == sizeof(trailer));
+			break;
+		case 1:
+			assert(sp_blocking_writev(port, iov, 3, 5000) == sizeof(message));
+			break;
+		default:
+			memcpy(message, header, sizeof(header));
+			memcpy(message + sizeof(header), payload, sizeof(payload));
+			memcpy(message + sizeof(header) + sizeof(payload), trailer, sizeof(trailer));
+			assert(sp_blocking_write(port, message, sizeof(message), 5000) == sizeof(message));
+			break;
+		}
+	}
+	assert(pthread_join(thread, NULL) == 0);
+	assert(sp_get_port_stats(port, &stats) == SP_OK);
+
+	printf("%s: %.1f ns and %.2f system calls per message\n", names[mode],
+		(double) (now_ns() - start) / BENCHMARK_MESSAGES,
+		(double) (stats.writes + stats.waits) / BENCHMARK_MESSAGES);
+
+	close_pty_port(master, port);
+}
+
+int main(int argc, char *argv[])
+{
+	(void) argc;
+	(void) argv;
+	int i;
+
+	for (i = 0; i < VECTOR_BYTES; i++)
+		vector_data[i] = (unsigned char) (i * 7 + i / 251);
+
+	test_high_fd();
+	test_short_reads();
+	test_vmin();
+	test_short_timeouts();
+	test_vectored();
+	test_vectored_timeouts();
+
+	printf("Sending %d messages of three parts\n", BENCHMARK_MESSAGES);
+	for (i = 0; i < 3; i++)
+		benchmark_vectored(i);
+
+	return 0;
+}
@@ -0,0 +1,545 @@
+#include "config.h"
+#include "libserialport.h"
+#include "libserialport_internal.h"
+#include "test_util.h"
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+
+/*
+ * Chunk pool tests. Reads are run against a pseudo-terminal pair, and the
+ * free list is exercised by threads taking and returning chunks at once.
+ * Finally, handing data to another thread in pooled chunks is timed
+ * against copying it into a newly allocated buffer, which is freed there.
+ */
+
+#define CHUNK_SIZE 64
+#define NUM_CHUNKS 8
+#define NUM_THREADS 8
+#define ITERATIONS 200000
+#define HANDOFF_BYTES (2 * 1024 * 1024)
+#define HANDOFF_QUEUE 16
+#define BENCHMARK_ITERATIONS 200000
+
+static int master;
+static struct sp_port *port;
+
+/* Send count bytes numbered from first from the master side. */
+static void send_bytes(int first, int count)
+{
+	unsigned char buf[1024];
+	int i, result, total = 0;
+
+	assert(count <= (int) sizeof(buf));
+	for (i = 0; i < count; i++)
+		buf[i] = (unsigned char) (first + i);
+
+	while (total < count) {
+		result = write(master, buf + total, count - total);
+		assert(result > 0);
+		total += result;
+	}
+}
+
+static void check_chunk(const struct sp_chunk *chunk, int first, int count)
+{
+	size_t i;
+
+	assert(chunk);
+	assert(chunk->length == (size_t) count);
+	for (i = 0; i < chunk->length; i++)
+		assert(chunk->data[i] == (unsigned char) (first + i));
+}
+
+static void check_stats(struct sp_chunk_pool *pool, unsigned int in_use,
+	unsigned int high_water)
+{
+	struct sp_chunk_pool_stats stats;
+
+	assert(sp_get_chunk_pool_stats(pool, &stats) == SP_OK);
+	assert(stats.chunk_size == CHUNK_SIZE);
+	assert(stats.num_chunks == NUM_CHUNKS);
+	assert(stats.in_use == in_use);
+	assert(stats.high_water == high_water);
+	assert(stats.memory >= NUM_CHUNKS * CHUNK_SIZE);
+	assert(stats.memory_in_use == in_use * CHUNK_SIZE);
+	assert(stats.memory_high_water == high_water * CHUNK_SIZE);
+}
+
+static void test_arguments(void)
+{
+	struct sp_chunk_pool *pool;
+	struct sp_chunk *chunk;
+	struct sp_chunk_pool_stats stats;
+
+	assert(sp_new_chunk_pool(0, NUM_CHUNKS, &pool) == SP_ERR_ARG);
+	assert(pool == NULL);
+	assert(sp_new_chunk_pool(CHUNK_SIZE, 0, &pool) == SP_ERR_ARG);
+	assert(sp_new_chunk_pool(CHUNK_SIZE, NUM_CHUNKS, NULL) == SP_ERR_ARG);
+
+	assert(sp_new_chunk_pool(CHUNK_SIZE, NUM_CHUNKS, &pool) == SP_OK);
+	assert(sp_nonblocking_read_chunk(port, NULL, &chunk) == SP_ERR_ARG);
+	assert(chunk == NULL);
+	assert(sp_nonblocking_read_chunk(port, pool, NULL) == SP_ERR_ARG);
+	assert(sp_nonblocking_read_chunk(NULL, pool, &chunk) == SP_ERR_ARG);
+	assert(sp_retain_chunk(NULL) == SP_ERR_ARG);
+	assert(sp_release_chunk(NULL) == SP_ERR_ARG);
+	assert(sp_get_chunk_pool_stats(NULL, &stats) == SP_ERR_ARG);
+	assert(sp_get_chunk_pool_stats(pool, NULL) == SP_ERR_ARG);
+	assert(sp_reset_chunk_pool_stats(NULL) == SP_ERR_ARG);
+
+	/* The chunk taken for the failed read went back to the pool. */
+	check_stats(pool, 0, 1);
+
+	sp_free_chunk_pool(pool);
+	sp_free_chunk_pool(NULL);
+}
+
+static void test_reads(void)
+{
+	struct sp_chunk_pool *pool;
+	struct sp_chunk *first, *second, *chunk;
+
+	assert(sp_new_chunk_pool(CHUNK_SIZE, NUM_CHUNKS, &pool) == SP_OK);
+
+	printf("Reading into chunks\n");
+	send_bytes(0, 100);
+	assert(sp_blocking_read_next_chunk(port, pool, 1000, &first) == CHUNK_SIZE);
+	check_chunk(first, 0, CHUNK_SIZE);
+	assert(sp_blocking_read_next_chunk(port, pool, 1000, &second) == 36);
+	check_chunk(second, CHUNK_SIZE, 36);
+	assert(first->data != second->data);
+	check_stats(pool, 2, 2);
+
+	/* Nothing to read leaves no chunk in use. */
+	assert(sp_nonblocking_read_chunk(port, pool, &chunk) == 0);
+	assert(chunk == NULL);
+	assert(sp_blocking_read_next_chunk(port, pool, 10, &chunk) == 0);
+	assert(chunk == NULL);
+	check_stats(pool, 2, 3);
+
+	assert(sp_release_chunk(first) == SP_OK);
+	assert(sp_release_chunk(second) == SP_OK);
+	check_stats(pool, 0, 3);
+
+	send_bytes(10, 20);
+	assert(sp_blocking_read_chunk(port, pool, 100, &chunk) == 20);
+	check_chunk(chunk, 10, 20);
+	assert(sp_release_chunk(chunk) == SP_OK);
+
+	send_bytes(0, CHUNK_SIZE + 1);
+	assert(sp_blocking_read_chunk(port, pool, 1000, &chunk) == CHUNK_SIZE);
+	check_chunk(chunk, 0, CHUNK_SIZE);
+	assert(sp_release_chunk(chunk) == SP_OK);
+	assert(sp_blocking_read_chunk(port, pool, 100, &chunk) == 1);
+	check_chunk(chunk, CHUNK_SIZE, 1);
+	assert(sp_release_chunk(chunk) == SP_OK);
+
+	sp_free_chunk_pool(pool);
+}
+
+static void test_exhaustion(void)
+{
+	struct sp_chunk_pool *pool;
+	struct sp_chunk *chunks[NUM_CHUNKS], *chunk;
+	struct sp_chunk_pool_stats stats;
+	int i;
+
+	printf("Running out of chunks\n");
+	assert(sp_new_chunk_pool(CHUNK_SIZE, NUM_CHUNKS, &pool) == SP_OK);
+
+	for (i = 0; i < NUM_CHUNKS; i++) {
+		send_bytes(i, 1);
+		assert(sp_blocking_read_next_chunk(port, pool, 1000, &chunks[i]) == 1);
+		check_chunk(chunks[i], i, 1);
+	}
+	check_stats(pool, NUM_CHUNKS, NUM_CHUNKS);
+
+	/* The data waits in the port until a chunk is free. */
+	send_bytes(42, 5);
+	assert(sp_blocking_read_next_chunk(port, pool, 1000, &chunk) == SP_ERR_MEM);
+	assert(chunk == NULL);
+	assert(sp_nonblocking_read_chunk(port, pool, &chunk) == SP_ERR_MEM);
+
+	assert(sp_get_chunk_pool_stats(pool, &stats) == SP_OK);
+	assert(stats.exhaustions == 2);
+	assert(stats.allocations == NUM_CHUNKS);
+
+	assert(sp_release_chunk(chunks[3]) == SP_OK);
+	assert(sp_blocking_read_next_chunk(port, pool, 1000, &chunk) == 5);
+	check_chunk(chunk, 42, 5);
+	assert(chunk == chunks[3]);
+	chunks[3] = chunk;
+
+	for (i = 0; i < NUM_CHUNKS; i++)
+		assert(sp_release_chunk(chunks[i]) == SP_OK);
+	check_stats(pool, 0, NUM_CHUNKS);
+
+	assert(sp_reset_chunk_pool_stats(pool) == SP_OK);
+	assert(sp_get_chunk_pool_stats(pool, &stats) == SP_OK);
+	assert(stats.exhaustions == 0);
+	assert(stats.allocations == 0);
+	assert(stats.high_water == 0);
+
+	sp_free_chunk_pool(pool);
+}
+
+static void test_references(void)
+{
+	struct sp_chunk_pool *pool;
+	struct sp_chunk *chunk;
+
+	printf("Sharing chunks\n");
+	assert(sp_new_chunk_pool(CHUNK_SIZE, NUM_CHUNKS, &pool) == SP_OK);
+
+	send_bytes(7, 3);
+	assert(sp_blocking_read_next_chunk(port, pool, 1000, &chunk) == 3);
+	assert(sp_retain_chunk(chunk) == SP_OK);
+	assert(sp_retain_chunk(chunk) == SP_OK);
+	assert(sp_release_chunk(chunk) == SP_OK);
+	assert(sp_release_chunk(chunk) == SP_OK);
+	check_stats(pool, 1, 1);
+	check_chunk(chunk, 7, 3);
+	assert(sp_release_chunk(chunk) == SP_OK);
+	check_stats(pool, 0, 1);
+
+	/* A chunk outlives its pool, which is freed with the chunk. */
+	send_bytes(9, 4);
+	assert(sp_blocking_read_next_chunk(port, pool, 1000, &chunk) == 4);
+	sp_free_chunk_pool(pool);
+	check_chunk(chunk, 9, 4);
+	assert(sp_release_chunk(chunk) == SP_OK);
+}
+
+struct stress {
+	struct sp_chunk_pool *pool;
+	int id;
+	/* Holder of each chunk, to catch one being handed out twice. */
+	int *owners;
+	int taken;
+};
+
+static void *stress_thread(void *arg)
+{
+	struct stress *stress = arg;
+	struct sp_chunk *held[3];
+	unsigned int i, j, num_held = 0, index;
+
+	for (i = 0; i < ITERATIONS; i++) {
+		if (num_held < 3 && (i % 5) != 4) {
+			if (!(held[num_held] = get_pool_chunk(stress->pool)))
+				continue;
+			index = held[num_held]->data[0];
+			assert(__atomic_exchange_n(&stress->owners[index], stress->id,
+				__ATOMIC_ACQ_REL) == -1);
+			num_held++;
+			stress->taken++;
+		} else {
+			for (j = 0; j < num_held; j++) {
+				index = held[j]->data[0];
+				assert(__atomic_exchange_n(&stress->owners[index], -1,
+					__ATOMIC_ACQ_REL) == stress->id);
+				assert(sp_release_chunk(held[j]) == SP_OK);
+			}
+			num_held = 0;
+		}
+	}
+
+	for (j = 0; j < num_held; j++) {
+		index = held[j]->data[0];
+		assert(__atomic_exchange_n(&stress->owners[index], -1,
+			__ATOMIC_ACQ_REL) == stress->id);
+		assert(sp_release_chunk(held[j]) == SP_OK);
+	}
+
+	return NULL;
+}
+
+static void test_threads(void)
+{
+	struct sp_chunk_pool *pool;
+	struct sp_chunk *chunks[NUM_CHUNKS];
+	struct sp_chunk_pool_stats stats;
+	struct stress stress[NUM_THREADS];
+	pthread_t threads[NUM_THREADS];
+	int owners[NUM_CHUNKS];
+	unsigned long long taken = 0;
+	int i;
+
+	printf("Taking chunks from %d threads\n", NUM_THREADS);
+	assert(sp_new_chunk_pool(CHUNK_SIZE, NUM_CHUNKS, &pool) == SP_OK);
+
+	/* Number each chunk, fewer than the threads can hold at once. */
+	for (i = 0; i < NUM_CHUNKS; i++) {
+		assert((chunks[i] = get_pool_chunk(pool)));
+		chunks[i]->data[0] = (unsigned char) i;
+		owners[i] = -1;
+	}
+	for (i = 0; i < NUM_CHUNKS; i++)
+		assert(sp_release_chunk(chunks[i]) == SP_OK);
+	assert(sp_reset_chunk_pool_stats(pool) == SP_OK);
+
+	for (i = 0; i < NUM_THREADS; i++) {
+		stress[i].pool = pool;
+		stress[i].id = i;
+		stress[i].owners = owners;
+		stress[i].taken = 0;
+		assert(pthread_create(&threads[i], NULL, stress_thread, &stress[i]) == 0);
+	}
+	for (i = 0; i < NUM_THREADS; i++) {
+		assert(pthread_join(threads[i], NULL) == 0);
+		taken += stress[i].taken;
+	}
+
+	assert(sp_get_chunk_pool_stats(pool, &stats) == SP_OK);
+	assert(stats.in_use == 0);
+	assert(stats.high_water > 0 && stats.high_water <= NUM_CHUNKS);
+	assert(stats.allocations == taken);
+	printf("%llu chunks taken, %llu times none was free\n",
+		stats.allocations, stats.exhaustions);
+
+	/* Every chunk is back on the free list. */
+	for (i = 0; i < NUM_CHUNKS; i++)
+		assert((chunks[i] = get_pool_chunk(pool)));
+	assert(get_pool_chunk(pool) == NULL);
+	for (i = 0; i < NUM_CHUNKS; i++)
+		assert(sp_release_chunk(chunks[i]) == SP_OK);
+
+	sp_free_chunk_pool(pool);
+}
+
+/* A queue of chunks from the reading thread to the consuming thread. */
+struct handoff {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct sp_chunk *chunks[HANDOFF_QUEUE];
+	unsigned int head, tail;
+	bool done;
+};
+
+static void *consume_thread(void *arg)
+{
+	struct handoff *handoff = arg;
+	struct sp_chunk *chunk;
+	unsigned char next = 0;
+	size_t i, received = 0;
+
+	pthread_mutex_lock(&handoff->lock);
+	for (;;) {
+		while (handoff->head == handoff->tail && !handoff->done)
+			pthread_cond_wait(&handoff->cond, &handoff->lock);
+		if (handoff->head == handoff->tail)
+			break;
+		chunk = handoff->chunks[handoff->head++ % HANDOFF_QUEUE];
+		pthread_cond_broadcast(&handoff->cond);
+		pthread_mutex_unlock(&handoff->lock);
+
+		for (i = 0; i < chunk->length; i++)
+			assert(chunk->data[i] == next++);
+		received += chunk->length;
+		assert(sp_release_chunk(chunk) == SP_OK);
+
+		pthread_mutex_lock(&handoff->lock);
+	}
+	pthread_mutex_unlock(&handoff->lock);
+
+	assert(received == HANDOFF_BYTES);
+
+	return NULL;
+}
+
+static void *produce_thread(void *arg)
+{
+	unsigned char buf[4096];
+	int i, result, sent = 0, total;
+
+	(void) arg;
+
+	while (sent < HANDOFF_BYTES) {
+		for (i = 0; i < (int) sizeof(buf); i++)
+			buf[i] = (unsigned char) (sent + i);
+		total = 0;
+		while (total < (int) sizeof(buf)) {
+			result = write(master, buf + total, sizeof(buf) - total);
+			assert(result > 0);
+			total += result;
+		}
+		sent += total;
+	}
+
+	return NULL;
+}
+
+static void test_handoff(void)
+{
+	struct sp_chunk_pool *pool;
+	struct sp_chunk *chunk;
+	struct sp_chunk_pool_stats stats;
+	struct handoff handoff;
+	pthread_t producer, consumer;
+	int result, received = 0;
+
+	printf("Handing %d bytes to another thread\n", HANDOFF_BYTES);
+	assert(sp_new_chunk_pool(1024, HANDOFF_QUEUE, &pool) == SP_OK);
+
+	memset(&handoff, 0, sizeof(handoff));
+	pthread_mutex_init(&handoff.lock, NULL);
+	pthread_cond_init(&handoff.cond, NULL);
+	assert(pthread_create(&consumer, NULL, consume_thread, &handoff) == 0);
+	assert(pthread_create(&producer, NULL, produce_thread, NULL) == 0);
+
+	while (received < HANDOFF_BYTES) {
+		result = sp_blocking_read_next_chunk(port, pool, 1000, &chunk);
+		if (result == SP_ERR_MEM) {
+			/* The consumer is behind; wait for it to release a chunk. */
+			usleep(100);
+			continue;
+		}
+		assert(result > 0);
+		received += result;
+
+		pthread_mutex_lock(&handoff.lock);
+		assert(handoff.tail - handoff.head < HANDOFF_QUEUE);
+		handoff.chunks[handoff.tail++ % HANDOFF_QUEUE] = chunk;
+		pthread_cond_broadcast(&handoff.cond);
+		pthread_mutex_unlock(&handoff.lock);
+	}
+
+	pthread_mutex_lock(&handoff.lock);
+	handoff.done = true;
+	pthread_cond_broadcast(&handoff.cond);
+	pthread_mutex_unlock(&handoff.lock);
+	assert(pthread_join(producer, NULL) == 0);
+	assert(pthread_join(consumer, NULL) == 0);
+
+	assert(sp_get_chunk_pool_stats(pool, &stats) == SP_OK);
+	assert(stats.in_use == 0);
+	printf("%llu chunks, at most %u in use, %llu times none was free\n",
+		stats.allocations, stats.high_water, stats.exhaustions);
+
+	pthread_cond_destroy(&handoff.cond);
+	pthread_mutex_destroy(&handoff.lock);
+	sp_free_chunk_pool(pool);
+}
+
+static double elapsed_ns(const struct timespec *start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return (end.tv_sec - start->tv_sec) * 1e9 + (end.tv_nsec - start->tv_nsec);
+}
+
+/*
+ * A single-producer, single-consumer queue for the benchmark, so that the
+ * cost measured is that of the buffers rather than of locking.
+ */
+struct bench_queue {
+	void *items[HANDOFF_QUEUE];
+	unsigned int head, tail;
+	bool pooled;
+};
+
+static void bench_push(struct bench_queue *queue, void *item)
+{
+	unsigned int tail = queue->tail;
+
+	while (tail - __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) == HANDOFF_QUEUE)
+		sched_yield();
+	queue->items[tail % HANDOFF_QUEUE] = item;
+	__atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static void *bench_consume(void *arg)
+{
+	struct bench_queue *queue = arg;
+	unsigned int head = 0;
+	void *item;
+	int i;
+
+	for (i = 0; i < BENCHMARK_ITERATIONS; i++) {
+		while (__atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE) == head)
+			sched_yield();
+		item = queue->items[head % HANDOFF_QUEUE];
+		__atomic_store_n(&queue->head, ++head, __ATOMIC_RELEASE);
+		if (queue->pooled) {
+			assert(((struct sp_chunk *) item)->length == 1024);
+			sp_release_chunk(item);
+		} else {
+			assert(((unsigned char *) item)[0] == 0x55);
+			free(item);
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Compare handing 1 KiB reads to another thread in pooled chunks with
+ * copying each from the read buffer into one allocated for the purpose.
+ * The read itself is stood in for by a copy into the chunk or read buffer.
+ */
+static void benchmark(bool pooled)
+{
+	static unsigned char source[1024], buf[1024];
+	struct sp_chunk_pool *pool;
+	struct sp_chunk *chunk;
+	struct bench_queue queue;
+	struct timespec start;
+	pthread_t consumer;
+	unsigned char *copy;
+	int i;
+
+	memset(source, 0x55, sizeof(source));
+	assert(sp_new_chunk_pool(sizeof(source), HANDOFF_QUEUE + 1, &pool) == SP_OK);
+	memset(&queue, 0, sizeof(queue));
+	queue.pooled = pooled;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	assert(pthread_create(&consumer, NULL, bench_consume, &queue) == 0);
+	for (i = 0; i < BENCHMARK_ITERATIONS; i++) {
+		if (pooled) {
+			while (!(chunk = get_pool_chunk(pool)))
+				sched_yield();
+			memcpy(chunk->data, source, sizeof(source));
+			chunk->length = sizeof(source);
+			bench_push(&queue, chunk);
+		} else {
+			memcpy(buf, source, sizeof(buf));
+			assert((copy = malloc(sizeof(buf))));
+			memcpy(copy, buf, sizeof(buf));
+			bench_push(&queue, copy);
+		}
+	}
+	assert(pthread_join(consumer, NULL) == 0);
+
+	printf("%s: %.1f ns per message\n",
+		pooled ? "Pooled chunks" : "malloc() and memcpy()",
+		elapsed_ns(&start) / BENCHMARK_ITERATIONS);
+
+	sp_free_chunk_pool(pool);
+}
+
+int main(int argc, char *argv[])
+{
+	(void) argc;
+	(void) argv;
+
+	master = open_pty_port(0, &port);
+
+	test_arguments();
+	test_reads();
+	test_exhaustion();
+	test_references();
+	test_threads();
+	test_handoff();
+
+	printf("Handing %d messages to another thread\n", BENCHMARK_ITERATIONS);
+	benchmark(false);
+	benchmark(true);
+
+	close_pty_port(master, port);
+
+	return 0;
+}
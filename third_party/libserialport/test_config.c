@@ -0,0 +1,300 @@
+#include "config.h"
+#include "libserialport.h"
+#include "libserialport_internal.h"
+#include "test_util.h"
+#include <assert.h>
+#include <stdarg.h>
+
+/*
+ * Configuration tests, run against a pseudo-terminal.
+ *
+ * The library is linked with -Wl,--wrap for tcgetattr, tcsetattr and
+ * ioctl, so that the system calls made by each operation can be counted.
+ * Pseudo-terminals have no modem control lines, so the ioctl shim also
+ * emulates RTS and DTR.
+ */
+
+static int tcgetattr_calls, tcsetattr_calls, ioctl_calls;
+static int modem_bits;
+static bool fail_modem_writes;
+
+int __real_tcgetattr(int fd, struct termios *term);
+int __real_tcsetattr(int fd, int action, const struct termios *term);
+int __real_ioctl(int fd, unsigned long request, ...);
+
+int __wrap_tcgetattr(int fd, struct termios *term);
+int __wrap_tcsetattr(int fd, int action, const struct termios *term);
+int __wrap_ioctl(int fd, unsigned long request, ...);
+
+int __wrap_tcgetattr(int fd, struct termios *term)
+{
+	tcgetattr_calls++;
+	return __real_tcgetattr(fd, term);
+}
+
+int __wrap_tcsetattr(int fd, int action, const struct termios *term)
+{
+	tcsetattr_calls++;
+	return __real_tcsetattr(fd, action, term);
+}
+
+int __wrap_ioctl(int fd, unsigned long request, ...)
+{
+	va_list args;
+	void *arg;
+
+	va_start(args, request);
+	arg = va_arg(args, void *);
+	va_end(args);
+
+	ioctl_calls++;
+
+	switch (request) {
+	case TIOCMGET:
+		*(int *)arg = modem_bits;
+		return 0;
+	case TIOCMBIS:
+		if (fail_modem_writes) {
+			errno = EIO;
+			return -1;
+		}
+		modem_bits |= *(int *)arg;
+		return 0;
+	case TIOCMBIC:
+		modem_bits &= ~*(int *)arg;
+		return 0;
+	case TIOCGICOUNT:
+		/* Pseudo-terminals keep no error counts, so make some up. */
+		memset(arg, 0, sizeof(struct serial_icounter_struct));
+		((struct serial_icounter_struct *)arg)->overrun = 3;
+		((struct serial_icounter_struct *)arg)->parity = 2;
+		return 0;
+	default:
+		return __real_ioctl(fd, request, arg);
+	}
+}
+
+static void reset_counts(void)
+{
+	tcgetattr_calls = tcsetattr_calls = ioctl_calls = 0;
+}
+
+static void print_counts(const char *operation)
+{
+	printf("%s: %d tcgetattr, %d tcsetattr, %d ioctl\n", operation,
+		tcgetattr_calls, tcsetattr_calls, ioctl_calls);
+}
+
+static int syscalls(void)
+{
+	return tcgetattr_calls + tcsetattr_calls + ioctl_calls;
+}
+
+int main(int argc, char *argv[])
+{
+	(void) argc;
+	(void) argv;
+	struct sp_port *port;
+	struct sp_port_config config;
+	struct sp_port_stats stats;
+	unsigned long long total;
+	char buf[16];
+	int master, i;
+
+	master = open_pty_port(0, &port);
+	printf("Opened %s\n", sp_get_port_name(port));
+
+	printf("Setting 9600 8N1 individually\n");
+	reset_counts();
+	assert(sp_set_baudrate(port, 9600) == SP_OK);
+	assert(sp_set_bits(port, 8) == SP_OK);
+	assert(sp_set_parity(port, SP_PARITY_NONE) == SP_OK);
+	assert(sp_set_stopbits(port, 1) == SP_OK);
+	assert(sp_set_flowcontrol(port, SP_FLOWCONTROL_NONE) == SP_OK);
+	print_counts("Individual");
+	assert(tcgetattr_calls == 0);
+	assert(tcsetattr_calls <= 5);
+
+	printf("Repeating an unchanged setting\n");
+	reset_counts();
+	assert(sp_set_baudrate(port, 9600) == SP_OK);
+	print_counts("Unchanged");
+	assert(syscalls() == 0);
+
+	printf("Staging 115200 7E2 with RTS and DTR asserted\n");
+	reset_counts();
+	assert(sp_begin_config(port) == SP_OK);
+	assert(sp_begin_config(port) == SP_ERR_ARG);
+	assert(sp_set_baudrate(port, 57600) == SP_OK);
+	assert(sp_set_baudrate(port, 115200) == SP_OK);
+	assert(sp_set_bits(port, 7) == SP_OK);
+	assert(sp_set_parity(port, SP_PARITY_EVEN) == SP_OK);
+	assert(sp_set_stopbits(port, 2) == SP_OK);
+	assert(sp_set_rts(port, SP_RTS_ON) == SP_OK);
+	assert(sp_set_dtr(port, SP_DTR_ON) == SP_OK);
+	print_counts("Staged");
+	assert(syscalls() == 0);
+	assert(sp_get_config(port, &config) == SP_OK);
+	assert(config.baudrate == 9600);
+
+	reset_counts();
+	assert(sp_commit_config(port) == SP_OK);
+	print_counts("Committed");
+	assert(tcgetattr_calls == 0);
+	assert(tcsetattr_calls == 1);
+	assert(ioctl_calls == 2);
+	assert(modem_bits == (TIOCM_RTS | TIOCM_DTR));
+	assert(sp_get_config(port, &config) == SP_OK);
+	assert(config.baudrate == 115200);
+	assert(config.bits == 7);
+	assert(config.parity == SP_PARITY_EVEN);
+	assert(config.stopbits == 2);
+	assert(config.rts == SP_RTS_ON);
+	assert(config.dtr == SP_DTR_ON);
+	assert(sp_commit_config(port) == SP_ERR_ARG);
+
+	printf("Committing only a control line change\n");
+	reset_counts();
+	assert(sp_begin_config(port) == SP_OK);
+	assert(sp_set_baudrate(port, 115200) == SP_OK);
+	assert(sp_set_dtr(port, SP_DTR_OFF) == SP_OK);
+	assert(sp_commit_config(port) == SP_OK);
+	print_counts("Committed");
+	assert(tcsetattr_calls == 0);
+	assert(ioctl_calls == 1);
+	assert(modem_bits == TIOCM_RTS);
+
+	printf("Rejecting invalid staged settings\n");
+	reset_counts();
+	assert(sp_begin_config(port) == SP_OK);
+	assert(sp_set_bits(port, 99) == SP_ERR_ARG);
+	assert(sp_set_bits(port, 4) == SP_ERR_ARG);
+	assert(sp_set_stopbits(port, 3) == SP_ERR_ARG);
+	assert(sp_set_parity(port, (enum sp_parity) 42) == SP_ERR_ARG);
+	assert(sp_set_xon_xoff(port, (enum sp_xonxoff) 42) == SP_ERR_ARG);
+	assert(sp_set_bits(port, 8) == SP_OK);
+	assert(port->staged.bits == 8);
+	assert(sp_set_bits(port, 99) == SP_ERR_ARG);
+	assert(port->staged.bits == 8);
+	assert(sp_abort_config(port) == SP_OK);
+	assert(syscalls() == 0);
+
+	printf("Aborting staged changes\n");
+	reset_counts();
+	assert(sp_begin_config(port) == SP_OK);
+	assert(sp_set_baudrate(port, 9600) == SP_OK);
+	assert(sp_set_flowcontrol(port, SP_FLOWCONTROL_NONE) == SP_OK);
+	assert(sp_abort_config(port) == SP_OK);
+	print_counts("Aborted");
+	assert(syscalls() == 0);
+	assert(sp_get_config(port, &config) == SP_OK);
+	assert(config.baudrate == 115200);
+	assert(sp_abort_config(port) == SP_ERR_ARG);
+
+	printf("Refreshing configuration\n");
+	reset_counts();
+	assert(sp_refresh_config(port) == SP_OK);
+	print_counts("Refreshed");
+	assert(tcgetattr_calls == 1);
+	assert(sp_get_config(port, &config) == SP_OK);
+	assert(config.baudrate == 115200);
+	assert(config.rts == SP_RTS_ON);
+	assert(config.dtr == SP_DTR_OFF);
+
+#ifdef USE_TERMIOS_SPEED
+	printf("Switching to a non-standard baud rate and back\n");
+	assert(sp_set_baudrate(port, 9600) == SP_OK);
+	reset_counts();
+	assert(sp_set_baudrate(port, 250000) == SP_OK);
+	print_counts("Non-standard");
+	/* Only the speed changes, so tcsetattr() is skipped. */
+	assert(tcsetattr_calls == 0);
+	assert(sp_refresh_config(port) == SP_OK);
+	assert(sp_get_config(port, &config) == SP_OK);
+	assert(config.baudrate == 250000);
+	assert(sp_set_baudrate(port, 9600) == SP_OK);
+	assert(sp_set_baudrate(port, 250000) == SP_OK);
+	reset_counts();
+	assert(sp_set_baudrate(port, 9600) == SP_OK);
+	print_counts("Standard");
+	assert(tcsetattr_calls == 1);
+	assert(sp_refresh_config(port) == SP_OK);
+	assert(sp_get_config(port, &config) == SP_OK);
+	assert(config.baudrate == 9600);
+#endif
+
+	printf("Retrying a commit which failed part way\n");
+	assert(sp_get_config(port, &config) == SP_OK);
+	assert(config.baudrate == 9600);
+	assert(sp_begin_config(port) == SP_OK);
+	assert(sp_set_baudrate(port, 19200) == SP_OK);
+	assert(sp_set_rts(port, SP_RTS_OFF) == SP_OK);
+	assert(sp_set_dtr(port, SP_DTR_ON) == SP_OK);
+	fail_modem_writes = true;
+	assert(sp_commit_config(port) == SP_ERR_FAIL);
+	/* RTS was lowered before raising DTR failed. */
+	assert(modem_bits == 0);
+	/* The changes are still being collected. */
+	assert(sp_begin_config(port) == SP_ERR_ARG);
+	assert(port->staged.baudrate == 19200);
+	assert(port->staged.rts == SP_RTS_OFF);
+	assert(port->staged.dtr == SP_DTR_ON);
+	fail_modem_writes = false;
+	reset_counts();
+	assert(sp_commit_config(port) == SP_OK);
+	print_counts("Retried");
+	/* The configuration is read back, as the port state is unknown. */
+	assert(tcgetattr_calls == 1);
+	assert(modem_bits == TIOCM_DTR);
+	assert(sp_get_config(port, &config) == SP_OK);
+	assert(config.baudrate == 19200);
+	assert(config.rts == SP_RTS_OFF);
+	assert(config.dtr == SP_DTR_ON);
+	assert(sp_commit_config(port) == SP_ERR_ARG);
+
+	printf("Aborting after a failed commit\n");
+	assert(sp_begin_config(port) == SP_OK);
+	assert(sp_set_rts(port, SP_RTS_ON) == SP_OK);
+	fail_modem_writes = true;
+	assert(sp_commit_config(port) == SP_ERR_FAIL);
+	fail_modem_writes = false;
+	assert(sp_abort_config(port) == SP_OK);
+	assert(sp_commit_config(port) == SP_ERR_ARG);
+
+	printf("Counting reads and writes\n");
+	assert(sp_reset_port_stats(port) == SP_OK);
+	assert(sp_blocking_write(port, "hello", 5, 100) == 5);
+	assert(read(master, buf, sizeof(buf)) == 5);
+	assert(write(master, "abc", 3) == 3);
+	assert(sp_blocking_read(port, buf, 3, 100) == 3);
+	assert(write(master, "de", 2) == 2);
+	assert(sp_blocking_read(port, buf, 4, 50) == 2);
+	/* A timeout with no data at all is not a short read. */
+	assert(sp_blocking_read(port, buf, 4, 10) == 0);
+	assert(sp_get_port_stats(port, &stats) == SP_OK);
+	printf("%llu bytes in %llu reads, %llu bytes in %llu writes, %llu waits\n",
+		stats.bytes_read, stats.reads, stats.bytes_written, stats.writes,
+		stats.waits);
+	assert(stats.bytes_read == 5);
+	assert(stats.bytes_written == 5);
+	assert(stats.reads >= 2);
+	assert(stats.writes >= 1);
+	assert(stats.short_reads == 1);
+	assert(stats.timeouts == 2);
+	assert(stats.waits >= 5);
+	for (i = 0, total = 0; i < SP_STATS_HISTOGRAM_SIZE; i++)
+		total += stats.wait_histogram[i];
+	assert(total == stats.waits);
+	/* The timed out wait lasted about 50ms, in the 32-64ms bucket. */
+	assert(stats.wait_histogram[16] >= 1);
+	assert(stats.overruns == 3);
+	assert(stats.parity_errors == 2);
+	assert(stats.frame_errors == 0);
+	assert(sp_reset_port_stats(port) == SP_OK);
+	assert(sp_get_port_stats(port, &stats) == SP_OK);
+	assert(stats.bytes_read == 0 && stats.waits == 0);
+
+	close_pty_port(master, port);
+
+	return 0;
+}
@@ -0,0 +1,547 @@
+#include "config.h"
+#include "libserialport.h"
+#include "libserialport_internal.h"
+#include <assert.h>
+#include <ftw.h>
+#include <pthread.h>
+
+/*
+ * Enumeration tests, run against a synthetic sysfs tree.
+ *
+ * A fake /sys and /dev are generated in a temporary directory, which is
+ * passed to the library through the LIBSERIALPORT_ROOT environment
+ * variable. The tree holds the given number of USB, Bluetooth, platform,
+ * serial8250 and virtual ttys, laid out as the kernel does.
+ */
+
+static char root[PATH_MAX];
+
+#define LAZY_THREADS 8
+
+#define LATENCY_TIMER_0 \
+	"sys/devices/pci0000:00/0000:00:14.0/usb1/1-1/1-1:1.0/ttyUSB0/latency_timer"
+
+/* Get the full path of a file in the generated tree. */
+static void get_path(char *buf, const char *path)
+{
+	assert(snprintf(buf, PATH_MAX, "%s/%s", root, path) < PATH_MAX);
+}
+
+static void make_dirs(const char *path)
+{
+	char buf[PATH_MAX], *ptr;
+
+	get_path(buf, path);
+	for (ptr = buf + strlen(root) + 1; (ptr = strchr(ptr, '/')); ptr++) {
+		*ptr = 0;
+		mkdir(buf, 0755);
+		*ptr = '/';
+	}
+	mkdir(buf, 0755);
+}
+
+static void make_file(const char *path, const char *contents)
+{
+	char buf[PATH_MAX];
+	FILE *file;
+
+	get_path(buf, path);
+	assert((file = fopen(buf, "w")));
+	fputs(contents, file);
+	fclose(file);
+}
+
+static void read_file(const char *path, char *contents, size_t size)
+{
+	char buf[PATH_MAX];
+	FILE *file;
+
+	get_path(buf, path);
+	assert((file = fopen(buf, "r")));
+	assert(fgets(contents, size, file));
+	fclose(file);
+}
+
+static void make_link(const char *target, const char *path)
+{
+	char buf[PATH_MAX];
+
+	get_path(buf, path);
+	assert(symlink(target, buf) == 0);
+}
+
+/*
+ * Add a tty whose device directory is dev_dir, relative to sys/devices.
+ * The class directory is placed under the device directory, with a
+ * device link back to it. Virtual ttys have no device directory.
+ */
+static void make_tty(const char *name, const char *dev_dir)
+{
+	char path[PATH_MAX], target[PATH_MAX];
+
+	if (dev_dir) {
+		snprintf(path, sizeof(path), "sys/devices/%s/tty/%s", dev_dir, name);
+		make_dirs(path);
+		snprintf(path, sizeof(path), "sys/devices/%s/tty/%s/device", dev_dir, name);
+		make_link("../..", path);
+		snprintf(target, sizeof(target), "../../devices/%s/tty/%s", dev_dir, name);
+	} else {
+		snprintf(path, sizeof(path), "sys/devices/virtual/tty/%s", name);
+		make_dirs(path);
+		snprintf(target, sizeof(target), "../../devices/virtual/tty/%s", name);
+	}
+
+	snprintf(path, sizeof(path), "sys/class/tty/%s", name);
+	make_link(target, path);
+
+	snprintf(path, sizeof(path), "dev/%s", name);
+	make_file(path, "");
+}
+
+/* Add a USB-serial adapter, with the tty below the interface. */
+static void make_usb_tty(int i)
+{
+	char dev_dir[256], path[PATH_MAX], name[32], value[32];
+
+	/* The USB device is created first, as the kernel does. */
+	snprintf(dev_dir, sizeof(dev_dir),
+		"sys/devices/pci0000:00/0000:00:14.0/usb1/1-%d", i + 1);
+	make_dirs(dev_dir);
+	snprintf(path, sizeof(path), "%s/busnum", dev_dir);
+	make_file(path, "1\n");
+	snprintf(path, sizeof(path), "%s/devnum", dev_dir);
+	snprintf(value, sizeof(value), "%d\n", i + 2);
+	make_file(path, value);
+	snprintf(path, sizeof(path), "%s/idVendor", dev_dir);
+	make_file(path, "0403\n");
+	snprintf(path, sizeof(path), "%s/idProduct", dev_dir);
+	make_file(path, "6001\n");
+	snprintf(path, sizeof(path), "%s/manufacturer", dev_dir);
+	make_file(path, "FTDI\n");
+	snprintf(path, sizeof(path), "%s/product", dev_dir);
+	make_file(path, "FT232R USB UART\n");
+	snprintf(path, sizeof(path), "%s/serial", dev_dir);
+	snprintf(value, sizeof(value), "A%07d\n", i);
+	make_file(path, value);
+
+	snprintf(name, sizeof(name), "ttyUSB%d", i);
+	snprintf(dev_dir, sizeof(dev_dir),
+		"pci0000:00/0000:00:14.0/usb1/1-%d/1-%d:1.0/%s", i + 1, i + 1, name);
+	make_tty(name, dev_dir);
+	snprintf(path, sizeof(path), "sys/devices/%s/latency_timer", dev_dir);
+	make_file(path, "16\n");
+}
+
+static void make_tree(int count)
+{
+	char dev_dir[256], path[PATH_MAX], name[32], value[32];
+	int i;
+
+	make_dirs("sys/class/tty");
+	make_dirs("dev");
+
+	for (i = 0; i < count; i++) {
+		make_usb_tty(i);
+
+		/* Bluetooth UART. */
+		snprintf(name, sizeof(name), "ttyBT%d", i);
+		snprintf(dev_dir, sizeof(dev_dir),
+			"platform/serial-bt/bluetooth/hci%d/hci%d:1", i, i);
+		make_tty(name, dev_dir);
+		snprintf(path, sizeof(path), "sys/devices/%s/address", dev_dir);
+		snprintf(value, sizeof(value), "00:11:22:33:%02x:%02x\n", i >> 8, i & 0xff);
+		make_file(path, value);
+
+		/* Platform UART. */
+		snprintf(name, sizeof(name), "ttyAMA%d", i);
+		snprintf(dev_dir, sizeof(dev_dir), "platform/soc/uart%d", i);
+		make_tty(name, dev_dir);
+
+		/*
+		 * Absent serial8250 port. Half report their type in sysfs, and
+		 * the rest must be probed, which fails as they are not ttys.
+		 */
+		snprintf(name, sizeof(name), "ttyS%d", i);
+		make_tty(name, "platform/serial8250");
+		if (i % 2 == 0) {
+			snprintf(path, sizeof(path),
+				"sys/devices/platform/serial8250/tty/%s/type", name);
+			make_file(path, "0\n");
+		}
+
+		/* Virtual terminal. */
+		snprintf(name, sizeof(name), "tty%d", i);
+		make_tty(name, NULL);
+	}
+}
+
+/* Wait for a monitor to have notifications pending. */
+static void wait_monitor(struct sp_monitor *monitor)
+{
+	struct pollfd pollfd;
+
+	assert(sp_get_monitor_handle(monitor, &pollfd.fd) == SP_OK);
+	pollfd.events = POLLIN;
+	assert(poll(&pollfd, 1, 1000) == 1);
+}
+
+/* Check that a monitor reports a single change, to the given port. */
+static void check_event(struct sp_monitor *monitor,
+	enum sp_monitor_event expected, const char *tty)
+{
+	enum sp_monitor_event event;
+	struct sp_port *port;
+
+	wait_monitor(monitor);
+	assert(sp_read_monitor_event(monitor, &event, &port) == 1);
+	assert(event == expected);
+	assert(!strcmp(sp_get_port_name(port) + strlen(root) + 5, tty));
+	assert(sp_read_monitor_event(monitor, &event, &port) == 0);
+	assert(!port);
+}
+
+/*
+ * Overflow the monitor's inotify queue, then change ports while their
+ * notifications are lost. The rescan on overflow must still find them.
+ */
+static void overflow_monitor(struct sp_monitor *monitor, int count)
+{
+	struct sp_port *port, * const *ports;
+	enum sp_monitor_event event;
+	char path[PATH_MAX], value[PATH_MAX];
+	int i, max_events, added = 0, removed = 0, changed = 0;
+	FILE *file;
+
+	printf("Rescanning after lost notifications\n");
+
+	if (!(file = fopen("/proc/sys/fs/inotify/max_queued_events", "r")) ||
+			fscanf(file, "%d", &max_events) != 1 || max_events > 100000) {
+		printf("Inotify queue size unknown or too large, skipped\n");
+		if (file)
+			fclose(file);
+		return;
+	}
+	fclose(file);
+
+	/* The kernel removes the class entry with the device node. */
+	snprintf(path, sizeof(path), "sys/class/tty/ttyUSB%d", count);
+	get_path(value, path);
+	assert(unlink(value) == 0);
+
+	for (i = 0; i <= max_events; i++) {
+		snprintf(path, sizeof(path), "dev/null%d", i);
+		make_file(path, "");
+	}
+
+	make_usb_tty(count + 1);
+	get_path(value, "sys/class/tty/ttyBT0");
+	assert(unlink(value) == 0);
+	get_path(path, "dev/ttyBT0");
+	assert(unlink(path) == 0);
+	make_file("sys/devices/pci0000:00/0000:00:14.0/usb1/1-1/product",
+		"FT230X Basic UART\n");
+
+	snprintf(value, sizeof(value), "ttyUSB%d", count + 1);
+	wait_monitor(monitor);
+	while (sp_read_monitor_event(monitor, &event, &port) == 1) {
+		if (event == SP_MONITOR_ADDED) {
+			assert(!strcmp(sp_get_port_name(port) + strlen(root) + 5, value));
+			added++;
+		} else if (event == SP_MONITOR_REMOVED) {
+			assert(!strcmp(sp_get_port_name(port) + strlen(root) + 5, "ttyBT0"));
+			removed++;
+		} else {
+			assert(!strcmp(sp_get_port_name(port) + strlen(root) + 5, "ttyUSB0"));
+			assert(!strcmp(sp_get_port_usb_product(port), "FT230X Basic UART"));
+			changed++;
+		}
+	}
+	assert(added == 1 && removed == 1 && changed == 1);
+	assert(sp_get_monitor_ports(monitor, &ports) == 3 * count + 1);
+}
+
+static void *lazy_getter(void *arg)
+{
+	struct sp_port *port = arg;
+
+	return sp_get_port_usb_product(port);
+}
+
+/* Request the details of a lazy port from several threads at once. */
+static void test_lazy_threads(const char *name)
+{
+	pthread_t threads[LAZY_THREADS];
+	struct sp_port *port;
+	void *product;
+	int i, round;
+
+	printf("Getting lazy details from %d threads\n", LAZY_THREADS);
+
+	for (round = 0; round < 20; round++) {
+		assert(sp_get_port_by_name_lazy(name, &port) == SP_OK);
+		for (i = 0; i < LAZY_THREADS; i++)
+			assert(pthread_create(&threads[i], NULL, lazy_getter, port) == 0);
+		for (i = 0; i < LAZY_THREADS; i++) {
+			assert(pthread_join(threads[i], &product) == 0);
+			assert(product && !strcmp(product, "FT232R USB UART"));
+		}
+		sp_free_port(port);
+	}
+}
+
+static int remove_entry(const char *path, const struct stat *statbuf,
+	int type, struct FTW *ftw)
+{
+	(void) statbuf;
+	(void) type;
+	(void) ftw;
+
+	return remove(path);
+}
+
+static double elapsed_us(const struct timespec *start, const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1e6 +
+		(end->tv_nsec - start->tv_nsec) / 1e3;
+}
+
+int main(int argc, char *argv[])
+{
+	struct sp_port **list, *port, *copy, * const *ports;
+	struct sp_port_filter *filter;
+	struct sp_monitor *monitor;
+	enum sp_monitor_event event;
+	struct timespec start, end;
+	char tmpdir[] = "/tmp/test_enumeration.XXXXXX";
+	char name[PATH_MAX], value[32];
+	int count = argc > 1 ? atoi(argv[1]) : 100;
+	int i, num_ports, usb, bluetooth, native;
+	int bus, address, vid, pid, timer;
+
+	assert(count > 0 && count <= 10000);
+	assert(mkdtemp(tmpdir));
+	assert(realpath(tmpdir, root));
+
+	printf("Generating %d of each tty type in %s\n", count, root);
+	make_tree(count);
+	setenv("LIBSERIALPORT_ROOT", root, 1);
+
+	printf("Listing ports\n");
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	assert(sp_list_ports(&list) == SP_OK);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	usb = bluetooth = native = 0;
+	for (num_ports = 0; list[num_ports]; num_ports++) {
+		port = list[num_ports];
+		switch (sp_get_port_transport(port)) {
+		case SP_TRANSPORT_USB:
+			usb++;
+			assert(sscanf(sp_get_port_name(port) + strlen(root),
+				"/dev/ttyUSB%d", &i) == 1);
+			assert(sp_get_port_usb_bus_address(port, &bus, &address) == SP_OK);
+			assert(bus == 1 && address == i + 2);
+			assert(sp_get_port_usb_vid_pid(port, &vid, &pid) == SP_OK);
+			assert(vid == 0x0403 && pid == 0x6001);
+			assert(!strcmp(sp_get_port_usb_manufacturer(port), "FTDI"));
+			assert(!strcmp(sp_get_port_usb_product(port), "FT232R USB UART"));
+			snprintf(value, sizeof(value), "A%07d", i);
+			assert(!strcmp(sp_get_port_usb_serial(port), value));
+			snprintf(name, sizeof(name), "FT232R USB UART - %s", value);
+			assert(!strcmp(sp_get_port_description(port), name));
+			break;
+		case SP_TRANSPORT_BLUETOOTH:
+			bluetooth++;
+			assert(sscanf(sp_get_port_name(port) + strlen(root),
+				"/dev/ttyBT%d", &i) == 1);
+			snprintf(value, sizeof(value), "00:11:22:33:%02x:%02x", i >> 8, i & 0xff);
+			assert(!strcmp(sp_get_port_bluetooth_address(port), value));
+			break;
+		default:
+			native++;
+			assert(!strncmp(sp_get_port_name(port) + strlen(root),
+				"/dev/ttyAMA", 11));
+			assert(!strcmp(sp_get_port_description(port),
+				sp_get_port_name(port) + strlen(root) + 5));
+			break;
+		}
+	}
+
+	printf("Found %d ports: %d USB, %d Bluetooth, %d native\n",
+		num_ports, usb, bluetooth, native);
+	printf("Enumeration took %.0f us, %.1f us per port\n",
+		elapsed_us(&start, &end), elapsed_us(&start, &end) / num_ports);
+	assert(usb == count);
+	assert(bluetooth == count);
+	assert(native == count);
+	sp_free_port_list(list);
+
+	printf("Looking up a single port\n");
+	get_path(name, "dev/ttyUSB0");
+	assert(sp_get_port_by_name(name, &port) == SP_OK);
+	assert(sp_get_port_transport(port) == SP_TRANSPORT_USB);
+	assert(sp_get_latency_timer(port, &timer) == SP_OK);
+	assert(timer == 16);
+
+	printf("Setting the latency timer\n");
+	assert(sp_set_latency_timer(port, 1) == SP_OK);
+	read_file(LATENCY_TIMER_0, value, sizeof(value));
+	assert(!strcmp(value, "1"));
+	assert(sp_get_latency_timer(port, &timer) == SP_OK);
+	assert(timer == 1);
+	assert(sp_set_latency_timer(port, 256) == SP_ERR_ARG);
+	assert(sp_set_latency_timer(port, -1) == SP_ERR_ARG);
+	make_file(LATENCY_TIMER_0, "fast\n");
+	assert(sp_get_latency_timer(port, &timer) == SP_ERR_FAIL);
+	assert(timer == 0);
+	make_file(LATENCY_TIMER_0, "16\n");
+	/* Low latency mode is set through the open device instead. */
+	assert(sp_set_low_latency(port, 1) == SP_ERR_ARG);
+	sp_free_port(port);
+
+	printf("Looking up a single port lazily\n");
+	get_path(name, "dev/ttyUSB0");
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	assert(sp_get_port_by_name_lazy(name, &port) == SP_OK);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	printf("Lazy lookup took %.0f us\n", elapsed_us(&start, &end));
+	/* The details are read on first access, so this change is seen. */
+	make_file("sys/devices/pci0000:00/0000:00:14.0/usb1/1-1/product",
+		"FT230X Basic UART\n");
+	assert(sp_copy_port(port, &copy) == SP_OK);
+	assert(!strcmp(sp_get_port_usb_product(port), "FT230X Basic UART"));
+	assert(!strcmp(sp_get_port_description(port), "FT230X Basic UART - A0000000"));
+	make_file("sys/devices/pci0000:00/0000:00:14.0/usb1/1-1/product",
+		"FT232R USB UART\n");
+	assert(!strcmp(sp_get_port_usb_product(port), "FT230X Basic UART"));
+	assert(!strcmp(sp_get_port_usb_product(copy), "FT232R USB UART"));
+	assert(sp_get_port_usb_vid_pid(copy, &vid, &pid) == SP_OK);
+	assert(vid == 0x0403 && pid == 0x6001);
+	sp_free_port(copy);
+	sp_free_port(port);
+
+	test_lazy_threads(name);
+
+	printf("Finding ports by filter\n");
+	assert(sp_new_port_filter(&filter) == SP_OK);
+	snprintf(value, sizeof(value), "A%07d", count - 1);
+	assert(sp_set_filter_usb_serial(filter, value) == SP_OK);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	assert(sp_find_port(filter, &port) == SP_OK);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	printf("Lookup by serial number took %.0f us\n", elapsed_us(&start, &end));
+	snprintf(value, sizeof(value), "dev/ttyUSB%d", count - 1);
+	get_path(name, value);
+	assert(port && !strcmp(sp_get_port_name(port), name));
+	sp_free_port(port);
+	assert(sp_set_filter_usb_serial(filter, "none") == SP_OK);
+	assert(sp_find_port(filter, &port) == SP_OK);
+	assert(!port);
+	assert(sp_set_filter_usb_serial(filter, NULL) == SP_OK);
+
+	assert(sp_set_filter_usb_vid_pid(filter, 0x0403, 0x6001) == SP_OK);
+	assert(sp_list_ports_filtered(filter, &list) == SP_OK);
+	for (num_ports = 0; list[num_ports]; num_ports++)
+		assert(sp_get_port_transport(list[num_ports]) == SP_TRANSPORT_USB);
+	assert(num_ports == count);
+	sp_free_port_list(list);
+	assert(sp_set_filter_usb_vid_pid(filter, 0x0403, 0x6015) == SP_OK);
+	assert(sp_list_ports_filtered(filter, &list) == SP_OK);
+	assert(!list[0]);
+	sp_free_port_list(list);
+	assert(sp_set_filter_usb_vid_pid(filter, -1, -1) == SP_OK);
+
+	assert(sp_set_filter_transport(filter, SP_TRANSPORT_BLUETOOTH) == SP_OK);
+	assert(sp_set_filter_bluetooth_address(filter, "00:11:22:33:00:00") == SP_OK);
+	assert(sp_find_port(filter, &port) == SP_OK);
+	get_path(name, "dev/ttyBT0");
+	assert(port && !strcmp(sp_get_port_name(port), name));
+	sp_free_port(port);
+	assert(sp_set_filter_bluetooth_address(filter, NULL) == SP_OK);
+
+	assert(sp_set_filter_transport(filter, SP_TRANSPORT_NATIVE) == SP_OK);
+	assert(sp_set_filter_name(filter, "*/ttyAMA?") == SP_OK);
+	assert(sp_list_ports_filtered(filter, &list) == SP_OK);
+	for (num_ports = 0; list[num_ports]; num_ports++)
+		;
+	assert(num_ports == (count < 10 ? count : 10));
+	sp_free_port_list(list);
+
+	printf("Adding a serial8250 port with a known type\n");
+	snprintf(value, sizeof(value), "ttyS%d", count);
+	make_tty(value, "platform/serial8250");
+	snprintf(name, sizeof(name),
+		"sys/devices/platform/serial8250/tty/%s/type", value);
+	make_file(name, "4\n");
+	assert(sp_set_filter_name(filter, "*/ttyS*") == SP_OK);
+	assert(sp_list_ports_filtered(filter, &list) == SP_OK);
+	snprintf(value, sizeof(value), "dev/ttyS%d", count);
+	get_path(name, value);
+	assert(list[0] && !strcmp(sp_get_port_name(list[0]), name));
+	assert(!list[1]);
+	sp_free_port_list(list);
+	sp_free_port_filter(filter);
+
+	get_path(name, "dev/ttyAMA0");
+	assert(sp_get_port_by_name(name, &port) == SP_OK);
+	assert(sp_get_latency_timer(port, &timer) == SP_ERR_SUPP);
+	assert(sp_set_latency_timer(port, 1) == SP_ERR_SUPP);
+	sp_free_port(port);
+
+	printf("Monitoring ports\n");
+	assert(sp_new_monitor(&monitor) == SP_OK);
+	/* This includes the serial8250 port added above. */
+	assert(sp_get_monitor_ports(monitor, &ports) == 3 * count + 1);
+	for (i = 1; ports[i]; i++)
+		assert(strcmp(sp_get_port_name(ports[i - 1]), sp_get_port_name(ports[i])) < 0);
+	assert(sp_find_monitor_port_by_usb(monitor, 1, 2, &port) == SP_OK);
+	assert(port && !strcmp(sp_get_port_usb_serial(port), "A0000000"));
+	assert(sp_find_monitor_port_by_serial(monitor, "A0000000", &port) == SP_OK);
+	assert(port && sp_get_port_usb_bus_address(port, &bus, &address) == SP_OK);
+	assert(address == 2);
+	get_path(name, "dev/ttyAMA0");
+	assert(sp_find_monitor_port_by_name(monitor, name, &port) == SP_OK);
+	assert(port && !strcmp(sp_get_port_name(port), name));
+	assert(sp_find_monitor_port_by_usb(monitor, 2, 2, &port) == SP_OK);
+	assert(!port);
+	assert(sp_read_monitor_event(monitor, &event, &port) == 0);
+
+	printf("Adding a port\n");
+	make_usb_tty(count);
+	snprintf(value, sizeof(value), "ttyUSB%d", count);
+	check_event(monitor, SP_MONITOR_ADDED, value);
+	assert(sp_find_monitor_port_by_usb(monitor, 1, count + 2, &port) == SP_OK);
+	assert(port && sp_get_port_usb_vid_pid(port, &vid, &pid) == SP_OK);
+	assert(vid == 0x0403 && pid == 0x6001);
+
+	printf("Changing a port\n");
+	snprintf(name, sizeof(name),
+		"sys/devices/pci0000:00/0000:00:14.0/usb1/1-%d/product", count + 1);
+	make_file(name, "FT231X USB UART\n");
+	snprintf(value, sizeof(value), "dev/ttyUSB%d", count);
+	get_path(name, value);
+	snprintf(value, sizeof(value), "ttyUSB%d", count);
+	assert(chmod(name, 0600) == 0);
+	check_event(monitor, SP_MONITOR_CHANGED, value);
+	assert(sp_find_monitor_port_by_name(monitor, name, &port) == SP_OK);
+	assert(port && !strcmp(sp_get_port_usb_product(port), "FT231X USB UART"));
+
+	printf("Removing a port\n");
+	assert(unlink(name) == 0);
+	check_event(monitor, SP_MONITOR_REMOVED, value);
+	assert(sp_find_monitor_port_by_name(monitor, name, &port) == SP_OK);
+	assert(!port);
+	assert(sp_get_monitor_ports(monitor, &ports) == 3 * count + 1);
+
+	printf("Touching a device which is not a serial port\n");
+	make_file("dev/null", "");
+	wait_monitor(monitor);
+	assert(sp_read_monitor_event(monitor, &event, &port) == 0);
+
+	overflow_monitor(monitor, count);
+	sp_free_monitor(monitor);
+
+	assert(nftw(root, remove_entry, 16, FTW_DEPTH | FTW_PHYS) == 0);
+
+	return 0;
+}
@@ -0,0 +1,225 @@
+#include "config.h"
+#include "libserialport.h"
+#include "libserialport_internal.h"
+#include "test_util.h"
+#include <assert.h>
+
+/*
+ * Event set tests, run against pseudo-terminal pairs.
+ *
+ * Built twice: once as is, where sp_wait_events() uses epoll, and once with
+ * NO_EPOLL, where it falls back to poll().
+ */
+
+#define NUM_PORTS 3
+
+static int masters[NUM_PORTS];
+static struct sp_port *ports[NUM_PORTS];
+
+static void open_pair(int i)
+{
+	masters[i] = open_pty_port(0, &ports[i]);
+}
+
+static void close_pair(int i)
+{
+	close_pty_port(masters[i], ports[i]);
+	ports[i] = NULL;
+}
+
+/* Read back everything the port has received. */
+static void drain(int i)
+{
+	char buf[64];
+
+	while (sp_nonblocking_read(ports[i], buf, sizeof(buf)) > 0)
+		;
+}
+
+/* Wait for events and return the mask reported for one port, if any. */
+static enum sp_event wait_for(struct sp_event_set *event_set,
+		struct sp_port *port, int *count)
+{
+	struct sp_event_result results[NUM_PORTS];
+	enum sp_event events = 0;
+	int result, i;
+
+	result = sp_wait_events(event_set, results, NUM_PORTS, 50);
+	assert(result >= 0);
+	for (i = 0; i < result; i++) {
+		assert(results[i].port != NULL);
+		if (results[i].port == port)
+			events |= results[i].events;
+	}
+	if (count)
+		*count = result;
+
+	return events;
+}
+
+static void test_reports_ports(void)
+{
+	struct sp_event_set *event_set;
+	struct sp_event_result result;
+	int i, count;
+
+	printf("Reporting which ports are readable\n");
+
+	assert(sp_new_event_set(&event_set) == SP_OK);
+	for (i = 0; i < NUM_PORTS; i++)
+		assert(sp_add_port_events(event_set, ports[i], SP_EVENT_RX_READY) == SP_OK);
+
+	/* Nothing has been received, so the wait times out. */
+	assert(sp_wait_events(event_set, &result, 1, 20) == 0);
+
+	assert(write(masters[1], "x", 1) == 1);
+	assert(wait_for(event_set, ports[1], &count) == SP_EVENT_RX_READY);
+	assert(count == 1);
+	drain(1);
+
+	/* Results are limited to the space given. */
+	assert(write(masters[0], "x", 1) == 1);
+	assert(write(masters[2], "x", 1) == 1);
+	assert(wait_for(event_set, NULL, &count) == 0);
+	assert(count == 2);
+	assert(sp_wait_events(event_set, &result, 1, 50) == 1);
+	assert(result.port == ports[0] || result.port == ports[2]);
+	assert(result.events == SP_EVENT_RX_READY);
+
+	/* sp_wait() sees the same readiness. */
+	assert(sp_wait(event_set, 50) == SP_OK);
+	drain(0);
+	drain(2);
+
+	printf("Merging masks of repeated adds\n");
+	assert(sp_add_port_events(event_set, ports[0], SP_EVENT_TX_READY) == SP_OK);
+	assert(event_set->count == NUM_PORTS);
+	assert(wait_for(event_set, ports[0], &count) == SP_EVENT_TX_READY);
+	assert(count == 1);
+
+	sp_free_event_set(event_set);
+}
+
+static void test_remove_and_modify(void)
+{
+	struct sp_event_set *event_set;
+	int i, count;
+
+	printf("Removing the middle port\n");
+
+	assert(sp_new_event_set(&event_set) == SP_OK);
+	for (i = 0; i < NUM_PORTS; i++)
+		assert(sp_add_port_events(event_set, ports[i], SP_EVENT_RX_READY) == SP_OK);
+
+	assert(sp_remove_port_events(event_set, ports[1]) == SP_OK);
+	assert(sp_remove_port_events(event_set, ports[1]) == SP_ERR_ARG);
+	assert(event_set->count == NUM_PORTS - 1);
+
+	/* The last port has been moved into the gap, and still reports. */
+	assert(write(masters[2], "x", 1) == 1);
+	assert(wait_for(event_set, ports[2], &count) == SP_EVENT_RX_READY);
+	assert(count == 1);
+	assert(sp_wait(event_set, 50) == SP_OK);
+	drain(2);
+
+	/* The removed port no longer does. */
+	assert(write(masters[1], "x", 1) == 1);
+	assert(wait_for(event_set, NULL, &count) == 0);
+	assert(count == 0);
+	drain(1);
+
+	printf("Narrowing a port's mask\n");
+
+	assert(sp_modify_port_events(event_set, ports[0],
+		SP_EVENT_RX_READY | SP_EVENT_TX_READY) == SP_OK);
+	assert(wait_for(event_set, ports[0], &count) == SP_EVENT_TX_READY);
+	assert(count == 1);
+
+	assert(sp_modify_port_events(event_set, ports[0], SP_EVENT_RX_READY) == SP_OK);
+	assert(wait_for(event_set, ports[0], &count) == 0);
+	assert(count == 0);
+
+	assert(write(masters[0], "x", 1) == 1);
+	assert(wait_for(event_set, ports[0], &count) == SP_EVENT_RX_READY);
+	assert(count == 1);
+	drain(0);
+
+	assert(sp_modify_port_events(event_set, ports[1], SP_EVENT_RX_READY) == SP_ERR_ARG);
+
+	printf("Removing a port after closing it\n");
+
+	assert(sp_close(ports[2]) == SP_OK);
+	assert(sp_remove_port_events(event_set, ports[2]) == SP_OK);
+	assert(event_set->count == 1);
+
+	assert(write(masters[0], "x", 1) == 1);
+	assert(wait_for(event_set, ports[0], &count) == SP_EVENT_RX_READY);
+	assert(count == 1);
+	assert(sp_wait(event_set, 50) == SP_OK);
+	drain(0);
+
+	assert(sp_open(ports[2], SP_MODE_READ_WRITE) == SP_OK);
+	assert(sp_set_flowcontrol(ports[2], SP_FLOWCONTROL_NONE) == SP_OK);
+
+	sp_free_event_set(event_set);
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+static void test_failed_merge(void)
+{
+	struct sp_event_set *event_set;
+	struct sp_event_result result;
+	int fd, saved;
+
+	printf("Keeping the mask when a merge fails\n");
+
+	assert(sp_new_event_set(&event_set) == SP_OK);
+	assert(sp_add_port_events(event_set, ports[0], SP_EVENT_RX_READY) == SP_OK);
+	/* Create the epoll instance. */
+	assert(sp_wait_events(event_set, &result, 1, 1) == 0);
+
+	/* Without the descriptor, epoll_ctl() fails. */
+	fd = ports[0]->fd;
+	saved = dup(fd);
+	assert(saved >= 0);
+	close(fd);
+	assert(sp_add_port_events(event_set, ports[0], SP_EVENT_TX_READY) == SP_ERR_FAIL);
+	assert(event_set->masks[0] == SP_EVENT_RX_READY);
+	assert(sp_modify_port_events(event_set, ports[0], SP_EVENT_TX_READY) == SP_ERR_FAIL);
+	assert(event_set->masks[0] == SP_EVENT_RX_READY);
+	assert(dup2(saved, fd) == fd);
+	close(saved);
+
+	/* Still only waiting for data. */
+	assert(wait_for(event_set, ports[0], NULL) == 0);
+
+	sp_free_event_set(event_set);
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+	(void) argc;
+	(void) argv;
+	int i;
+
+#ifdef HAVE_SYS_EPOLL_H
+	printf("Testing the epoll backend\n");
+#else
+	printf("Testing the poll backend\n");
+#endif
+
+	for (i = 0; i < NUM_PORTS; i++)
+		open_pair(i);
+
+	test_reports_ports();
+	test_remove_and_modify();
+#ifdef HAVE_SYS_EPOLL_H
+	test_failed_merge();
+#endif
+
+	for (i = 0; i < NUM_PORTS; i++)
+		close_pair(i);
+
+	return 0;
+}
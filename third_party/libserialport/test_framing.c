@@ -0,0 +1,246 @@
+#include "config.h"
+#include "libserialport.h"
+#include "libserialport_internal.h"
+#include "test_util.h"
+#include <assert.h>
+#include <pthread.h>
+
+/*
+ * Frame reading tests, run against a pseudo-terminal.
+ *
+ * Frames are written to the master side, and read back with the framing
+ * functions, checking what is kept in the read-ahead buffer between calls.
+ */
+
+#define SLIP_END 0xC0
+#define SLIP_ESC 0xDB
+#define SLIP_ESC_END 0xDC
+#define SLIP_ESC_ESC 0xDD
+
+#define BENCHMARK_FRAMES 5000
+#define BENCHMARK_FRAME_SIZE 64
+
+static int master;
+static struct sp_port *port;
+
+/* Send data, and give it time to reach the port side. */
+static void send(const void *data, size_t count)
+{
+	assert(write(master, data, count) == (ssize_t) count);
+	sleep_ms(10);
+}
+
+static void test_delimited(void)
+{
+	char buf[32];
+
+	printf("Reading delimited frames\n");
+
+	send("hello\nworld\n", 12);
+	assert(sp_blocking_read_until(port, buf, sizeof(buf), '\n', 100) == 6);
+	assert(memcmp(buf, "hello\n", 6) == 0);
+	/* The second frame comes from the read-ahead buffer. */
+	assert(sp_blocking_read_until(port, buf, sizeof(buf), '\n', 100) == 6);
+	assert(memcmp(buf, "world\n", 6) == 0);
+
+	printf("Keeping a partial frame over a timeout\n");
+
+	send("part", 4);
+	assert(sp_blocking_read_until(port, buf, sizeof(buf), '\n', 20) == 0);
+	assert(sp_blocking_read_until(port, buf, sizeof(buf), '\n', 1) == 0);
+	send("ial\n", 4);
+	assert(sp_blocking_read_until(port, buf, sizeof(buf), '\n', 100) == 8);
+	assert(memcmp(buf, "partial\n", 8) == 0);
+
+	/* With nothing at all sent, only the timeout ends the call. */
+	assert(sp_blocking_read_until(port, buf, sizeof(buf), '\n', 20) == 0);
+}
+
+static void test_too_long(void)
+{
+	unsigned char frame[300];
+	char buf[8];
+
+	printf("Discarding frames longer than the buffer\n");
+
+	/* A whole oversized frame, followed by one that fits. */
+	send("0123456789ABCDEF\nok\n", 20);
+	assert(sp_blocking_read_until(port, buf, sizeof(buf), '\n', 100) == SP_ERR_FAIL);
+	assert(sp_last_error_code() == EMSGSIZE);
+	assert(sp_blocking_read_until(port, buf, sizeof(buf), '\n', 100) == 3);
+	assert(memcmp(buf, "ok\n", 3) == 0);
+
+	/* An oversized frame whose end has not arrived yet. */
+	send("0123456789", 10);
+	assert(sp_blocking_read_until(port, buf, sizeof(buf), '\n', 100) == SP_ERR_FAIL);
+	assert(sp_last_error_code() == EMSGSIZE);
+	send("ABCDEF\nnext\n", 12);
+	assert(sp_blocking_read_until(port, buf, sizeof(buf), '\n', 100) == 5);
+	assert(memcmp(buf, "next\n", 5) == 0);
+
+	/* A length-prefixed frame, partly skipped on a later call. */
+	memset(frame, 'x', sizeof(frame));
+	frame[0] = 200;
+	send(frame, 100);
+	assert(sp_blocking_read_prefixed(port, buf, sizeof(buf), SP_PREFIX_8, 100) == SP_ERR_FAIL);
+	assert(sp_last_error_code() == EMSGSIZE);
+	/* 99 bytes of the frame have been sent, so 101 remain. */
+	frame[101] = 2;
+	frame[102] = 'o';
+	frame[103] = 'k';
+	send(frame, 104);
+	assert(sp_blocking_read_prefixed(port, buf, sizeof(buf), SP_PREFIX_8, 100) == 2);
+	assert(memcmp(buf, "ok", 2) == 0);
+
+	/* The same for the 16-bit prefix. */
+	frame[0] = 0;
+	frame[1] = 20;
+	frame[22] = 1;
+	frame[23] = 0;
+	frame[24] = '!';
+	send(frame, 25);
+	assert(sp_blocking_read_prefixed(port, buf, sizeof(buf), SP_PREFIX_16_BE, 100) == SP_ERR_FAIL);
+	assert(sp_last_error_code() == EMSGSIZE);
+	assert(sp_blocking_read_prefixed(port, buf, sizeof(buf), SP_PREFIX_16_LE, 100) == 1);
+	assert(buf[0] == '!');
+}
+
+static void test_slip(void)
+{
+	static const unsigned char bad[] = {
+		'a', SLIP_ESC, 'x', SLIP_END, 'o', 'k', SLIP_END
+	};
+	static const unsigned char escaped[] = {
+		SLIP_END, SLIP_ESC, SLIP_ESC_END, SLIP_ESC, SLIP_ESC_ESC, SLIP_END
+	};
+	unsigned char buf[8];
+
+	printf("Decoding SLIP frames\n");
+
+	send(bad, sizeof(bad));
+	assert(sp_blocking_read_slip(port, buf, sizeof(buf), 100) == SP_ERR_FAIL);
+	assert(sp_last_error_code() == EBADMSG);
+	assert(sp_blocking_read_slip(port, buf, sizeof(buf), 100) == 2);
+	assert(memcmp(buf, "ok", 2) == 0);
+
+	/* The leading empty frame is skipped. */
+	send(escaped, sizeof(escaped));
+	assert(sp_blocking_read_slip(port, buf, sizeof(buf), 100) == 2);
+	assert(buf[0] == SLIP_END && buf[1] == SLIP_ESC);
+}
+
+static void test_cobs(void)
+{
+	/* The first block claims four bytes, but the frame ends after one. */
+	static const unsigned char bad[] = {
+		0x05, 'a', 0x00, 0x02, 'a', 0x02, 'b', 0x00
+	};
+	unsigned char buf[8];
+
+	printf("Decoding COBS frames\n");
+
+	send(bad, sizeof(bad));
+	assert(sp_blocking_read_cobs(port, buf, sizeof(buf), 100) == SP_ERR_FAIL);
+	assert(sp_last_error_code() == EBADMSG);
+	assert(sp_blocking_read_cobs(port, buf, sizeof(buf), 100) == 3);
+	assert(memcmp(buf, "a\0b", 3) == 0);
+}
+
+static void test_flush(void)
+{
+	char buf[16];
+
+	printf("Flushing the read-ahead buffer\n");
+
+	send("one\ntwo\n", 8);
+	assert(sp_blocking_read_until(port, buf, sizeof(buf), '\n', 100) == 4);
+	assert(memcmp(buf, "one\n", 4) == 0);
+	/* "two\n" is now buffered, and is dropped with the input. */
+	assert(sp_flush(port, SP_BUF_INPUT) == SP_OK);
+	send("three\n", 6);
+	assert(sp_blocking_read_until(port, buf, sizeof(buf), '\n', 100) == 6);
+	assert(memcmp(buf, "three\n", 6) == 0);
+
+	/* Flushing output only leaves it alone. */
+	send("four\nfive\n", 10);
+	assert(sp_blocking_read_until(port, buf, sizeof(buf), '\n', 100) == 5);
+	assert(sp_flush(port, SP_BUF_OUTPUT) == SP_OK);
+	assert(sp_blocking_read_until(port, buf, sizeof(buf), '\n', 100) == 5);
+	assert(memcmp(buf, "five\n", 5) == 0);
+}
+
+static void *benchmark_writer(void *arg)
+{
+	unsigned char frame[BENCHMARK_FRAME_SIZE];
+	int i;
+
+	(void) arg;
+
+	memset(frame, 'f', sizeof(frame));
+	frame[sizeof(frame) - 1] = '\n';
+	for (i = 0; i < BENCHMARK_FRAMES; i++)
+		assert(write(master, frame, sizeof(frame)) == sizeof(frame));
+
+	return NULL;
+}
+
+/*
+ * Compare reading lines with sp_blocking_read_until() against reading a
+ * byte at a time until the delimiter, as programs without it have to.
+ */
+static void benchmark(bool framed)
+{
+	unsigned char buf[BENCHMARK_FRAME_SIZE * 2];
+	unsigned long long start, elapsed;
+	struct sp_port_stats stats;
+	pthread_t writer;
+	int i, length;
+
+	assert(sp_reset_port_stats(port) == SP_OK);
+	assert(pthread_create(&writer, NULL, benchmark_writer, NULL) == 0);
+	start = now_ns();
+
+	for (i = 0; i < BENCHMARK_FRAMES; i++) {
+		if (framed) {
+			length = sp_blocking_read_until(port, buf, sizeof(buf), '\n', 5000);
+		} else {
+			length = 0;
+			do
+				assert(sp_blocking_read(port, buf + length, 1, 5000) == 1);
+			while (buf[length++] != '\n');
+		}
+		assert(length == BENCHMARK_FRAME_SIZE);
+	}
+
+	elapsed = now_ns() - start;
+	assert(pthread_join(writer, NULL) == 0);
+	assert(sp_get_port_stats(port, &stats) == SP_OK);
+
+	printf("%s: %.1f MB/s, %.2f reads per frame\n",
+		framed ? "sp_blocking_read_until()" : "Byte at a time",
+		(double) BENCHMARK_FRAMES * BENCHMARK_FRAME_SIZE * 1000 / elapsed,
+		(double) stats.reads / BENCHMARK_FRAMES);
+}
+
+int main(int argc, char *argv[])
+{
+	(void) argc;
+	(void) argv;
+
+	master = open_pty_port(0, &port);
+
+	test_delimited();
+	test_too_long();
+	test_slip();
+	test_cobs();
+	test_flush();
+
+	printf("Reading %d frames of %d bytes\n", BENCHMARK_FRAMES,
+		BENCHMARK_FRAME_SIZE);
+	benchmark(false);
+	benchmark(true);
+
+	close_pty_port(master, port);
+
+	return 0;
+}
@@ -0,0 +1,384 @@
+#include "config.h"
+#include "libserialport.h"
+#include "libserialport_internal.h"
+#include "test_util.h"
+#include <assert.h>
+
+/*
+ * I/O ring tests, run against pseudo-terminal pairs with each backend, and
+ * a comparison of the system calls each needs to receive data.
+ */
+
+#define NUM_PAIRS 8
+#define NUM_BUFFERS 16
+#define BUFFER_SIZE 64
+#define MESSAGES 20
+#define MESSAGE_SIZE 50
+#define LARGE_WRITE (256 * 1024)
+#define BENCHMARK_BYTES (1024 * 1024)
+#define BENCHMARK_CHUNK 4096
+
+struct pair {
+	int master;
+	struct sp_port *port;
+	unsigned char sent;
+	unsigned char next;
+	int received;
+	int failures;
+};
+
+static struct pair pairs[NUM_PAIRS];
+static unsigned char large[LARGE_WRITE];
+static unsigned char chunk[BENCHMARK_CHUNK];
+
+static void open_pair(struct pair *pair)
+{
+	memset(pair, 0, sizeof(*pair));
+	pair->master = open_pty_port(0, &pair->port);
+}
+
+static void close_pair(struct pair *pair)
+{
+	close_pty_port(pair->master, pair->port);
+}
+
+static struct pair *find_pair(const struct sp_port *port)
+{
+	int i;
+
+	for (i = 0; i < NUM_PAIRS; i++)
+		if (pairs[i].port == port)
+			return &pairs[i];
+
+	assert(!"Completion for unknown port");
+	return NULL;
+}
+
+static void write_master(struct pair *pair, const unsigned char *buf, int count)
+{
+	int result, total = 0;
+
+	while (total < count) {
+		result = write(pair->master, buf + total, count - total);
+		assert(result > 0);
+		total += result;
+	}
+}
+
+/* Send numbered bytes from the master side of a pair. */
+static void send_bytes(struct pair *pair, int count)
+{
+	unsigned char buf[1024];
+	int i;
+
+	assert(count <= (int) sizeof(buf));
+	for (i = 0; i < count; i++)
+		buf[i] = pair->sent++;
+	write_master(pair, buf, count);
+}
+
+/* Check the bytes of a read completion, returning its buffer if asked. */
+static void check_read(struct sp_io_ring *ring,
+	const struct sp_io_completion *completion, bool release)
+{
+	struct pair *pair = find_pair(completion->port);
+	const unsigned char *buf = completion->buf;
+	int i;
+
+	assert(completion->op == SP_IO_RING_READ);
+	if (completion->result < 0) {
+		pair->failures++;
+		return;
+	}
+	assert(completion->result <= BUFFER_SIZE);
+	assert(completion->buffer_id < NUM_BUFFERS);
+	for (i = 0; i < completion->result; i++)
+		assert(buf[i] == pair->next++);
+	pair->received += completion->result;
+	if (release)
+		assert(sp_release_io_buffer(ring, completion->buffer_id) == SP_OK);
+}
+
+/* Collect and check completions until every pair has received its data. */
+static void receive_all(struct sp_io_ring *ring, int expected)
+{
+	struct sp_io_completion completions[8];
+	int count, i, done = 0;
+
+	while (!done) {
+		count = sp_io_ring_wait(ring, completions, 8, 5000);
+		assert(count > 0);
+		for (i = 0; i < count; i++)
+			check_read(ring, &completions[i], true);
+		done = 1;
+		for (i = 0; i < NUM_PAIRS; i++)
+			if (pairs[i].port && pairs[i].received < expected)
+				done = 0;
+	}
+}
+
+static void read_master(struct pair *pair, unsigned char *buf, int count)
+{
+	int result, total = 0;
+
+	while (total < count) {
+		result = read(pair->master, buf + total, count - total);
+		assert(result > 0);
+		total += result;
+	}
+}
+
+static void run_tests(enum sp_io_ring_backend backend)
+{
+	struct sp_io_completion completions[NUM_BUFFERS * 2], held[NUM_BUFFERS];
+	struct sp_io_ring *ring;
+	struct sp_io_ring_stats stats;
+	unsigned char buf[16];
+	int count, num_held, total, i, j;
+	int flags;
+
+	printf("Creating ring\n");
+	assert(sp_new_io_ring(backend, NUM_BUFFERS - 1, BUFFER_SIZE, &ring) == SP_OK);
+	assert(sp_get_io_ring_backend(ring) == (int) backend);
+	for (i = 0; i < NUM_PAIRS; i++) {
+		open_pair(&pairs[i]);
+		assert(sp_io_ring_add_port(ring, pairs[i].port) == SP_OK);
+	}
+	assert(sp_io_ring_add_port(ring, pairs[0].port) == SP_ERR_ARG);
+	assert(sp_start_receiver(pairs[0].port, 1024) == SP_ERR_ARG);
+	/* The ring does the reading. */
+	assert(sp_nonblocking_read(pairs[0].port, buf, sizeof(buf)) == SP_ERR_ARG);
+	assert(sp_blocking_read(pairs[0].port, buf, 1, 10) == SP_ERR_ARG);
+	assert(sp_io_ring_wait(ring, completions, 0, 10) == SP_ERR_ARG);
+	assert(sp_release_io_buffer(ring, NUM_BUFFERS) == SP_ERR_ARG);
+	assert(sp_io_ring_wait(ring, completions, NUM_BUFFERS, 10) == 0);
+
+	printf("Reading from %d ports\n", NUM_PAIRS);
+	for (i = 0; i < MESSAGES; i++)
+		for (j = 0; j < NUM_PAIRS; j++)
+			send_bytes(&pairs[j], MESSAGE_SIZE);
+	receive_all(ring, MESSAGES * MESSAGE_SIZE);
+
+	printf("Stopping when out of buffers\n");
+	for (j = 0; j < NUM_PAIRS; j++)
+		send_bytes(&pairs[j], 200);
+	/* Hold on to each buffer until no more data arrives. */
+	num_held = 0;
+	while (num_held < NUM_BUFFERS && (count = sp_io_ring_wait(ring,
+			held + num_held, NUM_BUFFERS - num_held, 100)) > 0) {
+		for (i = num_held; i < num_held + count; i++)
+			check_read(ring, &held[i], false);
+		num_held += count;
+		assert(num_held <= NUM_BUFFERS);
+	}
+	assert(num_held == NUM_BUFFERS);
+	assert(sp_io_ring_wait(ring, completions, NUM_BUFFERS, 100) == 0);
+	for (i = 0; i < num_held; i++)
+		assert(sp_release_io_buffer(ring, held[i].buffer_id) == SP_OK);
+	receive_all(ring, MESSAGES * MESSAGE_SIZE + 200);
+
+	printf("Writing in batches\n");
+	assert(sp_io_ring_write(ring, pairs[0].port, "abc", 3, (void *) 1) == SP_OK);
+	assert(sp_io_ring_write(ring, pairs[1].port, "xyz", 3, (void *) 4) == SP_OK);
+	assert(sp_io_ring_write(ring, pairs[0].port, "defg", 4, (void *) 2) == SP_OK);
+	assert(sp_io_ring_write(ring, pairs[0].port, "hi", 2, (void *) 3) == SP_OK);
+	assert(sp_io_ring_write(ring, pairs[0].port, "x", 0, NULL) == SP_ERR_ARG);
+	assert(sp_io_ring_write(ring, pairs[0].port, NULL, 1, NULL) == SP_ERR_ARG);
+	total = 0;
+	j = 1;
+	while (total < 4) {
+		count = sp_io_ring_wait(ring, completions, NUM_BUFFERS, 5000);
+		assert(count > 0);
+		for (i = 0; i < count; i++) {
+			assert(completions[i].op == SP_IO_RING_WRITE);
+			if (completions[i].port == pairs[1].port) {
+				assert(completions[i].user_data == (void *) 4);
+				assert(completions[i].result == 3);
+			} else {
+				/* Writes to a port complete in order. */
+				assert(completions[i].port == pairs[0].port);
+				assert(completions[i].user_data == (void *) (intptr_t) j++);
+				assert(completions[i].result ==
+					(int) strlen(completions[i].buf));
+			}
+		}
+		total += count;
+	}
+	read_master(&pairs[0], buf, 9);
+	assert(memcmp(buf, "abcdefghi", 9) == 0);
+	read_master(&pairs[1], buf, 3);
+	assert(memcmp(buf, "xyz", 3) == 0);
+
+	printf("Writing more than the port can take\n");
+	for (i = 0; i < LARGE_WRITE; i++)
+		large[i] = (unsigned char) (i * 7);
+	assert(sp_io_ring_write(ring, pairs[2].port, large, LARGE_WRITE, large) == SP_OK);
+	assert(sp_io_ring_submit(ring) == SP_OK);
+	flags = fcntl(pairs[2].master, F_GETFL);
+	assert(fcntl(pairs[2].master, F_SETFL, flags | O_NONBLOCK) == 0);
+	total = 0;
+	count = 0;
+	while (count == 0) {
+		while ((i = read(pairs[2].master, buf, sizeof(buf))) > 0) {
+			for (j = 0; j < i; j++)
+				assert(buf[j] == (unsigned char) ((total + j) * 7));
+			total += i;
+		}
+		count = sp_io_ring_wait(ring, completions, 1, 1);
+		assert(count >= 0);
+	}
+	assert(completions[0].op == SP_IO_RING_WRITE);
+	assert(completions[0].result == LARGE_WRITE);
+	assert(completions[0].user_data == large);
+	assert(fcntl(pairs[2].master, F_SETFL, flags) == 0);
+	read_master(&pairs[2], large, LARGE_WRITE - total);
+
+	printf("Removing ports\n");
+	assert(sp_io_ring_remove_port(ring, pairs[3].port) == SP_OK);
+	assert(sp_io_ring_remove_port(ring, pairs[3].port) == SP_ERR_ARG);
+	assert(sp_io_ring_write(ring, pairs[3].port, "a", 1, NULL) == SP_ERR_ARG);
+	/* Closing a port removes it too. */
+	assert(sp_io_ring_write(ring, pairs[4].port, large, LARGE_WRITE, NULL) == SP_OK);
+	assert(sp_io_ring_submit(ring) == SP_OK);
+	assert(sp_close(pairs[4].port) == SP_OK);
+	sp_free_port(pairs[4].port);
+	pairs[4].port = NULL;
+	send_bytes(&pairs[3], 10);
+	assert(sp_io_ring_wait(ring, completions, NUM_BUFFERS, 100) == 0);
+	assert(sp_nonblocking_read(pairs[3].port, buf, sizeof(buf)) == 10);
+	assert(sp_io_ring_add_port(ring, pairs[3].port) == SP_OK);
+
+	printf("Reporting a hangup\n");
+	close(pairs[5].master);
+	pairs[5].master = -1;
+	while ((count = sp_io_ring_wait(ring, completions, NUM_BUFFERS, 100)) > 0)
+		for (i = 0; i < count; i++)
+			check_read(ring, &completions[i], true);
+	assert(count == 0);
+	assert(pairs[5].failures == 1);
+	for (i = 0; i < NUM_PAIRS; i++)
+		if (i != 5)
+			assert(pairs[i].failures == 0);
+
+	assert(sp_get_io_ring_stats(ring, &stats) == SP_OK);
+	assert(stats.bytes_read == NUM_PAIRS * (MESSAGES * MESSAGE_SIZE + 200));
+	assert(stats.writes == 5);
+	assert(stats.syscalls > 0);
+
+	/* The remaining ports are removed, and stay open. */
+	sp_free_io_ring(ring);
+	assert(sp_nonblocking_read(pairs[0].port, buf, sizeof(buf)) == 0);
+	for (i = 0; i < NUM_PAIRS; i++)
+		close_pair(&pairs[i]);
+}
+
+/* Send as much of the benchmark data as the pseudo-terminal will take. */
+static int send_chunk(struct pair *pair, int sent)
+{
+	int count = BENCHMARK_BYTES - sent, result;
+
+	if (count == 0)
+		return 0;
+	if (count > BENCHMARK_CHUNK)
+		count = BENCHMARK_CHUNK;
+	result = write(pair->master, chunk, count);
+	assert(result > 0 || errno == EAGAIN);
+
+	return result > 0 ? result : 0;
+}
+
+static void benchmark_ring(enum sp_io_ring_backend backend, const char *name)
+{
+	struct sp_io_completion completions[64];
+	struct sp_io_ring_stats stats;
+	struct sp_io_ring *ring;
+	struct pair *pair = &pairs[0];
+	int sent = 0, received = 0, count, i;
+
+	assert(sp_new_io_ring(backend, 64, BENCHMARK_CHUNK, &ring) == SP_OK);
+	open_pair(pair);
+	assert(fcntl(pair->master, F_SETFL, O_NONBLOCK) == 0);
+	assert(sp_io_ring_add_port(ring, pair->port) == SP_OK);
+
+	/*
+	 * The writer runs on this thread, so io_uring mostly posts completions
+	 * while it is in write(), and they are collected without a system call.
+	 */
+	while (received < BENCHMARK_BYTES) {
+		sent += send_chunk(pair, sent);
+		count = sp_io_ring_wait(ring, completions, 64, 5000);
+		assert(count > 0);
+		for (i = 0; i < count; i++) {
+			assert(completions[i].result > 0);
+			received += completions[i].result;
+			assert(sp_release_io_buffer(ring, completions[i].buffer_id) == SP_OK);
+		}
+	}
+
+	assert(sp_get_io_ring_stats(ring, &stats) == SP_OK);
+	printf("%s: %.1f system calls per MB, %llu reads\n", name,
+		(double) stats.syscalls * 1024 * 1024 / received, stats.reads);
+
+	sp_free_io_ring(ring);
+	close_pair(pair);
+}
+
+static void benchmark_blocking(void)
+{
+	struct sp_port_stats stats;
+	struct pair *pair = &pairs[0];
+	unsigned char buf[BENCHMARK_CHUNK];
+	int sent = 0, received = 0, count;
+
+	open_pair(pair);
+	assert(fcntl(pair->master, F_SETFL, O_NONBLOCK) == 0);
+	assert(sp_reset_port_stats(pair->port) == SP_OK);
+
+	while (received < BENCHMARK_BYTES) {
+		sent += send_chunk(pair, sent);
+		count = sp_blocking_read_next(pair->port, buf, sizeof(buf), 5000);
+		assert(count > 0);
+		received += count;
+	}
+
+	assert(sp_get_port_stats(pair->port, &stats) == SP_OK);
+	printf("sp_blocking_read_next(): %.1f system calls per MB, %llu reads\n",
+		(double) (stats.reads + stats.waits) * 1024 * 1024 / received,
+		stats.reads);
+
+	close_pair(pair);
+}
+
+int main(int argc, char *argv[])
+{
+	struct sp_io_ring *ring;
+
+	(void) argc;
+	(void) argv;
+
+	assert(sp_new_io_ring(SP_IO_RING_AUTO, 0, BUFFER_SIZE, &ring) == SP_ERR_ARG);
+	assert(ring == NULL);
+	assert(sp_new_io_ring(SP_IO_RING_AUTO, NUM_BUFFERS, 0, &ring) == SP_ERR_ARG);
+	assert(sp_new_io_ring(SP_IO_RING_AUTO, NUM_BUFFERS, BUFFER_SIZE, NULL) == SP_ERR_ARG);
+
+	printf("Testing the poll() backend\n");
+	run_tests(SP_IO_RING_POLL);
+
+	if (sp_new_io_ring(SP_IO_RING_URING, NUM_BUFFERS, BUFFER_SIZE, &ring) == SP_OK) {
+		sp_free_io_ring(ring);
+		printf("Testing the io_uring backend\n");
+		run_tests(SP_IO_RING_URING);
+	} else {
+		printf("io_uring is not available, skipping its tests\n");
+	}
+
+	printf("Comparing system calls to receive %d bytes\n", BENCHMARK_BYTES);
+	benchmark_blocking();
+	benchmark_ring(SP_IO_RING_POLL, "poll() ring");
+	if (sp_new_io_ring(SP_IO_RING_URING, NUM_BUFFERS, BUFFER_SIZE, &ring) == SP_OK) {
+		sp_free_io_ring(ring);
+		benchmark_ring(SP_IO_RING_URING, "io_uring ring");
+	}
+
+	return 0;
+}
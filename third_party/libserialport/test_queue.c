@@ -0,0 +1,205 @@
+#include "config.h"
+#include "libserialport.h"
+#include "libserialport_internal.h"
+#include "test_util.h"
+#include <assert.h>
+
+/*
+ * Write queue tests, run against a pseudo-terminal.
+ *
+ * More data is queued than the pseudo-terminal will buffer, so that
+ * writev() only completes part of the queue until the master side has
+ * been read.
+ */
+
+#define NUM_BUFS 8
+#define BUF_SIZE 16384
+
+static int master;
+static unsigned char bufs[NUM_BUFS][BUF_SIZE];
+
+struct completion {
+	int calls;
+	size_t written;
+};
+
+static struct completion completions[NUM_BUFS];
+
+static void on_written(struct sp_port *port, const void *buf, size_t written,
+		void *user_data)
+{
+	struct completion *completion = user_data;
+
+	(void) port;
+
+	assert(buf == bufs[completion - completions]);
+	completion->calls++;
+	completion->written = written;
+}
+
+static void queue_all(struct sp_port *port)
+{
+	int i;
+
+	memset(completions, 0, sizeof(completions));
+	for (i = 0; i < NUM_BUFS; i++)
+		assert(sp_queue_write(port, bufs[i], BUF_SIZE, on_written,
+			&completions[i]) == BUF_SIZE);
+}
+
+/* Read everything the master side has received, into buf if not NULL. */
+static size_t read_master(unsigned char *buf, size_t size)
+{
+	unsigned char discard[4096];
+	struct pollfd pollfd;
+	size_t total = 0;
+	ssize_t result;
+
+	pollfd.fd = master;
+	pollfd.events = POLLIN;
+
+	/* Data reaches the master side asynchronously, so allow for a lull. */
+	while (poll(&pollfd, 1, 50) > 0) {
+		if (buf)
+			result = read(master, buf + total, size - total);
+		else
+			result = read(master, discard, sizeof(discard));
+		if (result <= 0)
+			break;
+		total += result;
+	}
+
+	return total;
+}
+
+/* Sum the bytes reported by callbacks, checking none was called twice. */
+static size_t completed_bytes(int *calls)
+{
+	size_t total = 0;
+	int i;
+
+	*calls = 0;
+	for (i = 0; i < NUM_BUFS; i++) {
+		assert(completions[i].calls <= 1);
+		*calls += completions[i].calls;
+		total += completions[i].written;
+	}
+
+	return total;
+}
+
+static void test_partial_writes(void)
+{
+	static unsigned char received[NUM_BUFS * BUF_SIZE];
+	struct sp_port *port;
+	size_t total = 0;
+	int remaining, rounds = 0, calls, i;
+
+	printf("Writing more than the pseudo-terminal buffers\n");
+
+	master = open_pty_port(O_NONBLOCK, &port);
+	assert(sp_set_write_queue_limit(port, 0) == SP_OK);
+	queue_all(port);
+
+	while ((remaining = sp_process_write_queue(port)) > 0) {
+		rounds++;
+		assert(total + remaining <= sizeof(received));
+		total += read_master(received + total, sizeof(received) - total);
+		/* Only buffers written in full have completed, in order. */
+		assert((size_t) remaining + total == sizeof(received));
+		completed_bytes(&calls);
+		for (i = 0; i < NUM_BUFS; i++) {
+			if ((size_t) (i + 1) * BUF_SIZE <= total) {
+				assert(completions[i].calls == 1);
+				assert(completions[i].written == BUF_SIZE);
+			} else {
+				assert(completions[i].calls == 0);
+			}
+		}
+	}
+	assert(remaining == 0);
+	total += read_master(received + total, sizeof(received) - total);
+
+	printf("Written in %d rounds\n", rounds + 1);
+	assert(rounds >= 1);
+	assert(total == sizeof(received));
+	assert(memcmp(received, bufs, sizeof(received)) == 0);
+	assert(completed_bytes(&calls) == sizeof(received));
+	assert(calls == NUM_BUFS);
+
+	close_pty_port(master, port);
+}
+
+static void test_limit(void)
+{
+	struct sp_port *port;
+
+	printf("Refusing buffers at the high-water mark\n");
+
+	master = open_pty_port(O_NONBLOCK, &port);
+	assert(sp_set_write_queue_limit(port, 100) == SP_OK);
+	assert(sp_queue_write(port, bufs[0], 60, NULL, NULL) == 60);
+	assert(sp_queue_write(port, bufs[1], 60, NULL, NULL) == 60);
+	assert(sp_queue_write(port, bufs[2], 1, NULL, NULL) == 0);
+	assert(sp_process_write_queue(port) == 0);
+	assert(read_master(NULL, 0) == 120);
+	assert(sp_queue_write(port, bufs[2], 1, NULL, NULL) == 1);
+	assert(sp_process_write_queue(port) == 0);
+	assert(read_master(NULL, 0) == 1);
+
+	close_pty_port(master, port);
+}
+
+static void test_discard(int by_free)
+{
+	struct sp_port *port;
+	size_t total;
+	int calls;
+
+	printf("Discarding the queue when %s the port\n",
+		by_free ? "freeing" : "closing");
+
+	master = open_pty_port(O_NONBLOCK, &port);
+	assert(sp_set_write_queue_limit(port, 0) == SP_OK);
+	queue_all(port);
+	assert(sp_process_write_queue(port) > 0);
+	total = read_master(NULL, 0);
+	completed_bytes(&calls);
+	assert(calls < NUM_BUFS);
+
+	if (by_free)
+		sp_free_port(port);
+	else
+		assert(sp_close(port) == SP_OK);
+
+	/* Every callback has run once, with the bytes actually written. */
+	assert(completed_bytes(&calls) == total);
+	assert(calls == NUM_BUFS);
+
+	if (!by_free) {
+		/* Nothing is left to discard. */
+		memset(completions, 0, sizeof(completions));
+		sp_free_port(port);
+		assert(completed_bytes(&calls) == 0 && calls == 0);
+	}
+
+	close(master);
+}
+
+int main(int argc, char *argv[])
+{
+	(void) argc;
+	(void) argv;
+	int i, j;
+
+	for (i = 0; i < NUM_BUFS; i++)
+		for (j = 0; j < BUF_SIZE; j++)
+			bufs[i][j] = (unsigned char) (i * 31 + j);
+
+	test_partial_writes();
+	test_limit();
+	test_discard(0);
+	test_discard(1);
+
+	return 0;
+}
@@ -0,0 +1,319 @@
+#include "config.h"
+#include "libserialport.h"
+#include "libserialport_internal.h"
+#include "test_util.h"
+#include <assert.h>
+
+/*
+ * Reactor tests, run against pseudo-terminal pairs. The test writes to the
+ * master side of each pair, and the reactor's callbacks read from the
+ * ports opened on the slave side.
+ */
+
+#define NUM_PAIRS 64
+#define NUM_WORKERS 4
+#define MESSAGES 20
+#define MESSAGE_SIZE 32
+#define BENCHMARK_PAIRS 100
+#define BENCHMARK_MESSAGES 200
+
+enum mode {
+	/* Read and check the data. */
+	MODE_COUNT,
+	/* Sleep in the callback when a 'b' arrives. */
+	MODE_BLOCK,
+	/* Remove the port from within its callback. */
+	MODE_REMOVE,
+	/* Switch to waiting for TX_READY, then back. */
+	MODE_TX,
+	/* Remove the victim port from within this port's callback. */
+	MODE_REMOVE_OTHER,
+};
+
+struct pair {
+	int master;
+	struct sp_port *port;
+	enum mode mode;
+	struct sp_reactor *reactor;
+	unsigned char next;
+	int received;
+	int calls;
+	int running;
+	int errors;
+	int tx_ready;
+	int bad;
+	struct pair *victim;
+	int victim_removed;
+	int victim_running;
+};
+
+static struct pair pairs[BENCHMARK_PAIRS];
+
+static void open_pair(struct pair *pair, enum mode mode)
+{
+	memset(pair, 0, sizeof(*pair));
+	pair->mode = mode;
+	pair->master = open_pty_port(0, &pair->port);
+}
+
+static void close_pair(struct pair *pair)
+{
+	close_pty_port(pair->master, pair->port);
+}
+
+static int load(int *var)
+{
+	return __atomic_load_n(var, __ATOMIC_ACQUIRE);
+}
+
+/* Wait up to five seconds for a counter to reach a value. */
+static void wait_for(int *var, int value)
+{
+	int i;
+
+	for (i = 0; i < 5000 && load(var) < value; i++)
+		sleep_ms(1);
+	assert(load(var) >= value);
+}
+
+static void callback(struct sp_port *port, enum sp_event events, void *user_data)
+{
+	struct pair *pair = user_data;
+	unsigned char buf[256];
+	int count, i;
+
+	assert(port == pair->port);
+
+	/* The reactor must never run two callbacks for a port at once. */
+	if (__atomic_add_fetch(&pair->running, 1, __ATOMIC_SEQ_CST) != 1)
+		pair->bad = 1;
+
+	__atomic_add_fetch(&pair->calls, 1, __ATOMIC_RELEASE);
+
+	if (events & SP_EVENT_ERROR)
+		__atomic_add_fetch(&pair->errors, 1, __ATOMIC_RELEASE);
+
+	if (events & SP_EVENT_TX_READY) {
+		__atomic_add_fetch(&pair->tx_ready, 1, __ATOMIC_RELEASE);
+		assert(sp_reactor_modify_port(pair->reactor, port, SP_EVENT_RX_READY) == SP_OK);
+	}
+
+	if (events & SP_EVENT_RX_READY) {
+		while ((count = sp_nonblocking_read(port, buf, sizeof(buf))) > 0) {
+			for (i = 0; i < count; i++) {
+				if (pair->mode == MODE_BLOCK && buf[i] == 'b')
+					sleep_ms(100);
+				else if (pair->mode == MODE_BLOCK && buf[i] == 's')
+					sleep_ms(50);
+				else if (pair->mode == MODE_COUNT && buf[i] != pair->next++)
+					pair->bad = 1;
+			}
+			__atomic_add_fetch(&pair->received, count, __ATOMIC_RELEASE);
+		}
+		if (pair->mode == MODE_REMOVE)
+			assert(sp_reactor_remove_port(pair->reactor, port) == SP_OK);
+		if (pair->mode == MODE_TX)
+			assert(sp_reactor_modify_port(pair->reactor, port,
+				SP_EVENT_TX_READY) == SP_OK);
+		if (pair->mode == MODE_REMOVE_OTHER && !pair->victim_removed) {
+			assert(sp_reactor_remove_port(pair->reactor,
+				pair->victim->port) == SP_OK);
+			pair->victim_running = load(&pair->victim->running);
+			__atomic_store_n(&pair->victim_removed, 1, __ATOMIC_RELEASE);
+		}
+	}
+
+	__atomic_sub_fetch(&pair->running, 1, __ATOMIC_SEQ_CST);
+}
+
+static void write_messages(int num_pairs, int messages)
+{
+	unsigned char buf[MESSAGE_SIZE];
+	int i, j, k;
+
+	for (i = 0; i < messages; i++) {
+		for (j = 0; j < num_pairs; j++) {
+			for (k = 0; k < MESSAGE_SIZE; k++)
+				buf[k] = (unsigned char) (i * MESSAGE_SIZE + k);
+			assert(write(pairs[j].master, buf, sizeof(buf)) == sizeof(buf));
+		}
+	}
+}
+
+static void benchmark(unsigned int workers)
+{
+	struct sp_reactor *reactor;
+	unsigned long long start, elapsed;
+	int i;
+
+	assert(sp_new_reactor(workers, &reactor) == SP_OK);
+	for (i = 0; i < BENCHMARK_PAIRS; i++) {
+		open_pair(&pairs[i], MODE_COUNT);
+		assert(sp_reactor_add_port(reactor, pairs[i].port, SP_EVENT_RX_READY,
+			callback, &pairs[i]) == SP_OK);
+	}
+
+	start = now_ns();
+	write_messages(BENCHMARK_PAIRS, BENCHMARK_MESSAGES);
+	for (i = 0; i < BENCHMARK_PAIRS; i++)
+		wait_for(&pairs[i].received, BENCHMARK_MESSAGES * MESSAGE_SIZE);
+	elapsed = now_ns() - start;
+
+	for (i = 0; i < BENCHMARK_PAIRS; i++) {
+		assert(!pairs[i].bad);
+		close_pair(&pairs[i]);
+	}
+	sp_free_reactor(reactor);
+
+	printf("%u workers: %llu messages per second over %d ports\n", workers,
+		(unsigned long long) BENCHMARK_PAIRS * BENCHMARK_MESSAGES * 1000000000 / elapsed,
+		BENCHMARK_PAIRS);
+}
+
+int main(int argc, char *argv[])
+{
+	(void) argc;
+	(void) argv;
+	struct sp_reactor *reactor;
+	struct sp_reactor_stats stats;
+	int i, calls;
+
+	printf("Checking arguments\n");
+	assert(sp_new_reactor(1, NULL) == SP_ERR_ARG);
+	assert(sp_new_reactor(0, &reactor) == SP_OK);
+	assert(sp_get_reactor_workers(reactor) == sysconf(_SC_NPROCESSORS_ONLN));
+	sp_free_reactor(reactor);
+
+	assert(sp_new_reactor(NUM_WORKERS, &reactor) == SP_OK);
+	assert(sp_get_reactor_workers(reactor) == NUM_WORKERS);
+	assert(sp_set_reactor_affinity(reactor, 0, 0) == SP_OK);
+	assert(sp_set_reactor_affinity(reactor, 0, -1) == SP_OK);
+	assert(sp_set_reactor_affinity(reactor, NUM_WORKERS, 0) == SP_ERR_ARG);
+	assert(sp_get_reactor_stats(reactor, NUM_WORKERS, &stats) == SP_ERR_ARG);
+
+	printf("Reading from %d ports with %d workers\n", NUM_PAIRS, NUM_WORKERS);
+	for (i = 0; i < NUM_PAIRS; i++) {
+		open_pair(&pairs[i], MODE_COUNT);
+		pairs[i].reactor = reactor;
+		assert(sp_reactor_add_port(reactor, pairs[i].port, SP_EVENT_RX_READY,
+			callback, &pairs[i]) == SP_OK);
+	}
+	assert(sp_reactor_add_port(reactor, pairs[0].port, SP_EVENT_RX_READY,
+		callback, &pairs[0]) == SP_ERR_ARG);
+	assert(sp_reactor_add_port(reactor, pairs[0].port, 8, callback, NULL) == SP_ERR_ARG);
+	assert(sp_start_receiver(pairs[0].port, 64) == SP_ERR_ARG);
+	for (i = 0; i < NUM_WORKERS; i++) {
+		assert(sp_get_reactor_stats(reactor, i, &stats) == SP_OK);
+		assert(stats.ports == NUM_PAIRS / NUM_WORKERS);
+	}
+
+	write_messages(NUM_PAIRS, MESSAGES);
+	for (i = 0; i < NUM_PAIRS; i++)
+		wait_for(&pairs[i].received, MESSAGES * MESSAGE_SIZE);
+	for (i = 0; i < NUM_PAIRS; i++) {
+		assert(!pairs[i].bad);
+		assert(pairs[i].received == MESSAGES * MESSAGE_SIZE);
+	}
+	for (i = 0, calls = 0; i < NUM_WORKERS; i++) {
+		assert(sp_get_reactor_stats(reactor, i, &stats) == SP_OK);
+		calls += (int) stats.dispatched;
+	}
+	for (i = 0; i < NUM_PAIRS; i++)
+		calls -= pairs[i].calls;
+	assert(calls == 0);
+
+	printf("Switching to TX_READY and back\n");
+	pairs[1].mode = MODE_TX;
+	assert(write(pairs[1].master, "t", 1) == 1);
+	wait_for(&pairs[1].tx_ready, 1);
+	pairs[1].mode = MODE_COUNT;
+	pairs[1].next = 't';
+	assert(write(pairs[1].master, "t", 1) == 1);
+	wait_for(&pairs[1].received, MESSAGES * MESSAGE_SIZE + 2);
+	sleep_ms(20);
+	assert(pairs[1].tx_ready == 1);
+
+	printf("Removing a port from its callback\n");
+	pairs[2].mode = MODE_REMOVE;
+	calls = pairs[2].calls;
+	assert(write(pairs[2].master, "r", 1) == 1);
+	wait_for(&pairs[2].calls, calls + 1);
+	assert(write(pairs[2].master, "r", 1) == 1);
+	sleep_ms(20);
+	assert(pairs[2].calls == calls + 1);
+	assert(sp_reactor_remove_port(reactor, pairs[2].port) == SP_ERR_ARG);
+
+	printf("Removing a port while its callback runs\n");
+	pairs[3].mode = MODE_BLOCK;
+	calls = pairs[3].calls;
+	assert(write(pairs[3].master, "b", 1) == 1);
+	wait_for(&pairs[3].calls, calls + 1);
+	assert(sp_reactor_remove_port(reactor, pairs[3].port) == SP_OK);
+	assert(load(&pairs[3].running) == 0);
+	assert(pairs[3].received == MESSAGES * MESSAGE_SIZE + 1);
+
+	printf("Removing a port from another port's callback\n");
+	/* Ports are dealt out in turn, so these have workers of their own. */
+	pairs[6].mode = MODE_BLOCK;
+	pairs[7].mode = MODE_REMOVE_OTHER;
+	pairs[7].victim = &pairs[6];
+	assert(write(pairs[6].master, "b", 1) == 1);
+	wait_for(&pairs[6].running, 1);
+	assert(write(pairs[7].master, "x", 1) == 1);
+	wait_for(&pairs[7].victim_removed, 1);
+	/* The removal waited for the victim's callback to return. */
+	assert(pairs[7].victim_running == 0);
+	assert(pairs[6].received == MESSAGES * MESSAGE_SIZE + 1);
+
+	printf("Reporting a hang-up once\n");
+	calls = pairs[4].calls;
+	close(pairs[4].master);
+	pairs[4].master = -1;
+	wait_for(&pairs[4].errors, 1);
+	sleep_ms(20);
+	assert(pairs[4].errors == 1);
+	assert(pairs[4].calls == calls + 1);
+
+	/* Closing a port removes it; the rest are removed by the reactor. */
+	assert(sp_close(pairs[5].port) == SP_OK);
+	assert(sp_reactor_modify_port(reactor, pairs[5].port, 0) == SP_ERR_ARG);
+	assert(sp_open(pairs[5].port, SP_MODE_READ_WRITE) == SP_OK);
+	sp_free_reactor(reactor);
+	for (i = 0; i < NUM_PAIRS; i++)
+		close_pair(&pairs[i]);
+
+	printf("Stealing queued ports from a busy worker\n");
+	assert(sp_new_reactor(2, &reactor) == SP_OK);
+	/* Ports alternate between workers; leave the first worker with three. */
+	for (i = 0; i < 6; i++) {
+		open_pair(&pairs[i], MODE_BLOCK);
+		pairs[i].reactor = reactor;
+		assert(sp_reactor_add_port(reactor, pairs[i].port, SP_EVENT_RX_READY,
+			callback, &pairs[i]) == SP_OK);
+	}
+	for (i = 1; i < 6; i += 2)
+		assert(sp_reactor_remove_port(reactor, pairs[i].port) == SP_OK);
+	assert(sp_get_reactor_stats(reactor, 0, &stats) == SP_OK);
+	assert(stats.ports == 3);
+	/* Keep the first worker busy while two more of its ports become ready. */
+	assert(write(pairs[0].master, "b", 1) == 1);
+	wait_for(&pairs[0].running, 1);
+	assert(write(pairs[2].master, "s", 1) == 1);
+	assert(write(pairs[4].master, "s", 1) == 1);
+	wait_for(&pairs[2].received, 1);
+	wait_for(&pairs[4].received, 1);
+	assert(sp_get_reactor_stats(reactor, 1, &stats) == SP_OK);
+	printf("Second worker ran %llu callbacks, stole %llu\n",
+		stats.dispatched, stats.stolen);
+	assert(stats.stolen == 1);
+	sp_free_reactor(reactor);
+	for (i = 0; i < 6; i++)
+		close_pair(&pairs[i]);
+
+	printf("Comparing throughput\n");
+	benchmark(1);
+	benchmark(2);
+	benchmark(4);
+
+	return 0;
+}
@@ -0,0 +1,192 @@
+#include "config.h"
+#include "libserialport.h"
+#include "libserialport_internal.h"
+#include "test_util.h"
+#include <assert.h>
+#include <pthread.h>
+
+/*
+ * Receive engine tests, run against a pseudo-terminal.
+ *
+ * A small ring is used, so that wrap-around and overflow are easy to
+ * reach by writing to the master side.
+ */
+
+#define RING_SIZE 16
+
+static int master;
+
+/* Wait until the reader thread has taken in the given number of bytes. */
+static void wait_taken(struct sp_port *port, unsigned long long count)
+{
+	struct sp_receiver_stats stats;
+	int i;
+
+	for (i = 0; i < 1000; i++) {
+		assert(sp_get_receiver_stats(port, &stats) == SP_OK);
+		if (stats.received + stats.dropped >= count)
+			return;
+		sleep_ms(1);
+	}
+	assert(!"Receiver did not take in the data");
+}
+
+static void test_wrap_around(void)
+{
+	struct sp_port *port;
+	struct sp_timestamp timestamp;
+	const void *span;
+	unsigned char data[10];
+	int i;
+
+	printf("Receiving across the end of the ring\n");
+
+	master = open_pty_port(0, &port);
+	assert(sp_start_receiver(port, RING_SIZE - 3) == SP_OK);
+
+	/* The reader thread owns the port's data. */
+	assert(sp_blocking_read(port, data, 1, 10) == SP_ERR_ARG);
+	assert(sp_blocking_read_next(port, data, 1, 10) == SP_ERR_ARG);
+	assert(sp_nonblocking_read(port, data, 1) == SP_ERR_ARG);
+	assert(sp_blocking_read_until(port, data, 1, '\n', 10) == SP_ERR_ARG);
+	assert(sp_read_timestamped(port, data, 1, 10, &timestamp) == SP_ERR_ARG);
+
+	for (i = 0; i < 10; i++)
+		data[i] = (unsigned char) i;
+	assert(write(master, data, 10) == 10);
+	wait_taken(port, 10);
+	assert(sp_acquire_received(port, &span, 100) == 10);
+	assert(memcmp(span, data, 10) == 0);
+	assert(sp_release_received(port, 10) == SP_OK);
+
+	/* The next 10 bytes run from offset 10 over the end to offset 4. */
+	for (i = 0; i < 10; i++)
+		data[i] = (unsigned char) (10 + i);
+	assert(write(master, data, 10) == 10);
+	wait_taken(port, 20);
+	assert(sp_received_waiting(port) == 10);
+	assert(sp_acquire_received(port, &span, 100) == RING_SIZE - 10);
+	assert(memcmp(span, data, RING_SIZE - 10) == 0);
+	assert(sp_release_received(port, RING_SIZE - 10) == SP_OK);
+	assert(sp_acquire_received(port, &span, 100) == 4);
+	assert(memcmp(span, data + RING_SIZE - 10, 4) == 0);
+	assert(sp_release_received(port, 5) == SP_ERR_ARG);
+	assert(sp_release_received(port, 4) == SP_OK);
+	assert(sp_received_waiting(port) == 0);
+
+	close_pty_port(master, port);
+}
+
+static void test_overflow(void)
+{
+	struct sp_port *port;
+	struct sp_receiver_stats stats;
+	unsigned char data[40];
+	const void *span;
+
+	printf("Discarding data when the ring is full\n");
+
+	master = open_pty_port(0, &port);
+	assert(sp_start_receiver(port, RING_SIZE) == SP_OK);
+
+	memset(data, 'a', sizeof(data));
+	assert(write(master, data, sizeof(data)) == sizeof(data));
+	wait_taken(port, sizeof(data));
+	assert(sp_get_receiver_stats(port, &stats) == SP_OK);
+	printf("%llu received, %llu dropped, %u overflows\n",
+		stats.received, stats.dropped, stats.overflows);
+	assert(stats.received == RING_SIZE);
+	assert(stats.dropped == sizeof(data) - RING_SIZE);
+	assert(stats.overflows == 1);
+
+	/* Make room, then overflow again. */
+	assert(sp_acquire_received(port, &span, 100) == RING_SIZE);
+	assert(sp_release_received(port, 8) == SP_OK);
+	assert(write(master, data, 20) == 20);
+	wait_taken(port, sizeof(data) + 20);
+	assert(sp_get_receiver_stats(port, &stats) == SP_OK);
+	assert(stats.received == RING_SIZE + 8);
+	assert(stats.dropped == sizeof(data) - RING_SIZE + 12);
+	assert(stats.overflows == 2);
+	assert(sp_received_waiting(port) == RING_SIZE);
+
+	close_pty_port(master, port);
+}
+
+static void test_error_after_data(void)
+{
+	struct sp_port *port;
+	const void *span;
+
+	printf("Reporting a hangup after the data before it\n");
+
+	master = open_pty_port(0, &port);
+	assert(sp_start_receiver(port, RING_SIZE) == SP_OK);
+
+	assert(write(master, "bye", 3) == 3);
+	wait_taken(port, 3);
+	close(master);
+
+	assert(sp_acquire_received(port, &span, 100) == 3);
+	assert(memcmp(span, "bye", 3) == 0);
+	/* Until released, the data is still returned. */
+	assert(sp_acquire_received(port, &span, 100) == 3);
+	assert(sp_release_received(port, 3) == SP_OK);
+	assert(sp_acquire_received(port, &span, 1000) == SP_ERR_FAIL);
+	printf("Error: %s\n", sp_last_error_message());
+	assert(span == NULL);
+
+	assert(sp_close(port) == SP_OK);
+	sp_free_port(port);
+}
+
+static void *consumer_thread(void *arg)
+{
+	struct sp_port *port = arg;
+	const void *span;
+
+	return (void *) (intptr_t) sp_acquire_received(port, &span, 0);
+}
+
+static void test_stop_while_waiting(int by_close)
+{
+	struct sp_port *port;
+	pthread_t consumer;
+	void *result;
+
+	printf("%s the port while a consumer waits\n",
+		by_close ? "Closing" : "Stopping the receiver on");
+
+	master = open_pty_port(0, &port);
+	assert(sp_start_receiver(port, RING_SIZE) == SP_OK);
+
+	assert(pthread_create(&consumer, NULL, consumer_thread, port) == 0);
+	sleep_ms(20);
+
+	if (by_close) {
+		assert(sp_close(port) == SP_OK);
+	} else {
+		assert(sp_stop_receiver(port) == SP_OK);
+		assert(sp_stop_receiver(port) == SP_ERR_ARG);
+	}
+
+	assert(pthread_join(consumer, &result) == 0);
+	assert((intptr_t) result == SP_ERR_ARG);
+
+	if (!by_close)
+		close_pty_port(master, port);
+}
+
+int main(int argc, char *argv[])
+{
+	(void) argc;
+	(void) argv;
+
+	test_wrap_around();
+	test_overflow();
+	test_error_after_data();
+	test_stop_while_waiting(0);
+	test_stop_while_waiting(1);
+
+	return 0;
+}
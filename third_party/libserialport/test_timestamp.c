@@ -0,0 +1,113 @@
+#include "config.h"
+#include "libserialport.h"
+#include "libserialport_internal.h"
+#include "test_util.h"
+#include <assert.h>
+#include <pthread.h>
+
+/*
+ * Timestamped read tests, run against a pseudo-terminal.
+ *
+ * A writer thread injects chunks into the master side at recorded times,
+ * and the reader checks the timestamps of the chunks it receives against
+ * them.
+ */
+
+#define NUM_CHUNKS 50
+#define CHUNK_SIZE 8
+#define INTERVAL_MS 5
+
+/* Generous, so that the test passes on loaded machines. */
+#define MAX_LATENCY_NS 50000000ULL
+
+static int master;
+static unsigned long long write_times[NUM_CHUNKS];
+
+static void *writer_thread(void *arg)
+{
+	unsigned char chunk[CHUNK_SIZE];
+	struct timespec interval;
+	int i, j;
+
+	(void) arg;
+
+	interval.tv_sec = 0;
+	interval.tv_nsec = INTERVAL_MS * 1000000;
+
+	for (i = 0; i < NUM_CHUNKS; i++) {
+		nanosleep(&interval, NULL);
+		for (j = 0; j < CHUNK_SIZE; j++)
+			chunk[j] = (unsigned char) (i * CHUNK_SIZE + j);
+		write_times[i] = now_ns();
+		assert(write(master, chunk, sizeof(chunk)) == sizeof(chunk));
+	}
+
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	(void) argc;
+	(void) argv;
+	struct sp_port *port;
+	struct sp_timestamp timestamp;
+	unsigned char buf[NUM_CHUNKS * CHUNK_SIZE];
+	unsigned long long latency, max_latency = 0, total_latency = 0;
+	unsigned long long offset = 0, first_byte;
+	pthread_t writer;
+	int result, i, chunks = 0;
+
+	master = open_pty_port(0, &port);
+	printf("Opened %s\n", sp_get_port_name(port));
+	assert(sp_set_baudrate(port, 115200) == SP_OK);
+	assert(sp_set_bits(port, 8) == SP_OK);
+	assert(sp_set_parity(port, SP_PARITY_NONE) == SP_OK);
+	assert(sp_set_stopbits(port, 1) == SP_OK);
+
+	printf("Timing out with no data\n");
+	assert(sp_read_timestamped(port, buf, sizeof(buf), 10, &timestamp) == 0);
+	assert(sp_read_timestamped(port, buf, sizeof(buf), 10, NULL) == SP_ERR_ARG);
+
+	printf("Reading %d chunks at %d ms intervals\n", NUM_CHUNKS, INTERVAL_MS);
+	assert(pthread_create(&writer, NULL, writer_thread, NULL) == 0);
+
+	while (offset < sizeof(buf)) {
+		result = sp_read_timestamped(port, buf + offset, sizeof(buf) - offset,
+			1000, &timestamp);
+		assert(result > 0);
+		assert(timestamp.offset == offset);
+		assert(timestamp.count == (size_t) result);
+		/* 10 bits per character at 115200 baud. */
+		assert(timestamp.byte_time_ns == 86805);
+
+		/* The chunk holding the end of a write cannot predate it. */
+		i = (int) ((offset + result - 1) / CHUNK_SIZE);
+		assert(timestamp.time_ns >= write_times[i]);
+		latency = timestamp.time_ns - write_times[i];
+		assert(latency < MAX_LATENCY_NS);
+		if (latency > max_latency)
+			max_latency = latency;
+		total_latency += latency;
+
+		assert(sp_get_byte_timestamp(&timestamp, result - 1, &first_byte) == SP_OK);
+		assert(first_byte == timestamp.time_ns);
+		assert(sp_get_byte_timestamp(&timestamp, 0, &first_byte) == SP_OK);
+		assert(first_byte == timestamp.time_ns - (result - 1) * 86805ULL);
+		assert(sp_get_byte_timestamp(&timestamp, result, &first_byte) == SP_ERR_ARG);
+
+		offset += result;
+		chunks++;
+	}
+
+	assert(pthread_join(writer, NULL) == 0);
+
+	for (i = 0; i < (int) sizeof(buf); i++)
+		assert(buf[i] == (unsigned char) i);
+
+	printf("Received %d chunks, latency %llu us average, %llu us maximum\n",
+		chunks, total_latency / chunks / 1000, max_latency / 1000);
+
+	close_pty_port(master, port);
+
+	return 0;
+}
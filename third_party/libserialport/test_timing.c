@@ -4,12 +4,56 @@
 #include <assert.h>
 #include <unistd.h>
 
+/*
+ * Wait out sub-millisecond timeouts the way the blocking calls do, and
+ * report how far past each deadline the wait actually ended.
+ */
+static void benchmark_timeouts(uint64_t timeout_ns, int repeats)
+{
+	struct time start, end, elapsed;
+	struct timeout to;
+	uint64_t ns, min = UINT64_MAX, max = 0, total = 0;
+	int i;
+
+	for (i = 0; i < repeats; i++) {
+		time_get(&start);
+		timeout_start_ns(&to, timeout_ns);
+		while (1) {
+			if (timeout_check(&to))
+				break;
+#ifdef HAVE_PPOLL
+			ppoll(NULL, 0, timeout_timespec(&to), NULL);
+#else
+			nanosleep(timeout_timespec(&to), NULL);
+#endif
+			timeout_update(&to);
+		}
+		time_get(&end);
+		time_sub(&end, &start, &elapsed);
+		ns = time_as_ns(&elapsed);
+		/* A timeout must never end early. */
+		assert(ns >= timeout_ns);
+		ns -= timeout_ns;
+		if (ns < min)
+			min = ns;
+		if (ns > max)
+			max = ns;
+		total += ns;
+	}
+
+	printf("%7lluns timeout: overshoot %lluus min, %lluus avg, %lluus max\n",
+		(unsigned long long) timeout_ns, (unsigned long long) min / 1000,
+		(unsigned long long) total / repeats / 1000,
+		(unsigned long long) max / 1000);
+}
+
 int main(int argc, char *argv[])
 {
 	(void) argc;
 	(void) argv;
 	struct time a, b, c;
 	struct timeval tv;
+	struct timespec *ts;
 	struct timeout to;
 
 	printf("Testing arithmetic\n");
@@ -24,6 +68,21 @@ int main(int argc, char *argv[])
 	time_as_timeval(&a, &tv);
 	assert(tv.tv_sec == 10);
 	assert(tv.tv_usec == 50000);
+	time_set_ns(&a, 1500000250ULL);
+	assert(time_as_ns(&a) == 1500000250ULL);
+	assert(time_as_ms(&a) == 1500);
+	time_set_ns(&b, 250);
+	time_sub(&a, &b, &c);
+	assert(time_as_ns(&c) == 1500000000ULL);
+	time_sub(&b, &a, &c);
+	assert(time_as_ns(&c) == 0);
+	printf("Testing sub-millisecond timeouts\n");
+	timeout_start_ns(&to, 250000);
+	assert((ts = timeout_timespec(&to)));
+	assert(ts->tv_sec == 0 && ts->tv_nsec == 250000);
+	assert(timeout_remaining_ms(&to) == 1);
+	timeout_start_ns(&to, 0);
+	assert(!timeout_timespec(&to));
 	time_get(&a);
 	printf("Sleeping for 1s\n");
 	sleep(1);
@@ -64,6 +123,11 @@ int main(int argc, char *argv[])
 	timeout_update(&to);
 	assert(timeout_check(&to));
 	printf("Timeout expired\n");
+	printf("Measuring timeout precision\n");
+	benchmark_timeouts(50000, 200);
+	benchmark_timeouts(250000, 200);
+	benchmark_timeouts(1000000, 100);
+	benchmark_timeouts(5000000, 20);
 
 	return 0;
 }
@@ -0,0 +1,241 @@
+#include "config.h"
+#include "libserialport.h"
+#include "libserialport_internal.h"
+#include "test_util.h"
+#include <assert.h>
+#include <pthread.h>
+
+/*
+ * Trace ring tests, and a comparison of the cost of tracing in each mode.
+ *
+ * The library is linked with -Wl,--wrap for calloc and free, so that the
+ * rings still allocated can be counted.
+ */
+
+#define NUM_THREADS 4
+#define EVENTS_PER_THREAD 1000
+#define BENCHMARK_CALLS 100000
+
+/* Allocations at least this large are rings of EVENTS_PER_THREAD events. */
+#define RING_BYTES (EVENTS_PER_THREAD * sizeof(struct sp_trace_event))
+
+static char message[256];
+
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static void *rings[NUM_THREADS];
+static int live_rings;
+
+void *__real_calloc(size_t nmemb, size_t size);
+void __real_free(void *ptr);
+
+void *__wrap_calloc(size_t nmemb, size_t size);
+void __wrap_free(void *ptr);
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+	void *ptr = __real_calloc(nmemb, size);
+	int i;
+
+	if (ptr && nmemb == 1 && size >= RING_BYTES) {
+		pthread_mutex_lock(&rings_lock);
+		for (i = 0; rings[i]; i++)
+			assert(i < NUM_THREADS - 1);
+		rings[i] = ptr;
+		live_rings++;
+		pthread_mutex_unlock(&rings_lock);
+	}
+
+	return ptr;
+}
+
+void __wrap_free(void *ptr)
+{
+	int i;
+
+	pthread_mutex_lock(&rings_lock);
+	for (i = 0; i < NUM_THREADS; i++) {
+		if (ptr && rings[i] == ptr) {
+			rings[i] = NULL;
+			live_rings--;
+		}
+	}
+	pthread_mutex_unlock(&rings_lock);
+
+	__real_free(ptr);
+}
+
+static void format_handler(const char *format, ...)
+{
+	va_list args;
+
+	va_start(args, format);
+	vsnprintf(message, sizeof(message), format, args);
+	va_end(args);
+}
+
+static void format_event(const struct sp_trace_event *event)
+{
+	assert(sp_format_trace_event(event, message, sizeof(message)) == SP_OK);
+	printf("[%llu] %s\n", event->thread, message);
+}
+
+static void *recorder_thread(void *arg)
+{
+	int i;
+
+	(void) arg;
+
+	for (i = 0; i < EVENTS_PER_THREAD; i++)
+		trace_record("event %d", i);
+
+	return NULL;
+}
+
+static void benchmark(const char *mode)
+{
+	unsigned long long start;
+	int i;
+
+	start = now_ns();
+	for (i = 0; i < BENCHMARK_CALLS; i++)
+		assert(sp_set_write_queue_limit(NULL, 0) == SP_ERR_ARG);
+	printf("%s: %llu ns per call\n", mode, (now_ns() - start) / BENCHMARK_CALLS);
+}
+
+int main(int argc, char *argv[])
+{
+	(void) argc;
+	(void) argv;
+	struct sp_trace_event events[NUM_THREADS * EVENTS_PER_THREAD + 1];
+	int next[NUM_THREADS + 1] = {0};
+	char small[8];
+	pthread_t threads[NUM_THREADS];
+	int count, total, i, value;
+
+	/* The default handler checks this on its first message. */
+	assert(setenv("LIBSERIALPORT_DEBUG", "1", 1) == 0);
+	sp_set_debug_handler(NULL);
+
+	printf("Checking arguments\n");
+	assert(sp_start_trace(0) == SP_ERR_ARG);
+	assert(sp_read_trace(NULL, 1) == SP_ERR_ARG);
+	assert(sp_read_trace(events, 1) == 0);
+
+	printf("Recording library calls\n");
+	assert(sp_start_trace(16) == SP_OK);
+	assert(sp_set_write_queue_limit(NULL, 5) == SP_ERR_ARG);
+	assert(sp_stop_trace() == SP_OK);
+	/* Not recorded once tracing has stopped. */
+	assert(sp_set_write_queue_limit(NULL, 6) == SP_ERR_ARG);
+	count = sp_read_trace(events, 16);
+	/* The start call's return, the traced call and error, the stop call. */
+	assert(count == 4);
+	for (i = 0; i < count; i++)
+		format_event(&events[i]);
+	assert(sp_format_trace_event(&events[1], message, sizeof(message)) == SP_OK);
+	assert(strcmp(message, "sp_set_write_queue_limit((nil), 5) called") == 0);
+	assert(sp_format_trace_event(&events[2], message, sizeof(message)) == SP_OK);
+	assert(strcmp(message,
+		"sp_set_write_queue_limit returning SP_ERR_ARG: Null port") == 0);
+	assert(events[1].time_ns <= events[2].time_ns);
+	assert(events[1].thread == events[2].thread);
+	assert(sp_read_trace(events, 16) == 0);
+
+	printf("Formatting arguments\n");
+	assert(sp_start_trace(16) == SP_OK);
+	trace_record("%s=%d %.*s|%5.1f%% %llu", "name", -5, 3, "abcdef",
+		2.5, 12345678901ULL);
+	trace_record("%04x %p %s %c", 255u, (void *) NULL, (char *) NULL, 'z');
+	trace_record("%s %s %s", "a string which fills most of the space",
+		"truncated", "empty");
+	trace_record("%d %d %d %d %d %d %d", 1, 2, 3, 4, 5, 6, 7);
+	assert(sp_stop_trace() == SP_OK);
+	assert(sp_read_trace(events, 16) == 6);
+	format_event(&events[1]);
+	assert(strcmp(message, "name=-5 abc|  2.5% 12345678901") == 0);
+	format_event(&events[2]);
+	assert(strcmp(message, "00ff (nil) (null) z") == 0);
+	format_event(&events[3]);
+	assert(strcmp(message, "a string which fills most of the space truncat ") == 0);
+	/* Conversions beyond the recorded arguments are dropped. */
+	format_event(&events[4]);
+	assert(strcmp(message, "1 2 3 4 5 6 ") == 0);
+	assert(sp_format_trace_event(&events[1], small, sizeof(small)) == SP_OK);
+	assert(strcmp(small, "name=-5") == 0);
+	assert(sp_format_trace_event(&events[1], small, 0) == SP_ERR_ARG);
+
+	printf("Overwriting the oldest events\n");
+	/* This thread's ring keeps the size it was first given. */
+	assert(sp_start_trace(3) == SP_OK);
+	for (i = 0; i < 40; i++)
+		trace_record("event %d", i);
+	assert(sp_stop_trace() == SP_OK);
+	count = sp_read_trace(events, 64);
+	assert(count == 16);
+	/* The last event is the call to sp_stop_trace(). */
+	for (i = 0; i < count - 1; i++)
+		assert(events[i].args[0] == (unsigned long long) (25 + i));
+
+	printf("Recording from %d threads\n", NUM_THREADS);
+	assert(sp_start_trace(EVENTS_PER_THREAD) == SP_OK);
+	assert(sp_read_trace(events, 16) == 1);
+	for (i = 0; i < NUM_THREADS; i++)
+		assert(pthread_create(&threads[i], NULL, recorder_thread, NULL) == 0);
+	/* Read concurrently with the recording threads. */
+	total = 0;
+	while (total < NUM_THREADS * EVENTS_PER_THREAD) {
+		count = sp_read_trace(events + total,
+			NUM_THREADS * EVENTS_PER_THREAD - total);
+		assert(count >= 0);
+		total += count;
+	}
+	for (i = 0; i < NUM_THREADS; i++)
+		assert(pthread_join(threads[i], NULL) == 0);
+	assert(sp_stop_trace() == SP_OK);
+	assert(sp_read_trace(events + total, 1) == 1);
+	assert(events[total].thread == 1);
+	/* Thread 1 is this one; the recording threads are numbered after it. */
+	for (i = 0; i < total; i++) {
+		assert(events[i].thread >= 2 && events[i].thread <= NUM_THREADS + 1);
+		value = (int) events[i].args[0];
+		assert(value == next[events[i].thread - 1]++);
+	}
+	for (i = 1; i <= NUM_THREADS; i++)
+		assert(next[i] == EVENTS_PER_THREAD);
+	/* Their threads have exited and every event has been read. */
+	assert(live_rings == 0);
+
+	printf("Keeping the ring of an exited thread until it is read\n");
+	assert(sp_start_trace(EVENTS_PER_THREAD) == SP_OK);
+	assert(pthread_create(&threads[0], NULL, recorder_thread, NULL) == 0);
+	assert(pthread_join(threads[0], NULL) == 0);
+	assert(sp_stop_trace() == SP_OK);
+	assert(live_rings == 1);
+	/* The ring is only freed by the read which empties it. */
+	total = 0;
+	while ((count = sp_read_trace(events, 100)) > 0) {
+		for (i = 0; i < count; i++)
+			if (events[i].thread == NUM_THREADS + 2)
+				assert(events[i].args[0] == (unsigned long long) total++);
+		if (total < EVENTS_PER_THREAD)
+			assert(live_rings == 1);
+	}
+	assert(total == EVENTS_PER_THREAD);
+	assert(live_rings == 0);
+
+	printf("Comparing the cost of tracing\n");
+	sp_set_debug_handler(NULL);
+	benchmark("No handler");
+	sp_set_debug_handler(format_handler);
+	benchmark("Formatting handler");
+	sp_set_debug_handler(NULL);
+	assert(sp_start_trace(1024) == SP_OK);
+	benchmark("Trace ring");
+	assert(sp_stop_trace() == SP_OK);
+	/* Last, since the default handler's output is discarded. */
+	assert(freopen("/dev/null", "w", stderr));
+	sp_set_debug_handler(sp_default_debug_handler);
+	benchmark("Default handler");
+
+	return 0;
+}
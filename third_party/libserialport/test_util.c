@@ -0,0 +1,49 @@
+#include "config.h"
+#include "libserialport.h"
+#include "libserialport_internal.h"
+#include "test_util.h"
+#include <assert.h>
+
+int open_pty_port(int flags, struct sp_port **port_ptr)
+{
+	int master;
+
+	master = posix_openpt(O_RDWR | O_NOCTTY | flags);
+	assert(master >= 0);
+	assert(grantpt(master) == 0);
+	assert(unlockpt(master) == 0);
+
+	assert(sp_get_port_by_name(ptsname(master), port_ptr) == SP_OK);
+	assert(sp_open(*port_ptr, SP_MODE_READ_WRITE) == SP_OK);
+	/* Binary data must not be taken for XON/XOFF characters. */
+	assert(sp_set_flowcontrol(*port_ptr, SP_FLOWCONTROL_NONE) == SP_OK);
+
+	return master;
+}
+
+void close_pty_port(int master, struct sp_port *port)
+{
+	if (port) {
+		assert(sp_close(port) == SP_OK);
+		sp_free_port(port);
+	}
+	if (master >= 0)
+		close(master);
+}
+
+void sleep_ms(long ms)
+{
+	struct timespec delay;
+
+	delay.tv_sec = ms / 1000;
+	delay.tv_nsec = (ms % 1000) * 1000000;
+	nanosleep(&delay, NULL);
+}
+
+unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	assert(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+	return (unsigned long long) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
@@ -0,0 +1,23 @@
+#ifndef TEST_UTIL_H
+#define TEST_UTIL_H
+
+/*
+ * Helpers shared by the tests which run against a pseudo-terminal.
+ */
+
+/*
+ * Open a pseudo-terminal, passing extra flags such as O_NONBLOCK for its
+ * master side, and open its slave side as a port with flow control off.
+ * Returns the master descriptor.
+ */
+int open_pty_port(int flags, struct sp_port **port_ptr);
+
+/* Close and free a port from open_pty_port(), if any, and its master. */
+void close_pty_port(int master, struct sp_port *port);
+
+void sleep_ms(long ms);
+
+/* Read the monotonic clock. */
+unsigned long long now_ns(void);
+
+#endif
@@ -19,6 +19,17 @@
 
 #include "libserialport_internal.h"
 
+#define NS_PER_SEC 1000000000LL
+
+#ifdef _WIN32
+static int64_t ticks_per_sec(void)
+{
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	return frequency.QuadPart;
+}
+#endif
+
 SP_PRIV void time_get(struct time *time)
 {
 #ifdef _WIN32
@@ -29,105 +40,105 @@ SP_PRIV void time_get(struct time *time)
 	struct timespec ts;
 	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
 		clock_gettime(CLOCK_REALTIME, &ts);
-	time->tv.tv_sec = ts.tv_sec;
-	time->tv.tv_usec = ts.tv_nsec / 1000;
+	time->ticks = (int64_t) ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
 #elif defined(__APPLE__)
 	mach_timebase_info_data_t info;
 	mach_timebase_info(&info);
 	uint64_t ticks = mach_absolute_time();
-	uint64_t ns = (ticks * info.numer) / info.denom;
-	time->tv.tv_sec = ns / 1000000000;
-	time->tv.tv_usec = (ns % 1000000000) / 1000;
+	time->ticks = (int64_t) ((ticks * info.numer) / info.denom);
 #else
-	gettimeofday(&time->tv, NULL);
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	time->ticks = (int64_t) tv.tv_sec * NS_PER_SEC + (int64_t) tv.tv_usec * 1000;
 #endif
 }
 
-SP_PRIV void time_set_ms(struct time *time, unsigned int ms)
+SP_PRIV void time_set_ns(struct time *time, uint64_t ns)
 {
 #ifdef _WIN32
-	LARGE_INTEGER frequency;
-	QueryPerformanceFrequency(&frequency);
-	time->ticks = ms * (frequency.QuadPart / 1000);
+	int64_t frequency = ticks_per_sec();
+	time->ticks = (int64_t) (ns / NS_PER_SEC) * frequency +
+		(int64_t) (ns % NS_PER_SEC) * frequency / NS_PER_SEC;
 #else
-	time->tv.tv_sec = ms / 1000;
-	time->tv.tv_usec = (ms % 1000) * 1000;
+	time->ticks = (int64_t) ns;
 #endif
 }
 
+SP_PRIV void time_set_ms(struct time *time, unsigned int ms)
+{
+	time_set_ns(time, (uint64_t) ms * 1000000);
+}
+
 SP_PRIV void time_add(const struct time *a,
 		const struct time *b, struct time *result)
 {
-#ifdef _WIN32
 	result->ticks = a->ticks + b->ticks;
-#else
-	timeradd(&a->tv, &b->tv, &result->tv);
-#endif
 }
 
 SP_PRIV void time_sub(const struct time *a,
 		const struct time *b, struct time *result)
 {
-#ifdef _WIN32
 	result->ticks = a->ticks - b->ticks;
-#else
-	timersub(&a->tv, &b->tv, &result->tv);
-#endif
 }
 
 SP_PRIV bool time_greater(const struct time *a, const struct time *b)
 {
-#ifdef _WIN32
 	return (a->ticks > b->ticks);
-#else
-	return timercmp(&a->tv, &b->tv, >);
-#endif
 }
 
-SP_PRIV void time_as_timeval(const struct time *time, struct timeval *tv)
+SP_PRIV uint64_t time_as_ns(const struct time *time)
 {
+	if (time->ticks <= 0)
+		return 0;
 #ifdef _WIN32
-	LARGE_INTEGER frequency;
-	QueryPerformanceFrequency(&frequency);
-	tv->tv_sec = (long) (time->ticks / frequency.QuadPart);
-	tv->tv_usec = (long) ((time->ticks % frequency.QuadPart) /
-		(frequency.QuadPart / 1000000));
+	int64_t frequency = ticks_per_sec();
+	return (uint64_t) (time->ticks / frequency) * NS_PER_SEC +
+		(uint64_t) (time->ticks % frequency) * NS_PER_SEC / frequency;
 #else
-	*tv = time->tv;
+	return (uint64_t) time->ticks;
 #endif
 }
 
+SP_PRIV void time_as_timeval(const struct time *time, struct timeval *tv)
+{
+	uint64_t ns = time_as_ns(time);
+
+	tv->tv_sec = (long) (ns / NS_PER_SEC);
+	tv->tv_usec = (long) ((ns % NS_PER_SEC) / 1000);
+}
+
 SP_PRIV unsigned int time_as_ms(const struct time *time)
 {
-#ifdef _WIN32
-	LARGE_INTEGER frequency;
-	QueryPerformanceFrequency(&frequency);
-	return (unsigned int) (time->ticks / (frequency.QuadPart / 1000));
-#else
-	return time->tv.tv_sec * 1000 + time->tv.tv_usec / 1000;
-#endif
+	return (unsigned int) (time_as_ns(time) / 1000000);
 }
 
-SP_PRIV void timeout_start(struct timeout *timeout, unsigned int timeout_ms)
+SP_PRIV void timeout_start_ns(struct timeout *timeout, uint64_t timeout_ns)
 {
-	timeout->ms = timeout_ms;
+	timeout->ns = timeout_ns;
 
 	/* Get time at start of operation. */
 	time_get(&timeout->start);
 	/* Define duration of timeout. */
-	time_set_ms(&timeout->delta, timeout_ms);
+	time_set_ns(&timeout->delta, timeout_ns);
 	/* Calculate time at which we should give up. */
 	time_add(&timeout->start, &timeout->delta, &timeout->end);
 	/* Disable limit unless timeout_limit() called. */
 	timeout->limit_ms = 0;
 	/* First blocking call has not yet been made. */
 	timeout->calls_started = false;
+	/* No limit yet, so no overflow. */
+	timeout->overflow = false;
+}
+
+SP_PRIV void timeout_start(struct timeout *timeout, unsigned int timeout_ms)
+{
+	timeout_start_ns(timeout, (uint64_t) timeout_ms * 1000000);
 }
 
 SP_PRIV void timeout_limit(struct timeout *timeout, unsigned int limit_ms)
 {
 	timeout->limit_ms = limit_ms;
-	timeout->overflow = (timeout->ms > timeout->limit_ms);
+	timeout->overflow = (timeout->ns > (uint64_t) limit_ms * 1000000);
 	time_set_ms(&timeout->delta_max, timeout->limit_ms);
 }
 
@@ -136,7 +147,7 @@ SP_PRIV bool timeout_check(struct timeout *timeout)
 	if (!timeout->calls_started)
 		return false;
 
-	if (timeout->ms == 0)
+	if (timeout->ns == 0)
 		return false;
 
 	time_get(&timeout->now);
@@ -145,7 +156,8 @@ SP_PRIV bool timeout_check(struct timeout *timeout)
 		if ((timeout->overflow = time_greater(&timeout->delta, &timeout->delta_max)))
 			timeout->delta = timeout->delta_max;
 
-	return time_greater(&timeout->now, &timeout->end);
+	/* Reaching the end time exactly also counts, as nothing remains. */
+	return !time_greater(&timeout->end, &timeout->now);
 }
 
 SP_PRIV void timeout_update(struct timeout *timeout)
@@ -156,19 +168,41 @@ SP_PRIV void timeout_update(struct timeout *timeout)
 #ifndef _WIN32
 SP_PRIV struct timeval *timeout_timeval(struct timeout *timeout)
 {
-	if (timeout->ms == 0)
+	if (timeout->ns == 0)
 		return NULL;
 
 	time_as_timeval(&timeout->delta, &timeout->delta_tv);
 
 	return &timeout->delta_tv;
 }
+
+SP_PRIV struct timespec *timeout_timespec(struct timeout *timeout)
+{
+	uint64_t ns;
+
+	if (timeout->ns == 0)
+		return NULL;
+
+	ns = time_as_ns(&timeout->delta);
+	timeout->delta_ts.tv_sec = (time_t) (ns / NS_PER_SEC);
+	timeout->delta_ts.tv_nsec = (long) (ns % NS_PER_SEC);
+
+	return &timeout->delta_ts;
+}
 #endif
 
 SP_PRIV unsigned int timeout_remaining_ms(struct timeout *timeout)
 {
+	uint64_t ms;
+
 	if (timeout->limit_ms && timeout->overflow)
 		return timeout->limit_ms;
-	else
-		return time_as_ms(&timeout->delta);
+
+	/*
+	 * Round up, so that a sub-millisecond remainder is not passed on as
+	 * zero, which most callers take to mean no timeout.
+	 */
+	ms = (time_as_ns(&timeout->delta) + 999999) / 1000000;
+
+	return ms > UINT_MAX ? UINT_MAX : (unsigned int) ms;
 }
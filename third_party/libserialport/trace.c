@@ -0,0 +1,550 @@
+/*
+ * This file is part of the libserialport project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libserialport_internal.h"
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+/* Marks a NULL string argument. */
+#define NULL_STRING (~0ULL)
+
+/*
+ * One event in a ring. The sequence number is odd while the owning thread
+ * is writing the event, and 2 * (index + 1) once it is complete, so that a
+ * reader can detect events which changed while it was copying them.
+ */
+struct trace_slot {
+	uint64_t sequence;
+	struct sp_trace_event event;
+};
+
+/*
+ * A single-producer ring owned by one thread. Only the owner advances head,
+ * and only sp_read_trace() advances tail. Once the owner has exited, the
+ * ring is freed by sp_read_trace() when its events have all been read.
+ */
+struct trace_ring {
+	struct trace_ring *next;
+	uint64_t head;
+	uint64_t tail;
+	uint64_t mask;
+	uint64_t exited;
+	unsigned long long thread;
+	struct trace_slot slots[];
+};
+
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#define LOAD_ACQUIRE(var) \
+	((uint64_t) InterlockedCompareExchange64((volatile LONG64 *) &(var), 0, 0))
+#define STORE_RELEASE(var, value) \
+	InterlockedExchange64((volatile LONG64 *) &(var), (LONG64) (value))
+#define WRITE_FENCE() MemoryBarrier()
+#define READ_FENCE() MemoryBarrier()
+#define PUSH_RING(ring) do { \
+	do { \
+		(ring)->next = trace_rings; \
+	} while (InterlockedCompareExchangePointer((PVOID volatile *) &trace_rings, \
+	                                           (ring), (ring)->next) != (ring)->next); \
+} while (0)
+#define NEXT_THREAD() ((unsigned long long) InterlockedIncrement64(&trace_threads))
+#define LOAD_RINGS() ((struct trace_ring *) InterlockedCompareExchangePointer( \
+	(PVOID volatile *) &trace_rings, NULL, NULL))
+#define UNLINK_FIRST_RING(ring) \
+	(InterlockedCompareExchangePointer((PVOID volatile *) &trace_rings, \
+	                                   (ring)->next, (ring)) == (ring))
+static volatile LONG64 trace_threads;
+#else
+#define THREAD_LOCAL __thread
+#define LOAD_ACQUIRE(var) __atomic_load_n(&(var), __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(var, value) __atomic_store_n(&(var), (value), __ATOMIC_RELEASE)
+#define WRITE_FENCE() __atomic_thread_fence(__ATOMIC_RELEASE)
+#define READ_FENCE() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define PUSH_RING(ring) do { \
+	(ring)->next = __atomic_load_n(&trace_rings, __ATOMIC_RELAXED); \
+	while (!__atomic_compare_exchange_n(&trace_rings, &(ring)->next, (ring), \
+	                                    false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) \
+		; \
+} while (0)
+#define NEXT_THREAD() __atomic_add_fetch(&trace_threads, 1ULL, __ATOMIC_RELAXED)
+#define LOAD_RINGS() __atomic_load_n(&trace_rings, __ATOMIC_ACQUIRE)
+#define UNLINK_FIRST_RING(ring) unlink_first_ring(ring)
+static unsigned long long trace_threads;
+#endif
+
+size_t sp_trace_ring_size;
+
+/*
+ * All rings not yet freed. Rings are added at the front by their threads,
+ * and only sp_read_trace() removes them.
+ */
+static struct trace_ring *trace_rings;
+
+static THREAD_LOCAL struct trace_ring *thread_ring;
+
+#ifndef _MSC_VER
+static bool unlink_first_ring(struct trace_ring *ring)
+{
+	struct trace_ring *expected = ring;
+
+	return __atomic_compare_exchange_n(&trace_rings, &expected, ring->next,
+		false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+#endif
+
+/* Called on exit of a thread which has a ring. */
+static void ring_exited(void *ring)
+{
+	thread_ring = NULL;
+	/* All of the thread's events are published before this. */
+	STORE_RELEASE(((struct trace_ring *) ring)->exited, 1);
+}
+
+/*
+ * Arrange for ring_exited() to be called when the current thread exits.
+ * If that is not possible, the ring is simply kept.
+ */
+#ifdef _WIN32
+static INIT_ONCE exit_key_once = INIT_ONCE_STATIC_INIT;
+static DWORD exit_key = FLS_OUT_OF_INDEXES;
+
+static VOID NTAPI ring_exited_callback(PVOID ring)
+{
+	ring_exited(ring);
+}
+
+static BOOL CALLBACK create_exit_key(PINIT_ONCE once, PVOID param, PVOID *context)
+{
+	(void) once;
+	(void) param;
+	(void) context;
+
+	exit_key = FlsAlloc(ring_exited_callback);
+
+	return TRUE;
+}
+
+static void watch_thread_exit(struct trace_ring *ring)
+{
+	InitOnceExecuteOnce(&exit_key_once, create_exit_key, NULL, NULL);
+	if (exit_key != FLS_OUT_OF_INDEXES)
+		FlsSetValue(exit_key, ring);
+}
+#else
+static pthread_once_t exit_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t exit_key;
+static bool exit_key_valid;
+
+static void create_exit_key(void)
+{
+	exit_key_valid = pthread_key_create(&exit_key, ring_exited) == 0;
+}
+
+static void watch_thread_exit(struct trace_ring *ring)
+{
+	pthread_once(&exit_key_once, create_exit_key);
+	if (exit_key_valid)
+		pthread_setspecific(exit_key, ring);
+}
+#endif
+
+enum arg_type {
+	ARG_INT,
+	ARG_LONG,
+	ARG_LONG_LONG,
+	ARG_SIZE,
+	ARG_DOUBLE,
+	ARG_POINTER,
+	ARG_STRING,
+};
+
+/* Most arguments one conversion can take: width, precision and value. */
+#define MAX_CONVERSION_ARGS 3
+
+/*
+ * Parse the conversion specification starting after a '%'. Returns a
+ * pointer past it, and fills in the types of the arguments it consumes,
+ * including any '*' width or precision.
+ */
+static const char *parse_conversion(const char *spec, enum arg_type *types,
+                                    unsigned int *count)
+{
+	enum arg_type length = ARG_INT;
+
+	*count = 0;
+
+	while (*spec && strchr("-+ #0123456789.*", *spec)) {
+		if (*spec == '*' && *count < MAX_CONVERSION_ARGS - 1)
+			types[(*count)++] = ARG_INT;
+		spec++;
+	}
+
+	if (*spec == 'l' && spec[1] == 'l') {
+		length = ARG_LONG_LONG;
+		spec += 2;
+	} else if (*spec == 'l') {
+		length = ARG_LONG;
+		spec++;
+	} else if (*spec == 'z' || *spec == 'j' || *spec == 't') {
+		length = ARG_SIZE;
+		spec++;
+	} else {
+		while (*spec == 'h' || *spec == 'L')
+			spec++;
+	}
+
+	switch (*spec) {
+	case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+		types[(*count)++] = length;
+		break;
+	case 'e': case 'E': case 'f': case 'F': case 'g': case 'G':
+		types[(*count)++] = ARG_DOUBLE;
+		break;
+	case 'p':
+		types[(*count)++] = ARG_POINTER;
+		break;
+	case 's':
+		types[(*count)++] = ARG_STRING;
+		break;
+	case '\0':
+		return spec;
+	default:
+		break;
+	}
+
+	return spec + 1;
+}
+
+static struct trace_ring *new_ring(size_t size)
+{
+	struct trace_ring *ring;
+	size_t capacity = 1;
+
+	while (capacity < size)
+		capacity <<= 1;
+
+	if (!(ring = calloc(1, sizeof(struct trace_ring) +
+	                       capacity * sizeof(struct trace_slot))))
+		return NULL;
+
+	ring->mask = capacity - 1;
+	ring->thread = NEXT_THREAD();
+	watch_thread_exit(ring);
+	PUSH_RING(ring);
+
+	return ring;
+}
+
+SP_PRIV void trace_record(const char *format, ...)
+{
+	struct trace_ring *ring = thread_ring;
+	struct sp_trace_event *event;
+	struct trace_slot *slot;
+	struct time now;
+	enum arg_type types[MAX_CONVERSION_ARGS];
+	const char *spec, *string;
+	size_t strings = 0, space, length;
+	unsigned int arg = 0, count, i;
+	double value;
+	uint64_t head;
+	va_list args;
+
+	if (!ring) {
+		if (!(ring = new_ring(sp_trace_ring_size)))
+			return;
+		thread_ring = ring;
+	}
+
+	head = ring->head;
+	slot = &ring->slots[head & ring->mask];
+	event = &slot->event;
+
+	/* Mark the slot as being written before changing its contents. */
+	STORE_RELEASE(slot->sequence, 2 * head + 1);
+	WRITE_FENCE();
+
+	time_get(&now);
+	event->time_ns = time_as_ns(&now);
+	event->thread = ring->thread;
+	event->format = format;
+
+	va_start(args, format);
+	for (spec = strchr(format, '%'); spec; spec = strchr(spec, '%')) {
+		if (*++spec == '%') {
+			spec++;
+			continue;
+		}
+		spec = parse_conversion(spec, types, &count);
+		for (i = 0; i < count && arg < SP_TRACE_MAX_ARGS; i++, arg++) {
+			switch (types[i]) {
+			case ARG_INT:
+				event->args[arg] = (unsigned long long) va_arg(args, int);
+				break;
+			case ARG_LONG:
+				event->args[arg] = (unsigned long long) va_arg(args, long);
+				break;
+			case ARG_LONG_LONG:
+				event->args[arg] = va_arg(args, unsigned long long);
+				break;
+			case ARG_SIZE:
+				event->args[arg] = va_arg(args, size_t);
+				break;
+			case ARG_DOUBLE:
+				value = va_arg(args, double);
+				memcpy(&event->args[arg], &value, sizeof(value));
+				break;
+			case ARG_POINTER:
+				event->args[arg] = (uintptr_t) va_arg(args, void *);
+				break;
+			case ARG_STRING:
+				if (!(string = va_arg(args, const char *))) {
+					event->args[arg] = NULL_STRING;
+					break;
+				}
+				/* The last byte is kept as an empty string for overflow. */
+				space = SP_TRACE_STRING_SIZE - 1 - strings;
+				if (space == 0) {
+					event->args[arg] = SP_TRACE_STRING_SIZE - 1;
+					break;
+				}
+				length = strlen(string);
+				if (length > space - 1)
+					length = space - 1;
+				memcpy(event->strings + strings, string, length);
+				event->strings[strings + length] = '\0';
+				event->args[arg] = strings;
+				strings += length + 1;
+				break;
+			}
+		}
+	}
+	va_end(args);
+	event->strings[SP_TRACE_STRING_SIZE - 1] = '\0';
+
+	STORE_RELEASE(slot->sequence, 2 * head + 2);
+	STORE_RELEASE(ring->head, head + 1);
+}
+
+/* Copy the oldest unread event of a ring, returning false if none is left. */
+static bool read_event(struct trace_ring *ring, struct sp_trace_event *event)
+{
+	struct trace_slot *slot;
+	uint64_t head, tail, sequence;
+
+	head = LOAD_ACQUIRE(ring->head);
+
+	for (tail = ring->tail; tail < head; tail++) {
+		/* Skip events which have been overwritten. */
+		if (head - tail > ring->mask + 1)
+			tail = head - ring->mask - 1;
+
+		slot = &ring->slots[tail & ring->mask];
+		sequence = LOAD_ACQUIRE(slot->sequence);
+		if (sequence != 2 * tail + 2)
+			continue;
+		memcpy(event, &slot->event, sizeof(struct sp_trace_event));
+		READ_FENCE();
+		if (LOAD_ACQUIRE(slot->sequence) != sequence)
+			continue;
+
+		ring->tail = tail + 1;
+		return true;
+	}
+
+	ring->tail = tail;
+	return false;
+}
+
+/* Free the rings of exited threads whose events have all been read. */
+static void free_exited_rings(void)
+{
+	struct trace_ring *ring, *prev = NULL;
+
+	ring = LOAD_RINGS();
+
+	while (ring) {
+		if (!LOAD_ACQUIRE(ring->exited) || ring->tail < LOAD_ACQUIRE(ring->head)) {
+			prev = ring;
+			ring = ring->next;
+			continue;
+		}
+		if (prev) {
+			/* Other threads only ever change the first link. */
+			prev->next = ring->next;
+		} else if (!UNLINK_FIRST_RING(ring)) {
+			/* A ring was added in front of it; look again. */
+			ring = LOAD_RINGS();
+			continue;
+		}
+		free(ring);
+		ring = prev ? prev->next : LOAD_RINGS();
+	}
+}
+
+SP_API enum sp_return sp_start_trace(size_t ring_size)
+{
+	TRACE("%d", ring_size);
+
+	if (ring_size == 0)
+		RETURN_ERROR(SP_ERR_ARG, "Zero ring size");
+
+	if (ring_size > (SIZE_MAX >> 1) / sizeof(struct trace_slot))
+		RETURN_ERROR(SP_ERR_ARG, "Ring size too large");
+
+	sp_trace_ring_size = ring_size;
+
+	RETURN_OK();
+}
+
+SP_API enum sp_return sp_stop_trace(void)
+{
+	TRACE_VOID();
+
+	sp_trace_ring_size = 0;
+
+	RETURN_OK();
+}
+
+/*
+ * Reading and formatting events is not itself traced, so that draining
+ * the rings does not refill them.
+ */
+SP_API enum sp_return sp_read_trace(struct sp_trace_event *events, size_t count)
+{
+	struct trace_ring *ring;
+	size_t total = 0;
+
+	if (!events)
+		return SP_ERR_ARG;
+
+	if (count > INT_MAX)
+		count = INT_MAX;
+
+	for (ring = LOAD_RINGS(); ring && total < count; ring = ring->next)
+		while (total < count && read_event(ring, &events[total]))
+			total++;
+
+	free_exited_rings();
+
+	return (int) total;
+}
+
+SP_API enum sp_return sp_format_trace_event(const struct sp_trace_event *event,
+                                            char *buf, size_t size)
+{
+	const char *format, *spec, *end;
+	char conversion[64];
+	enum arg_type types[MAX_CONVERSION_ARGS];
+	unsigned long long value;
+	unsigned int arg = 0, count, i;
+	size_t used = 0, length;
+	double number;
+	int result;
+
+	if (!event || !event->format || !buf || size == 0)
+		return SP_ERR_ARG;
+
+	format = event->format;
+
+	/*
+	 * Copy the literal text, and format each conversion on its own with
+	 * the recorded argument cast back to the type it was read as. A '*'
+	 * width or precision is replaced by its recorded value.
+	 */
+	while (*format && used < size - 1) {
+		if (!(spec = strchr(format, '%')))
+			spec = format + strlen(format);
+		length = spec - format;
+		if (length > size - 1 - used)
+			length = size - 1 - used;
+		memcpy(buf + used, format, length);
+		used += length;
+		if (!*spec || used >= size - 1)
+			break;
+
+		if (spec[1] == '%') {
+			buf[used++] = '%';
+			format = spec + 2;
+			continue;
+		}
+
+		end = parse_conversion(spec + 1, types, &count);
+		format = end;
+		if (count == 0 || arg + count > SP_TRACE_MAX_ARGS)
+			break;
+
+		length = 0;
+		for (i = 0; spec < end; spec++) {
+			if (*spec == '*')
+				result = snprintf(conversion + length,
+					sizeof(conversion) - length, "%d",
+					(int) event->args[arg + i++]);
+			else
+				result = snprintf(conversion + length,
+					sizeof(conversion) - length, "%c", *spec);
+			if (result < 0 || (size_t) result >= sizeof(conversion) - length)
+				break;
+			length += result;
+		}
+		if (spec < end)
+			break;
+
+		arg += count;
+		value = event->args[arg - 1];
+		switch (types[count - 1]) {
+		case ARG_INT:
+			result = snprintf(buf + used, size - used, conversion, (int) value);
+			break;
+		case ARG_LONG:
+			result = snprintf(buf + used, size - used, conversion, (long) value);
+			break;
+		case ARG_LONG_LONG:
+			result = snprintf(buf + used, size - used, conversion, value);
+			break;
+		case ARG_SIZE:
+			result = snprintf(buf + used, size - used, conversion, (size_t) value);
+			break;
+		case ARG_DOUBLE:
+			memcpy(&number, &value, sizeof(number));
+			result = snprintf(buf + used, size - used, conversion, number);
+			break;
+		case ARG_POINTER:
+			result = snprintf(buf + used, size - used, conversion,
+				(void *) (uintptr_t) value);
+			break;
+		case ARG_STRING:
+			result = snprintf(buf + used, size - used, conversion,
+				value == NULL_STRING ? "(null)" :
+				event->strings + (value < SP_TRACE_STRING_SIZE ?
+					value : SP_TRACE_STRING_SIZE - 1));
+			break;
+		default:
+			result = 0;
+			break;
+		}
+		if (result < 0)
+			break;
+		if ((size_t) result >= size - used)
+			result = (int) (size - 1 - used);
+		used += result;
+	}
+
+	buf[used] = '\0';
+
+	return SP_OK;
+}
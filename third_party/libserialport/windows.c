@@ -484,7 +484,7 @@ SP_PRIV enum sp_return get_port_details(struct sp_port *port)
 	RETURN_OK();
 }
 
-SP_PRIV enum sp_return list_ports(struct sp_port ***list)
+SP_PRIV enum sp_return list_ports(struct port_list *list)
 {
 	HKEY key;
 	TCHAR *value, *data;
@@ -548,7 +548,7 @@ SP_PRIV enum sp_return list_ports(struct sp_port ***list)
 			strcpy(name, data);
 #endif
 			DEBUG_FMT("Found port %s", name);
-			if (!(*list = list_append(*list, name))) {
+			if (!list_append(list, name)) {
 				SET_ERROR(ret, SP_ERR_MEM, "List append failed");
 				free(name);
 				goto out;